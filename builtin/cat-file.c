@@ -28,6 +28,8 @@
 #include "replace-object.h"
 #include "promisor-remote.h"
 #include "mailmap.h"
+#include "repo-settings.h"
+#include "thread-utils.h"
 #include "write-or-die.h"
 
 enum batch_mode {
@@ -48,6 +50,7 @@ struct batch_options {
 	char input_delim;
 	char output_delim;
 	const char *format;
+	int read_ahead_threads;
 };
 
 static const char *force_path;
@@ -280,6 +283,13 @@ struct expand_data {
 	const char *rest;
 	struct object_id delta_base_oid;
 
+	/*
+	 * If non-NULL, the contents of an object that have already been read
+	 * ahead of time. They are used instead of reading the object again
+	 * if they match the object we end up printing.
+	 */
+	struct prefetched_object *prefetched;
+
 	/*
 	 * If mark_query is true, we do not expand anything, but rather
 	 * just mark the object_info with items we wish to query.
@@ -309,6 +319,37 @@ struct expand_data {
 };
 #define EXPAND_DATA_INIT  { .mode = S_IFINVALID }
 
+struct prefetched_object {
+	struct object_id oid;
+	enum object_type type;
+	unsigned long size;
+	void *contents;
+
+	/* Where the object is stored, to read objects in storage order. */
+	struct packed_git *pack;
+	off_t offset;
+
+	/* Whether the name resolved to an object worth reading ahead. */
+	unsigned wanted : 1;
+};
+
+static void *take_prefetched_object(struct expand_data *data,
+				    enum object_type *type,
+				    unsigned long *size)
+{
+	struct prefetched_object *obj = data->prefetched;
+	void *contents;
+
+	if (!obj || !obj->contents || !oideq(&obj->oid, &data->oid))
+		return NULL;
+
+	contents = obj->contents;
+	*type = obj->type;
+	*size = obj->size;
+	obj->contents = NULL;
+	return contents;
+}
+
 static int is_atom(const char *atom, const char *s, int slen)
 {
 	int alen = strlen(atom);
@@ -416,7 +457,18 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 			batch_write(opt, contents, size);
 			free(contents);
 		} else {
-			stream_blob(oid);
+			enum object_type type;
+			unsigned long size;
+			void *contents;
+
+			contents = take_prefetched_object(data, &type, &size);
+			if (contents && type == OBJ_BLOB) {
+				batch_write(opt, contents, size);
+				free(contents);
+			} else {
+				free(contents);
+				stream_blob(oid);
+			}
 		}
 	}
 	else {
@@ -424,8 +476,10 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 		unsigned long size;
 		void *contents;
 
-		contents = odb_read_object(the_repository->objects, oid,
-					   &type, &size);
+		contents = take_prefetched_object(data, &type, &size);
+		if (!contents)
+			contents = odb_read_object(the_repository->objects, oid,
+						   &type, &size);
 		if (!contents)
 			die("object %s disappeared", oid_to_hex(oid));
 
@@ -692,20 +746,237 @@ static void parse_cmd_info(struct batch_options *opt,
 	batch_one_object(line, output, opt, data);
 }
 
+/*
+ * Upper bound for the size of the objects read ahead of a flush, so that
+ * large batches can be pipelined without holding all of them in memory.
+ */
+#define READ_AHEAD_LIMIT (64 * 1024 * 1024)
+
+struct read_ahead_data {
+	struct batch_options *opt;
+	struct queued_cmd *cmd;
+	size_t nr, next;
+	pthread_mutex_t mutex;
+	void (*fn)(struct read_ahead_data *ra, size_t i);
+
+	/* Only used while resolving names. */
+	struct prefetched_object *objs;
+
+	/* Only used while reading objects. */
+	struct prefetched_object **queue;
+};
+
+static void *read_ahead_worker(void *vdata)
+{
+	struct read_ahead_data *ra = vdata;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&ra->mutex);
+		i = ra->next++;
+		pthread_mutex_unlock(&ra->mutex);
+
+		if (i >= ra->nr)
+			break;
+		ra->fn(ra, i);
+	}
+
+	return NULL;
+}
+
+static void run_read_ahead_workers(struct read_ahead_data *ra)
+{
+	pthread_t *threads;
+	int i, nr_threads = ra->opt->read_ahead_threads;
+
+	if (nr_threads > ra->nr)
+		nr_threads = ra->nr;
+
+	ra->next = 0;
+	pthread_mutex_init(&ra->mutex, NULL);
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 read_ahead_worker, ra);
+		if (err)
+			die(_("read-ahead: unable to create thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&ra->mutex);
+	free(threads);
+}
+
+static void resolve_one(struct read_ahead_data *ra, size_t i)
+{
+	struct prefetched_object *obj = &ra->objs[i];
+	const char *name = ra->cmd[i].line, *end;
+	struct object_info oi = OBJECT_INFO_INIT;
+
+	if (ra->cmd[i].fn != parse_cmd_contents)
+		return;
+
+	/*
+	 * Resolving a name may look at refs and parse objects, which must
+	 * not race with the reads of other workers, so it is done under
+	 * the object read lock. Plain object IDs, the common case, are
+	 * resolved without it.
+	 */
+	if (parse_oid_hex_any(name, &obj->oid, &end) == GIT_HASH_UNKNOWN ||
+	    *end) {
+		struct object_context ctx = { 0 };
+		int flags = GET_OID_HASH_ANY | GET_OID_QUIETLY |
+			(ra->opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0);
+		int ret;
+
+		obj_read_lock();
+		ret = get_oid_with_context(the_repository, name, flags,
+					   &obj->oid, &ctx);
+		obj_read_unlock();
+		if (ret == FOUND && !ctx.mode)
+			ret = -1; /* symlinks are reported, not printed */
+		object_context_release(&ctx);
+		if (ret != FOUND)
+			return;
+	}
+
+	oi.typep = &obj->type;
+	oi.sizep = &obj->size;
+	if (odb_read_object_info_extended(the_repository->objects,
+					  &obj->oid, &oi,
+					  OBJECT_INFO_LOOKUP_REPLACE) < 0)
+		return;
+
+	/*
+	 * Large blobs are streamed, and converted blobs are read via the
+	 * filters, so neither benefits from reading ahead.
+	 */
+	if (obj->type == OBJ_BLOB &&
+	    (obj->size > repo_settings_get_big_file_threshold(the_repository) ||
+	     ra->opt->transform_mode))
+		return;
+
+	if (oi.whence == OI_PACKED) {
+		obj->pack = oi.u.packed.pack;
+		obj->offset = oi.u.packed.offset;
+	}
+	obj->wanted = 1;
+}
+
+/*
+ * Resolve the names of the "contents" commands in "cmd" in parallel,
+ * and look up the objects they name, filling in "objs", which has one
+ * slot per command.
+ */
+static void resolve_objects(struct batch_options *opt,
+			    struct queued_cmd *cmd, int nr,
+			    struct prefetched_object *objs)
+{
+	struct read_ahead_data ra = {
+		.opt = opt,
+		.cmd = cmd,
+		.nr = nr,
+		.fn = resolve_one,
+		.objs = objs,
+	};
+
+	run_read_ahead_workers(&ra);
+}
+
+static void read_one(struct read_ahead_data *ra, size_t i)
+{
+	struct prefetched_object *obj = ra->queue[i];
+
+	obj->contents = odb_read_object(the_repository->objects,
+					&obj->oid, &obj->type, &obj->size);
+}
+
+static int prefetched_object_cmp(const void *va, const void *vb)
+{
+	const struct prefetched_object *a = *(const struct prefetched_object **)va;
+	const struct prefetched_object *b = *(const struct prefetched_object **)vb;
+
+	if (a->pack != b->pack)
+		return a->pack < b->pack ? -1 : 1;
+	if (a->pack && a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return oidcmp(&a->oid, &b->oid);
+}
+
+/*
+ * Read the objects resolved by resolve_objects() at the start of "objs"
+ * in parallel. Objects are read in the order in which they are stored to
+ * reduce random access. Returns the number of slots covered; the caller
+ * must free their contents.
+ */
+static int read_ahead_objects(struct batch_options *opt,
+			      struct prefetched_object *objs, int nr)
+{
+	struct read_ahead_data ra = {
+		.opt = opt,
+		.fn = read_one,
+	};
+	size_t total = 0, alloc = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (!objs[i].wanted)
+			continue;
+		/* Always read at least one object to make progress. */
+		if (ra.nr && total + objs[i].size > READ_AHEAD_LIMIT)
+			break;
+		ALLOC_GROW(ra.queue, ra.nr + 1, alloc);
+		ra.queue[ra.nr++] = &objs[i];
+		total += objs[i].size;
+	}
+	nr = i;
+
+	QSORT(ra.queue, ra.nr, prefetched_object_cmp);
+	run_read_ahead_workers(&ra);
+
+	free(ra.queue);
+	return nr;
+}
+
 static void dispatch_calls(struct batch_options *opt,
 		struct strbuf *output,
 		struct expand_data *data,
 		struct queued_cmd *cmd,
 		int nr)
 {
-	int i;
+	struct prefetched_object *objs = NULL;
+	int i, end;
 
 	if (!opt->buffer_output)
 		die(_("flush is only for --buffer mode"));
 
-	for (i = 0; i < nr; i++)
-		cmd[i].fn(opt, cmd[i].line, output, data);
+	if (opt->read_ahead_threads > 1) {
+		CALLOC_ARRAY(objs, nr);
+		resolve_objects(opt, cmd, nr, objs);
+	}
 
+	for (i = 0; i < nr; i = end) {
+		if (objs)
+			end = i + read_ahead_objects(opt, objs + i, nr - i);
+		else
+			end = nr;
+
+		for (; i < end; i++) {
+			data->prefetched = objs ? &objs[i] : NULL;
+			cmd[i].fn(opt, cmd[i].line, output, data);
+			if (objs)
+				FREE_AND_NULL(objs[i].contents);
+		}
+	}
+
+	data->prefetched = NULL;
+	free(objs);
 	fflush(stdout);
 }
 
@@ -1067,7 +1338,7 @@ int cmd_cat_file(int argc,
 		   "             [<rev>:<path|tree-ish> | --path=<path|tree-ish> <rev>]"),
 		N_("git cat-file (--batch | --batch-check | --batch-command) [--batch-all-objects]\n"
 		   "             [--buffer] [--follow-symlinks] [--unordered]\n"
-		   "             [--textconv | --filters] [-Z]"),
+		   "             [--textconv | --filters] [-Z] [--threads=<n>]"),
 		NULL
 	};
 	const struct option options[] = {
@@ -1110,6 +1381,8 @@ int cmd_cat_file(int argc,
 			 N_("follow in-tree symlinks")),
 		OPT_BOOL(0, "unordered", &batch.unordered,
 			 N_("do not order objects before emitting them")),
+		OPT_INTEGER(0, "threads", &batch.read_ahead_threads,
+			    N_("read objects queued by --batch-command --buffer using <n> threads")),
 		/* Textconv options, stand-ole*/
 		OPT_GROUP(N_("Emit object (blob or tree) with conversion or filter (stand-alone, or with batch)")),
 		OPT_CMDMODE(0, "textconv", &opt,
@@ -1125,6 +1398,7 @@ int cmd_cat_file(int argc,
 	repo_config(the_repository, git_cat_file_config, NULL);
 
 	batch.buffer_output = -1;
+	batch.read_ahead_threads = 1;
 
 	argc = parse_options(argc, argv, prefix, options, builtin_catfile_usage, 0);
 	opt_cw = (opt == 'c' || opt == 'w');
@@ -1177,6 +1451,19 @@ int cmd_cat_file(int argc,
 		usage_msg_optf(_("'%s' requires a batch mode"), builtin_catfile_usage,
 			       options, "-Z");
 
+	if (batch.read_ahead_threads != 1 &&
+	    batch.batch_mode != BATCH_MODE_QUEUE_AND_DISPATCH)
+		usage_msg_optf(_("the option '%s' requires '%s'"), builtin_catfile_usage,
+			       options, "--threads", "--batch-command");
+	if (batch.read_ahead_threads < 0)
+		die(_("invalid number of threads specified (%d)"),
+		    batch.read_ahead_threads);
+	else if (!HAVE_THREADS && batch.read_ahead_threads > 1) {
+		warning(_("no threads support, ignoring --threads"));
+		batch.read_ahead_threads = 1;
+	} else if (!batch.read_ahead_threads)
+		batch.read_ahead_threads = online_cpus();
+
 	batch.input_delim = batch.output_delim = '\n';
 	if (input_nul_terminated)
 		batch.input_delim = '\0';
@@ -6,6 +6,7 @@
 #include "delta.h"
 #include "environment.h"
 #include "gettext.h"
+#include "hashmap.h"
 #include "hex.h"
 #include "pack.h"
 #include "csum-file.h"
@@ -18,6 +19,7 @@
 #include "strbuf.h"
 #include "thread-utils.h"
 #include "packfile.h"
+#include "pack-objinfo.h"
 #include "pack-revindex.h"
 #include "object-file.h"
 #include "odb.h"
@@ -25,15 +27,18 @@
 #include "oid-array.h"
 #include "oidset.h"
 #include "path.h"
+#include "prio-queue.h"
 #include "replace-object.h"
 #include "tree-walk.h"
 #include "promisor-remote.h"
 #include "run-command.h"
 #include "setup.h"
 #include "strvec.h"
+#include "tempfile.h"
+#include "trace2.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--verify] [--strict[=<msg-id>=<severity>...]] [--fsck-objects[=<msg-id>=<severity>...]] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--[no-]low-memory] [--verify] [--strict[=<msg-id>=<severity>...]] [--fsck-objects[=<msg-id>=<severity>...]] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -41,6 +46,9 @@ struct object_entry {
 	unsigned char hdr_size;
 	signed char type;
 	signed char real_type;
+	/* Only maintained with --low-memory. */
+	unsigned char is_ofs_base;
+	unsigned char resolved_early;
 };
 
 struct object_stat {
@@ -128,7 +136,9 @@ static struct ref_delta_entry *ref_deltas;
 static struct thread_local_data nothread_data;
 static int nr_objects;
 static int nr_ofs_deltas;
+static int nr_ofs_delta_entries;
 static int nr_ref_deltas;
+static int ofs_deltas_alloc;
 static int ref_deltas_alloc;
 static int nr_resolved_deltas;
 static int nr_threads;
@@ -141,6 +151,8 @@ static int verbose;
 static const char *progress_title;
 static int show_resolving_progress;
 static int show_stat;
+static int low_memory;
+static int write_objinfo;
 static int check_self_contained_and_connected;
 
 static struct progress *progress;
@@ -167,6 +179,13 @@ static struct thread_local_data *thread_data;
 static int nr_dispatched;
 static int threads_active;
 
+/*
+ * Threads that hash and check complete objects during the first pass,
+ * see start_hash_workers().
+ */
+static pthread_t *hash_workers;
+static int nr_hash_workers;
+
 static pthread_mutex_t read_mutex;
 #define read_lock()		lock_mutex(&read_mutex)
 #define read_unlock()		unlock_mutex(&read_mutex)
@@ -480,18 +499,24 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
-		hdrlen = format_object_header(hdr, sizeof(hdr), type, size);
-		the_hash_algo->init_fn(&c);
-		git_hash_update(&c, hdr, hdrlen);
-	} else
-		oid = NULL;
 	if (type == OBJ_BLOB &&
 	    size > repo_settings_get_big_file_threshold(the_repository))
 		buf = fixed_buf;
 	else
 		buf = xmallocz(size);
 
+	/*
+	 * Deltas are hashed once resolved, and complete objects we keep in
+	 * memory are left to the hash workers if there are any.
+	 */
+	if (is_delta_type(type) || (buf != fixed_buf && nr_hash_workers))
+		oid = NULL;
+	if (oid) {
+		hdrlen = format_object_header(hdr, sizeof(hdr), type, size);
+		the_hash_algo->init_fn(&c);
+		git_hash_update(&c, hdr, hdrlen);
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
@@ -651,6 +676,108 @@ static void *get_data_from_pack(struct object_entry *obj)
 	return unpack_data(obj, NULL, NULL);
 }
 
+/* Find the object starting at "offset" among the first "nr" objects. */
+static struct object_entry *find_object_at(off_t offset, int nr)
+{
+	int first = 0, last = nr;
+
+	while (first < last) {
+		int next = first + (last - first) / 2;
+
+		if (objects[next].idx.offset == offset)
+			return &objects[next];
+		if (offset < objects[next].idx.offset)
+			last = next;
+		else
+			first = next + 1;
+	}
+	return NULL;
+}
+
+/*
+ * Return the base of an OFS_DELTA object, by parsing its header again
+ * from the pack. Its validity was already checked by the first pass.
+ */
+static struct object_entry *ofs_delta_base(struct object_entry *obj)
+{
+	unsigned char hdr[256], *p = hdr;
+	struct object_entry *base;
+	off_t base_offset;
+	unsigned char c;
+
+	if (pread_in_full(get_thread_data()->pack_fd, hdr, obj->hdr_size,
+			  obj->idx.offset) != obj->hdr_size)
+		die_errno(_("cannot pread pack file"));
+
+	do {
+		c = *p++;
+	} while (c & 0x80);
+	c = *p++;
+	base_offset = c & 127;
+	while (c & 128) {
+		base_offset += 1;
+		c = *p++;
+		base_offset = (base_offset << 7) + (c & 127);
+	}
+
+	base = find_object_at(obj->idx.offset - base_offset, nr_objects);
+	if (!base)
+		bad_object(obj->idx.offset,
+			   _("delta base offset is out of bound"));
+	return base;
+}
+
+/*
+ * Reconstruct an object that was resolved by resolve_spilled_deltas(),
+ * by applying its chain of OFS_DELTA objects to the base found at the
+ * end of it.
+ */
+static void *reconstruct_object(struct object_entry *obj, unsigned long *size)
+{
+	struct object_entry **chain = NULL;
+	size_t chain_nr = 0, chain_alloc = 0;
+	void *data;
+
+	while (obj->type == OBJ_OFS_DELTA) {
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = obj;
+		obj = ofs_delta_base(obj);
+	}
+	if (is_delta_type(obj->type))
+		BUG("cannot reconstruct delta chain ending at %"PRIuMAX,
+		    (uintmax_t)obj->idx.offset);
+
+	data = get_data_from_pack(obj);
+	*size = obj->size;
+	while (chain_nr--) {
+		struct object_entry *delta_obj = chain[chain_nr];
+		void *delta_data = get_data_from_pack(delta_obj);
+		void *result = patch_delta(data, *size,
+					   delta_data, delta_obj->size, size);
+
+		free(delta_data);
+		free(data);
+		if (!result)
+			bad_object(delta_obj->idx.offset,
+				   _("failed to apply delta"));
+		data = result;
+	}
+	free(chain);
+	return data;
+}
+
+/*
+ * Return the contents of an object that roots a tree of deltas in
+ * threaded_second_pass().
+ */
+static void *get_root_data(struct object_entry *obj, unsigned long *size)
+{
+	if (obj->resolved_early)
+		return reconstruct_object(obj, size);
+	*size = obj->size;
+	return get_data_from_pack(obj);
+}
+
 static int compare_ofs_delta_bases(off_t offset1, off_t offset2,
 				   enum object_type type1,
 				   enum object_type type2)
@@ -665,7 +792,7 @@ static int compare_ofs_delta_bases(off_t offset1, off_t offset2,
 
 static int find_ofs_delta(const off_t offset)
 {
-	int first = 0, last = nr_ofs_deltas;
+	int first = 0, last = nr_ofs_delta_entries;
 
 	while (first < last) {
 		int next = first + (last - first) / 2;
@@ -691,7 +818,7 @@ static void find_ofs_delta_children(off_t offset,
 {
 	int first = find_ofs_delta(offset);
 	int last = first;
-	int end = nr_ofs_deltas - 1;
+	int end = nr_ofs_delta_entries - 1;
 
 	if (first < 0) {
 		*first_index = 0;
@@ -977,6 +1104,140 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 	free(new_data);
 }
 
+/*
+ * The first pass has to inflate every object to find where the next
+ * one starts, so that is left to the main thread. But once a complete
+ * (non-delta) object has been inflated, it can be hashed and checked by
+ * sha1_object() while the main thread goes on reading. The main thread
+ * queues such objects here, and a pool of hash workers takes them off.
+ *
+ * All of this is guarded by hash_mutex.
+ */
+struct hash_job {
+	struct object_entry *obj;
+	void *data;
+};
+
+#define HASH_JOBS_MAX 1024
+#define HASH_JOBS_MAX_BYTES (64 * 1024 * 1024)
+
+static struct hash_job hash_jobs[HASH_JOBS_MAX];
+static unsigned hash_jobs_first, hash_jobs_nr;
+static size_t hash_jobs_bytes;
+static int hash_jobs_done;
+static pthread_mutex_t hash_mutex;
+/* signaled when a job is queued, and when the workers are to stop */
+static pthread_cond_t hash_job_queued;
+/* signaled when a job is taken off the queue while it is full */
+static pthread_cond_t hash_job_taken;
+static int hash_queue_full;
+
+static void *hash_worker(void *data UNUSED)
+{
+	for (;;) {
+		struct hash_job job;
+		struct object_entry *obj;
+
+		pthread_mutex_lock(&hash_mutex);
+		while (!hash_jobs_nr && !hash_jobs_done)
+			pthread_cond_wait(&hash_job_queued, &hash_mutex);
+		if (!hash_jobs_nr) {
+			pthread_mutex_unlock(&hash_mutex);
+			break;
+		}
+		job = hash_jobs[hash_jobs_first];
+		hash_jobs_first = (hash_jobs_first + 1) % HASH_JOBS_MAX;
+		hash_jobs_nr--;
+		hash_jobs_bytes -= job.obj->size;
+		if (hash_queue_full)
+			pthread_cond_signal(&hash_job_taken);
+		pthread_mutex_unlock(&hash_mutex);
+
+		obj = job.obj;
+		hash_object_file(the_hash_algo, job.data, obj->size, obj->type,
+				 &obj->idx.oid);
+		sha1_object(job.data, NULL, obj->size, obj->type,
+			    &obj->idx.oid);
+		free(job.data);
+	}
+	return NULL;
+}
+
+static void start_hash_workers(void)
+{
+	int i;
+
+	if (!HAVE_THREADS)
+		return;
+	if (nr_threads > 1)
+		nr_hash_workers = nr_threads - 1;
+	else if (getenv("GIT_FORCE_THREADS"))
+		nr_hash_workers = 1;
+	else
+		return;
+
+	/* sha1_object() relies on read_lock() */
+	init_recursive_mutex(&read_mutex);
+	threads_active = 1;
+
+	pthread_mutex_init(&hash_mutex, NULL);
+	pthread_cond_init(&hash_job_queued, NULL);
+	pthread_cond_init(&hash_job_taken, NULL);
+	CALLOC_ARRAY(hash_workers, nr_hash_workers);
+	for (i = 0; i < nr_hash_workers; i++) {
+		int ret = pthread_create(&hash_workers[i], NULL,
+					 hash_worker, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+/*
+ * Hands "data" (the contents of "obj") to the hash workers, waiting for
+ * room in the queue if they fall behind.
+ */
+static void queue_hash_job(struct object_entry *obj, void *data)
+{
+	pthread_mutex_lock(&hash_mutex);
+	while (hash_jobs_nr == HASH_JOBS_MAX ||
+	       (hash_jobs_nr &&
+		hash_jobs_bytes + obj->size > HASH_JOBS_MAX_BYTES)) {
+		hash_queue_full = 1;
+		pthread_cond_wait(&hash_job_taken, &hash_mutex);
+	}
+	hash_queue_full = 0;
+	hash_jobs[(hash_jobs_first + hash_jobs_nr) % HASH_JOBS_MAX].obj = obj;
+	hash_jobs[(hash_jobs_first + hash_jobs_nr) % HASH_JOBS_MAX].data = data;
+	hash_jobs_nr++;
+	hash_jobs_bytes += obj->size;
+	pthread_cond_signal(&hash_job_queued);
+	pthread_mutex_unlock(&hash_mutex);
+}
+
+/* Waits for all queued objects to be hashed and checked. */
+static void stop_hash_workers(void)
+{
+	int i;
+
+	if (!nr_hash_workers)
+		return;
+
+	pthread_mutex_lock(&hash_mutex);
+	hash_jobs_done = 1;
+	pthread_cond_broadcast(&hash_job_queued);
+	pthread_mutex_unlock(&hash_mutex);
+	for (i = 0; i < nr_hash_workers; i++)
+		pthread_join(hash_workers[i], NULL);
+	FREE_AND_NULL(hash_workers);
+	nr_hash_workers = 0;
+
+	pthread_cond_destroy(&hash_job_queued);
+	pthread_cond_destroy(&hash_job_taken);
+	pthread_mutex_destroy(&hash_mutex);
+	threads_active = 0;
+	pthread_mutex_destroy(&read_mutex);
+}
+
 /*
  * Ensure that this node has been reconstructed and return its contents.
  *
@@ -995,14 +1256,13 @@ static void *get_base_data(struct base_data *c)
 		struct base_data **delta = NULL;
 		int delta_nr = 0, delta_alloc = 0;
 
-		while (is_delta_type(c->obj->type) && !c->data) {
+		while (c->base && !c->data) {
 			ALLOC_GROW(delta, delta_nr + 1, delta_alloc);
 			delta[delta_nr++] = c;
 			c = c->base;
 		}
 		if (!delta_nr) {
-			c->data = get_data_from_pack(obj);
-			c->size = obj->size;
+			c->data = get_root_data(obj, &c->size);
 			base_cache_used += c->size;
 			prune_base_data(c);
 		}
@@ -1042,16 +1302,20 @@ static struct base_data *make_base(struct object_entry *obj,
 	return base;
 }
 
-static struct base_data *resolve_delta(struct object_entry *delta_obj,
-				       struct base_data *base)
+/*
+ * Apply the delta "delta_obj" to the contents of "base_obj", then hash
+ * and check the result, which is returned.
+ */
+static void *apply_delta(struct object_entry *delta_obj,
+			 struct object_entry *base_obj,
+			 void *base_data, unsigned long base_size,
+			 unsigned long *result_size)
 {
 	void *delta_data, *result_data;
-	struct base_data *result;
-	unsigned long result_size;
 
 	if (show_stat) {
 		int i = delta_obj - objects;
-		int j = base->obj - objects;
+		int j = base_obj - objects;
 		obj_stat[i].delta_depth = obj_stat[j].delta_depth + 1;
 		deepest_delta_lock();
 		if (deepest_delta < obj_stat[i].delta_depth)
@@ -1060,16 +1324,28 @@ static struct base_data *resolve_delta(struct object_entry *delta_obj,
 		obj_stat[i].base_object_no = j;
 	}
 	delta_data = get_data_from_pack(delta_obj);
-	assert(base->data);
-	result_data = patch_delta(base->data, base->size,
-				  delta_data, delta_obj->size, &result_size);
+	result_data = patch_delta(base_data, base_size,
+				  delta_data, delta_obj->size, result_size);
 	free(delta_data);
 	if (!result_data)
 		bad_object(delta_obj->idx.offset, _("failed to apply delta"));
-	hash_object_file(the_hash_algo, result_data, result_size,
+	hash_object_file(the_hash_algo, result_data, *result_size,
 			 delta_obj->real_type, &delta_obj->idx.oid);
-	sha1_object(result_data, NULL, result_size, delta_obj->real_type,
+	sha1_object(result_data, NULL, *result_size, delta_obj->real_type,
 		    &delta_obj->idx.oid);
+	return result_data;
+}
+
+static struct base_data *resolve_delta(struct object_entry *delta_obj,
+				       struct base_data *base)
+{
+	void *result_data;
+	struct base_data *result;
+	unsigned long result_size;
+
+	assert(base->data);
+	result_data = apply_delta(delta_obj, base->obj, base->data, base->size,
+				  &result_size);
 
 	result = make_base(delta_obj, base);
 	result->data = result_data;
@@ -1119,7 +1395,8 @@ static void *threaded_second_pass(void *data)
 			 * Take an object from the object array.
 			 */
 			while (nr_dispatched < nr_objects &&
-			       is_delta_type(objects[nr_dispatched].type))
+			       is_delta_type(objects[nr_dispatched].type) &&
+			       !objects[nr_dispatched].resolved_early)
 				nr_dispatched++;
 			if (nr_dispatched >= nr_objects) {
 				work_unlock();
@@ -1193,8 +1470,8 @@ static void *threaded_second_pass(void *data)
 					 * have access to this object's data while
 					 * outside the work mutex.
 					 */
-					child->data = get_data_from_pack(child_obj);
-					child->size = child_obj->size;
+					child->data = get_root_data(child_obj,
+								    &child->size);
 				}
 			}
 		}
@@ -1241,6 +1518,270 @@ static void *threaded_second_pass(void *data)
 	return NULL;
 }
 
+/*
+ * With --low-memory, the first pass does not keep OFS_DELTA entries in
+ * memory. They are sorted in runs of at most "spill_records" entries,
+ * which are written to temporary files and merged back in the order of
+ * their base offsets by resolve_spilled_deltas().
+ */
+#define SPILL_RECORDS (64 * 1024)
+
+struct ofs_delta_run {
+	struct tempfile *tempfile;
+	FILE *fp;
+	struct ofs_delta_entry head;
+};
+
+static struct ofs_delta_entry *spill_buf;
+static size_t spill_nr, spill_pos, spill_records;
+static struct ofs_delta_run *spill_runs;
+static size_t spill_runs_nr, spill_runs_alloc;
+
+static int compare_ofs_delta_runs(const void *a, const void *b,
+				  void *data UNUSED)
+{
+	const struct ofs_delta_run *run_a = a;
+	const struct ofs_delta_run *run_b = b;
+
+	return compare_ofs_delta_entry(&run_a->head, &run_b->head);
+}
+
+static struct prio_queue spill_queue = { compare_ofs_delta_runs };
+
+static void flush_spilled_ofs_deltas(void)
+{
+	struct ofs_delta_run *run;
+
+	if (!spill_nr)
+		return;
+	QSORT(spill_buf, spill_nr, compare_ofs_delta_entry);
+
+	ALLOC_GROW(spill_runs, spill_runs_nr + 1, spill_runs_alloc);
+	run = &spill_runs[spill_runs_nr++];
+	memset(run, 0, sizeof(*run));
+	run->tempfile = mks_tempfile_t("index-pack-deltas-XXXXXX");
+	if (!run->tempfile)
+		die_errno(_("unable to create temporary file"));
+	write_or_die(get_tempfile_fd(run->tempfile), spill_buf,
+		     st_mult(spill_nr, sizeof(*spill_buf)));
+	spill_nr = 0;
+}
+
+static void spill_ofs_delta(off_t offset, int obj_no)
+{
+	if (!spill_records) {
+		spill_records = git_env_ulong("GIT_TEST_INDEX_PACK_SPILL_RECORDS",
+					      SPILL_RECORDS);
+		ALLOC_ARRAY(spill_buf, spill_records);
+	}
+	if (spill_nr >= spill_records)
+		flush_spilled_ofs_deltas();
+	spill_buf[spill_nr].offset = offset;
+	spill_buf[spill_nr].obj_no = obj_no;
+	spill_nr++;
+}
+
+static void start_spilled_ofs_deltas(void)
+{
+	if (!spill_runs_nr) {
+		/* everything fit in a single run; keep it in memory */
+		QSORT(spill_buf, spill_nr, compare_ofs_delta_entry);
+		return;
+	}
+
+	flush_spilled_ofs_deltas();
+	FREE_AND_NULL(spill_buf);
+
+	for (size_t i = 0; i < spill_runs_nr; i++) {
+		struct ofs_delta_run *run = &spill_runs[i];
+
+		if (lseek(get_tempfile_fd(run->tempfile), 0, SEEK_SET) < 0)
+			die_errno(_("unable to rewind temporary file"));
+		run->fp = fdopen_tempfile(run->tempfile, "rb");
+		if (!run->fp)
+			die_errno(_("unable to read temporary file"));
+		if (fread(&run->head, sizeof(run->head), 1, run->fp) != 1)
+			die_errno(_("unable to read temporary file"));
+		prio_queue_put(&spill_queue, run);
+	}
+}
+
+static int next_spilled_ofs_delta(struct ofs_delta_entry *out)
+{
+	struct ofs_delta_run *run;
+
+	if (!spill_runs_nr) {
+		if (spill_pos >= spill_nr)
+			return 0;
+		*out = spill_buf[spill_pos++];
+		return 1;
+	}
+
+	run = prio_queue_peek(&spill_queue);
+	if (!run)
+		return 0;
+	*out = run->head;
+	if (fread(&run->head, sizeof(run->head), 1, run->fp) == 1) {
+		prio_queue_replace(&spill_queue, run);
+	} else {
+		if (ferror(run->fp))
+			die_errno(_("unable to read temporary file"));
+		prio_queue_get(&spill_queue);
+		delete_tempfile(&run->tempfile);
+	}
+	return 1;
+}
+
+static void release_spilled_ofs_deltas(void)
+{
+	for (size_t i = 0; i < spill_runs_nr; i++)
+		delete_tempfile(&spill_runs[i].tempfile);
+	FREE_AND_NULL(spill_runs);
+	spill_runs_nr = spill_runs_alloc = 0;
+	FREE_AND_NULL(spill_buf);
+	spill_nr = spill_pos = spill_records = 0;
+	clear_prio_queue(&spill_queue);
+}
+
+/*
+ * Resolved objects that are themselves OFS_DELTA bases are kept here
+ * until the merged runs reach their offset, as long as they fit within
+ * base_cache_limit. Those that do not are reconstructed when needed.
+ */
+struct spilled_base {
+	struct hashmap_entry ent;
+	struct object_entry *obj;
+	void *data;
+	unsigned long size;
+};
+
+static struct hashmap spilled_bases;
+static size_t spilled_bases_peak;
+
+static int spilled_base_cmp(const void *cmp_data UNUSED,
+			    const struct hashmap_entry *eptr,
+			    const struct hashmap_entry *entry_or_key,
+			    const void *keydata UNUSED)
+{
+	const struct spilled_base *a, *b;
+
+	a = container_of(eptr, const struct spilled_base, ent);
+	b = container_of(entry_or_key, const struct spilled_base, ent);
+	return a->obj != b->obj;
+}
+
+static void add_spilled_base(struct object_entry *obj,
+			     void *data, unsigned long size)
+{
+	struct spilled_base *base;
+
+	if (base_cache_used + size > base_cache_limit) {
+		free(data);
+		return;
+	}
+
+	CALLOC_ARRAY(base, 1);
+	hashmap_entry_init(&base->ent, obj - objects);
+	base->obj = obj;
+	base->data = data;
+	base->size = size;
+	hashmap_add(&spilled_bases, &base->ent);
+
+	base_cache_used += size;
+	if (spilled_bases_peak < base_cache_used)
+		spilled_bases_peak = base_cache_used;
+}
+
+static void *take_spilled_base(struct object_entry *obj, unsigned long *size)
+{
+	struct spilled_base key, *base;
+	void *data;
+
+	hashmap_entry_init(&key.ent, obj - objects);
+	key.obj = obj;
+	base = hashmap_remove_entry(&spilled_bases, &key, ent, NULL);
+	if (!base)
+		return reconstruct_object(obj, size);
+
+	data = base->data;
+	*size = base->size;
+	base_cache_used -= base->size;
+	free(base);
+	return data;
+}
+
+/*
+ * Resolve the OFS_DELTA objects spilled by the first pass, all deltas
+ * of the same base at once, in the order of their base offsets. As a
+ * base always comes before its deltas in the pack, it has been resolved
+ * by the time its deltas are reached, unless a REF_DELTA object is part
+ * of its chain. Such deltas are kept in ofs_deltas and are left to
+ * threaded_second_pass(), which treats the objects resolved here as
+ * possible bases for REF_DELTA objects.
+ */
+static void resolve_spilled_deltas(void)
+{
+	struct ofs_delta_entry delta;
+	int more;
+
+	trace2_region_enter("index-pack", "resolve-spilled-deltas",
+			    the_repository);
+	hashmap_init(&spilled_bases, spilled_base_cmp, NULL, 0);
+	start_spilled_ofs_deltas();
+
+	more = next_spilled_ofs_delta(&delta);
+	while (more) {
+		off_t offset = delta.offset;
+		struct object_entry *base = find_object_at(offset, nr_objects);
+		void *base_data = NULL;
+		unsigned long base_size = 0;
+
+		if (base && !is_delta_type(base->real_type))
+			base_data = take_spilled_base(base, &base_size);
+
+		do {
+			struct object_entry *obj = &objects[delta.obj_no];
+			void *data;
+			unsigned long size;
+
+			if (!base_data) {
+				ALLOC_GROW(ofs_deltas, nr_ofs_delta_entries + 1,
+					   ofs_deltas_alloc);
+				ofs_deltas[nr_ofs_delta_entries++] = delta;
+				continue;
+			}
+
+			obj->real_type = base->real_type;
+			data = apply_delta(obj, base, base_data, base_size,
+					   &size);
+			obj->resolved_early = 1;
+			nr_resolved_deltas++;
+			display_progress(progress, nr_resolved_deltas);
+
+			if (obj->is_ofs_base)
+				add_spilled_base(obj, data, size);
+			else
+				free(data);
+		} while ((more = next_spilled_ofs_delta(&delta)) &&
+			 delta.offset == offset);
+
+		free(base_data);
+	}
+
+	trace2_data_intmax("index-pack", the_repository,
+			   "low-memory/spill-runs", spill_runs_nr);
+	trace2_data_intmax("index-pack", the_repository,
+			   "low-memory/deferred-deltas", nr_ofs_delta_entries);
+	trace2_data_intmax("index-pack", the_repository,
+			   "low-memory/base-cache-peak", spilled_bases_peak);
+	trace2_region_leave("index-pack", "resolve-spilled-deltas",
+			    the_repository);
+
+	hashmap_clear_and_free(&spilled_bases, struct spilled_base, ent);
+	base_cache_used = 0;
+	release_spilled_ofs_deltas();
+}
+
 /*
  * First pass:
  * - find locations of all objects;
@@ -1250,7 +1791,7 @@ static void *threaded_second_pass(void *data)
 static void parse_pack_objects(unsigned char *hash)
 {
 	int i, nr_delays = 0;
-	struct ofs_delta_entry *ofs_delta = ofs_deltas;
+	off_t ofs_delta_offset = 0;
 	struct object_id ref_delta_oid;
 	struct stat st;
 	struct git_hash_ctx tmp_ctx;
@@ -1261,16 +1802,29 @@ static void parse_pack_objects(unsigned char *hash)
 				progress_title ? progress_title :
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+	start_hash_workers();
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
-		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
+		void *data = unpack_raw_entry(obj, &ofs_delta_offset,
 					      &ref_delta_oid,
 					      &obj->idx.oid);
 		obj->real_type = obj->type;
 		if (obj->type == OBJ_OFS_DELTA) {
 			nr_ofs_deltas++;
-			ofs_delta->obj_no = i;
-			ofs_delta++;
+			if (low_memory) {
+				struct object_entry *base;
+
+				base = find_object_at(ofs_delta_offset, i);
+				if (base)
+					base->is_ofs_base = 1;
+				spill_ofs_delta(ofs_delta_offset, i);
+			} else {
+				ALLOC_GROW(ofs_deltas, nr_ofs_delta_entries + 1,
+					   ofs_deltas_alloc);
+				ofs_deltas[nr_ofs_delta_entries].offset = ofs_delta_offset;
+				ofs_deltas[nr_ofs_delta_entries].obj_no = i;
+				nr_ofs_delta_entries++;
+			}
 		} else if (obj->type == OBJ_REF_DELTA) {
 			ALLOC_GROW(ref_deltas, nr_ref_deltas + 1, ref_deltas_alloc);
 			oidcpy(&ref_deltas[nr_ref_deltas].oid, &ref_delta_oid);
@@ -1280,6 +1834,9 @@ static void parse_pack_objects(unsigned char *hash)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
+		} else if (nr_hash_workers) {
+			queue_hash_job(obj, data);
+			data = NULL;
 		} else
 			sha1_object(data, NULL, obj->size, obj->type,
 				    &obj->idx.oid);
@@ -1287,6 +1844,7 @@ static void parse_pack_objects(unsigned char *hash)
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+	stop_hash_workers();
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1333,17 +1891,32 @@ static void resolve_deltas(struct pack_idx_option *opts)
 	if (!nr_ofs_deltas && !nr_ref_deltas)
 		return;
 
-	/* Sort deltas by base SHA1/offset for fast searching */
-	QSORT(ofs_deltas, nr_ofs_deltas, compare_ofs_delta_entry);
-	QSORT(ref_deltas, nr_ref_deltas, compare_ref_delta_entry);
-
 	if (verbose || show_resolving_progress)
 		progress = start_progress(the_repository,
 					  _("Resolving deltas"),
 					  nr_ref_deltas + nr_ofs_deltas);
 
+	if (low_memory) {
+		/*
+		 * Only one delta base cache is used, whatever the number
+		 * of threads, as the spilled deltas are resolved by this
+		 * thread alone. The deltas left in ofs_deltas are sorted
+		 * already.
+		 */
+		base_cache_limit = opts->delta_base_cache_limit;
+		resolve_spilled_deltas();
+		if (!nr_ofs_delta_entries && !nr_ref_deltas)
+			return;
+	} else {
+		base_cache_limit = opts->delta_base_cache_limit * nr_threads;
+		QSORT(ofs_deltas, nr_ofs_delta_entries,
+		      compare_ofs_delta_entry);
+	}
+
+	/* Sort deltas by base SHA1 for fast searching */
+	QSORT(ref_deltas, nr_ref_deltas, compare_ref_delta_entry);
+
 	nr_dispatched = 0;
-	base_cache_limit = opts->delta_base_cache_limit * nr_threads;
 	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
 		init_thread();
 		for (i = 0; i < nr_threads; i++) {
@@ -1603,6 +2176,24 @@ static void rename_tmp_packfile(const char **final_name,
 	}
 }
 
+/*
+ * Unlike pack-objects, we do not know the final size of deltified
+ * objects at the end, so let the pack-objinfo code compute them from
+ * the finished pack.
+ */
+static void write_objinfo_file(const char *index_name)
+{
+	struct packed_git *p;
+
+	p = add_packed_git(the_repository, index_name, strlen(index_name), 1);
+	if (!p || write_pack_objinfo_file(p) < 0)
+		warning(_("failed to write object info for '%s'"), index_name);
+	if (p) {
+		close_pack(p);
+		free(p);
+	}
+}
+
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
 		  const char *final_rev_index_name, const char *curr_rev_index_name,
@@ -1643,6 +2234,9 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 		packfile_store_load_pack(files->packed, final_index_name, 0);
 	}
 
+	if (write_objinfo && startup_info->have_repository)
+		write_objinfo_file(final_index_name);
+
 	if (!from_stdin) {
 		printf("%s\n", hash_to_hex(hash));
 	} else {
@@ -1693,6 +2287,14 @@ static int git_index_pack_config(const char *k, const char *v,
 		opts->delta_base_cache_limit = git_config_ulong(k, v, ctx->kvi);
 		return 0;
 	}
+	if (!strcmp(k, "pack.indexlowmemory")) {
+		low_memory = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.writeobjectinfo")) {
+		write_objinfo = git_config_bool(k, v);
+		return 0;
+	}
 	return git_default_config(k, v, ctx, cb);
 }
 
@@ -2002,6 +2604,10 @@ int cmd_index_pack(int argc,
 				rev_index = 1;
 			} else if (!strcmp(arg, "--no-rev-index")) {
 				rev_index = 0;
+			} else if (!strcmp(arg, "--low-memory")) {
+				low_memory = 1;
+			} else if (!strcmp(arg, "--no-low-memory")) {
+				low_memory = 0;
 			} else
 				usage(index_pack_usage);
 			continue;
@@ -2077,7 +2683,6 @@ int cmd_index_pack(int argc,
 	CALLOC_ARRAY(objects, st_add(nr_objects, 1));
 	if (show_stat)
 		CALLOC_ARRAY(obj_stat, st_add(nr_objects, 1));
-	CALLOC_ARRAY(ofs_deltas, nr_objects);
 	parse_pack_objects(pack_hash);
 	if (report_end_of_input)
 		write_in_full(2, "\0", 1);
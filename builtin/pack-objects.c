@@ -37,10 +37,14 @@
 #include "replace-object.h"
 #include "dir.h"
 #include "midx.h"
+#include "trace.h"
 #include "trace2.h"
+#include "json-writer.h"
 #include "shallow.h"
 #include "promisor-remote.h"
+#include "pack-dhints.h"
 #include "pack-mtimes.h"
+#include "pack-objinfo.h"
 #include "parse-options.h"
 #include "pkt-line.h"
 #include "blob.h"
@@ -105,12 +109,21 @@ static inline void oe_set_delta(struct packing_data *pack,
 		e->delta_idx = 0;
 }
 
+/*
+ * The delta tree only links objects in pack->objects; bases in
+ * pack->ext_bases never have children recorded.
+ */
 static inline struct object_entry *oe_delta_sibling(
 		const struct packing_data *pack,
 		const struct object_entry *e)
 {
-	if (e->delta_sibling_idx)
-		return &pack->objects[e->delta_sibling_idx - 1];
+	uint32_t idx;
+
+	if (!pack->delta_sibling)
+		return NULL;
+	idx = pack->delta_sibling[e - pack->objects];
+	if (idx)
+		return &pack->objects[idx - 1];
 	return NULL;
 }
 
@@ -118,8 +131,13 @@ static inline struct object_entry *oe_delta_child(
 		const struct packing_data *pack,
 		const struct object_entry *e)
 {
-	if (e->delta_child_idx)
-		return &pack->objects[e->delta_child_idx - 1];
+	uint32_t idx;
+
+	if (!pack->delta_child)
+		return NULL;
+	idx = pack->delta_child[e - pack->objects];
+	if (idx)
+		return &pack->objects[idx - 1];
 	return NULL;
 }
 
@@ -127,20 +145,26 @@ static inline void oe_set_delta_child(struct packing_data *pack,
 				      struct object_entry *e,
 				      struct object_entry *delta)
 {
-	if (delta)
-		e->delta_child_idx = (delta - pack->objects) + 1;
-	else
-		e->delta_child_idx = 0;
+	if (!pack->delta_child) {
+		if (!delta)
+			return;
+		CALLOC_ARRAY(pack->delta_child, pack->nr_alloc);
+	}
+	pack->delta_child[e - pack->objects] =
+		delta ? (delta - pack->objects) + 1 : 0;
 }
 
 static inline void oe_set_delta_sibling(struct packing_data *pack,
 					struct object_entry *e,
 					struct object_entry *delta)
 {
-	if (delta)
-		e->delta_sibling_idx = (delta - pack->objects) + 1;
-	else
-		e->delta_sibling_idx = 0;
+	if (!pack->delta_sibling) {
+		if (!delta)
+			return;
+		CALLOC_ARRAY(pack->delta_sibling, pack->nr_alloc);
+	}
+	pack->delta_sibling[e - pack->objects] =
+		delta ? (delta - pack->objects) + 1 : 0;
 }
 
 static inline void oe_set_size(struct packing_data *pack,
@@ -254,6 +278,9 @@ static enum {
 	WRITE_BITMAP_TRUE,
 } write_bitmap_index;
 static uint16_t write_bitmap_options = BITMAP_OPT_HASH_CACHE;
+static int write_objinfo;
+static int use_delta_hints;
+static uint32_t nr_hinted_deltas, nr_hinted_rejects;
 
 static int exclude_promisor_objects;
 static int exclude_promisor_objects_best_effort;
@@ -351,22 +378,25 @@ static void index_commit_for_bitmap(struct commit *commit)
 	indexed_commits[indexed_commits_nr++] = commit;
 }
 
-static void *get_delta(struct object_entry *entry)
+static void *get_delta_from(struct object_entry *entry,
+			    struct object_entry *base)
 {
 	unsigned long size, base_size, delta_size;
 	void *buf, *base_buf, *delta_buf;
 	enum object_type type;
 
+	packing_data_lock(&to_pack);
 	buf = odb_read_object(the_repository->objects, &entry->idx.oid,
 			      &type, &size);
 	if (!buf)
 		die(_("unable to read %s"), oid_to_hex(&entry->idx.oid));
 	base_buf = odb_read_object(the_repository->objects,
-				   &DELTA(entry)->idx.oid, &type,
+				   &base->idx.oid, &type,
 				   &base_size);
 	if (!base_buf)
 		die("unable to read %s",
-		    oid_to_hex(&DELTA(entry)->idx.oid));
+		    oid_to_hex(&base->idx.oid));
+	packing_data_unlock(&to_pack);
 	delta_buf = diff_delta(base_buf, base_size,
 			       buf, size, &delta_size, 0);
 	/*
@@ -381,31 +411,45 @@ static void *get_delta(struct object_entry *entry)
 	return delta_buf;
 }
 
-static unsigned long do_compress(void **pptr, unsigned long size)
+static void *get_delta(struct object_entry *entry)
+{
+	return get_delta_from(entry, DELTA(entry));
+}
+
+/*
+ * Compress "size" bytes at "in" into a newly allocated buffer returned
+ * in "out", leaving the input alone.
+ */
+static unsigned long compress_buffer(const void *in, unsigned long size,
+				     void **out)
 {
 	git_zstream stream;
-	void *in, *out;
 	unsigned long maxsize;
 
 	git_deflate_init(&stream, pack_compression_level);
 	maxsize = git_deflate_bound(&stream, size);
+	*out = xmalloc(maxsize);
 
-	in = *pptr;
-	out = xmalloc(maxsize);
-	*pptr = out;
-
-	stream.next_in = in;
+	stream.next_in = (unsigned char *)in;
 	stream.avail_in = size;
-	stream.next_out = out;
+	stream.next_out = *out;
 	stream.avail_out = maxsize;
 	while (git_deflate(&stream, Z_FINISH) == Z_OK)
 		; /* nothing */
 	git_deflate_end(&stream);
 
-	free(in);
 	return stream.total_out;
 }
 
+static unsigned long do_compress(void **pptr, unsigned long size)
+{
+	void *in = *pptr;
+	unsigned long len = compress_buffer(in, size, pptr);
+
+	free(in);
+	return len;
+}
+
 static unsigned long write_large_blob_data(struct odb_read_stream *st, struct hashfile *f,
 					   const struct object_id *oid)
 {
@@ -488,7 +532,7 @@ static void copy_pack_data(struct hashfile *f,
 		in = use_pack(p, w_curs, offset, &avail);
 		if (avail > len)
 			avail = (unsigned long)len;
-		hashwrite(f, in, avail);
+		hashwrite_from_fd(f, in, avail, packfile_fd(p), offset);
 		offset += avail;
 		len -= avail;
 	}
@@ -505,6 +549,375 @@ static inline int oe_size_greater_than(struct packing_data *pack,
 	return oe_get_size_slow(pack, lhs) > rhs;
 }
 
+/*
+ * Decide whether the data for "entry" can be copied verbatim from the
+ * pack it lives in. "has_delta" says whether we picked a delta base for
+ * it at all, "usable_delta" whether we can store it as a delta against
+ * that base in the pack being written.
+ */
+static int want_reuse(struct object_entry *entry,
+		      int has_delta, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!IN_PACK(entry))
+		return 0;	/* can't reuse what we don't have */
+	else if (oe_type(entry) == OBJ_REF_DELTA ||
+		 oe_type(entry) == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (oe_type(entry) != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (has_delta)
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+/*
+ * When we are allowed to use more than one thread and do not have to
+ * split the output into several packs, worker threads read and compress
+ * the objects that are about to be written, while the main thread keeps
+ * writing them out in order. The workers run a bounded distance ahead
+ * of the writer, both in number of objects and in bytes of compressed
+ * data waiting to be written. Anything the workers did not prepare in
+ * time (or chose to skip, like objects reused verbatim and large blobs
+ * that are streamed) is handled by the writer itself as before, so the
+ * resulting pack is the same no matter how many threads we use.
+ */
+#define WRITE_POS_NONE UINT32_MAX
+#define WRITE_PIPELINE_SLOTS_PER_THREAD 64
+#define WRITE_PIPELINE_MAX_BUFFERED (64 * 1024 * 1024)
+
+enum write_slot_state {
+	WRITE_SLOT_EMPTY = 0,
+	WRITE_SLOT_BUSY,
+	WRITE_SLOT_DONE,
+};
+
+struct write_slot {
+	uint32_t pos;
+	enum write_slot_state state;
+	struct object_entry *entry;
+	struct object_entry *base;
+	void *buf;
+	unsigned long size;
+	unsigned long datalen;
+	enum object_type type;
+};
+
+static struct write_pipeline {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int threads_nr;
+
+	uint32_t *order; /* indices into to_pack.objects */
+	uint32_t nr;
+	/* write position of each entry, or WRITE_POS_NONE once taken */
+	uint32_t *pos;
+	/* positions below "claimed" have been looked at by a worker */
+	uint32_t claimed;
+	/* positions below "consumed" have been written out */
+	uint32_t consumed;
+
+	struct write_slot *slots;
+	uint32_t slots_nr;
+	unsigned long buffered;
+	unsigned long big_file_threshold;
+	int done;
+} write_pipeline;
+
+static void write_pipeline_lock(void)
+{
+	if (write_pipeline.threads_nr)
+		pthread_mutex_lock(&write_pipeline.mutex);
+}
+
+static void write_pipeline_unlock(void)
+{
+	if (write_pipeline.threads_nr)
+		pthread_mutex_unlock(&write_pipeline.mutex);
+}
+
+/*
+ * Read and compress the object in "slot" the same way
+ * write_no_reuse_object() would. Returns 0 if the writer should handle
+ * the object itself.
+ */
+static int precompute_object(struct write_slot *slot)
+{
+	struct object_entry *entry = slot->entry;
+	void *buf;
+
+	if (entry->preferred_base ||
+	    want_reuse(entry, !!slot->base, !!slot->base))
+		return 0;
+
+	if (slot->base) {
+		/* already compressed during the delta search */
+		if (entry->z_delta_size)
+			return 0;
+		slot->size = DELTA_SIZE(entry);
+		if (entry->delta_data) {
+			slot->datalen = compress_buffer(entry->delta_data,
+							slot->size, &slot->buf);
+		} else {
+			buf = get_delta_from(entry, slot->base);
+			slot->datalen = do_compress(&buf, slot->size);
+			slot->buf = buf;
+		}
+		slot->type = OBJ_REF_DELTA; /* the writer picks the flavor */
+		return 1;
+	}
+
+	if (oe_type(entry) == OBJ_BLOB &&
+	    oe_size_greater_than(&to_pack, entry,
+				 write_pipeline.big_file_threshold))
+		return 0;
+
+	packing_data_lock(&to_pack);
+	buf = odb_read_object(the_repository->objects, &entry->idx.oid,
+			      &slot->type, &slot->size);
+	packing_data_unlock(&to_pack);
+	if (!buf)
+		return 0; /* let the writer complain */
+	slot->datalen = do_compress(&buf, slot->size);
+	slot->buf = buf;
+	return 1;
+}
+
+static int write_pipeline_can_claim(void)
+{
+	struct write_pipeline *wp = &write_pipeline;
+
+	if (wp->claimed >= wp->nr)
+		return 0;
+	if (wp->claimed - wp->consumed >= wp->slots_nr)
+		return 0;
+	return !wp->buffered || wp->buffered < WRITE_PIPELINE_MAX_BUFFERED;
+}
+
+static void *write_pipeline_worker(void *data UNUSED)
+{
+	struct write_pipeline *wp = &write_pipeline;
+
+	pthread_mutex_lock(&wp->mutex);
+	for (;;) {
+		struct object_entry *entry;
+		struct write_slot *slot;
+		uint32_t pos;
+		int ok;
+
+		while (!wp->done && !write_pipeline_can_claim())
+			pthread_cond_wait(&wp->cond, &wp->mutex);
+		if (wp->done)
+			break;
+
+		pos = wp->claimed++;
+		entry = &to_pack.objects[wp->order[pos]];
+		if (wp->pos[wp->order[pos]] != pos)
+			continue; /* the writer got to it first */
+
+		slot = &wp->slots[pos % wp->slots_nr];
+		slot->pos = pos;
+		slot->state = WRITE_SLOT_BUSY;
+		slot->entry = entry;
+		slot->base = DELTA(entry);
+		slot->buf = NULL;
+		pthread_mutex_unlock(&wp->mutex);
+
+		ok = precompute_object(slot);
+
+		pthread_mutex_lock(&wp->mutex);
+		if (ok) {
+			slot->state = WRITE_SLOT_DONE;
+			wp->buffered += slot->datalen;
+		} else {
+			slot->state = WRITE_SLOT_EMPTY;
+		}
+		pthread_cond_broadcast(&wp->cond);
+	}
+	pthread_mutex_unlock(&wp->mutex);
+	return NULL;
+}
+
+/* Drop whatever "slot" holds. Must be called with the mutex held. */
+static void write_pipeline_release(struct write_slot *slot)
+{
+	while (slot->state == WRITE_SLOT_BUSY)
+		pthread_cond_wait(&write_pipeline.cond, &write_pipeline.mutex);
+	if (slot->state == WRITE_SLOT_DONE) {
+		write_pipeline.buffered -= slot->datalen;
+		FREE_AND_NULL(slot->buf);
+	}
+	slot->state = WRITE_SLOT_EMPTY;
+	pthread_cond_broadcast(&write_pipeline.cond);
+}
+
+/*
+ * Hand over the data a worker has prepared for "entry", if any, waiting
+ * for it if a worker is still busy with it. Otherwise make sure that no
+ * worker will pick up the entry anymore and return 0, in which case the
+ * caller has to read and compress the object itself.
+ */
+static int take_precomputed(struct object_entry *entry, void **buf,
+			    enum object_type *type, unsigned long *size,
+			    unsigned long *datalen)
+{
+	struct write_pipeline *wp = &write_pipeline;
+	struct write_slot *slot;
+	uint32_t pos;
+	int ret = 0;
+
+	if (!wp->threads_nr)
+		return 0;
+
+	pthread_mutex_lock(&wp->mutex);
+	pos = wp->pos[entry - to_pack.objects];
+	wp->pos[entry - to_pack.objects] = WRITE_POS_NONE;
+	if (pos == WRITE_POS_NONE || pos >= wp->claimed)
+		goto out;
+
+	slot = &wp->slots[pos % wp->slots_nr];
+	if (slot->pos != pos)
+		goto out;
+	while (slot->state == WRITE_SLOT_BUSY)
+		pthread_cond_wait(&wp->cond, &wp->mutex);
+	if (slot->state == WRITE_SLOT_DONE && slot->base == DELTA(entry)) {
+		*buf = slot->buf;
+		*type = slot->type;
+		*size = slot->size;
+		*datalen = slot->datalen;
+		slot->buf = NULL;
+		ret = 1;
+	}
+	write_pipeline_release(slot);
+out:
+	pthread_mutex_unlock(&wp->mutex);
+	return ret;
+}
+
+/* Tell the workers that everything before "pos" has been written. */
+static void write_pipeline_advance(uint32_t pos)
+{
+	struct write_pipeline *wp = &write_pipeline;
+
+	if (!wp->threads_nr)
+		return;
+
+	pthread_mutex_lock(&wp->mutex);
+	for (; wp->consumed < pos; wp->consumed++) {
+		struct write_slot *slot;
+
+		if (wp->consumed >= wp->claimed)
+			continue;
+		slot = &wp->slots[wp->consumed % wp->slots_nr];
+		if (slot->pos == wp->consumed)
+			write_pipeline_release(slot);
+	}
+	if (wp->claimed < wp->consumed)
+		wp->claimed = wp->consumed;
+	pthread_cond_broadcast(&wp->cond);
+	pthread_mutex_unlock(&wp->mutex);
+}
+
+static int write_pipeline_threads(void)
+{
+	int cpus = online_cpus();
+
+	if (delta_search_threads <= 1)
+		return 0;
+	/*
+	 * The writer needs a CPU of its own to keep up with the workers;
+	 * when we are short of CPUs, they would only take turns with it.
+	 */
+	if (delta_search_threads >= cpus &&
+	    !git_env_bool("GIT_TEST_PACK_WRITE_PIPELINE", 0))
+		return cpus - 1;
+	return delta_search_threads;
+}
+
+static void start_write_pipeline(uint32_t *order, uint32_t nr)
+{
+	struct write_pipeline *wp = &write_pipeline;
+	uint32_t i;
+	int t, threads;
+
+	if (!HAVE_THREADS || pack_size_limit || nr < 2)
+		return;
+	threads = write_pipeline_threads();
+	if (threads < 1)
+		return;
+
+	memset(wp, 0, sizeof(*wp));
+	wp->order = order;
+	wp->nr = nr;
+	ALLOC_ARRAY(wp->pos, to_pack.nr_objects);
+	for (i = 0; i < to_pack.nr_objects; i++)
+		wp->pos[i] = WRITE_POS_NONE;
+	for (i = 0; i < nr; i++)
+		wp->pos[order[i]] = i;
+	wp->slots_nr = threads * WRITE_PIPELINE_SLOTS_PER_THREAD;
+	CALLOC_ARRAY(wp->slots, wp->slots_nr);
+	for (i = 0; i < wp->slots_nr; i++)
+		wp->slots[i].pos = WRITE_POS_NONE;
+	wp->big_file_threshold =
+		repo_settings_get_big_file_threshold(the_repository);
+
+	pthread_mutex_init(&wp->mutex, NULL);
+	pthread_cond_init(&wp->cond, NULL);
+	CALLOC_ARRAY(wp->threads, threads);
+	for (t = 0; t < threads; t++) {
+		int ret = pthread_create(&wp->threads[t], NULL,
+					 write_pipeline_worker, NULL);
+		if (ret) {
+			warning(_("unable to create thread: %s"), strerror(ret));
+			break;
+		}
+		wp->threads_nr++;
+	}
+	if (!wp->threads_nr) {
+		pthread_cond_destroy(&wp->cond);
+		pthread_mutex_destroy(&wp->mutex);
+		FREE_AND_NULL(wp->threads);
+		FREE_AND_NULL(wp->slots);
+		FREE_AND_NULL(wp->pos);
+		return;
+	}
+	trace2_data_intmax("pack-objects", the_repository,
+			   "write_threads", wp->threads_nr);
+}
+
+static void stop_write_pipeline(void)
+{
+	struct write_pipeline *wp = &write_pipeline;
+	uint32_t i;
+	int t;
+
+	if (!wp->threads_nr)
+		return;
+
+	pthread_mutex_lock(&wp->mutex);
+	wp->done = 1;
+	pthread_cond_broadcast(&wp->cond);
+	pthread_mutex_unlock(&wp->mutex);
+	for (t = 0; t < wp->threads_nr; t++)
+		pthread_join(wp->threads[t], NULL);
+
+	for (i = 0; i < wp->slots_nr; i++)
+		free(wp->slots[i].buf);
+	pthread_cond_destroy(&wp->cond);
+	pthread_mutex_destroy(&wp->mutex);
+	free(wp->threads);
+	free(wp->slots);
+	free(wp->pos);
+	memset(wp, 0, sizeof(*wp));
+}
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct hashfile *f, struct object_entry *entry,
 					   unsigned long limit, int usable_delta)
@@ -518,7 +931,17 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	struct odb_read_stream *st = NULL;
 	const unsigned hashsz = the_hash_algo->rawsz;
 
+	if (take_precomputed(entry, &buf, &type, &size, &datalen)) {
+		if (usable_delta)
+			type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
+				OBJ_OFS_DELTA : OBJ_REF_DELTA;
+		FREE_AND_NULL(entry->delta_data);
+		entry->z_delta_size = 0;
+		goto write_header;
+	}
+
 	if (!usable_delta) {
+		packing_data_lock(&to_pack);
 		if (oe_type(entry) == OBJ_BLOB &&
 		    oe_size_greater_than(&to_pack, entry,
 					 repo_settings_get_big_file_threshold(the_repository)) &&
@@ -541,6 +964,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 		 */
 		FREE_AND_NULL(entry->delta_data);
 		entry->z_delta_size = 0;
+		packing_data_unlock(&to_pack);
 	} else if (entry->delta_data) {
 		size = DELTA_SIZE(entry);
 		buf = entry->delta_data;
@@ -548,6 +972,11 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	} else {
+		/*
+		 * get_delta() only holds the lock while reading the objects,
+		 * so that the write pipeline workers can keep reading while
+		 * we compute the delta.
+		 */
 		buf = get_delta(entry);
 		size = DELTA_SIZE(entry);
 		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
@@ -561,6 +990,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	else
 		datalen = do_compress(&buf, size);
 
+write_header:
 	/*
 	 * The object header is a byte of 'type' followed by zero or
 	 * more bytes of length.
@@ -612,8 +1042,10 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 		hashwrite(f, header, hdrlen);
 	}
 	if (st) {
+		packing_data_lock(&to_pack);
 		datalen = write_large_blob_data(st, f, &entry->idx.oid);
 		odb_read_stream_close(st);
+		packing_data_unlock(&to_pack);
 	} else {
 		hashwrite(f, buf, datalen);
 		free(buf);
@@ -622,9 +1054,13 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	return hdrlen + datalen;
 }
 
-/* Return 0 if we will bust the pack-size limit */
-static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
-				unsigned long limit, int usable_delta)
+/*
+ * Return 0 if we will bust the pack-size limit, and -1 if the data in
+ * the pack turned out to be corrupt and the object needs to be written
+ * afresh.
+ */
+static off_t copy_reused_object(struct hashfile *f, struct object_entry *entry,
+				unsigned long limit)
 {
 	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
@@ -657,7 +1093,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return -1;
 	}
 
 	offset += entry->in_pack_header_size;
@@ -668,7 +1104,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("corrupt packed object for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return -1;
 	}
 
 	if (type == OBJ_OFS_DELTA) {
@@ -707,6 +1143,21 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 	return hdrlen + datalen;
 }
 
+/* Return 0 if we will bust the pack-size limit */
+static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
+				unsigned long limit, int usable_delta)
+{
+	off_t len;
+
+	packing_data_lock(&to_pack);
+	len = copy_reused_object(f, entry, limit);
+	packing_data_unlock(&to_pack);
+
+	if (len < 0)
+		return write_no_reuse_object(f, entry, limit, usable_delta);
+	return len;
+}
+
 /* Return 0 if we will bust the pack-size limit */
 static off_t write_object(struct hashfile *f,
 			  struct object_entry *entry,
@@ -742,24 +1193,7 @@ static off_t write_object(struct hashfile *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!IN_PACK(entry))
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (oe_type(entry) == OBJ_REF_DELTA ||
-		 oe_type(entry) == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (oe_type(entry) != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (DELTA(entry))
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
-
+	to_reuse = want_reuse(entry, !!DELTA(entry), usable_delta);
 	if (!to_reuse)
 		len = write_no_reuse_object(f, entry, limit, usable_delta);
 	else
@@ -810,7 +1244,9 @@ static enum write_one_status write_one(struct hashfile *f,
 		switch (write_one(f, DELTA(e), offset)) {
 		case WRITE_ONE_RECURSIVE:
 			/* we cannot depend on this one */
+			write_pipeline_lock();
 			SET_DELTA(e, NULL);
+			write_pipeline_unlock();
 			break;
 		default:
 			break;
@@ -858,17 +1294,26 @@ static inline unsigned char oe_layer(struct packing_data *pack,
 	return pack->layer[e - pack->objects];
 }
 
-static inline void add_to_write_order(struct object_entry **wo,
+static inline void add_to_write_order(uint32_t *wo,
 			       unsigned int *endp,
 			       struct object_entry *e)
 {
 	if (e->filled || oe_layer(&to_pack, e) != write_layer)
 		return;
-	wo[(*endp)++] = e;
+	wo[(*endp)++] = e - to_pack.objects;
 	e->filled = 1;
 }
 
-static void add_descendants_to_write_order(struct object_entry **wo,
+/*
+ * Returns the parent of "e" in the delta tree. Objects whose delta base
+ * is not in the pack are the roots of their own trees.
+ */
+static inline struct object_entry *delta_parent(struct object_entry *e)
+{
+	return e->ext_base ? NULL : DELTA(e);
+}
+
+static void add_descendants_to_write_order(uint32_t *wo,
 					   unsigned int *endp,
 					   struct object_entry *e)
 {
@@ -895,11 +1340,11 @@ static void add_descendants_to_write_order(struct object_entry **wo,
 				continue;
 			}
 			/* go back to our parent node */
-			e = DELTA(e);
+			e = delta_parent(e);
 			while (e && !DELTA_SIBLING(e)) {
 				/* we're on the right side of a subtree, keep
 				 * going up until we can go right again */
-				e = DELTA(e);
+				e = delta_parent(e);
 			}
 			if (!e) {
 				/* done- we hit our original root node */
@@ -911,18 +1356,18 @@ static void add_descendants_to_write_order(struct object_entry **wo,
 	};
 }
 
-static void add_family_to_write_order(struct object_entry **wo,
+static void add_family_to_write_order(uint32_t *wo,
 				      unsigned int *endp,
 				      struct object_entry *e)
 {
 	struct object_entry *root;
 
-	for (root = e; DELTA(root); root = DELTA(root))
+	for (root = e; delta_parent(root); root = delta_parent(root))
 		; /* nothing */
 	add_descendants_to_write_order(wo, endp, root);
 }
 
-static void compute_layer_order(struct object_entry **wo, unsigned int *wo_end)
+static void compute_layer_order(uint32_t *wo, unsigned int *wo_end)
 {
 	unsigned int i, last_untagged;
 	struct object_entry *objects = to_pack.objects;
@@ -970,12 +1415,15 @@ static void compute_layer_order(struct object_entry **wo, unsigned int *wo_end)
 	}
 }
 
-static struct object_entry **compute_write_order(void)
+/*
+ * Returns the objects to write, in order, as indices into to_pack.objects.
+ */
+static uint32_t *compute_write_order(void)
 {
 	uint32_t max_layers = 1;
 	unsigned int i, wo_end;
 
-	struct object_entry **wo;
+	uint32_t *wo;
 	struct object_entry *objects = to_pack.objects;
 
 	for (i = 0; i < to_pack.nr_objects; i++) {
@@ -992,10 +1440,10 @@ static struct object_entry **compute_write_order(void)
 	 */
 	for (i = to_pack.nr_objects; i > 0;) {
 		struct object_entry *e = &objects[--i];
-		if (!DELTA(e))
+		if (!delta_parent(e))
 			continue;
 		/* Mark me as the first child */
-		e->delta_sibling_idx = DELTA(e)->delta_child_idx;
+		SET_DELTA_SIBLING(e, DELTA_CHILD(DELTA(e)));
 		SET_DELTA_CHILD(DELTA(e), e);
 	}
 
@@ -1020,6 +1468,10 @@ static struct object_entry **compute_write_order(void)
 		die(_("ordered %u objects, expected %"PRIu32),
 		    wo_end, to_pack.nr_objects);
 
+	/* the delta tree is not needed for writing */
+	FREE_AND_NULL(to_pack.delta_child);
+	FREE_AND_NULL(to_pack.delta_sibling);
+
 	return wo;
 }
 
@@ -1080,11 +1532,28 @@ static off_t find_reused_offset(off_t where)
 	return reused_chunks[lo-1].difference;
 }
 
-static void write_reused_pack_one(struct packed_git *reuse_packfile,
+/*
+ * Returns true if the object at "base_offset" in the reused pack is a
+ * duplicate whose copy in the MIDX comes from a different pack. The
+ * preferred pack wins all such ties, so this never happens there.
+ */
+static int reused_base_is_elsewhere(struct bitmapped_pack *pack,
+				    off_t base_offset)
+{
+	uint32_t pos;
+
+	if (!pack->from_midx || !pack->bitmap_pos)
+		return 0;
+	return midx_pair_to_pack_pos(pack->from_midx, pack->pack_int_id,
+				     base_offset, &pos) < 0;
+}
+
+static void write_reused_pack_one(struct bitmapped_pack *pack,
 				  size_t pos, struct hashfile *out,
 				  off_t pack_start,
 				  struct pack_window **w_curs)
 {
+	struct packed_git *reuse_packfile = pack->p;
 	off_t offset, next, cur;
 	enum object_type type;
 	unsigned long size;
@@ -1109,8 +1578,12 @@ static void write_reused_pack_one(struct packed_git *reuse_packfile,
 		base_offset = get_delta_base(reuse_packfile, w_curs, &cur, type, offset);
 		assert(base_offset != 0);
 
-		/* Convert to REF_DELTA if we must... */
-		if (!allow_ofs_delta) {
+		/*
+		 * Convert to REF_DELTA if we must, or if the base we are
+		 * sending is the copy from another pack...
+		 */
+		if (!allow_ofs_delta ||
+		    reused_base_is_elsewhere(pack, base_offset)) {
 			uint32_t base_pos;
 			struct object_id base_oid;
 
@@ -1281,7 +1754,7 @@ static void write_reused_pack(struct bitmapped_pack *reuse_packfile,
 				pack_pos = pos + offset;
 			}
 
-			write_reused_pack_one(reuse_packfile->p, pack_pos, f,
+			write_reused_pack_one(reuse_packfile, pack_pos, f,
 					      pack_start, &w_curs);
 			display_progress(progress_state, ++written);
 		}
@@ -1314,6 +1787,112 @@ static const char no_split_warning[] = N_(
 "disabling bitmap writing, packs are split due to pack.packSizeLimit"
 );
 
+static void write_pack_objinfo(struct strbuf *name_prefix)
+{
+	size_t name_prefix_len = name_prefix->len;
+	struct packed_git *p;
+
+	strbuf_addstr(name_prefix, "idx");
+	p = add_packed_git(the_repository, name_prefix->buf,
+			   name_prefix->len, 1);
+	if (!p || write_pack_objinfo_file(p) < 0)
+		warning(_("failed to write object info for '%s'"),
+			name_prefix->buf);
+	if (p) {
+		close_pack(p);
+		free(p);
+	}
+	strbuf_setlen(name_prefix, name_prefix_len);
+}
+
+static int delta_hint_for(const struct object_id *oid,
+			  enum object_type in_pack_type,
+			  void *data UNUSED)
+{
+	struct object_entry *e = packlist_find(&to_pack, oid);
+
+	if (!e)
+		return 0;
+	if (in_pack_type == OBJ_OFS_DELTA || in_pack_type == OBJ_REF_DELTA)
+		return e->delta_good;
+	return e->delta_rejected;
+}
+
+static void write_pack_dhints(struct strbuf *name_prefix)
+{
+	size_t name_prefix_len = name_prefix->len;
+	struct packed_git *p;
+
+	strbuf_addstr(name_prefix, "idx");
+	p = add_packed_git(the_repository, name_prefix->buf,
+			   name_prefix->len, 1);
+	if (!p || write_pack_dhints_file(p, window, depth,
+					 delta_hint_for, NULL) < 0)
+		warning(_("failed to write delta hints for '%s'"),
+			name_prefix->buf);
+	if (p) {
+		close_pack(p);
+		free(p);
+	}
+	strbuf_setlen(name_prefix, name_prefix_len);
+}
+
+static struct hashfile *hashfd_stdout(void)
+{
+	/*
+	 * This command is most often invoked via git-upload-pack(1), which
+	 * will typically chunk data into pktlines. As such, we use the
+	 * maximum data length of them as buffer length.
+	 *
+	 * Note that we need to subtract one though to accomodate for the
+	 * sideband byte.
+	 */
+	struct hashfd_options opts = {
+		.progress = progress_state,
+		.buffer_len = LARGE_PACKET_DATA_MAX - 1,
+	};
+	return hashfd_ext(the_repository->hash_algo, 1, "<stdout>", &opts);
+}
+
+static void write_reused_packs(struct hashfile *f)
+{
+	size_t i;
+
+	for (i = 0; i < reuse_packfiles_nr; i++) {
+		reused_chunks_nr = 0;
+		write_reused_pack(&reuse_packfiles[i], f);
+		if (reused_chunks_nr)
+			reuse_packfiles_used_nr++;
+	}
+}
+
+/*
+ * The pack we are streaming to stdout, if its header and the objects
+ * reused verbatim from existing packs have already been written.
+ */
+static struct hashfile *pack_stream;
+
+/*
+ * Objects reused verbatim from existing packs come first in the output
+ * and do not depend on anything prepare_pack() computes, and the total
+ * number of objects is known as soon as they are enumerated. So when
+ * writing to stdout, send the header and the reused objects right away
+ * instead of only after the delta search. This lets clients (and
+ * upload-pack's keepalives) see data early in a large clone.
+ */
+static void start_pack_stream(void)
+{
+	if (!pack_to_stdout || !reuse_packfiles_nr)
+		return;
+
+	trace2_region_enter("pack-objects", "stream-reused", the_repository);
+	write_excluded_by_configs();
+	pack_stream = hashfd_stdout();
+	write_pack_header(pack_stream, nr_result);
+	write_reused_packs(pack_stream);
+	trace2_region_leave("pack-objects", "stream-reused", the_repository);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -1321,7 +1900,7 @@ static void write_pack_file(void)
 	off_t offset;
 	uint32_t nr_remaining = nr_result;
 	time_t last_mtime = 0;
-	struct object_entry **write_order;
+	uint32_t *write_order;
 
 	if (progress > pack_to_stdout)
 		progress_state = start_progress(the_repository,
@@ -1333,46 +1912,36 @@ static void write_pack_file(void)
 		unsigned char hash[GIT_MAX_RAWSZ];
 		char *pack_tmp_name = NULL;
 
-		if (pack_to_stdout) {
-			/*
-			 * This command is most often invoked via
-			 * git-upload-pack(1), which will typically chunk data
-			 * into pktlines. As such, we use the maximum data
-			 * length of them as buffer length.
-			 *
-			 * Note that we need to subtract one though to
-			 * accomodate for the sideband byte.
-			 */
-			struct hashfd_options opts = {
-				.progress = progress_state,
-				.buffer_len = LARGE_PACKET_DATA_MAX - 1,
-			};
-			f = hashfd_ext(the_repository->hash_algo, 1,
-				       "<stdout>", &opts);
+		if (pack_stream) {
+			f = pack_stream;
+			f->tp = progress_state;
+			pack_stream = NULL;
+			offset = hashfile_total(f);
 		} else {
-			f = create_tmp_packfile(the_repository, &pack_tmp_name);
-		}
+			if (pack_to_stdout)
+				f = hashfd_stdout();
+			else
+				f = create_tmp_packfile(the_repository, &pack_tmp_name);
 
-		offset = write_pack_header(f, nr_remaining);
+			offset = write_pack_header(f, nr_remaining);
 
-		if (reuse_packfiles_nr) {
-			assert(pack_to_stdout);
-			for (j = 0; j < reuse_packfiles_nr; j++) {
-				reused_chunks_nr = 0;
-				write_reused_pack(&reuse_packfiles[j], f);
-				if (reused_chunks_nr)
-					reuse_packfiles_used_nr++;
+			if (reuse_packfiles_nr) {
+				assert(pack_to_stdout);
+				write_reused_packs(f);
+				offset = hashfile_total(f);
 			}
-			offset = hashfile_total(f);
 		}
 
 		nr_written = 0;
+		start_write_pipeline(write_order, to_pack.nr_objects);
 		for (; i < to_pack.nr_objects; i++) {
-			struct object_entry *e = write_order[i];
+			struct object_entry *e = &to_pack.objects[write_order[i]];
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
+			write_pipeline_advance(i + 1);
 			display_progress(progress_state, written);
 		}
+		stop_write_pipeline();
 
 		if (pack_to_stdout) {
 			/*
@@ -1474,6 +2043,11 @@ static void write_pack_file(void)
 
 			rename_tmp_packfile_idx(the_repository, &tmpname, &idx_tmp_name);
 
+			if (write_objinfo)
+				write_pack_objinfo(&tmpname);
+			if (use_delta_hints && window > 1)
+				write_pack_dhints(&tmpname);
+
 			free(idx_tmp_name);
 			strbuf_release(&tmpname);
 			free(pack_tmp_name);
@@ -2226,6 +2800,23 @@ static void prefetch_to_pack(uint32_t object_index_start) {
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * Returns the delta hint that the .dhints file of "p" records for the
+ * object at "offset", or 0 if there is no such file or it describes a
+ * less thorough search than the one we are about to do.
+ */
+static int delta_hint(struct packed_git *p, off_t offset)
+{
+	uint32_t pos;
+
+	if (!use_delta_hints || window <= 1 ||
+	    !pack_dhints_usable(p, window, depth))
+		return 0;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		return 0;
+	return nth_packed_dhint(p, pack_pos_to_index(p, pos));
+}
+
 static void check_object(struct object_entry *entry, uint32_t object_index)
 {
 	unsigned long canonical_size;
@@ -2274,10 +2865,20 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 			entry->in_pack_header_size = used;
 			if (oe_type(entry) < OBJ_COMMIT || oe_type(entry) > OBJ_BLOB)
 				goto give_up;
+			entry->delta_rejected = delta_hint(p, entry->in_pack_offset);
+			if (entry->delta_rejected)
+				nr_hinted_rejects++;
 			unuse_pack(&w_curs);
 			return;
 		case OBJ_REF_DELTA:
-			if (reuse_delta && !entry->preferred_base) {
+			/*
+			 * A delta that an earlier search at least as thorough
+			 * as ours settled on is worth reusing even when we
+			 * were asked not to reuse deltas in general.
+			 */
+			entry->delta_good = delta_hint(p, entry->in_pack_offset);
+			if ((reuse_delta || entry->delta_good) &&
+			    !entry->preferred_base) {
 				oidread(&base_ref,
 					use_pack(p, &w_curs,
 						 entry->in_pack_offset + used,
@@ -2309,7 +2910,9 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 				      oid_to_hex(&entry->idx.oid));
 				goto give_up;
 			}
-			if (reuse_delta && !entry->preferred_base) {
+			entry->delta_good = delta_hint(p, entry->in_pack_offset);
+			if ((reuse_delta || entry->delta_good) &&
+			    !entry->preferred_base) {
 				uint32_t pos;
 				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
@@ -2329,12 +2932,14 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 
 			if (base_entry) {
 				SET_DELTA(entry, base_entry);
-				entry->delta_sibling_idx = base_entry->delta_child_idx;
+				SET_DELTA_SIBLING(entry, DELTA_CHILD(base_entry));
 				SET_DELTA_CHILD(base_entry, entry);
 			} else {
 				SET_DELTA_EXT(entry, &base_ref);
 			}
 
+			if (entry->delta_good)
+				nr_hinted_deltas++;
 			unuse_pack(&w_curs);
 			return;
 		}
@@ -2423,18 +3028,22 @@ static int pack_offset_sort(const void *_a, const void *_b)
  */
 static void drop_reused_delta(struct object_entry *entry)
 {
-	unsigned *idx = &to_pack.objects[entry->delta_idx - 1].delta_child_idx;
+	struct object_entry *base = DELTA(entry);
+	struct object_entry *oe, *prev = NULL;
 	struct object_info oi = OBJECT_INFO_INIT;
 	enum object_type type;
 	unsigned long size;
 
-	while (*idx) {
-		struct object_entry *oe = &to_pack.objects[*idx - 1];
-
-		if (oe == entry)
-			*idx = oe->delta_sibling_idx;
+	for (oe = entry->ext_base ? NULL : DELTA_CHILD(base);
+	     oe;
+	     prev = oe, oe = DELTA_SIBLING(oe)) {
+		if (oe != entry)
+			continue;
+		if (prev)
+			SET_DELTA_SIBLING(prev, DELTA_SIBLING(oe));
 		else
-			idx = &oe->delta_sibling_idx;
+			SET_DELTA_CHILD(base, DELTA_SIBLING(oe));
+		break;
 	}
 	SET_DELTA(entry, NULL);
 	entry->depth = 0;
@@ -2607,6 +3216,13 @@ static void get_object_details(void)
 	}
 	stop_progress(&progress_state);
 
+	if (use_delta_hints) {
+		trace2_data_intmax("pack-objects", the_repository,
+				   "delta-hints/reused", nr_hinted_deltas);
+		trace2_data_intmax("pack-objects", the_repository,
+				   "delta-hints/rejected", nr_hinted_rejects);
+	}
+
 	/*
 	 * This must happen in a second pass, since we rely on the delta
 	 * information for the whole list being completed.
@@ -2784,8 +3400,11 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	 * be considered, as even if we produce a suboptimal delta against
 	 * it, we will still save the transfer cost, as we already know
 	 * the other side has it and we won't send src_entry at all.
+	 *
+	 * The delta hints of a pack tell us the same even when we do not
+	 * reuse deltas, so we skip those pairs, too.
 	 */
-	if (reuse_delta && IN_PACK(trg_entry) &&
+	if ((reuse_delta || trg_entry->delta_rejected) && IN_PACK(trg_entry) &&
 	    IN_PACK(trg_entry) == IN_PACK(src_entry) &&
 	    !src_entry->preferred_base &&
 	    trg_entry->in_pack_type != OBJ_REF_DELTA &&
@@ -2942,32 +3561,78 @@ static unsigned long free_unpacked(struct unpacked *n)
 	return freed_mem;
 }
 
-static void find_deltas(struct object_entry **list, unsigned *list_size,
-			int window, int depth, unsigned *processed)
-{
-	uint32_t i, idx = 0, count = 0;
+/*
+ * The sliding window of delta base candidates used by find_deltas(). It
+ * can be carried over from one part of the object list to the next, so
+ * that splitting up the list does not lose any candidates as long as
+ * the parts are searched in order.
+ */
+struct delta_window {
 	struct unpacked *array;
-	unsigned long mem_usage = 0;
+	int window;
+	int depth;
+	uint32_t idx;
+	uint32_t count;
+	unsigned long mem_usage;
+};
 
-	CALLOC_ARRAY(array, window);
+static void delta_window_init(struct delta_window *w, int window, int depth)
+{
+	memset(w, 0, sizeof(*w));
+	CALLOC_ARRAY(w->array, window);
+	w->window = window;
+	w->depth = depth;
+}
 
-	for (;;) {
-		struct object_entry *entry;
+static void delta_window_reset(struct delta_window *w)
+{
+	int i;
+
+	for (i = 0; i < w->window; i++)
+		free_unpacked(w->array + i);
+	w->idx = 0;
+	w->count = 0;
+	w->mem_usage = 0;
+}
+
+static void delta_window_release(struct delta_window *w)
+{
+	int i;
+
+	for (i = 0; i < w->window; ++i) {
+		free_delta_index(w->array[i].index);
+		free(w->array[i].data);
+	}
+	FREE_AND_NULL(w->array);
+}
+
+/* how many objects to search before updating the shared progress */
+#define DELTA_PROGRESS_BATCH 64
+
+static void find_deltas_in_window(struct delta_window *w,
+				  struct object_entry **list, unsigned list_size,
+				  unsigned *processed)
+{
+	struct unpacked *array = w->array;
+	int window = w->window, depth = w->depth;
+	uint32_t idx = w->idx, count = w->count;
+	unsigned long mem_usage = w->mem_usage;
+	unsigned done = 0;
+
+	while (list_size--) {
+		struct object_entry *entry = *list++;
 		struct unpacked *n = array + idx;
 		int j, max_depth, best_base = -1;
 
-		progress_lock();
-		if (!*list_size) {
-			progress_unlock();
-			break;
-		}
-		entry = *list++;
-		(*list_size)--;
-		if (!entry->preferred_base) {
-			(*processed)++;
+		if (!entry->preferred_base)
+			done++;
+		if (done == DELTA_PROGRESS_BATCH) {
+			progress_lock();
+			*processed += done;
 			display_progress(progress_state, *processed);
+			progress_unlock();
+			done = 0;
 		}
-		progress_unlock();
 
 		mem_usage -= free_unpacked(n);
 		n->entry = entry;
@@ -3009,12 +3674,25 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 			if (!m->entry)
 				break;
 			ret = try_delta(n, m, max_depth, &mem_usage);
-			if (ret < 0)
+			if (ret < 0) {
+				j = 0; /* no other candidate would do either */
 				break;
-			else if (ret > 0)
+			} else if (ret > 0)
 				best_base = other_idx;
 		}
 
+		/*
+		 * Remember the outcome for the delta hints. The outcome is
+		 * only meaningful if all candidates were actually tried,
+		 * which is not the case when reusing deltas skips some of
+		 * them.
+		 */
+		if (!reuse_delta) {
+			if (DELTA(entry))
+				entry->delta_good = 1;
+			else if (!j)
+				entry->delta_rejected = 1;
+		}
 		/*
 		 * If we decided to cache the delta data, then it is best
 		 * to compress it right away.  First because we have to do
@@ -3077,16 +3755,31 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 			idx = 0;
 	}
 
-	for (i = 0; i < window; ++i) {
-		free_delta_index(array[i].index);
-		free(array[i].data);
+	if (done) {
+		progress_lock();
+		*processed += done;
+		display_progress(progress_state, *processed);
+		progress_unlock();
 	}
-	free(array);
+
+	w->idx = idx;
+	w->count = count;
+	w->mem_usage = mem_usage;
+}
+
+static void find_deltas(struct object_entry **list, unsigned list_size,
+			int window, int depth, unsigned *processed)
+{
+	struct delta_window w;
+
+	delta_window_init(&w, window, depth);
+	find_deltas_in_window(&w, list, list_size, processed);
+	delta_window_release(&w);
 }
 
 /*
- * The main object list is split into smaller lists, each is handed to
- * one worker.
+ * When searching for deltas by path, the list of regions is split into
+ * smaller lists, each is handed to one worker.
  *
  * The main thread waits on the condition that (at least) one of the workers
  * has stopped working (which is indicated in the .working member of
@@ -3102,7 +3795,6 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 
 struct thread_params {
 	pthread_t thread;
-	struct object_entry **list;
 	struct packing_region *regions;
 	unsigned list_size;
 	unsigned remaining;
@@ -3134,170 +3826,250 @@ static void cleanup_threaded_search(void)
 	pthread_mutex_destroy(&progress_mutex);
 }
 
-static void *threaded_find_deltas(void *arg)
+/*
+ * The threaded delta search over the main object list cuts the list
+ * into chunks, preferably on "path" (name hash) boundaries, and hands
+ * each worker a contiguous run of them. A worker processes its run
+ * front to back and carries its delta window over from one chunk to
+ * the next, so that it finds the same deltas a single thread would on
+ * that part of the list. A worker that runs out of chunks steals the
+ * back half of the run of the worker with the most chunks left.
+ *
+ * Each run is protected by a mutex of its own that its owner takes once
+ * per chunk, so workers only ever contend with each other while
+ * stealing.
+ */
+#define DELTA_CHUNKS_PER_THREAD 16
+
+struct delta_chunk {
+	struct object_entry **list;
+	unsigned nr;
+};
+
+struct delta_worker {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	/* chunks in [head, tail) are still to be searched by us */
+	unsigned head, tail;
+	struct delta_window window;
+	struct delta_search *search;
+	uint64_t busy_ns;
+	unsigned chunks;
+	unsigned steals;
+};
+
+struct delta_search {
+	struct delta_chunk *chunks;
+	unsigned chunks_nr;
+	struct delta_worker *workers;
+	int workers_nr;
+	unsigned *processed;
+};
+
+static void split_delta_chunks(struct delta_search *ds,
+			       struct object_entry **list, unsigned list_size,
+			       int window)
 {
-	struct thread_params *me = arg;
+	unsigned chunk_size, alloc = 0;
 
-	progress_lock();
-	while (me->remaining) {
-		progress_unlock();
+	chunk_size = list_size / (delta_search_threads * DELTA_CHUNKS_PER_THREAD);
+	/* don't use too small chunks or no deltas will be found after a steal */
+	if (chunk_size < 2 * window)
+		chunk_size = 2 * window;
 
-		find_deltas(me->list, &me->remaining,
-			    me->window, me->depth, me->processed);
+	while (list_size) {
+		unsigned nr = chunk_size, max = 2 * chunk_size;
 
-		progress_lock();
-		me->working = 0;
-		pthread_cond_signal(&progress_cond);
-		progress_unlock();
+		if (nr >= list_size) {
+			nr = list_size;
+		} else {
+			/* try to end the chunk on a "path" boundary */
+			while (nr < max && nr < list_size && list[nr]->hash &&
+			       list[nr]->hash == list[nr - 1]->hash)
+				nr++;
+			/*
+			 * Some "paths" have so many objects that no
+			 * boundary can be found; cut them where we
+			 * intended to.
+			 */
+			if (nr == max)
+				nr = chunk_size;
+		}
+
+		ALLOC_GROW(ds->chunks, ds->chunks_nr + 1, alloc);
+		ds->chunks[ds->chunks_nr].list = list;
+		ds->chunks[ds->chunks_nr].nr = nr;
+		ds->chunks_nr++;
+
+		list += nr;
+		list_size -= nr;
+	}
+}
+
+/* Take over the back half of the chunks of the busiest other worker. */
+static int steal_delta_chunks(struct delta_worker *me)
+{
+	struct delta_search *ds = me->search;
+
+	for (;;) {
+		struct delta_worker *victim = NULL;
+		unsigned victim_left = 0, nr, first, i;
+
+		for (i = 0; i < ds->workers_nr; i++) {
+			struct delta_worker *w = &ds->workers[i];
+			unsigned left;
+
+			if (w == me)
+				continue;
+			pthread_mutex_lock(&w->mutex);
+			left = w->tail - w->head;
+			pthread_mutex_unlock(&w->mutex);
+			if (left > victim_left) {
+				victim = w;
+				victim_left = left;
+			}
+		}
+		if (!victim)
+			return 0;
+
+		pthread_mutex_lock(&victim->mutex);
+		nr = (victim->tail - victim->head + 1) / 2;
+		victim->tail -= nr;
+		first = victim->tail;
+		pthread_mutex_unlock(&victim->mutex);
+		if (!nr)
+			continue; /* it finished in the meantime; look again */
 
-		/*
-		 * We must not set ->data_ready before we wait on the
-		 * condition because the main thread may have set it to 1
-		 * before we get here. In order to be sure that new
-		 * work is available if we see 1 in ->data_ready, it
-		 * was initialized to 0 before this thread was spawned
-		 * and we reset it to 0 right away.
-		 */
 		pthread_mutex_lock(&me->mutex);
-		while (!me->data_ready)
-			pthread_cond_wait(&me->cond, &me->mutex);
-		me->data_ready = 0;
+		me->head = first;
+		me->tail = first + nr;
 		pthread_mutex_unlock(&me->mutex);
+		me->steals++;
+		return 1;
+	}
+}
 
-		progress_lock();
+static void *delta_search_worker(void *arg)
+{
+	struct delta_worker *me = arg;
+	struct delta_search *ds = me->search;
+	unsigned last = UINT_MAX;
+
+	trace2_thread_start("delta-search");
+
+	for (;;) {
+		struct delta_chunk *chunk;
+		uint64_t start;
+		unsigned c;
+
+		pthread_mutex_lock(&me->mutex);
+		c = me->head < me->tail ? me->head++ : UINT_MAX;
+		pthread_mutex_unlock(&me->mutex);
+		if (c == UINT_MAX) {
+			if (!steal_delta_chunks(me))
+				break;
+			continue;
+		}
+
+		/* candidates from a chunk we did not just search are of no use */
+		if (c != last + 1)
+			delta_window_reset(&me->window);
+		last = c;
+
+		chunk = &ds->chunks[c];
+		start = getnanotime();
+		find_deltas_in_window(&me->window, chunk->list, chunk->nr,
+				      ds->processed);
+		me->busy_ns += getnanotime() - start;
+		me->chunks++;
 	}
-	progress_unlock();
-	/* leave ->working 1 so that this doesn't get more work assigned */
+
+	trace2_thread_exit();
 	return NULL;
 }
 
+static void trace_delta_search(struct delta_search *ds, uint64_t wall_ns)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+	int i;
+
+	if (!trace2_is_enabled())
+		return;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "chunks", ds->chunks_nr);
+	jw_object_intmax(&jw, "wall_us", wall_ns / 1000);
+	jw_object_inline_begin_array(&jw, "threads");
+	for (i = 0; i < ds->workers_nr; i++) {
+		struct delta_worker *w = &ds->workers[i];
+
+		jw_array_inline_begin_object(&jw);
+		jw_object_intmax(&jw, "busy_us", w->busy_ns / 1000);
+		jw_object_intmax(&jw, "idle_us", (wall_ns - w->busy_ns) / 1000);
+		jw_object_intmax(&jw, "chunks", w->chunks);
+		jw_object_intmax(&jw, "steals", w->steals);
+		jw_end(&jw);
+	}
+	jw_end(&jw);
+	jw_end(&jw);
+
+	trace2_data_json("pack-objects", the_repository, "delta-search", &jw);
+	jw_release(&jw);
+}
+
 static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			   int window, int depth, unsigned *processed)
 {
-	struct thread_params *p;
-	int i, ret, active_threads = 0;
+	struct delta_search ds = { .processed = processed };
+	uint64_t start;
+	int i, ret;
 
 	init_threaded_search();
 
 	if (delta_search_threads <= 1) {
-		find_deltas(list, &list_size, window, depth, processed);
+		find_deltas(list, list_size, window, depth, processed);
 		cleanup_threaded_search();
 		return;
 	}
 	if (progress > pack_to_stdout)
 		fprintf_ln(stderr, _("Delta compression using up to %d threads"),
 			   delta_search_threads);
-	CALLOC_ARRAY(p, delta_search_threads);
 
-	/* Partition the work amongst work threads. */
-	for (i = 0; i < delta_search_threads; i++) {
-		unsigned sub_size = list_size / (delta_search_threads - i);
+	split_delta_chunks(&ds, list, list_size, window);
+	ds.workers_nr = delta_search_threads;
+	if (ds.workers_nr > ds.chunks_nr)
+		ds.workers_nr = ds.chunks_nr;
+	CALLOC_ARRAY(ds.workers, ds.workers_nr);
 
-		/* don't use too small segments or no deltas will be found */
-		if (sub_size < 2*window && i+1 < delta_search_threads)
-			sub_size = 0;
+	/* Partition the chunks amongst work threads. */
+	for (i = 0; i < ds.workers_nr; i++) {
+		struct delta_worker *w = &ds.workers[i];
 
-		p[i].window = window;
-		p[i].depth = depth;
-		p[i].processed = processed;
-		p[i].working = 1;
-		p[i].data_ready = 0;
-
-		/* try to split chunks on "path" boundaries */
-		while (sub_size && sub_size < list_size &&
-		       list[sub_size]->hash &&
-		       list[sub_size]->hash == list[sub_size-1]->hash)
-			sub_size++;
-
-		p[i].list = list;
-		p[i].list_size = sub_size;
-		p[i].remaining = sub_size;
-
-		list += sub_size;
-		list_size -= sub_size;
+		w->search = &ds;
+		w->head = (uint64_t)ds.chunks_nr * i / ds.workers_nr;
+		w->tail = (uint64_t)ds.chunks_nr * (i + 1) / ds.workers_nr;
+		delta_window_init(&w->window, window, depth);
+		pthread_mutex_init(&w->mutex, NULL);
 	}
 
-	/* Start work threads. */
-	for (i = 0; i < delta_search_threads; i++) {
-		if (!p[i].list_size)
-			continue;
-		pthread_mutex_init(&p[i].mutex, NULL);
-		pthread_cond_init(&p[i].cond, NULL);
-		ret = pthread_create(&p[i].thread, NULL,
-				     threaded_find_deltas, &p[i]);
+	start = getnanotime();
+	for (i = 0; i < ds.workers_nr; i++) {
+		ret = pthread_create(&ds.workers[i].thread, NULL,
+				     delta_search_worker, &ds.workers[i]);
 		if (ret)
 			die(_("unable to create thread: %s"), strerror(ret));
-		active_threads++;
 	}
+	for (i = 0; i < ds.workers_nr; i++)
+		pthread_join(ds.workers[i].thread, NULL);
+	trace_delta_search(&ds, getnanotime() - start);
 
-	/*
-	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
-	 */
-	while (active_threads) {
-		struct thread_params *target = NULL;
-		struct thread_params *victim = NULL;
-		unsigned sub_size = 0;
-
-		progress_lock();
-		for (;;) {
-			for (i = 0; !target && i < delta_search_threads; i++)
-				if (!p[i].working)
-					target = &p[i];
-			if (target)
-				break;
-			pthread_cond_wait(&progress_cond, &progress_mutex);
-		}
-
-		for (i = 0; i < delta_search_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
-				victim = &p[i];
-		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
-			}
-			target->list = list;
-			victim->list_size -= sub_size;
-			victim->remaining -= sub_size;
-		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
-		target->working = 1;
-		progress_unlock();
-
-		pthread_mutex_lock(&target->mutex);
-		target->data_ready = 1;
-		pthread_cond_signal(&target->cond);
-		pthread_mutex_unlock(&target->mutex);
-
-		if (!sub_size) {
-			pthread_join(target->thread, NULL);
-			pthread_cond_destroy(&target->cond);
-			pthread_mutex_destroy(&target->mutex);
-			active_threads--;
-		}
+	for (i = 0; i < ds.workers_nr; i++) {
+		delta_window_release(&ds.workers[i].window);
+		pthread_mutex_destroy(&ds.workers[i].mutex);
 	}
 	cleanup_threaded_search();
-	free(p);
+	free(ds.workers);
+	free(ds.chunks);
 }
 
 static int obj_is_packed(const struct object_id *oid)
@@ -3350,7 +4122,8 @@ static int should_attempt_deltas(struct object_entry *entry)
 {
 	if (DELTA(entry))
 		/* This happens if we decided to reuse existing
-		 * delta from a pack. "reuse_delta &&" is implied.
+		 * delta from a pack. "reuse_delta &&" is implied,
+		 * unless the delta hints of the pack vouch for it.
 		 */
 		return 0;
 
@@ -3391,7 +4164,7 @@ static void find_deltas_for_region(struct object_entry *list,
 	}
 
 	QSORT(delta_list, delta_list_nr, type_size_sort);
-	find_deltas(delta_list, &delta_list_nr, window, depth, processed);
+	find_deltas(delta_list, delta_list_nr, window, depth, processed);
 	free(delta_list);
 }
 
@@ -3678,6 +4451,13 @@ static int git_pack_config(const char *k, const char *v,
 			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
 	}
 
+	if (!strcmp(k, "pack.writebitmaproaring")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_ROARING;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_ROARING;
+	}
+
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -3716,6 +4496,14 @@ static int git_pack_config(const char *k, const char *v,
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.deltahints")) {
+		use_delta_hints = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.writeobjectinfo")) {
+		write_objinfo = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.writereverseindex")) {
 		if (git_config_bool(k, v))
 			pack_idx_opts.flags |= WRITE_REV;
@@ -5378,6 +6166,7 @@ int cmd_pack_objects(int argc,
 
 	if (non_empty && !nr_result)
 		goto cleanup;
+	start_pack_stream();
 	if (nr_result) {
 		trace2_region_enter("pack-objects", "prepare-pack",
 				    the_repository);
@@ -5387,7 +6176,8 @@ int cmd_pack_objects(int argc,
 	}
 
 	trace2_region_enter("pack-objects", "write-pack-file", the_repository);
-	write_excluded_by_configs();
+	if (!pack_stream)
+		write_excluded_by_configs();
 	write_pack_file();
 	trace2_region_leave("pack-objects", "write-pack-file", the_repository);
 
@@ -16,6 +16,7 @@
 #include "hex.h"
 #include "hook.h"
 #include "lockfile.h"
+#include "loose-cache.h"
 #include "object.h"
 #include "object-file.h"
 #include "object-name.h"
@@ -2109,6 +2110,7 @@ static void execute_commands(struct command *commands,
 		return;
 	}
 	tmp_objdir = NULL;
+	update_loose_cache(the_repository->objects->sources);
 
 	check_aliased_updates(commands);
 
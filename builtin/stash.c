@@ -8,6 +8,7 @@
 #include "hash.h"
 #include "hex.h"
 #include "object-name.h"
+#include "odb.h"
 #include "parse-options.h"
 #include "refs.h"
 #include "lockfile.h"
@@ -1444,6 +1445,7 @@ static int do_create_stash(const struct pathspec *ps, struct strbuf *stash_msg_b
 	struct strbuf msg = STRBUF_INIT;
 	struct strbuf commit_tree_label = STRBUF_INIT;
 	struct strbuf untracked_files = STRBUF_INIT;
+	struct odb_transaction *transaction = NULL;
 
 	prepare_fallback_ident("git stash", "git@stash");
 
@@ -1483,6 +1485,12 @@ static int do_create_stash(const struct pathspec *ps, struct strbuf *stash_msg_b
 	strbuf_addf(&msg, "%s: %s ", branch_name, head_short_sha1);
 	pp_commit_easy(CMIT_FMT_ONELINE, head_commit, &msg);
 
+	/*
+	 * The stash commits are only referenced once our caller stores them,
+	 * so we can batch up writing the objects that make them up.
+	 */
+	transaction = odb_transaction_begin_pack(the_repository->objects);
+
 	strbuf_addf(&commit_tree_label, "index on %s\n", msg.buf);
 	commit_list_insert(head_commit, &parents);
 	if (write_index_as_tree(&info->i_tree, the_repository->index,
@@ -1509,6 +1517,13 @@ static int do_create_stash(const struct pathspec *ps, struct strbuf *stash_msg_b
 		}
 		untracked_commit_option = 1;
 	}
+	/*
+	 * Recording the worktree state spawns processes that may need to read
+	 * the objects written so far.
+	 */
+	odb_transaction_commit(transaction);
+	transaction = NULL;
+
 	if (patch_mode) {
 		ret = stash_patch(info, ps, patch, quiet, interactive_opts);
 		if (ret < 0) {
@@ -1539,6 +1554,8 @@ static int do_create_stash(const struct pathspec *ps, struct strbuf *stash_msg_b
 		}
 	}
 
+	transaction = odb_transaction_begin_pack(the_repository->objects);
+
 	if (!stash_msg_buf->len)
 		strbuf_addf(stash_msg_buf, "WIP on %s", msg.buf);
 	else
@@ -1562,6 +1579,7 @@ static int do_create_stash(const struct pathspec *ps, struct strbuf *stash_msg_b
 	}
 
 done:
+	odb_transaction_commit(transaction);
 	strbuf_release(&commit_tree_label);
 	strbuf_release(&msg);
 	strbuf_release(&untracked_files);
@@ -21,6 +21,7 @@
 #include "replace-object.h"
 #include "progress.h"
 #include "bloom.h"
+#include "path-index.h"
 #include "commit-slab.h"
 #include "shallow.h"
 #include "json-writer.h"
@@ -51,6 +52,7 @@ void git_test_write_commit_graph_or_die(struct odb_source *source)
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
+#define GRAPH_CHUNKID_PATHINDEX 0x50494458 /* "PIDX" */
 
 #define GRAPH_VERSION_1 0x1
 #define GRAPH_VERSION GRAPH_VERSION_1
@@ -447,6 +449,8 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 		   &graph->chunk_extra_edges_size);
 	pair_chunk(cf, GRAPH_CHUNKID_BASE, &graph->chunk_base_graphs,
 		   &graph->chunk_base_graphs_size);
+	pair_chunk(cf, GRAPH_CHUNKID_PATHINDEX, &graph->chunk_path_index,
+		   &graph->chunk_path_index_size);
 
 	prepare_repo_settings(r);
 
@@ -735,7 +739,7 @@ struct commit_graph *read_commit_graph_one(struct odb_source *source)
  * On the first invocation, this function attempts to load the commit
  * graph if the repository is configured to have one.
  */
-static struct commit_graph *prepare_commit_graph(struct repository *r)
+struct commit_graph *prepare_commit_graph(struct repository *r)
 {
 	struct odb_source *source;
 
@@ -1161,6 +1165,8 @@ struct write_commit_graph_context {
 	const struct commit_graph_opts *opts;
 	size_t total_bloom_filter_data_size;
 	const struct bloom_filter_settings *bloom_settings;
+	struct string_list path_index_paths;
+	struct strbuf path_index;
 
 	int count_bloom_filter_computed;
 	int count_bloom_filter_not_computed;
@@ -1510,6 +1516,15 @@ static int write_graph_chunk_bloom_data(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_path_index(struct hashfile *f,
+					void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+
+	hashwrite(f, ctx->path_index.buf, ctx->path_index.len);
+	return 0;
+}
+
 static int add_packed_commits_oi(const struct object_id *oid,
 				 struct object_info *oi,
 				 void *data)
@@ -2177,6 +2192,9 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 				 ctx->total_bloom_filter_data_size),
 			  write_graph_chunk_bloom_data);
 	}
+	if (ctx->path_index.len)
+		add_chunk(cf, GRAPH_CHUNKID_PATHINDEX, ctx->path_index.len,
+			  write_graph_chunk_path_index);
 	if (ctx->num_commit_graphs_after > 1)
 		add_chunk(cf, GRAPH_CHUNKID_BASE,
 			  st_mult(hashsz, ctx->num_commit_graphs_after - 1),
@@ -2551,6 +2569,37 @@ static void expire_commit_graphs(struct write_commit_graph_context *ctx)
 	strbuf_release(&path);
 }
 
+static void read_path_index_config(struct write_commit_graph_context *ctx)
+{
+	const struct string_list *values;
+	struct strbuf path = STRBUF_INIT;
+	size_t i;
+
+	if (repo_config_get_string_multi(ctx->r, "commitgraph.pathindex",
+					 &values))
+		return;
+
+	for (i = 0; i < values->nr; i++) {
+		/* an empty value resets the list */
+		if (!*values->items[i].string) {
+			string_list_clear(&ctx->path_index_paths, 0);
+			continue;
+		}
+
+		strbuf_reset(&path);
+		strbuf_addstr(&path, values->items[i].string);
+		if (normalize_path_index_path(&path) < 0) {
+			warning(_("ignoring invalid commitGraph.pathIndex path '%s'"),
+				values->items[i].string);
+			continue;
+		}
+		string_list_append(&ctx->path_index_paths, path.buf);
+	}
+	string_list_sort_u(&ctx->path_index_paths, 0);
+
+	strbuf_release(&path);
+}
+
 int write_commit_graph(struct odb_source *source,
 		       const struct string_list *const pack_indexes,
 		       struct oidset *commits,
@@ -2568,6 +2617,8 @@ int write_commit_graph(struct odb_source *source,
 		.total_bloom_filter_data_size = 0,
 		.write_generation_data = (get_configured_generation_version(r) == 2),
 		.num_generation_data_overflows = 0,
+		.path_index_paths = STRING_LIST_INIT_DUP,
+		.path_index = STRBUF_INIT,
 	};
 	uint32_t i;
 	int res = 0;
@@ -2625,6 +2676,8 @@ int write_commit_graph(struct odb_source *source,
 
 	bloom_settings.hash_version = bloom_settings.hash_version == 2 ? 2 : 1;
 
+	read_path_index_config(&ctx);
+
 	if (ctx.split) {
 		for (struct commit_graph *chain = g; chain; chain = chain->base_graph)
 			ctx.num_commit_graphs_before++;
@@ -2700,6 +2753,14 @@ int write_commit_graph(struct odb_source *source,
 	if (ctx.changed_paths)
 		compute_bloom_filters(&ctx);
 
+	if (ctx.path_index_paths.nr) {
+		compute_path_index(ctx.r, ctx.commits.items, ctx.commits.nr,
+				   &ctx.path_index_paths, &ctx.path_index,
+				   ctx.report_progress);
+		trace2_data_intmax("commit-graph", ctx.r, "path-index-paths",
+				   ctx.path_index_paths.nr);
+	}
+
 	res = write_commit_graph_file(&ctx);
 
 	if (ctx.changed_paths)
@@ -2715,6 +2776,8 @@ int write_commit_graph(struct odb_source *source,
 	free(ctx.base_graph_name);
 	commit_stack_clear(&ctx.commits);
 	oid_array_clear(&ctx.oids);
+	string_list_clear(&ctx.path_index_paths, 0);
+	strbuf_release(&ctx.path_index);
 	clear_topo_level_slab(&topo_levels);
 
 	if (ctx.r->objects->commit_graph) {
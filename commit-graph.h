@@ -109,6 +109,8 @@ struct commit_graph {
 	const unsigned char *chunk_bloom_indexes;
 	const unsigned char *chunk_bloom_data;
 	size_t chunk_bloom_data_size;
+	const unsigned char *chunk_path_index;
+	size_t chunk_path_index_size;
 
 	struct topo_level_slab *topo_levels;
 	struct bloom_filter_settings *bloom_filter_settings;
@@ -123,6 +125,12 @@ struct commit_graph *read_commit_graph_one(struct odb_source *source);
 
 struct repo_settings;
 
+/*
+ * Load the commit-graph of "r" if it has not been loaded yet, and return
+ * its topmost layer, or NULL if there is none (or it is disabled).
+ */
+struct commit_graph *prepare_commit_graph(struct repository *r);
+
 /*
  * Callers should initialize the repo_settings with prepare_repo_settings()
  * prior to calling parse_commit_graph().
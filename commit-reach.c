@@ -5,6 +5,7 @@
 #include "commit-graph.h"
 #include "decorate.h"
 #include "hex.h"
+#include "pack-bitmap.h"
 #include "prio-queue.h"
 #include "ref-filter.h"
 #include "revision.h"
@@ -1057,6 +1058,15 @@ void ahead_behind(struct repository *r,
 	if (!commits_nr || !counts_nr)
 		return;
 
+	/*
+	 * With reachability bitmaps, each count is the size of the
+	 * difference between the bitmaps of its tip and base, and the
+	 * cost no longer grows with the number of tips times the number
+	 * of commits between them and their merge bases.
+	 */
+	if (!bitmap_ahead_behind(r, commits, commits_nr, counts, counts_nr))
+		return;
+
 	for (size_t i = 0; i < counts_nr; i++) {
 		counts[i].ahead = 0;
 		counts[i].behind = 0;
@@ -4,6 +4,7 @@
 #include "common-init.h"
 #include "exec-cmd.h"
 #include "gettext.h"
+#include "git-zlib.h"
 #include "attr.h"
 #include "repository.h"
 #include "setup.h"
@@ -53,6 +54,7 @@ void init_git(const char **argv)
 	initialize_repository(the_repository);
 
 	attr_start();
+	git_zlib_start();
 
 	trace2_initialize();
 	trace2_cmd_start(argv);
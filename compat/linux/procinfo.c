@@ -1,5 +1,9 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
 #include "git-compat-util.h"
 
+#include "json-writer.h"
+#include "repository.h"
 #include "strbuf.h"
 #include "strvec.h"
 #include "trace2.h"
@@ -148,6 +152,47 @@ static void push_ancestry_name(struct strvec *names, pid_t pid)
 	return;
 }
 
+/*
+ * Emit JSON data with the peak memory usage of the current process,
+ * taken from the "VmPeak" (virtual) and "VmHWM" (resident) fields of
+ * /proc/self/status and converted to bytes.
+ */
+static void get_peak_memory_info(void)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct json_writer jw = JSON_WRITER_INIT;
+	const char *fields[] = { "VmPeak", "VmHWM" };
+	int found = 0;
+
+	if (strbuf_read_file(&sb, "/proc/self/status", 0) < 0)
+		return;
+
+	jw_object_begin(&jw, 0);
+	for (size_t i = 0; i < ARRAY_SIZE(fields); i++) {
+		const char *p = sb.buf;
+		uintmax_t kb;
+
+		while ((p = strstr(p, fields[i]))) {
+			if ((p == sb.buf || p[-1] == '\n') &&
+			    p[strlen(fields[i])] == ':')
+				break;
+			p++;
+		}
+		if (!p)
+			continue;
+		kb = strtoumax(p + strlen(fields[i]) + 1, NULL, 10);
+		jw_object_intmax(&jw, fields[i], (intmax_t)(kb * 1024));
+		found++;
+	}
+	jw_end(&jw);
+
+	if (found)
+		trace2_data_json("process", the_repository,
+				 "linux/memory", &jw);
+	jw_release(&jw);
+	strbuf_release(&sb);
+}
+
 void trace2_collect_process_info(enum trace2_process_info_reason reason)
 {
 	struct strvec names = STRVEC_INIT;
@@ -157,11 +202,7 @@ void trace2_collect_process_info(enum trace2_process_info_reason reason)
 
 	switch (reason) {
 	case TRACE2_PROCESS_INFO_EXIT:
-		/*
-		 * The Windows version of this calls its
-		 * get_peak_memory_info() here. We may want to insert
-		 * similar process-end statistics here in the future.
-		 */
+		get_peak_memory_info();
 		break;
 	case TRACE2_PROCESS_INFO_STARTUP:
 		push_ancestry_name(&names, getppid());
@@ -146,6 +146,47 @@ void hashwrite(struct hashfile *f, const void *buf, uint32_t count)
 	}
 }
 
+void hashwrite_from_fd(struct hashfile *f, const void *buf, uint32_t count,
+		       int src_fd, off_t offset)
+{
+	const char *p = buf;
+
+	/*
+	 * Small writes are better served by our buffer, and when verifying
+	 * the output against an existing file we need to see all of it.
+	 */
+	if (f->no_sendfile || src_fd < 0 || 0 <= f->check_fd ||
+	    count < f->buffer_len) {
+		hashwrite(f, buf, count);
+		return;
+	}
+
+	hashflush(f);
+	if (f->do_crc)
+		f->crc32 = crc32(f->crc32, buf, count);
+	if (!f->skip_hash)
+		git_hash_update(&f->ctx, buf, count);
+
+	while (count) {
+		ssize_t nr = xsendfile(f->fd, src_fd, offset, count);
+		if (nr <= 0) {
+			/*
+			 * Not all file descriptors support copying data
+			 * this way. Write out the rest ourselves, which
+			 * also reports errors that are not about that.
+			 */
+			f->no_sendfile = 1;
+			flush(f, p, count);
+			return;
+		}
+		f->total += nr;
+		display_throughput(f->tp, f->total);
+		count -= nr;
+		offset += nr;
+		p += nr;
+	}
+}
+
 struct hashfile *hashfd_check(const struct git_hash_algo *algop,
 			      const char *name)
 {
@@ -174,6 +215,7 @@ struct hashfile *hashfd_ext(const struct git_hash_algo *algop,
 	f->name = name;
 	f->do_crc = 0;
 	f->skip_hash = 0;
+	f->no_sendfile = 0;
 
 	f->algop = unsafe_hash_algo(algop);
 	f->algop->init_fn(&f->ctx);
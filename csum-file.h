@@ -28,6 +28,12 @@ struct hashfile {
 	 * instead only use it as a buffered write.
 	 */
 	int skip_hash;
+
+	/*
+	 * Set once copying data within the kernel via hashwrite_from_fd()
+	 * failed, after which we always fall back to writing it out.
+	 */
+	int no_sendfile;
 };
 
 /* Checkpoint */
@@ -77,6 +83,16 @@ int finalize_hashfile(struct hashfile *, unsigned char *, enum fsync_component,
 void discard_hashfile(struct hashfile *);
 void hashwrite(struct hashfile *, const void *, uint32_t);
 void hashflush(struct hashfile *f);
+
+/*
+ * Like hashwrite(), but "buf" holds the same "count" bytes that can be found
+ * at "offset" of "src_fd". Large writes are then copied from "src_fd" to the
+ * output without going through user space where the platform supports it,
+ * while "buf" is only used to update the checksum. This is most useful when
+ * "buf" is a mapping of "src_fd" to begin with.
+ */
+void hashwrite_from_fd(struct hashfile *f, const void *buf, uint32_t count,
+		       int src_fd, off_t offset);
 void crc32_begin(struct hashfile *);
 uint32_t crc32_end(struct hashfile *);
 
@@ -119,6 +119,61 @@ struct index_entry {
 	unsigned int val;
 };
 
+/*
+ * Number of blocks hashed side by side when building the index. The
+ * Rabin polynomial of a block is a chain of dependent table lookups;
+ * interleaving several independent chains lets the CPU overlap them.
+ */
+#define HASH_BLOCKS 4
+
+static inline unsigned int hash_block(const unsigned char *data)
+{
+	unsigned int i, val = 0;
+
+	for (i = 1; i <= RABIN_WINDOW; i++)
+		val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
+	return val;
+}
+
+static inline void hash_blocks(const unsigned char *data, unsigned int *val)
+{
+	int i, j;
+
+	for (j = 0; j < HASH_BLOCKS; j++)
+		val[j] = 0;
+	for (i = 1; i <= RABIN_WINDOW; i++)
+		for (j = 0; j < HASH_BLOCKS; j++) {
+			const unsigned char *block = data - j * RABIN_WINDOW;
+			val[j] = ((val[j] << 8) | block[i]) ^
+				 T[val[j] >> RABIN_SHIFT];
+		}
+}
+
+/*
+ * Return how many leading bytes "a" and "b" have in common, looking at
+ * no more than "len" of them. Compare a word at a time for as long as
+ * the buffers agree, and look at the last word bytewise to find where
+ * they differ.
+ */
+static inline size_t match_len(const unsigned char *a,
+			       const unsigned char *b, size_t len)
+{
+	size_t n = 0;
+
+	while (len - n >= sizeof(uint64_t)) {
+		uint64_t x, y;
+
+		memcpy(&x, a + n, sizeof(x));
+		memcpy(&y, b + n, sizeof(y));
+		if (x != y)
+			break;
+		n += sizeof(x);
+	}
+	while (n < len && a[n] == b[n])
+		n++;
+	return n;
+}
+
 struct unpacked_index_entry {
 	struct index_entry entry;
 	struct unpacked_index_entry *next;
@@ -135,6 +190,7 @@ struct delta_index {
 struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 {
 	unsigned int i, hsize, hmask, entries, prev_val, *hash_count;
+	unsigned int vals[HASH_BLOCKS], batch = 0, batch_nr = 0;
 	const unsigned char *data, *buffer = buf;
 	struct delta_index *index;
 	struct unpacked_index_entry *entry, **hash;
@@ -185,9 +241,19 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	for (data = buffer + entries * RABIN_WINDOW - RABIN_WINDOW;
 	     data >= buffer;
 	     data -= RABIN_WINDOW) {
-		unsigned int val = 0;
-		for (i = 1; i <= RABIN_WINDOW; i++)
-			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
+		unsigned int val;
+		if (batch == batch_nr) {
+			/* hash this block and the ones below it in one go */
+			batch = 0;
+			if (data - buffer >= (HASH_BLOCKS - 1) * RABIN_WINDOW) {
+				hash_blocks(data, vals);
+				batch_nr = HASH_BLOCKS;
+			} else {
+				vals[0] = hash_block(data);
+				batch_nr = 1;
+			}
+		}
+		val = vals[batch++];
 		if (val == prev_val) {
 			/* keep the lowest of consecutive identical blocks */
 			entry[-1].entry.ptr = data + RABIN_WINDOW;
@@ -380,19 +446,18 @@ create_delta(const struct delta_index *index,
 			i = val & index->hash_mask;
 			for (entry = index->hash[i]; entry < index->hash[i+1]; entry++) {
 				const unsigned char *ref = entry->ptr;
-				const unsigned char *src = data;
 				unsigned int ref_size = ref_top - ref;
+				size_t len;
 				if (entry->val != val)
 					continue;
-				if (ref_size > top - src)
-					ref_size = top - src;
+				if (ref_size > top - data)
+					ref_size = top - data;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
-				if (msize < ref - entry->ptr) {
+				len = match_len(data, ref, ref_size);
+				if (msize < len) {
 					/* this is our best match so far */
-					msize = ref - entry->ptr;
+					msize = len;
 					moff = entry->ptr - ref_data;
 					if (msize >= 4096) /* good enough */
 						break;
@@ -18,10 +18,103 @@
  */
 #include "git-compat-util.h"
 #include "ewok.h"
+#include "ewok_rlw.h"
 
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
 
+/*
+ * The word kernels below work on 128-bit vectors where the compiler
+ * supports vector extensions. Every 64-bit target Git cares about has
+ * 128-bit vector registers in its base instruction set (SSE2 on x86-64,
+ * NEON on arm64), so this needs no runtime check; elsewhere the compiler
+ * lowers the vectors back to scalar code.
+ */
+#if defined(__GNUC__)
+typedef eword_t ewah_vec __attribute__((vector_size(16)));
+#define EWAH_VEC_WORDS (sizeof(ewah_vec) / sizeof(eword_t))
+#endif
+
+void ewah_words_or(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i = 0;
+
+#ifdef EWAH_VEC_WORDS
+	for (; i + EWAH_VEC_WORDS <= nr; i += EWAH_VEC_WORDS) {
+		ewah_vec a, b;
+		memcpy(&a, dst + i, sizeof(a));
+		memcpy(&b, src + i, sizeof(b));
+		a |= b;
+		memcpy(dst + i, &a, sizeof(a));
+	}
+#endif
+	for (; i < nr; i++)
+		dst[i] |= src[i];
+}
+
+void ewah_words_and_not(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i = 0;
+
+#ifdef EWAH_VEC_WORDS
+	for (; i + EWAH_VEC_WORDS <= nr; i += EWAH_VEC_WORDS) {
+		ewah_vec a, b;
+		memcpy(&a, dst + i, sizeof(a));
+		memcpy(&b, src + i, sizeof(b));
+		a &= ~b;
+		memcpy(dst + i, &a, sizeof(a));
+	}
+#endif
+	for (; i < nr; i++)
+		dst[i] &= ~src[i];
+}
+
+static size_t words_popcount_generic(const eword_t *words, size_t nr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < nr; i++)
+		count += ewah_bit_popcount64(words[i]);
+	return count;
+}
+
+/*
+ * The POPCNT instruction is not part of the x86-64 base instruction
+ * set, but is about four times as fast as ewah_bit_popcount64() where
+ * it exists, so pick an implementation at runtime.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__POPCNT__)
+#define EWAH_POPCOUNT_DISPATCH
+
+__attribute__((target("popcnt")))
+static size_t words_popcount_popcnt(const eword_t *words, size_t nr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < nr; i++)
+		count += __builtin_popcountll(words[i]);
+	return count;
+}
+#endif
+
+size_t ewah_words_popcount(const eword_t *words, size_t nr)
+{
+#ifdef EWAH_POPCOUNT_DISPATCH
+	static size_t (*popcount_fn)(const eword_t *, size_t);
+
+	if (!popcount_fn) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("popcnt"))
+			popcount_fn = words_popcount_popcnt;
+		else
+			popcount_fn = words_popcount_generic;
+	}
+	return popcount_fn(words, nr);
+#else
+	return words_popcount_generic(words, nr);
+#endif
+}
+
 struct bitmap *bitmap_word_alloc(size_t word_alloc)
 {
 	struct bitmap *bitmap = xmalloc(sizeof(struct bitmap));
@@ -42,7 +135,7 @@ struct bitmap *bitmap_dup(const struct bitmap *src)
 	return dst;
 }
 
-static void bitmap_grow(struct bitmap *self, size_t word_alloc)
+void bitmap_grow(struct bitmap *self, size_t word_alloc)
 {
 	size_t old_size = self->word_alloc;
 	ALLOC_GROW(self->words, word_alloc, self->word_alloc);
@@ -122,19 +215,13 @@ void bitmap_and_not(struct bitmap *self, struct bitmap *other)
 	const size_t count = (self->word_alloc < other->word_alloc) ?
 		self->word_alloc : other->word_alloc;
 
-	size_t i;
-
-	for (i = 0; i < count; ++i)
-		self->words[i] &= ~other->words[i];
+	ewah_words_and_not(self->words, other->words, count);
 }
 
 void bitmap_or(struct bitmap *self, const struct bitmap *other)
 {
-	size_t i;
-
 	bitmap_grow(self, other->word_alloc);
-	for (i = 0; i < other->word_alloc; i++)
-		self->words[i] |= other->words[i];
+	ewah_words_or(self->words, other->words, other->word_alloc);
 }
 
 int ewah_bitmap_is_subset(struct ewah_bitmap *self, struct bitmap *other)
@@ -184,9 +271,7 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
 	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
+	size_t pos = 0, pointer = 0;
 
 	if (self->word_alloc < other_final) {
 		self->word_alloc = other_final;
@@ -195,32 +280,54 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 			      self->word_alloc - original_size);
 	}
 
-	ewah_iterator_init(&it, other);
-
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	/*
+	 * Walk the run-length words directly instead of going through an
+	 * ewah_iterator: runs of zeroes are skipped in one step, and
+	 * literal words are OR'd in bulk.
+	 */
+	while (pointer < other->buffer_size) {
+		eword_t *rlw = &other->buffer[pointer++];
+		size_t run = rlw_get_running_len(rlw);
+		size_t literals = rlw_get_literal_words(rlw);
+
+		if (run > self->word_alloc - pos)
+			run = self->word_alloc - pos;
+		if (rlw_get_run_bit(rlw))
+			memset(self->words + pos, 0xff, run * sizeof(eword_t));
+		pos += run;
+
+		if (literals > other->buffer_size - pointer)
+			literals = other->buffer_size - pointer;
+		if (literals > self->word_alloc - pos)
+			literals = self->word_alloc - pos;
+		ewah_words_or(self->words + pos, other->buffer + pointer,
+			      literals);
+		pos += literals;
+		pointer += rlw_get_literal_words(rlw);
+	}
 }
 
 size_t bitmap_popcount(struct bitmap *self)
 {
-	size_t i, count = 0;
-
-	for (i = 0; i < self->word_alloc; ++i)
-		count += ewah_bit_popcount64(self->words[i]);
-
-	return count;
+	return ewah_words_popcount(self->words, self->word_alloc);
 }
 
 size_t ewah_bitmap_popcount(struct ewah_bitmap *self)
 {
-	struct ewah_iterator it;
-	eword_t word;
-	size_t count = 0;
+	size_t pointer = 0, count = 0;
 
-	ewah_iterator_init(&it, self);
+	while (pointer < self->buffer_size) {
+		eword_t *rlw = &self->buffer[pointer++];
+		size_t literals = rlw_get_literal_words(rlw);
 
-	while (ewah_iterator_next(&word, &it))
-		count += ewah_bit_popcount64(word);
+		if (rlw_get_run_bit(rlw))
+			count += rlw_get_running_len(rlw) * BITS_IN_EWORD;
+
+		if (literals > self->buffer_size - pointer)
+			literals = self->buffer_size - pointer;
+		count += ewah_words_popcount(self->buffer + pointer, literals);
+		pointer += literals;
+	}
 
 	return count;
 }
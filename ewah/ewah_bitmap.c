@@ -355,6 +355,44 @@ int ewah_iterator_next(eword_t *next, struct ewah_iterator *it)
 	return 1;
 }
 
+size_t ewah_iterator_next_words(eword_t *out, size_t nr,
+				struct ewah_iterator *it)
+{
+	size_t n = 0;
+
+	while (n < nr && it->pointer < it->buffer_size) {
+		size_t len;
+
+		if (it->compressed < it->rl) {
+			len = it->rl - it->compressed;
+			if (len > nr - n)
+				len = nr - n;
+
+			memset(out + n, it->b ? 0xff : 0, len * sizeof(eword_t));
+			it->compressed += len;
+		} else {
+			len = it->lw - it->literals;
+			if (len > nr - n)
+				len = nr - n;
+
+			assert(it->pointer + len < it->buffer_size);
+
+			memcpy(out + n, it->buffer + it->pointer + 1,
+			       len * sizeof(eword_t));
+			it->literals += len;
+			it->pointer += len;
+		}
+		n += len;
+
+		if (it->compressed == it->rl && it->literals == it->lw) {
+			if (++it->pointer < it->buffer_size)
+				read_new_rlw(it);
+		}
+	}
+
+	return n;
+}
+
 void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
 {
 	it->buffer = parent->buffer;
@@ -383,20 +421,49 @@ void ewah_or_iterator_init(struct ewah_or_iterator *it,
 		ewah_iterator_init(&it->its[it->nr++], parents[i]);
 }
 
-int ewah_or_iterator_next(eword_t *next, struct ewah_or_iterator *it)
+/*
+ * Decode the next block of words from each iterator and OR them
+ * together. Iterators which run out early contribute zeroes, so the
+ * block is as long as the longest one.
+ */
+static void ewah_or_iterator_fill(struct ewah_or_iterator *it)
 {
-	eword_t buf, out = 0;
+	eword_t words[EWAH_OR_ITERATOR_WORDS];
 	size_t i;
-	int ret = 0;
 
-	for (i = 0; i < it->nr; i++)
-		if (ewah_iterator_next(&buf, &it->its[i])) {
-			out |= buf;
-			ret = 1;
+	it->buf_nr = 0;
+	it->buf_pos = 0;
+
+	for (i = 0; i < it->nr; i++) {
+		size_t nr;
+
+		if (!i) {
+			it->buf_nr = ewah_iterator_next_words(it->buf,
+							      EWAH_OR_ITERATOR_WORDS,
+							      &it->its[i]);
+			continue;
 		}
 
-	*next = out;
-	return ret;
+		nr = ewah_iterator_next_words(words, EWAH_OR_ITERATOR_WORDS,
+					      &it->its[i]);
+		if (nr > it->buf_nr) {
+			MEMZERO_ARRAY(it->buf + it->buf_nr, nr - it->buf_nr);
+			it->buf_nr = nr;
+		}
+		ewah_words_or(it->buf, words, nr);
+	}
+}
+
+int ewah_or_iterator_next(eword_t *next, struct ewah_or_iterator *it)
+{
+	if (it->buf_pos == it->buf_nr) {
+		ewah_or_iterator_fill(it);
+		if (!it->buf_nr)
+			return 0;
+	}
+
+	*next = it->buf[it->buf_pos++];
+	return 1;
 }
 
 void ewah_or_iterator_release(struct ewah_or_iterator *it)
@@ -148,9 +148,26 @@ void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
  */
 int ewah_iterator_next(eword_t *next, struct ewah_iterator *it);
 
+/**
+ * Like ewah_iterator_next(), but yield up to `nr` words at once into
+ * `out`. Runs are expanded and literal words copied in bulk, which is
+ * much cheaper than yielding them one by one.
+ *
+ * Return: the number of words yielded, which is less than `nr` only
+ * when there are no words left
+ */
+size_t ewah_iterator_next_words(eword_t *out, size_t nr,
+				struct ewah_iterator *it);
+
+#define EWAH_OR_ITERATOR_WORDS 64
+
 struct ewah_or_iterator {
 	struct ewah_iterator *its;
 	size_t nr;
+
+	/* words decoded from `its` but not yet yielded */
+	eword_t buf[EWAH_OR_ITERATOR_WORDS];
+	size_t buf_nr, buf_pos;
 };
 
 void ewah_or_iterator_init(struct ewah_or_iterator *it,
@@ -186,6 +203,7 @@ struct bitmap {
 struct bitmap *bitmap_new(void);
 struct bitmap *bitmap_word_alloc(size_t word_alloc);
 struct bitmap *bitmap_dup(const struct bitmap *src);
+void bitmap_grow(struct bitmap *self, size_t word_alloc);
 void bitmap_set(struct bitmap *self, size_t pos);
 void bitmap_unset(struct bitmap *self, size_t pos);
 int bitmap_get(struct bitmap *self, size_t pos);
@@ -203,6 +221,14 @@ int ewah_bitmap_is_subset(struct ewah_bitmap *self, struct bitmap *other);
 struct ewah_bitmap * bitmap_to_ewah(struct bitmap *bitmap);
 struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah);
 
+/*
+ * Kernels over arrays of uncompressed words, used to implement the
+ * operations below. `dst` and `src` must not overlap.
+ */
+void ewah_words_or(eword_t *dst, const eword_t *src, size_t nr);
+void ewah_words_and_not(eword_t *dst, const eword_t *src, size_t nr);
+size_t ewah_words_popcount(const eword_t *words, size_t nr);
+
 void bitmap_and_not(struct bitmap *self, struct bitmap *other);
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other);
 void bitmap_or(struct bitmap *self, const struct bitmap *other);
@@ -0,0 +1,440 @@
+#include "git-compat-util.h"
+#include "ewok.h"
+#include "roaring.h"
+#include "strbuf.h"
+
+#define ROARING_CHUNK_BITS (1U << 16)
+#define ROARING_CHUNK_WORDS (ROARING_CHUNK_BITS / BITS_IN_EWORD)
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_DESCRIPTOR_SIZE 8
+
+static size_t container_size(uint16_t type, uint32_t cardinality,
+			     uint32_t nr_runs)
+{
+	switch (type) {
+	case ROARING_ARRAY:
+		return st_mult(cardinality, sizeof(uint16_t));
+	case ROARING_BITSET:
+		return ROARING_CHUNK_WORDS * sizeof(eword_t);
+	case ROARING_RUN:
+		return st_add(sizeof(uint32_t),
+			      st_mult(nr_runs, 2 * sizeof(uint16_t)));
+	}
+	BUG("unknown roaring container type: %d", type);
+}
+
+/*
+ * Return the position of the first bit at or after "pos" in the chunk
+ * "words" which is set (or unset, when "set" is zero), or
+ * ROARING_CHUNK_BITS if there is none.
+ */
+static uint32_t chunk_next(const eword_t *words, uint32_t pos, int set)
+{
+	uint32_t i = pos / BITS_IN_EWORD;
+	eword_t w;
+
+	if (pos >= ROARING_CHUNK_BITS)
+		return ROARING_CHUNK_BITS;
+
+	w = set ? words[i] : ~words[i];
+	w &= ~(eword_t)0 << (pos % BITS_IN_EWORD);
+	while (!w) {
+		if (++i == ROARING_CHUNK_WORDS)
+			return ROARING_CHUNK_BITS;
+		w = set ? words[i] : ~words[i];
+	}
+	return i * BITS_IN_EWORD + ewah_bit_ctz64(w);
+}
+
+static void add_be16(struct strbuf *sb, uint16_t v)
+{
+	unsigned char buf[2];
+	put_be16(buf, v);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void add_be32(struct strbuf *sb, uint32_t v)
+{
+	unsigned char buf[4];
+	put_be32(buf, v);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void add_be64(struct strbuf *sb, uint64_t v)
+{
+	unsigned char buf[8];
+	put_be64(buf, v);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void write_container(struct strbuf *desc, struct strbuf *payload,
+			    uint16_t key, const eword_t *words)
+{
+	uint32_t cardinality = 0, nr_runs = 0;
+	eword_t carry = 0;
+	uint16_t type;
+	size_t i;
+
+	for (i = 0; i < ROARING_CHUNK_WORDS; i++) {
+		eword_t w = words[i];
+		cardinality += ewah_bit_popcount64(w);
+		/* count the bits which start a run of ones */
+		nr_runs += ewah_bit_popcount64(w & ~((w << 1) | carry));
+		carry = w >> (BITS_IN_EWORD - 1);
+	}
+
+	/*
+	 * Pick whichever encoding is the smallest, preferring bitsets and
+	 * then arrays on ties, since they are the cheapest to query.
+	 */
+	type = ROARING_BITSET;
+	if (cardinality <= ROARING_ARRAY_MAX &&
+	    container_size(ROARING_ARRAY, cardinality, 0) <
+	    container_size(type, cardinality, 0))
+		type = ROARING_ARRAY;
+	if (container_size(ROARING_RUN, cardinality, nr_runs) <
+	    container_size(type, cardinality, 0))
+		type = ROARING_RUN;
+
+	add_be16(desc, key);
+	add_be16(desc, type);
+	add_be32(desc, cardinality);
+
+	switch (type) {
+	case ROARING_ARRAY:
+		for (i = 0; i < ROARING_CHUNK_WORDS; i++) {
+			eword_t w = words[i];
+			while (w) {
+				add_be16(payload, i * BITS_IN_EWORD +
+					 ewah_bit_ctz64(w));
+				w &= w - 1;
+			}
+		}
+		break;
+	case ROARING_BITSET:
+		for (i = 0; i < ROARING_CHUNK_WORDS; i++)
+			add_be64(payload, words[i]);
+		break;
+	case ROARING_RUN: {
+		uint32_t start = chunk_next(words, 0, 1);
+
+		add_be32(payload, nr_runs);
+		while (start < ROARING_CHUNK_BITS) {
+			uint32_t end = chunk_next(words, start, 0);
+			add_be16(payload, start);
+			add_be16(payload, end - start - 1);
+			start = chunk_next(words, end, 1);
+		}
+		break;
+	}
+	}
+}
+
+int roaring_serialize_ewah(struct ewah_bitmap *ewah,
+			   int (*write_fun)(void *, const void *, size_t),
+			   void *data)
+{
+	struct strbuf desc = STRBUF_INIT, payload = STRBUF_INIT;
+	struct ewah_iterator it;
+	eword_t chunk[ROARING_CHUNK_WORDS];
+	eword_t word, any = 0;
+	unsigned char header[8];
+	uint32_t nr = 0, key = 0;
+	size_t i = 0;
+	int ret = -1;
+
+	ewah_iterator_init(&it, ewah);
+	for (;;) {
+		int more = ewah_iterator_next(&word, &it);
+
+		if (more) {
+			chunk[i++] = word;
+			any |= word;
+		}
+		if (i == ROARING_CHUNK_WORDS || (!more && i)) {
+			MEMZERO_ARRAY(chunk + i, ROARING_CHUNK_WORDS - i);
+			if (any) {
+				write_container(&desc, &payload, key, chunk);
+				nr++;
+			}
+			key++;
+			i = 0;
+			any = 0;
+		}
+		if (!more)
+			break;
+	}
+
+	put_be32(header, ewah->bit_size);
+	put_be32(header + 4, nr);
+
+	if (write_fun(data, header, sizeof(header)) != sizeof(header) ||
+	    write_fun(data, desc.buf, desc.len) != (int)desc.len ||
+	    write_fun(data, payload.buf, payload.len) != (int)payload.len)
+		goto out;
+
+	ret = sizeof(header) + desc.len + payload.len;
+out:
+	strbuf_release(&desc);
+	strbuf_release(&payload);
+	return ret;
+}
+
+ssize_t roaring_read_mmap(struct roaring_bitmap *self,
+			  const void *map, size_t len)
+{
+	const unsigned char *ptr = map;
+	const unsigned char *desc;
+	uint32_t max_key;
+	size_t i;
+
+	if (len < 2 * sizeof(uint32_t))
+		return error("corrupt roaring bitmap: eof in header");
+	self->bit_size = get_be32(ptr);
+	self->nr = get_be32(ptr + 4);
+	ptr += 2 * sizeof(uint32_t);
+	len -= 2 * sizeof(uint32_t);
+
+	if (len / ROARING_DESCRIPTOR_SIZE < self->nr)
+		return error("corrupt roaring bitmap: eof in containers");
+	desc = ptr;
+	ptr += st_mult(self->nr, ROARING_DESCRIPTOR_SIZE);
+	len -= st_mult(self->nr, ROARING_DESCRIPTOR_SIZE);
+
+	max_key = DIV_ROUND_UP((uint64_t)self->bit_size, ROARING_CHUNK_BITS);
+
+	REALLOC_ARRAY(self->containers, self->nr);
+	for (i = 0; i < self->nr; i++) {
+		struct roaring_container *c = &self->containers[i];
+		size_t size;
+
+		c->key = get_be16(desc);
+		c->type = get_be16(desc + 2);
+		c->cardinality = get_be32(desc + 4);
+		c->nr_runs = 0;
+		desc += ROARING_DESCRIPTOR_SIZE;
+
+		if (c->key >= max_key ||
+		    (i && c->key <= self->containers[i - 1].key))
+			return error("corrupt roaring bitmap: "
+				     "bad key %"PRIu32" in container %"PRIuMAX,
+				     (uint32_t)c->key, (uintmax_t)i);
+		if (!c->cardinality || c->cardinality > ROARING_CHUNK_BITS)
+			return error("corrupt roaring bitmap: "
+				     "bad cardinality in container %"PRIuMAX,
+				     (uintmax_t)i);
+
+		switch (c->type) {
+		case ROARING_ARRAY:
+			if (c->cardinality > ROARING_ARRAY_MAX)
+				return error("corrupt roaring bitmap: "
+					     "array container %"PRIuMAX" too large",
+					     (uintmax_t)i);
+			break;
+		case ROARING_BITSET:
+			break;
+		case ROARING_RUN:
+			if (len < sizeof(uint32_t))
+				return error("corrupt roaring bitmap: "
+					     "eof in container %"PRIuMAX,
+					     (uintmax_t)i);
+			c->nr_runs = get_be32(ptr);
+			if (c->nr_runs > c->cardinality)
+				return error("corrupt roaring bitmap: "
+					     "bad run count in container %"PRIuMAX,
+					     (uintmax_t)i);
+			break;
+		default:
+			return error("corrupt roaring bitmap: "
+				     "unknown type %d in container %"PRIuMAX,
+				     c->type, (uintmax_t)i);
+		}
+
+		size = container_size(c->type, c->cardinality, c->nr_runs);
+		if (len < size)
+			return error("corrupt roaring bitmap: "
+				     "eof in container %"PRIuMAX,
+				     (uintmax_t)i);
+		c->data = ptr;
+		if (c->type == ROARING_RUN)
+			c->data += sizeof(uint32_t);
+		ptr += size;
+		len -= size;
+	}
+
+	return ptr - (const unsigned char *)map;
+}
+
+void roaring_release(struct roaring_bitmap *self)
+{
+	if (!self)
+		return;
+	FREE_AND_NULL(self->containers);
+	self->nr = 0;
+	self->bit_size = 0;
+}
+
+static const struct roaring_container *find_container(const struct roaring_bitmap *self,
+						      uint16_t key)
+{
+	size_t lo = 0, hi = self->nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		uint16_t k = self->containers[mi].key;
+
+		if (k == key)
+			return &self->containers[mi];
+		if (k < key)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+int roaring_contains(const struct roaring_bitmap *self, uint32_t pos)
+{
+	const struct roaring_container *c;
+	uint16_t low = pos & (ROARING_CHUNK_BITS - 1);
+	size_t lo, hi;
+
+	if (pos >= self->bit_size)
+		return 0;
+	c = find_container(self, pos / ROARING_CHUNK_BITS);
+	if (!c)
+		return 0;
+
+	switch (c->type) {
+	case ROARING_ARRAY:
+		lo = 0;
+		hi = c->cardinality;
+		while (lo < hi) {
+			size_t mi = lo + (hi - lo) / 2;
+			uint16_t v = get_be16(c->data + 2 * mi);
+
+			if (v == low)
+				return 1;
+			if (v < low)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		return 0;
+	case ROARING_BITSET:
+		return !!(get_be64(c->data + 8 * (low / BITS_IN_EWORD)) &
+			  ((eword_t)1 << (low % BITS_IN_EWORD)));
+	case ROARING_RUN:
+		/* find the last run starting at or before "low" */
+		lo = 0;
+		hi = c->nr_runs;
+		while (lo < hi) {
+			size_t mi = lo + (hi - lo) / 2;
+
+			if (get_be16(c->data + 4 * mi) <= low)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		if (!lo)
+			return 0;
+		lo--;
+		return low - get_be16(c->data + 4 * lo) <=
+			get_be16(c->data + 4 * lo + 2);
+	}
+	return 0;
+}
+
+size_t roaring_popcount(const struct roaring_bitmap *self)
+{
+	size_t count = 0;
+	size_t i;
+
+	for (i = 0; i < self->nr; i++)
+		count += self->containers[i].cardinality;
+	return count;
+}
+
+static void set_range(eword_t *words, size_t start, size_t end)
+{
+	size_t first = start / BITS_IN_EWORD;
+	size_t last = (end - 1) / BITS_IN_EWORD;
+	eword_t first_mask = ~(eword_t)0 << (start % BITS_IN_EWORD);
+	eword_t last_mask = ~(eword_t)0 >> (BITS_IN_EWORD - 1 - (end - 1) % BITS_IN_EWORD);
+	size_t i;
+
+	if (first == last) {
+		words[first] |= first_mask & last_mask;
+		return;
+	}
+	words[first] |= first_mask;
+	for (i = first + 1; i < last; i++)
+		words[i] = ~(eword_t)0;
+	words[last] |= last_mask;
+}
+
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other)
+{
+	size_t nr_words = DIV_ROUND_UP((size_t)other->bit_size, BITS_IN_EWORD);
+	size_t nr_bits = nr_words * BITS_IN_EWORD;
+	size_t i, j;
+
+	bitmap_grow(self, nr_words);
+
+	for (i = 0; i < other->nr; i++) {
+		const struct roaring_container *c = &other->containers[i];
+		size_t base = (size_t)c->key * ROARING_CHUNK_BITS;
+		eword_t *words = self->words + base / BITS_IN_EWORD;
+		const unsigned char *p = c->data;
+
+		switch (c->type) {
+		case ROARING_ARRAY:
+			for (j = 0; j < c->cardinality; j++, p += 2) {
+				size_t pos = base + get_be16(p);
+				if (pos < nr_bits)
+					self->words[pos / BITS_IN_EWORD] |=
+						(eword_t)1 << (pos % BITS_IN_EWORD);
+			}
+			break;
+		case ROARING_BITSET: {
+			size_t n = nr_words - base / BITS_IN_EWORD;
+
+			if (n > ROARING_CHUNK_WORDS)
+				n = ROARING_CHUNK_WORDS;
+			for (j = 0; j < n; j++)
+				words[j] |= get_be64(p + 8 * j);
+			break;
+		}
+		case ROARING_RUN:
+			for (j = 0; j < c->nr_runs; j++, p += 4) {
+				size_t start = base + get_be16(p);
+				size_t end = start + get_be16(p + 2) + 1;
+
+				if (end > nr_bits)
+					end = nr_bits;
+				if (start < end)
+					set_range(self->words, start, end);
+			}
+			break;
+		}
+	}
+}
+
+struct bitmap *roaring_to_bitmap(const struct roaring_bitmap *self)
+{
+	struct bitmap *bitmap;
+
+	bitmap = bitmap_word_alloc(DIV_ROUND_UP((size_t)self->bit_size,
+						BITS_IN_EWORD));
+	bitmap_or_roaring(bitmap, self);
+	return bitmap;
+}
+
+struct ewah_bitmap *roaring_to_ewah(const struct roaring_bitmap *self)
+{
+	struct bitmap *bitmap = roaring_to_bitmap(self);
+	struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+
+	bitmap_free(bitmap);
+	return ewah;
+}
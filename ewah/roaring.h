@@ -0,0 +1,77 @@
+#ifndef __EWOK_ROARING_H__
+#define __EWOK_ROARING_H__
+
+struct bitmap;
+struct ewah_bitmap;
+
+/*
+ * Roaring-style compressed bitmaps.
+ *
+ * The bit space is cut into chunks of 2^16 bits. Each chunk that has
+ * any bit set is stored in a container, whose layout depends on its
+ * contents:
+ *
+ *   - ROARING_ARRAY: a sorted array of the (16-bit) positions that are
+ *     set, for sparse chunks of at most 4096 bits.
+ *
+ *   - ROARING_BITSET: all 1024 64-bit words of the chunk.
+ *
+ *   - ROARING_RUN: a sorted array of (start, length - 1) pairs of
+ *     16-bit values, for chunks made of long runs of set bits.
+ *
+ * Unlike EWAH, any container can be found with a binary search over
+ * the container keys, so a membership test does not need to decode the
+ * whole bitmap. A bitmap read with roaring_read_mmap() points into the
+ * mapped data; the containers are decoded when they are used.
+ *
+ * See Documentation/technical/bitmap-format.adoc for the on-disk format.
+ */
+
+enum roaring_container_type {
+	ROARING_ARRAY = 1,
+	ROARING_BITSET = 2,
+	ROARING_RUN = 3,
+};
+
+struct roaring_container {
+	uint16_t key;
+	uint16_t type;
+	/* The number of bits set in the container. */
+	uint32_t cardinality;
+	/* The number of pairs in a ROARING_RUN container. */
+	uint32_t nr_runs;
+	const unsigned char *data;
+};
+
+struct roaring_bitmap {
+	uint32_t bit_size;
+	uint32_t nr;
+	struct roaring_container *containers;
+};
+
+/*
+ * Write "ewah" as a roaring bitmap through "write_fun", and return the
+ * number of bytes written, or a negative value on error.
+ */
+int roaring_serialize_ewah(struct ewah_bitmap *ewah,
+			   int (*write_fun)(void *out, const void *buf,
+					    size_t len),
+			   void *out);
+
+/*
+ * Read a roaring bitmap from "map", which must outlive it. Returns the
+ * number of bytes read, or a negative value if the bitmap is corrupt.
+ */
+ssize_t roaring_read_mmap(struct roaring_bitmap *self,
+			  const void *map, size_t len);
+
+void roaring_release(struct roaring_bitmap *self);
+
+int roaring_contains(const struct roaring_bitmap *self, uint32_t pos);
+size_t roaring_popcount(const struct roaring_bitmap *self);
+
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other);
+struct bitmap *roaring_to_bitmap(const struct roaring_bitmap *self);
+struct ewah_bitmap *roaring_to_ewah(const struct roaring_bitmap *self);
+
+#endif
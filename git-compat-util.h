@@ -198,6 +198,10 @@ static inline const char *precompose_string_if_needed(const char *in)
 # include <sys/sysinfo.h>
 #endif
 
+#ifdef HAVE_SENDFILE
+# include <sys/sendfile.h>
+#endif
+
 #ifndef PATH_SEP
 #define PATH_SEP ':'
 #endif
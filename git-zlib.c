@@ -5,6 +5,11 @@
 #include "git-compat-util.h"
 #include "git-zlib.h"
 
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#include "thread-utils.h"
+#endif
+
 static const char *zerr_to_string(int status)
 {
 	switch (status) {
@@ -153,6 +158,123 @@ int git_inflate(git_zstream *strm, int flush)
 	return status;
 }
 
+#ifdef HAVE_LIBDEFLATE
+/*
+ * Allocating a decompressor is not free, so each thread sets one up the
+ * first time it inflates an object and reuses it for all later ones.
+ */
+#if HAVE_THREADS
+static pthread_key_t decompressor_key;
+
+static void free_decompressor(void *d)
+{
+	libdeflate_free_decompressor(d);
+}
+
+void git_zlib_start(void)
+{
+	pthread_key_create(&decompressor_key, free_decompressor);
+}
+#else
+static struct libdeflate_decompressor *decompressor;
+
+void git_zlib_start(void)
+{
+}
+#endif
+
+static struct libdeflate_decompressor *get_decompressor(void)
+{
+	struct libdeflate_decompressor *d;
+
+#if HAVE_THREADS
+	d = pthread_getspecific(decompressor_key);
+#else
+	d = decompressor;
+#endif
+	if (d)
+		return d;
+
+	d = libdeflate_alloc_decompressor();
+	if (!d)
+		die("libdeflate: out of memory");
+#if HAVE_THREADS
+	pthread_setspecific(decompressor_key, d);
+#else
+	decompressor = d;
+#endif
+	return d;
+}
+
+int git_inflate_oneshot(void *out, unsigned long *out_len,
+			const void *in, unsigned long *in_len)
+{
+	enum libdeflate_result res;
+	size_t consumed = 0, produced = 0;
+
+	res = libdeflate_zlib_decompress_ex(get_decompressor(), in, *in_len,
+					    out, *out_len, &consumed, &produced);
+
+	*in_len = consumed;
+	*out_len = produced;
+
+	switch (res) {
+	case LIBDEFLATE_SUCCESS:
+		return Z_STREAM_END;
+	case LIBDEFLATE_INSUFFICIENT_SPACE:
+		return Z_BUF_ERROR;
+	default:
+		/*
+		 * libdeflate cannot tell a truncated stream apart from a
+		 * corrupt one, so callers need to handle both alike.
+		 */
+		return Z_DATA_ERROR;
+	}
+}
+#else
+void git_zlib_start(void)
+{
+}
+
+int git_inflate_oneshot(void *out, unsigned long *out_len,
+			const void *in, unsigned long *in_len)
+{
+	struct z_stream_s z;
+	int status;
+
+	if (*out_len > ZLIB_BUF_MAX)
+		BUG("git_inflate_oneshot() is meant for small objects");
+
+	memset(&z, 0, sizeof(z));
+	/* zlib-ng marks `next_in` as `const`, but zlib does not. */
+	z.next_in = (void *)in;
+	z.avail_in = zlib_buf_cap(*in_len);
+	z.next_out = out;
+	z.avail_out = *out_len;
+
+	status = inflateInit(&z);
+	if (status == Z_MEM_ERROR)
+		die("inflateInit: out of memory");
+	if (status != Z_OK)
+		return status;
+
+	status = inflate(&z, Z_FINISH);
+	if (status == Z_MEM_ERROR)
+		die("inflate: out of memory");
+
+	*in_len = z.total_in;
+	*out_len = z.total_out;
+	inflateEnd(&z);
+
+	/*
+	 * With Z_FINISH, zlib returns Z_BUF_ERROR rather than Z_OK when it
+	 * could not finish the stream. Either way, one of the buffers was
+	 * too small.
+	 */
+	return status == Z_OK ? Z_BUF_ERROR : status;
+}
+#endif
+
 unsigned long git_deflate_bound(git_zstream *strm, unsigned long size)
 {
 	return deflateBound(&strm->z, size);
@@ -18,6 +18,27 @@ void git_inflate_init_gzip_only(git_zstream *);
 void git_inflate_end(git_zstream *);
 int git_inflate(git_zstream *, int flush);
 
+/*
+ * Inflate the complete zlib stream found at "in" into "out" in a single
+ * call. This is meant for small objects whose inflated size is known in
+ * advance, and uses libdeflate instead of zlib when Git is built with
+ * USE_LIBDEFLATE.
+ *
+ * On entry "*in_len" and "*out_len" hold the sizes of the buffers, on
+ * return the number of bytes consumed and produced. Returns Z_STREAM_END
+ * if the whole stream has been inflated. Any other return value means
+ * that the stream is corrupt, or that one of the buffers was too small
+ * to hold all of it, which callers cannot tell apart in general.
+ */
+int git_inflate_oneshot(void *out, unsigned long *out_len,
+			const void *in, unsigned long *in_len);
+
+/*
+ * Set up the per-thread state of git_inflate_oneshot(). Must be called
+ * before any threads are started.
+ */
+void git_zlib_start(void);
+
 void git_deflate_init(git_zstream *, int level);
 void git_deflate_init_gzip(git_zstream *, int level);
 void git_deflate_init_raw(git_zstream *, int level);
@@ -0,0 +1,359 @@
+#include "git-compat-util.h"
+#include "gettext.h"
+#include "loose-cache.h"
+#include "abspath.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "environment.h"
+#include "hash.h"
+#include "lockfile.h"
+#include "odb.h"
+#include "odb/source.h"
+#include "oid-array.h"
+#include "path.h"
+#include "repo-settings.h"
+#include "repository.h"
+#include "strbuf.h"
+
+/*
+ * The file starts with a 12-byte header, followed by one entry for each
+ * of the 256 loose object subdirectories. Each entry records the mtime
+ * of the directory at the time it was read (8 bytes of seconds and 4
+ * bytes of nanoseconds) and the cumulative number of objects in all
+ * subdirectories up to and including this one (4 bytes). The sorted
+ * object IDs themselves follow, and the file ends with a checksum.
+ */
+#define LOOSE_CACHE_HEADER_SIZE (12)
+#define LOOSE_CACHE_SUBDIR_ENTRY_SIZE (16)
+#define LOOSE_CACHE_TABLE_SIZE (256 * LOOSE_CACHE_SUBDIR_ENTRY_SIZE)
+
+struct loose_cache {
+	const struct git_hash_algo *algop;
+	char *objdir;
+
+	const unsigned char *data;
+	size_t data_len;
+	const unsigned char *table;
+	const unsigned char *oids;
+	uint32_t nr;
+
+	/* mtime of the cache file itself, used to detect racy entries */
+	time_t mtime;
+};
+
+struct loose_cache_stamp {
+	uint64_t sec;
+	uint32_t nsec;
+};
+
+static char *loose_cache_filename(struct odb_source *source)
+{
+	return xstrfmt("%s/info/loose-cache", source->path);
+}
+
+/*
+ * Records the mtime of the given subdirectory in "stamp". A missing
+ * directory is recorded as a zero stamp.
+ */
+static int stat_subdir(const char *objdir, unsigned int subdir_nr,
+		       struct loose_cache_stamp *stamp)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	int ret = 0;
+
+	strbuf_addf(&path, "%s/%02x", objdir, subdir_nr);
+	if (stat(path.buf, &st) < 0) {
+		if (errno == ENOENT)
+			memset(stamp, 0, sizeof(*stamp));
+		else
+			ret = -1;
+	} else {
+		stamp->sec = st.st_mtime;
+		stamp->nsec = ST_MTIME_NSEC(st);
+	}
+	strbuf_release(&path);
+	return ret;
+}
+
+static const unsigned char *subdir_entry(const struct loose_cache *lc,
+					 unsigned int subdir_nr)
+{
+	return lc->table + st_mult(LOOSE_CACHE_SUBDIR_ENTRY_SIZE, subdir_nr);
+}
+
+static uint32_t subdir_end(const struct loose_cache *lc, unsigned int subdir_nr)
+{
+	return get_be32(subdir_entry(lc, subdir_nr) + 12);
+}
+
+static uint32_t subdir_start(const struct loose_cache *lc, unsigned int subdir_nr)
+{
+	return subdir_nr ? subdir_end(lc, subdir_nr - 1) : 0;
+}
+
+/*
+ * Returns true if the entry for "subdir_nr" still describes the contents
+ * of that directory, i.e., if the directory has not been modified since.
+ */
+static int subdir_is_fresh(const struct loose_cache *lc, unsigned int subdir_nr)
+{
+	const unsigned char *entry = subdir_entry(lc, subdir_nr);
+	struct loose_cache_stamp stamp;
+
+	if (stat_subdir(lc->objdir, subdir_nr, &stamp) < 0)
+		return 0;
+	if (stamp.sec != get_be64(entry) || stamp.nsec != get_be32(entry + 8))
+		return 0;
+
+	/*
+	 * Like racily clean index entries, a directory that was modified
+	 * in the same second as the cache was written may have been
+	 * modified again after we have read it without its mtime changing.
+	 */
+	if (stamp.sec && (time_t)stamp.sec >= lc->mtime)
+		return 0;
+
+	return 1;
+}
+
+static struct loose_cache *loose_cache_load_file(struct odb_source *source,
+						 const char *path)
+{
+	const struct git_hash_algo *algop = source->odb->repo->hash_algo;
+	struct loose_cache *lc = NULL;
+	unsigned char *data = NULL;
+	size_t data_len = 0;
+	struct stat st;
+	uint32_t nr = 0;
+	int fd, i;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		error_errno(_("failed to read %s"), path);
+		goto cleanup;
+	}
+
+	data_len = xsize_t(st.st_size);
+	if (data_len < LOOSE_CACHE_HEADER_SIZE + LOOSE_CACHE_TABLE_SIZE) {
+		error(_("loose object cache %s is too small"), path);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (get_be32(data) != LOOSE_CACHE_SIGNATURE) {
+		error(_("loose object cache %s has unknown signature"), path);
+		goto cleanup;
+	}
+	if (get_be32(data + 4) != LOOSE_CACHE_VERSION) {
+		error(_("loose object cache %s has unsupported version %"PRIu32),
+		      path, get_be32(data + 4));
+		goto cleanup;
+	}
+	if (get_be32(data + 8) != hash_algo_by_ptr(algop)) {
+		error(_("loose object cache %s has unsupported hash id %"PRIu32),
+		      path, get_be32(data + 8));
+		goto cleanup;
+	}
+
+	for (i = 0; i < 256; i++) {
+		const unsigned char *entry = data + LOOSE_CACHE_HEADER_SIZE +
+			i * LOOSE_CACHE_SUBDIR_ENTRY_SIZE;
+		uint32_t end = get_be32(entry + 12);
+		if (end < nr) {
+			error(_("loose object cache %s is corrupt"), path);
+			goto cleanup;
+		}
+		nr = end;
+	}
+
+	if (data_len != st_add3(LOOSE_CACHE_HEADER_SIZE + LOOSE_CACHE_TABLE_SIZE,
+				st_mult(nr, algop->rawsz), algop->rawsz)) {
+		error(_("loose object cache %s is corrupt"), path);
+		goto cleanup;
+	}
+
+	CALLOC_ARRAY(lc, 1);
+	lc->algop = algop;
+	lc->objdir = xstrdup(source->path);
+	lc->data = data;
+	lc->data_len = data_len;
+	lc->table = data + LOOSE_CACHE_HEADER_SIZE;
+	lc->oids = lc->table + LOOSE_CACHE_TABLE_SIZE;
+	lc->nr = nr;
+	lc->mtime = st.st_mtime;
+
+cleanup:
+	if (!lc && data)
+		munmap(data, data_len);
+	close(fd);
+	return lc;
+}
+
+struct loose_cache *loose_cache_load(struct odb_source *source)
+{
+	char *path = loose_cache_filename(source);
+	struct loose_cache *lc = loose_cache_load_file(source, path);
+	free(path);
+	return lc;
+}
+
+void loose_cache_free(struct loose_cache *lc)
+{
+	if (!lc)
+		return;
+	munmap((void *)lc->data, lc->data_len);
+	free(lc->objdir);
+	free(lc);
+}
+
+int loose_cache_for_each_in_subdir(struct loose_cache *lc,
+				   unsigned int subdir_nr,
+				   each_loose_object_fn cb, void *data)
+{
+	uint32_t i;
+
+	if (subdir_nr > 0xff)
+		BUG("invalid loose object subdirectory: %x", subdir_nr);
+	if (!subdir_is_fresh(lc, subdir_nr))
+		return -1;
+
+	for (i = subdir_start(lc, subdir_nr); i < subdir_end(lc, subdir_nr); i++) {
+		struct object_id oid;
+		int r;
+
+		oidread(&oid, lc->oids + st_mult(i, lc->algop->rawsz), lc->algop);
+		r = cb(&oid, NULL, data);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+static int collect_loose_object(const struct object_id *oid,
+				const char *path UNUSED,
+				void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
+int write_loose_cache(struct odb_source *source)
+{
+	struct repository *r = source->odb->repo;
+	struct lock_file lk = LOCK_INIT;
+	struct loose_cache *old = NULL;
+	struct loose_cache_stamp stamps[256];
+	uint32_t ends[256];
+	struct oid_array oids = OID_ARRAY_INIT;
+	struct hashfile *f;
+	char *path;
+	size_t i;
+	int changed = 0, ret = 0;
+
+	path = loose_cache_filename(source);
+	if (safe_create_leading_directories_const(r, path) ||
+	    hold_lock_file_for_update_mode(&lk, path, 0, 0444) < 0) {
+		/* somebody else is already updating the cache */
+		ret = -1;
+		goto cleanup;
+	}
+
+	old = loose_cache_load_file(source, path);
+
+	for (i = 0; i < 256; i++) {
+		/*
+		 * Take the stamp before reading the directory; if it is
+		 * modified while we read it, the entry will be stale.
+		 */
+		if (stat_subdir(source->path, i, &stamps[i]) < 0) {
+			ret = error_errno(_("unable to stat %s/%02x"),
+					  source->path, (unsigned)i);
+			goto cleanup;
+		}
+
+		if (!old ||
+		    loose_cache_for_each_in_subdir(old, i, collect_loose_object,
+						   &oids) < 0) {
+			if (for_each_loose_file_in_subdir(source, i,
+							  collect_loose_object,
+							  &oids)) {
+				ret = -1;
+				goto cleanup;
+			}
+			changed = 1;
+		}
+
+		if (oids.nr > UINT32_MAX) {
+			ret = error(_("too many loose objects"));
+			goto cleanup;
+		}
+		ends[i] = oids.nr;
+	}
+
+	/* there is no need to rewrite a cache that is still up-to-date */
+	if (!changed)
+		goto cleanup;
+
+	/* release the old cache before we replace it */
+	loose_cache_free(old);
+	old = NULL;
+
+	/*
+	 * Subdirectories are read in order, so sorting the whole array
+	 * orders each of them without mixing their objects.
+	 */
+	oid_array_sort(&oids);
+
+	f = hashfd(r->hash_algo, get_lock_file_fd(&lk), get_lock_file_path(&lk));
+
+	hashwrite_be32(f, LOOSE_CACHE_SIGNATURE);
+	hashwrite_be32(f, LOOSE_CACHE_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(r->hash_algo));
+	for (i = 0; i < 256; i++) {
+		hashwrite_be64(f, stamps[i].sec);
+		hashwrite_be32(f, stamps[i].nsec);
+		hashwrite_be32(f, ends[i]);
+	}
+	for (i = 0; i < oids.nr; i++)
+		hashwrite(f, oids.oid[i].hash, r->hash_algo->rawsz);
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE, CSUM_HASH_IN_STREAM);
+
+	if (adjust_shared_perm(r, get_lock_file_path(&lk)) < 0 ||
+	    commit_lock_file(&lk) < 0)
+		ret = error_errno(_("unable to write loose object cache %s"),
+				  path);
+
+cleanup:
+	rollback_lock_file(&lk);
+	loose_cache_free(old);
+	oid_array_clear(&oids);
+	free(path);
+	return ret;
+}
+
+void update_loose_cache(struct odb_source *source)
+{
+	struct repository *r = source->odb->repo;
+	const char *quarantine = getenv(GIT_QUARANTINE_ENVIRONMENT);
+
+	prepare_repo_settings(r);
+	if (!r->settings.core_loose_object_cache || source->will_destroy)
+		return;
+
+	/*
+	 * The quarantine directory of "receive-pack" is going to be
+	 * migrated into the main object directory, and we do not want
+	 * our cache to end up there. "receive-pack" updates the cache of
+	 * the main object directory after the migration instead.
+	 */
+	if (quarantine && fspatheq(absolute_path(source->path), quarantine))
+		return;
+
+	write_loose_cache(source);
+}
@@ -0,0 +1,51 @@
+#ifndef LOOSE_CACHE_H
+#define LOOSE_CACHE_H
+
+#include "object-file.h"
+
+#define LOOSE_CACHE_SIGNATURE 0x4c4f4348 /* "LOCH" */
+#define LOOSE_CACHE_VERSION 1
+
+struct odb_source;
+struct loose_cache;
+
+/*
+ * Loads the persistent loose object cache ("$OBJDIR/info/loose-cache")
+ * of the given source. Returns NULL if there is no such file or if it
+ * cannot be used.
+ */
+struct loose_cache *loose_cache_load(struct odb_source *source);
+
+void loose_cache_free(struct loose_cache *lc);
+
+/*
+ * Invokes "cb" for every object recorded in the loose object
+ * subdirectory "subdir_nr" (e.g., "$OBJDIR/f0"), in lexicographic
+ * order. The "path" argument given to "cb" is always NULL.
+ *
+ * Returns -1 without invoking "cb" if the subdirectory has been
+ * modified since the cache was written, in which case the caller has to
+ * fall back to reading the directory itself. Otherwise, returns any
+ * non-zero value returned by "cb", or zero.
+ */
+int loose_cache_for_each_in_subdir(struct loose_cache *lc,
+				   unsigned int subdir_nr,
+				   each_loose_object_fn cb, void *data);
+
+/*
+ * Writes the loose object cache for the given source. Only those
+ * subdirectories that have changed since the existing cache (if any) was
+ * written are read again, and the cache is left alone if there are none.
+ * Returns zero on success.
+ */
+int write_loose_cache(struct odb_source *source);
+
+/*
+ * Like write_loose_cache(), but only if "core.looseObjectCache" is
+ * enabled. Temporary object directories (like the quarantine of
+ * "receive-pack") are left alone, as their contents are going to be
+ * migrated into a source whose cache is updated after the migration.
+ */
+void update_loose_cache(struct odb_source *source);
+
+#endif
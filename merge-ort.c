@@ -5400,7 +5400,10 @@ void merge_incore_nonrecursive(struct merge_options *opt,
 			       struct tree *side2,
 			       struct merge_result *result)
 {
+	struct odb_transaction *transaction;
+
 	trace2_region_enter("merge", "incore_nonrecursive", opt->repo);
+	transaction = odb_transaction_begin_pack(opt->repo->objects);
 
 	trace2_region_enter("merge", "merge_start", opt->repo);
 	assert(opt->ancestor != NULL);
@@ -5417,6 +5420,7 @@ void merge_incore_nonrecursive(struct merge_options *opt,
 	trace2_region_leave("merge", "merge_start", opt->repo);
 
 	merge_ort_nonrecursive_internal(opt, merge_base, side1, side2, result);
+	odb_transaction_commit(transaction);
 	trace2_region_leave("merge", "incore_nonrecursive", opt->repo);
 }
 
@@ -5426,6 +5430,8 @@ void merge_incore_recursive(struct merge_options *opt,
 			    struct commit *side2,
 			    struct merge_result *result)
 {
+	struct odb_transaction *transaction;
+
 	trace2_region_enter("merge", "incore_recursive", opt->repo);
 
 	/*
@@ -5440,7 +5446,9 @@ void merge_incore_recursive(struct merge_options *opt,
 	merge_start(opt, result);
 	trace2_region_leave("merge", "merge_start", opt->repo);
 
+	transaction = odb_transaction_begin_pack(opt->repo->objects);
 	merge_ort_internal(opt, merge_bases, side1, side2, result);
+	odb_transaction_commit(transaction);
 	trace2_region_leave("merge", "incore_recursive", opt->repo);
 }
 
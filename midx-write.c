@@ -907,6 +907,9 @@ static int write_midx_bitmap(struct write_midx_context *ctx,
 	if (flags & MIDX_WRITE_BITMAP_LOOKUP_TABLE)
 		options |= BITMAP_OPT_LOOKUP_TABLE;
 
+	if (flags & MIDX_WRITE_BITMAP_ROARING)
+		options |= BITMAP_OPT_ROARING;
+
 	/*
 	 * Build the MIDX-order index based on pdata.objects (which is already
 	 * in MIDX order; c.f., 'midx_pack_order_cmp()' for the definition of
@@ -5,6 +5,7 @@
 #include "commit.h"
 #include "environment.h"
 #include "gettext.h"
+#include "odb.h"
 #include "refs.h"
 #include "notes-utils.h"
 #include "strbuf.h"
@@ -16,10 +17,14 @@ void create_notes_commit(struct repository *r,
 			 struct object_id *result_oid)
 {
 	struct commit_list *parents_to_free = NULL;
+	struct odb_transaction *transaction;
 	struct object_id tree_oid;
 
 	assert(t->initialized);
 
+	/* Write the notes trees and the commit on top of them in one go. */
+	transaction = odb_transaction_begin_pack(r->objects);
+
 	if (write_notes_tree(t, &tree_oid))
 		die("Failed to write notes tree to database");
 
@@ -40,6 +45,7 @@ void create_notes_commit(struct repository *r,
 			NULL))
 		die("Failed to commit notes tree to database");
 
+	odb_transaction_commit(transaction);
 	commit_list_free(parents_to_free);
 }
 
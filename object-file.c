@@ -10,6 +10,7 @@
 #define USE_THE_REPOSITORY_VARIABLE
 
 #include "git-compat-util.h"
+#include "config.h"
 #include "convert.h"
 #include "dir.h"
 #include "environment.h"
@@ -17,6 +18,7 @@
 #include "gettext.h"
 #include "hex.h"
 #include "loose.h"
+#include "loose-cache.h"
 #include "object-file-convert.h"
 #include "object-file.h"
 #include "odb.h"
@@ -395,6 +397,44 @@ static int parse_loose_header(const char *hdr, struct object_info *oi)
 	return 0;
 }
 
+/*
+ * Loose objects up to this size are inflated in one go, using a buffer that
+ * is large enough to hold them unless they compress better than the given
+ * ratio. Objects that do not fit are read via the regular streaming path.
+ */
+#define LOOSE_ONESHOT_MAX (16 * 1024)
+#define LOOSE_ONESHOT_RATIO 4
+
+static void *unpack_loose_oneshot(unsigned char *map, unsigned long mapsize,
+				  struct object_info *oi)
+{
+	unsigned long in_len = mapsize;
+	unsigned long out_len = MAX_HEADER_LEN + mapsize * LOOSE_ONESHOT_RATIO;
+	char *buf = xmalloc(out_len + 1);
+	char *nul;
+	int status;
+
+	obj_read_unlock();
+	status = git_inflate_oneshot(buf, &out_len, map, &in_len);
+	obj_read_lock();
+	if (status != Z_STREAM_END || in_len != mapsize)
+		goto fail;
+
+	nul = memchr(buf, '\0', out_len < MAX_HEADER_LEN ? out_len : MAX_HEADER_LEN);
+	if (!nul || parse_loose_header(buf, oi) < 0 || *oi->typep < 0 ||
+	    *oi->sizep != out_len - (nul + 1 - buf))
+		goto fail;
+
+	memmove(buf, nul + 1, *oi->sizep);
+	buf[*oi->sizep] = '\0';
+	return buf;
+
+fail:
+	/* Let the streaming path sort out and report any errors. */
+	free(buf);
+	return NULL;
+}
+
 static int read_object_info_from_path(struct odb_source *source,
 				      const char *path,
 				      const struct object_id *oid,
@@ -477,6 +517,19 @@ static int read_object_info_from_path(struct odb_source *source,
 	if (oi->mtimep)
 		*oi->mtimep = st.st_mtime;
 
+	if (oi->contentp && mapsize <= LOOSE_ONESHOT_MAX) {
+		if (!oi->sizep)
+			oi->sizep = &size_scratch;
+		if (!oi->typep)
+			oi->typep = &type_scratch;
+
+		*oi->contentp = unpack_loose_oneshot(map, mapsize, oi);
+		if (*oi->contentp) {
+			ret = 0;
+			goto out;
+		}
+	}
+
 	stream_to_end = &stream;
 
 	switch (unpack_loose_header(&stream, map, mapsize, hdr, sizeof(hdr))) {
@@ -725,6 +778,14 @@ void hash_object_file(const struct git_hash_algo *algo, const void *buf,
 	write_object_file_prepare(algo, buf, len, type, oid, hdr, &hdrlen);
 }
 
+/* An object that has been written to the packfile of a transaction. */
+struct transaction_object {
+	struct pack_idx_entry idx; /* must be first */
+	enum object_type type;
+	size_t size;
+	off_t disk_size;
+};
+
 struct transaction_packfile {
 	char *pack_tmp_name;
 	struct hashfile *f;
@@ -734,6 +795,13 @@ struct transaction_packfile {
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
+
+	/*
+	 * Maps the IDs of all objects in "written" to their
+	 * "struct transaction_object", so that they can be read before
+	 * the packfile has been flushed.
+	 */
+	kh_oid_map_t *objects;
 };
 
 struct odb_transaction_files {
@@ -741,8 +809,30 @@ struct odb_transaction_files {
 
 	struct tmp_objdir *objdir;
 	struct transaction_packfile packfile;
+
+	/* Whether any loose objects were written during the transaction. */
+	unsigned loose_written : 1;
+
+	/*
+	 * Whether to write all objects into the transaction's packfile
+	 * instead of writing them as loose objects ("core.packTransactions").
+	 */
+	unsigned write_pack : 1;
 };
 
+static int transaction_has_object(struct odb_transaction_files *transaction,
+				  const struct object_id *oid)
+{
+	return transaction->packfile.objects &&
+	       kh_get_oid_map(transaction->packfile.objects, *oid) !=
+	       kh_end(transaction->packfile.objects);
+}
+
+static int write_transaction_object(struct odb_transaction_files *transaction,
+				    const struct object_id *oid,
+				    enum object_type type,
+				    const void *buf, unsigned long len);
+
 static void prepare_loose_object_transaction(struct odb_transaction *base)
 {
 	struct odb_transaction_files *transaction =
@@ -818,6 +908,29 @@ static void flush_loose_object_transaction(struct odb_transaction_files *transac
 	transaction->objdir = NULL;
 }
 
+/*
+ * Record that "oid" has just been written as a loose object into "source".
+ */
+static void loose_object_written(struct odb_source *source,
+				 const struct object_id *oid)
+{
+	struct odb_source_files *files = odb_source_files_downcast(source);
+	struct odb_transaction_files *transaction =
+		container_of_or_null(source->odb->transaction,
+				     struct odb_transaction_files, base);
+	size_t word_bits = bitsizeof(files->loose->subdir_seen[0]);
+	int subdir_nr = oid->hash[0];
+
+	/* Keep the loose object cache of this process up-to-date... */
+	if (files->loose->subdir_seen[subdir_nr / word_bits] &
+	    ((size_t)1u << (subdir_nr % word_bits)))
+		oidtree_insert(files->loose->cache, oid);
+
+	/* ...and let the transaction update the persistent one. */
+	if (transaction)
+		transaction->loose_written = 1;
+}
+
 /* Finalize a file on disk, and close it. */
 static void close_loose_object(struct odb_source *source,
 			       int fd, const char *filename)
@@ -1046,8 +1159,11 @@ static int write_loose_object(struct odb_source *source,
 			warning_errno(_("failed utime() on %s"), tmp_file.buf);
 	}
 
-	return finalize_object_file_flags(source->odb->repo, tmp_file.buf, filename.buf,
-					  FOF_SKIP_COLLISION_CHECK);
+	ret = finalize_object_file_flags(source->odb->repo, tmp_file.buf, filename.buf,
+					 FOF_SKIP_COLLISION_CHECK);
+	if (!ret)
+		loose_object_written(source, oid);
+	return ret;
 }
 
 int odb_source_loose_freshen_object(struct odb_source *source,
@@ -1158,6 +1274,8 @@ int odb_source_loose_write_stream(struct odb_source *source,
 
 	err = finalize_object_file_flags(source->odb->repo, tmp_file.buf, filename.buf,
 					 FOF_SKIP_COLLISION_CHECK);
+	if (!err)
+		loose_object_written(source, oid);
 	if (!err && compat)
 		err = repo_add_loose_object_map(source, oid, &compat_oid);
 cleanup:
@@ -1174,6 +1292,7 @@ int odb_source_loose_write_object(struct odb_source *source,
 {
 	const struct git_hash_algo *algo = source->odb->repo->hash_algo;
 	const struct git_hash_algo *compat = source->odb->repo->compat_hash_algo;
+	struct odb_transaction_files *transaction;
 	struct object_id compat_oid;
 	char hdr[MAX_HEADER_LEN];
 	int hdrlen = sizeof(hdr);
@@ -1200,6 +1319,21 @@ int odb_source_loose_write_object(struct odb_source *source,
 	write_object_file_prepare(algo, buf, len, type, oid, hdr, &hdrlen);
 	if (odb_freshen_object(source->odb, oid))
 		return 0;
+
+	/*
+	 * Transactions may append objects to a packfile instead. The map of
+	 * loose objects needed for the compatibility hash does not cover
+	 * packfiles, so we only do that when there is none.
+	 */
+	transaction = container_of_or_null(source->odb->transaction,
+					   struct odb_transaction_files, base);
+	if (transaction && transaction->write_pack &&
+	    transaction->base.source == source && !compat) {
+		if (transaction_has_object(transaction, oid))
+			return 0;
+		return write_transaction_object(transaction, oid, type, buf, len);
+	}
+
 	if (write_loose_object(source, oid, hdr, hdrlen, buf, len, 0, flags))
 		return -1;
 	if (compat)
@@ -1382,15 +1516,28 @@ static int already_written(struct odb_transaction_files *transaction,
 			   ODB_HAS_OBJECT_RECHECK_PACKED | ODB_HAS_OBJECT_FETCH_PROMISOR))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (uint32_t i = 0; i < transaction->packfile.nr_written; i++)
-		if (oideq(&transaction->packfile.written[i]->oid, oid))
-			return 1;
+	if (transaction_has_object(transaction, oid))
+		return 1;
 
 	/* This is a new object we need to keep */
 	return 0;
 }
 
+static void add_transaction_object(struct transaction_packfile *state,
+				   struct transaction_object *obj)
+{
+	khiter_t pos;
+	int hashret;
+
+	ALLOC_GROW(state->written, state->nr_written + 1, state->alloc_written);
+	state->written[state->nr_written++] = &obj->idx;
+
+	if (!state->objects)
+		state->objects = kh_init_oid_map();
+	pos = kh_put_oid_map(state->objects, obj->idx.oid, &hashret);
+	kh_value(state->objects, pos) = obj;
+}
+
 /* Lazily create backing packfile for the state */
 static void prepare_packfile_transaction(struct odb_transaction_files *transaction,
 					 unsigned flags)
@@ -1543,6 +1690,7 @@ static void flush_packfile_transaction(struct odb_transaction_files *transaction
 	free(idx_tmp_name);
 	free(state->pack_tmp_name);
 	free(state->written);
+	kh_destroy_oid_map(state->objects);
 	memset(state, 0, sizeof(*state));
 
 	strbuf_release(&packname);
@@ -1579,6 +1727,7 @@ static int index_blob_packfile_transaction(struct odb_transaction_files *transac
 	unsigned char obuf[16384];
 	unsigned header_len;
 	struct hashfile_checkpoint checkpoint;
+	struct transaction_object *obj = NULL;
 	struct pack_idx_entry *idx = NULL;
 
 	seekback = lseek(fd, 0, SEEK_CUR);
@@ -1592,7 +1741,10 @@ static int index_blob_packfile_transaction(struct odb_transaction_files *transac
 
 	/* Note: idx is non-NULL when we are writing */
 	if ((flags & INDEX_WRITE_OBJECT) != 0) {
-		CALLOC_ARRAY(idx, 1);
+		CALLOC_ARRAY(obj, 1);
+		obj->type = OBJ_BLOB;
+		obj->size = size;
+		idx = &obj->idx;
 
 		prepare_packfile_transaction(transaction, flags);
 		hashfile_checkpoint_init(state->f, &checkpoint);
@@ -1631,17 +1783,159 @@ static int index_blob_packfile_transaction(struct odb_transaction_files *transac
 	if (already_written(transaction, result_oid)) {
 		hashfile_truncate(state->f, &checkpoint);
 		state->offset = checkpoint.offset;
-		free(idx);
+		free(obj);
 	} else {
 		oidcpy(&idx->oid, result_oid);
-		ALLOC_GROW(state->written,
-			   state->nr_written + 1,
-			   state->alloc_written);
-		state->written[state->nr_written++] = idx;
+		obj->disk_size = state->offset - idx->offset;
+		add_transaction_object(state, obj);
 	}
 	return 0;
 }
 
+/*
+ * Append the given object to the packfile of the transaction, which must
+ * not contain it yet.
+ */
+static int write_transaction_object(struct odb_transaction_files *transaction,
+				    const struct object_id *oid,
+				    enum object_type type,
+				    const void *buf, unsigned long len)
+{
+	struct transaction_packfile *state = &transaction->packfile;
+	struct transaction_object *obj;
+	unsigned char hdr[MAX_PACK_OBJECT_HEADER];
+	unsigned long maxsize;
+	unsigned char *out;
+	git_zstream stream;
+	int hdrlen, status;
+
+	git_deflate_init(&stream, pack_compression_level);
+	maxsize = git_deflate_bound(&stream, len);
+	out = xmalloc(maxsize);
+	stream.next_in = (void *)buf;
+	stream.avail_in = len;
+	stream.next_out = out;
+	stream.avail_out = maxsize;
+	while ((status = git_deflate(&stream, Z_FINISH)) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&stream);
+	if (status != Z_STREAM_END) {
+		free(out);
+		return error(_("unable to deflate new object %s (%d)"),
+			     oid_to_hex(oid), status);
+	}
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr), type, len);
+
+	/* would we bust the size limit? */
+	if (state->nr_written && pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + hdrlen + stream.total_out)
+		flush_packfile_transaction(transaction);
+	prepare_packfile_transaction(transaction, INDEX_WRITE_OBJECT);
+
+	CALLOC_ARRAY(obj, 1);
+	oidcpy(&obj->idx.oid, oid);
+	obj->idx.offset = state->offset;
+	obj->type = type;
+	obj->size = len;
+	obj->disk_size = hdrlen + stream.total_out;
+
+	crc32_begin(state->f);
+	hashwrite(state->f, hdr, hdrlen);
+	hashwrite(state->f, out, stream.total_out);
+	obj->idx.crc32 = crc32_end(state->f);
+	state->offset += obj->disk_size;
+
+	add_transaction_object(state, obj);
+	free(out);
+	return 0;
+}
+
+/*
+ * Read back the contents of an object from the packfile of a transaction
+ * that has not been flushed yet.
+ */
+static void *read_transaction_object(struct transaction_packfile *state,
+				     struct transaction_object *obj)
+{
+	unsigned char hdr[MAX_PACK_OBJECT_HEADER];
+	int hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
+						  obj->type, obj->size);
+	size_t insize = obj->disk_size - hdrlen;
+	unsigned char *in = xmalloc(insize);
+	void *out = xmallocz(obj->size);
+	git_zstream stream;
+	int status = Z_DATA_ERROR;
+
+	hashflush(state->f);
+	if (pread_in_full(state->f->fd, in, insize,
+			  obj->idx.offset + hdrlen) != (ssize_t)insize) {
+		error_errno(_("unable to read back object %s"),
+			    oid_to_hex(&obj->idx.oid));
+		goto out;
+	}
+
+	memset(&stream, 0, sizeof(stream));
+	git_inflate_init(&stream);
+	stream.next_in = in;
+	stream.avail_in = insize;
+	stream.next_out = out;
+	stream.avail_out = obj->size;
+	status = git_inflate(&stream, Z_FINISH);
+	git_inflate_end(&stream);
+	if (status != Z_STREAM_END || stream.total_out != obj->size)
+		error(_("corrupt object %s in transaction packfile"),
+		      oid_to_hex(&obj->idx.oid));
+
+out:
+	free(in);
+	if (status != Z_STREAM_END || stream.total_out != obj->size)
+		FREE_AND_NULL(out);
+	return out;
+}
+
+int odb_transaction_files_read_object_info(struct odb_source *source,
+					   const struct object_id *oid,
+					   struct object_info *oi)
+{
+	struct odb_transaction_files *transaction =
+		container_of_or_null(source->odb->transaction,
+				     struct odb_transaction_files, base);
+	struct transaction_object *obj;
+	khiter_t pos;
+
+	if (!transaction || transaction->base.source != source ||
+	    !transaction->packfile.objects)
+		return -1;
+
+	pos = kh_get_oid_map(transaction->packfile.objects, *oid);
+	if (pos == kh_end(transaction->packfile.objects))
+		return -1;
+	if (!oi)
+		return 0;
+	obj = kh_value(transaction->packfile.objects, pos);
+
+	if (oi->typep)
+		*oi->typep = obj->type;
+	if (oi->sizep)
+		*oi->sizep = obj->size;
+	if (oi->disk_sizep)
+		*oi->disk_sizep = obj->disk_size;
+	if (oi->delta_base_oid)
+		oidclr(oi->delta_base_oid, source->odb->repo->hash_algo);
+	if (oi->mtimep)
+		*oi->mtimep = time(NULL);
+	if (oi->contentp) {
+		*oi->contentp = read_transaction_object(&transaction->packfile, obj);
+		if (!*oi->contentp)
+			return -1;
+	}
+
+	/* There is no packfile we could point to yet. */
+	oi->whence = OI_LOOSE;
+	return 0;
+}
+
 static int hash_blob_stream(const struct git_hash_algo *hash_algo,
 			    struct object_id *result_oid, int fd, size_t size)
 {
@@ -1858,6 +2152,22 @@ int for_each_loose_file_in_source(struct odb_source *source,
 	return r;
 }
 
+int for_each_loose_file_in_subdir(struct odb_source *source,
+				  unsigned int subdir_nr,
+				  each_loose_object_fn obj_cb,
+				  void *data)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int r;
+
+	strbuf_addstr(&buf, source->path);
+	r = for_each_file_in_obj_subdir(subdir_nr, &buf,
+					source->odb->repo->hash_algo,
+					obj_cb, NULL, NULL, data);
+	strbuf_release(&buf);
+	return r;
+}
+
 struct for_each_object_wrapper_data {
 	struct odb_source *source;
 	const struct object_info *request;
@@ -2055,12 +2365,25 @@ static struct oidtree *odb_source_loose_cache(struct odb_source *source,
 		ALLOC_ARRAY(files->loose->cache, 1);
 		oidtree_init(files->loose->cache);
 	}
-	strbuf_addstr(&buf, source->path);
-	for_each_file_in_obj_subdir(subdir_nr, &buf,
-				    source->odb->repo->hash_algo,
-				    append_loose_object,
-				    NULL, NULL,
-				    files->loose->cache);
+	if (!files->loose->cache_file_tried) {
+		struct repository *r = source->odb->repo;
+
+		prepare_repo_settings(r);
+		if (r->settings.core_loose_object_cache)
+			files->loose->cache_file = loose_cache_load(source);
+		files->loose->cache_file_tried = 1;
+	}
+	if (!files->loose->cache_file ||
+	    loose_cache_for_each_in_subdir(files->loose->cache_file, subdir_nr,
+					   append_loose_object,
+					   files->loose->cache) < 0) {
+		strbuf_addstr(&buf, source->path);
+		for_each_file_in_obj_subdir(subdir_nr, &buf,
+					    source->odb->repo->hash_algo,
+					    append_loose_object,
+					    NULL, NULL,
+					    files->loose->cache);
+	}
 	*bitmap |= mask;
 	strbuf_release(&buf);
 	return files->loose->cache;
@@ -2072,6 +2395,9 @@ static void odb_source_loose_clear_cache(struct odb_source_loose *loose)
 	FREE_AND_NULL(loose->cache);
 	memset(&loose->subdir_seen, 0,
 	       sizeof(loose->subdir_seen));
+	loose_cache_free(loose->cache_file);
+	loose->cache_file = NULL;
+	loose->cache_file_tried = 0;
 }
 
 void odb_source_loose_reprepare(struct odb_source *source)
@@ -2212,12 +2538,16 @@ static void odb_transaction_files_commit(struct odb_transaction *base)
 
 	flush_loose_object_transaction(transaction);
 	flush_packfile_transaction(transaction);
+
+	if (transaction->loose_written)
+		update_loose_cache(base->source);
 }
 
 struct odb_transaction *odb_transaction_files_begin(struct odb_source *source)
 {
 	struct odb_transaction_files *transaction;
 	struct object_database *odb = source->odb;
+	int write_pack = 0;
 
 	if (odb->transaction)
 		return NULL;
@@ -2225,6 +2555,8 @@ struct odb_transaction *odb_transaction_files_begin(struct odb_source *source)
 	transaction = xcalloc(1, sizeof(*transaction));
 	transaction->base.source = source;
 	transaction->base.commit = odb_transaction_files_commit;
+	repo_config_get_bool(odb->repo, "core.packtransactions", &write_pack);
+	transaction->write_pack = write_pack;
 
 	return &transaction->base;
 }
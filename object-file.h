@@ -6,6 +6,7 @@
 #include "odb.h"
 
 struct index_state;
+struct loose_cache;
 
 enum {
 	INDEX_WRITE_OBJECT = (1 << 0),
@@ -35,6 +36,15 @@ struct odb_source_loose {
 	uint32_t subdir_seen[8]; /* 256 bits */
 	struct oidtree *cache;
 
+	/*
+	 * The persistent loose object cache ("info/loose-cache"), if
+	 * enabled via "core.looseObjectCache". It is used to fill the above
+	 * cache for those subdirectories that have not changed since it was
+	 * written without having to read them.
+	 */
+	struct loose_cache *cache_file;
+	unsigned cache_file_tried : 1;
+
 	/* Map between object IDs for loose objects. */
 	struct loose_object_map *map;
 };
@@ -120,6 +130,15 @@ int for_each_loose_file_in_source(struct odb_source *source,
 				  each_loose_subdir_fn subdir_cb,
 				  void *data);
 
+/*
+ * Like for_each_loose_file_in_source(), but only iterates over the objects
+ * in the loose object subdirectory "subdir_nr" (e.g., "$OBJDIR/f0").
+ */
+int for_each_loose_file_in_subdir(struct odb_source *source,
+				  unsigned int subdir_nr,
+				  each_loose_object_fn obj_cb,
+				  void *data);
+
 /*
  * Iterate through all loose objects in the given object database source and
  * invoke the callback function for each of them. If an object info request is
@@ -232,4 +251,14 @@ struct odb_transaction;
  */
 struct odb_transaction *odb_transaction_files_begin(struct odb_source *source);
 
+/*
+ * Look up an object that has been written to the packfile of the pending
+ * transaction of the given source, but which has not been flushed yet.
+ * Populates "oi" (which may be NULL) and returns 0 if the object has been
+ * found, a negative value otherwise.
+ */
+int odb_transaction_files_read_object_info(struct odb_source *source,
+					   const struct object_id *oid,
+					   struct object_info *oi);
+
 #endif /* OBJECT_FILE_H */
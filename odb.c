@@ -1165,6 +1165,17 @@ struct odb_transaction *odb_transaction_begin(struct object_database *odb)
 	return odb->transaction;
 }
 
+struct odb_transaction *odb_transaction_begin_pack(struct object_database *odb)
+{
+	int write_pack = 0;
+
+	repo_config_get_bool(odb->repo, "core.packtransactions", &write_pack);
+	if (!write_pack)
+		return NULL;
+
+	return odb_transaction_begin(odb);
+}
+
 void odb_transaction_commit(struct odb_transaction *transaction)
 {
 	if (!transaction)
@@ -155,6 +155,14 @@ void odb_reprepare(struct object_database *o);
  */
 struct odb_transaction *odb_transaction_begin(struct object_database *odb);
 
+/*
+ * Like odb_transaction_begin(), but only starts a transaction if
+ * "core.packTransactions" is enabled and returns NULL otherwise. This is
+ * meant for writers that do not batch up their objects unless they can be
+ * written into a single packfile.
+ */
+struct odb_transaction *odb_transaction_begin_pack(struct object_database *odb);
+
 /*
  * Commits an ODB transaction making the written objects visible. If the
  * specified transaction is NULL, the function is a no-op.
@@ -418,12 +426,12 @@ void odb_assert_oid_type(struct object_database *odb,
  * obj_read_lock() and obj_read_unlock() may also be used to protect other
  * section which cannot execute in parallel with object reading. Since the used
  * lock is a recursive mutex, these sections can even contain calls to object
- * reading functions. However, beware that in these cases zlib inflation won't
- * be performed in parallel, losing performance.
+ * reading functions. However, beware that in these cases zlib inflation and
+ * delta application won't be performed in parallel, losing performance.
  *
  * TODO: odb_read_object_info_extended()'s call stack has a recursive behavior. If
  * any of its callees end up calling it, this recursive call won't benefit from
- * parallel inflation.
+ * parallel inflation or delta application.
  */
 void enable_obj_read_lock(void);
 void disable_obj_read_lock(void);
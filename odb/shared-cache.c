@@ -0,0 +1,300 @@
+#include "git-compat-util.h"
+#include "config.h"
+#include "gettext.h"
+#include "hex.h"
+#include "object-file.h"
+#include "odb.h"
+#include "odb/shared-cache.h"
+#include "repository.h"
+#include "strbuf.h"
+#include "wrapper.h"
+
+/*
+ * Entries are spread across one fan-out directory per first byte of their
+ * object ID, just like loose objects.
+ */
+#define SHARED_CACHE_FANOUT 256
+
+/*
+ * Objects larger than this are never cached. Big objects tend to be read
+ * rarely, and would evict many small entries that are read all the time.
+ */
+#define SHARED_CACHE_MAX_OBJECT_SIZE (1024 * 1024)
+
+/*
+ * Hits only refresh the mtime of entries that have not been refreshed for
+ * this many seconds. Eviction does not need a finer granularity, and this
+ * saves frequently read entries from a utime() call on every hit.
+ */
+#define SHARED_CACHE_TOUCH_INTERVAL 60
+
+struct shared_object_cache {
+	struct repository *repo;
+	char *path;
+
+	/*
+	 * The maximum total size of all entries, or 0 if unlimited. As
+	 * object IDs are uniformly distributed, each fan-out directory is
+	 * trimmed to its share of the limit on its own, so that eviction
+	 * never has to look at the whole cache.
+	 */
+	unsigned long limit;
+
+	/*
+	 * The number of bytes we have written to each fan-out directory
+	 * since we have last trimmed it, plus one. Zero means that we have
+	 * not trimmed the directory yet.
+	 */
+	size_t written[SHARED_CACHE_FANOUT];
+};
+
+struct shared_object_cache *shared_object_cache_new(struct repository *r)
+{
+	struct shared_object_cache *cache;
+	char *path = NULL;
+	struct stat st;
+
+	if (repo_config_get_pathname(r, "core.sharedobjectcache", &path) ||
+	    !path || !*path) {
+		free(path);
+		return NULL;
+	}
+
+	if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+		warning_errno(_("unable to create shared object cache '%s'"), path);
+		free(path);
+		return NULL;
+	}
+	if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		warning(_("shared object cache '%s' is not a directory"), path);
+		free(path);
+		return NULL;
+	}
+
+	CALLOC_ARRAY(cache, 1);
+	cache->repo = r;
+	cache->path = path;
+	cache->limit = 256 * 1024 * 1024;
+	repo_config_get_ulong(r, "core.sharedobjectcachelimit", &cache->limit);
+
+	return cache;
+}
+
+void shared_object_cache_free(struct shared_object_cache *cache)
+{
+	if (!cache)
+		return;
+	free(cache->path);
+	free(cache);
+}
+
+static void shared_object_cache_path(struct shared_object_cache *cache,
+				     struct strbuf *buf,
+				     const struct object_id *oid)
+{
+	const char *hex = oid_to_hex(oid);
+	strbuf_addf(buf, "%s/%.2s/%s", cache->path, hex, hex + 2);
+}
+
+int shared_object_cache_read(struct shared_object_cache *cache,
+			     const struct object_id *oid,
+			     struct object_info *oi)
+{
+	struct strbuf path = STRBUF_INIT;
+	enum object_type type;
+	uintmax_t size;
+	char *buf = NULL, *sp, *nul, *end;
+	size_t total, hdrlen;
+	struct stat st;
+	int fd = -1, ret = -1;
+
+	if (oi->disk_sizep || oi->delta_base_oid || oi->mtimep)
+		goto out;
+
+	shared_object_cache_path(cache, &path, oid);
+	fd = git_open(path.buf);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		goto out;
+
+	total = xsize_t(st.st_size);
+	buf = xmallocz(total);
+	if (read_in_full(fd, buf, total) != (ssize_t)total)
+		goto out;
+
+	/* The entry starts with a header just like loose objects do. */
+	nul = memchr(buf, '\0', total);
+	sp = nul ? memchr(buf, ' ', nul - buf) : NULL;
+	if (!sp)
+		goto out;
+	type = type_from_string_gently(buf, sp - buf, 1);
+	size = strtoumax(sp + 1, &end, 10);
+	hdrlen = nul - buf + 1;
+	if (type <= OBJ_NONE || end != nul || size != total - hdrlen)
+		goto out;
+
+	memmove(buf, buf + hdrlen, size);
+	buf[size] = '\0';
+
+	/*
+	 * Entries may have been corrupted, or written by somebody we do not
+	 * trust. Hashing is cheap compared to resolving deltas, so always
+	 * verify them, and drop those that do not match their object ID.
+	 */
+	if (check_object_signature(cache->repo, oid, buf, size, type) < 0) {
+		unlink(path.buf);
+		goto out;
+	}
+
+	if (oi->typep)
+		*oi->typep = type;
+	if (oi->sizep)
+		*oi->sizep = size;
+	if (oi->contentp) {
+		*oi->contentp = buf;
+		buf = NULL;
+	}
+	oi->whence = OI_CACHED;
+	ret = 0;
+
+	/* keep recently used entries from being evicted */
+	if (st.st_mtime + SHARED_CACHE_TOUCH_INTERVAL < time(NULL))
+		utime(path.buf, NULL);
+
+out:
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	strbuf_release(&path);
+	return ret;
+}
+
+struct shared_cache_entry {
+	char *path;
+	off_t size;
+	timestamp_t mtime;
+};
+
+static int shared_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct shared_cache_entry *a = va, *b = vb;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Remove the least recently used entries from the fan-out directory "dir",
+ * which ends in a slash, until it fits in its share of the size limit.
+ */
+static void shared_object_cache_trim(struct shared_object_cache *cache,
+				     struct strbuf *dir)
+{
+	struct shared_cache_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i;
+	uintmax_t total = 0;
+	struct dirent *de;
+	size_t dirlen;
+	DIR *d;
+
+	d = opendir(dir->buf);
+	if (!d)
+		return;
+	dirlen = dir->len;
+
+	while ((de = readdir(d))) {
+		struct stat st;
+
+		if (de->d_name[0] == '.' || starts_with(de->d_name, "tmp_"))
+			continue;
+		strbuf_setlen(dir, dirlen);
+		strbuf_addstr(dir, de->d_name);
+		if (lstat(dir->buf, &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = xstrdup(dir->buf);
+		entries[nr].size = st.st_size;
+		entries[nr].mtime = st.st_mtime;
+		nr++;
+		total += st.st_size;
+	}
+	closedir(d);
+
+	QSORT(entries, nr, shared_cache_entry_cmp);
+	for (i = 0; i < nr && total > cache->limit / SHARED_CACHE_FANOUT; i++) {
+		if (!unlink(entries[i].path))
+			total -= entries[i].size;
+	}
+
+	for (i = 0; i < nr; i++)
+		free(entries[i].path);
+	free(entries);
+}
+
+void shared_object_cache_write(struct shared_object_cache *cache,
+			       const struct object_id *oid,
+			       enum object_type type,
+			       const void *buf, unsigned long len)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf tmp = STRBUF_INIT;
+	unsigned long max_size = SHARED_CACHE_MAX_OBJECT_SIZE;
+	char hdr[32];
+	int hdrlen, fd;
+	size_t dirlen;
+	size_t *written = &cache->written[oid->hash[0]];
+
+	if (cache->limit && max_size > cache->limit / SHARED_CACHE_FANOUT)
+		max_size = cache->limit / SHARED_CACHE_FANOUT;
+	if (len > max_size)
+		return;
+
+	shared_object_cache_path(cache, &path, oid);
+
+	strbuf_add(&tmp, path.buf, path.len - (cache->repo->hash_algo->hexsz - 2));
+	if (mkdir(tmp.buf, 0755) < 0 && errno != EEXIST)
+		goto out;
+	dirlen = tmp.len;
+	strbuf_addstr(&tmp, "tmp_XXXXXX");
+
+	fd = git_mkstemp_mode(tmp.buf, 0444);
+	if (fd < 0)
+		goto out;
+
+	hdrlen = format_object_header(hdr, sizeof(hdr), type, len);
+	if (write_in_full(fd, hdr, hdrlen) < 0 ||
+	    write_in_full(fd, buf, len) < 0) {
+		close(fd);
+		unlink(tmp.buf);
+		goto out;
+	}
+	close(fd);
+
+	/* Concurrent writers may race, but they all write the same data. */
+	if (rename(tmp.buf, path.buf) < 0) {
+		unlink(tmp.buf);
+		goto out;
+	}
+
+	/*
+	 * Trim the directory when we first write to it, and then again
+	 * whenever we have added a quarter of its share of the limit. This
+	 * bounds how far the cache can grow beyond its limit while keeping
+	 * the cost of scanning directories low.
+	 */
+	if (cache->limit) {
+		int first = !*written;
+
+		*written += hdrlen + len;
+		if (first || *written > cache->limit / SHARED_CACHE_FANOUT / 4) {
+			strbuf_setlen(&tmp, dirlen);
+			shared_object_cache_trim(cache, &tmp);
+			*written = 1;
+		}
+	}
+
+out:
+	strbuf_release(&tmp);
+	strbuf_release(&path);
+}
@@ -0,0 +1,53 @@
+#ifndef ODB_SHARED_CACHE_H
+#define ODB_SHARED_CACHE_H
+
+#include "object.h"
+
+struct object_info;
+struct repository;
+
+/*
+ * The shared object cache is a directory, typically on a memory-backed file
+ * system like "/dev/shm", that stores the contents of objects that are
+ * expensive to reconstruct (i.e., deltified objects in packfiles) in their
+ * final, inflated form. As entries are content-addressed, the directory can
+ * be shared by any number of processes and repositories on the same host,
+ * which will then only need to resolve each such object once.
+ *
+ * The cache is configured via "core.sharedObjectCache", and its size is
+ * bounded by "core.sharedObjectCacheLimit", evicting the least recently used
+ * entries first. When it is not configured or the directory is unusable, all
+ * lookups miss and callers fall back to reading objects from the object
+ * database sources themselves.
+ */
+struct shared_object_cache;
+
+/*
+ * Set up the shared object cache configured for the given repository.
+ * Returns NULL if there is none.
+ */
+struct shared_object_cache *shared_object_cache_new(struct repository *r);
+
+void shared_object_cache_free(struct shared_object_cache *cache);
+
+/*
+ * Look up the given object in the cache and populate the type, size and
+ * contents requested in "oi". Returns 0 if the object has been found, a
+ * negative value otherwise. Requests for any other object information
+ * always miss.
+ */
+int shared_object_cache_read(struct shared_object_cache *cache,
+			     const struct object_id *oid,
+			     struct object_info *oi);
+
+/*
+ * Store the given object in the cache, unless it is too large, and evict old
+ * entries if the cache grows beyond its limit. Failures are silently ignored,
+ * the object will be reconstructed from the object database again next time.
+ */
+void shared_object_cache_write(struct shared_object_cache *cache,
+			       const struct object_id *oid,
+			       enum object_type type,
+			       const void *buf, unsigned long len);
+
+#endif
@@ -5,6 +5,7 @@
 #include "lockfile.h"
 #include "object-file.h"
 #include "odb.h"
+#include "odb/shared-cache.h"
 #include "odb/source.h"
 #include "odb/source-files.h"
 #include "packfile.h"
@@ -29,6 +30,7 @@ static void odb_source_files_free(struct odb_source *source)
 	chdir_notify_unregister(NULL, odb_source_files_reparent, files);
 	odb_source_loose_free(files->loose);
 	packfile_store_free(files->packed);
+	shared_object_cache_free(files->shared_cache);
 	odb_source_release(&files->base);
 	free(files);
 }
@@ -46,15 +48,56 @@ static void odb_source_files_reprepare(struct odb_source *source)
 	packfile_store_reprepare(files->packed);
 }
 
+static struct shared_object_cache *shared_cache(struct odb_source_files *files)
+{
+	if (!files->shared_cache_tried) {
+		files->shared_cache = shared_object_cache_new(files->base.odb->repo);
+		files->shared_cache_tried = 1;
+	}
+	return files->shared_cache;
+}
+
 static int odb_source_files_read_object_info(struct odb_source *source,
 					     const struct object_id *oid,
 					     struct object_info *oi,
 					     enum object_info_flags flags)
 {
 	struct odb_source_files *files = odb_source_files_downcast(source);
+	struct shared_object_cache *cache = NULL;
+
+	/* Objects written by a pending transaction are not in any pack yet. */
+	if (!odb_transaction_files_read_object_info(source, oid, oi))
+		return 0;
+
+	/*
+	 * Reading the contents of deltified objects is expensive, so we may
+	 * share them with other processes via the shared object cache. Only
+	 * look there once the pack header told us that we would otherwise
+	 * have to resolve a delta, and reuse the location we have found for
+	 * reading the object from its pack.
+	 */
+	if (oi && oi->contentp && !(flags & OBJECT_INFO_SECOND_READ) &&
+	    (cache = shared_cache(files))) {
+		struct pack_entry e;
+
+		if (packfile_store_find_entry(files->packed, oid, &e)) {
+			if (!pack_entry_is_delta(&e))
+				cache = NULL;
+			else if (!shared_object_cache_read(cache, oid, oi))
+				return 0;
+
+			if (!pack_entry_read_object_info(oid, &e, oi)) {
+				if (cache && oi->typep && oi->sizep)
+					shared_object_cache_write(cache, oid, *oi->typep,
+								  *oi->contentp, *oi->sizep);
+				return 0;
+			}
+		}
+	} else if (!packfile_store_read_object_info(files->packed, oid, oi, flags)) {
+		return 0;
+	}
 
-	if (!packfile_store_read_object_info(files->packed, oid, oi, flags) ||
-	    !odb_source_loose_read_object_info(source, oid, oi, flags))
+	if (!odb_source_loose_read_object_info(source, oid, oi, flags))
 		return 0;
 
 	return -1;
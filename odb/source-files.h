@@ -5,6 +5,7 @@
 
 struct odb_source_loose;
 struct packfile_store;
+struct shared_object_cache;
 
 /*
  * The files object database source uses a combination of loose objects and
@@ -14,6 +15,10 @@ struct odb_source_files {
 	struct odb_source base;
 	struct odb_source_loose *loose;
 	struct packfile_store *packed;
+
+	/* The host-wide cache of reconstructed objects, if configured. */
+	struct shared_object_cache *shared_cache;
+	unsigned shared_cache_tried : 1;
 };
 
 /* Allocate and initialize a new object source. */
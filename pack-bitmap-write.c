@@ -11,6 +11,7 @@
 #include "progress.h"
 #include "pack.h"
 #include "pack-bitmap.h"
+#include "ewah/roaring.h"
 #include "hash-lookup.h"
 #include "pack-objects.h"
 #include "path.h"
@@ -791,6 +792,19 @@ static inline void dump_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap)
 		die("Failed to write bitmap index");
 }
 
+/*
+ * Like dump_bitmap(), but for the type and commit bitmaps, which are
+ * written in the roaring format when "roaring" is set.
+ */
+static void dump_index_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap,
+			      int roaring)
+{
+	if (!roaring)
+		dump_bitmap(f, bitmap);
+	else if (roaring_serialize_ewah(bitmap, hashwrite_ewah_helper, f) < 0)
+		die("Failed to write bitmap index");
+}
+
 static const struct object_id *oid_access(size_t pos, const void *table)
 {
 	const struct pack_idx_entry * const *index = table;
@@ -798,7 +812,8 @@ static const struct object_id *oid_access(size_t pos, const void *table)
 }
 
 static void write_selected_commits_v1(struct bitmap_writer *writer,
-				      struct hashfile *f, off_t *offsets)
+				      struct hashfile *f, off_t *offsets,
+				      int roaring)
 {
 	int i;
 
@@ -815,7 +830,7 @@ static void write_selected_commits_v1(struct bitmap_writer *writer,
 		hashwrite_u8(f, stored->xor_offset);
 		hashwrite_u8(f, stored->flags);
 
-		dump_bitmap(f, stored->write_as);
+		dump_index_bitmap(f, stored->write_as, roaring);
 	}
 }
 
@@ -1047,6 +1062,7 @@ void bitmap_writer_finish(struct bitmap_writer *writer,
 	uint32_t i, base_objects;
 
 	struct bitmap_disk_header header;
+	int roaring = !!(options & BITMAP_OPT_ROARING);
 
 	int fd = odb_mkstemp(writer->repo->objects, &tmp_file,
 			     "pack/tmp_bitmap_XXXXXX");
@@ -1054,19 +1070,35 @@ void bitmap_writer_finish(struct bitmap_writer *writer,
 	if (writer->pseudo_merges_nr)
 		options |= BITMAP_OPT_PSEUDO_MERGES;
 
+	if (roaring) {
+		/*
+		 * Roaring bitmaps are not XOR'd against each other, so
+		 * that each of them can be used without decoding any
+		 * other first.
+		 */
+		for (i = 0; i < writer->selected_nr; i++) {
+			struct bitmapped_commit *stored = &writer->selected[i];
+
+			if (stored->write_as != stored->bitmap)
+				ewah_pool_free(stored->write_as);
+			stored->write_as = stored->bitmap;
+			stored->xor_offset = 0;
+		}
+	}
+
 	f = hashfd(writer->repo->hash_algo, fd, tmp_file.buf);
 
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
-	header.version = htons(default_version);
+	header.version = htons(roaring ? 2 : default_version);
 	header.options = htons(flags | options);
 	header.entry_count = htonl(bitmap_writer_nr_selected_commits(writer));
 	hashcpy(header.checksum, writer->pack_checksum, writer->repo->hash_algo);
 
 	hashwrite(f, &header, sizeof(header) - GIT_MAX_RAWSZ + writer->repo->hash_algo->rawsz);
-	dump_bitmap(f, writer->commits);
-	dump_bitmap(f, writer->trees);
-	dump_bitmap(f, writer->blobs);
-	dump_bitmap(f, writer->tags);
+	dump_index_bitmap(f, writer->commits, roaring);
+	dump_index_bitmap(f, writer->trees, roaring);
+	dump_index_bitmap(f, writer->blobs, roaring);
+	dump_index_bitmap(f, writer->tags, roaring);
 
 	if (options & BITMAP_OPT_LOOKUP_TABLE)
 		CALLOC_ARRAY(offsets, writer->to_pack->nr_objects);
@@ -1088,7 +1120,7 @@ void bitmap_writer_finish(struct bitmap_writer *writer,
 		stored->commit_pos = commit_pos + base_objects;
 	}
 
-	write_selected_commits_v1(writer, f, offsets);
+	write_selected_commits_v1(writer, f, offsets, roaring);
 
 	if (options & BITMAP_OPT_PSEUDO_MERGES)
 		write_pseudo_merges(writer, f);
@@ -22,6 +22,10 @@
 #include "midx.h"
 #include "config.h"
 #include "pseudo-merge.h"
+#include "ewah/roaring.h"
+#include "commit-reach.h"
+#include "prio-queue.h"
+#include "shallow.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -30,6 +34,11 @@
 struct stored_bitmap {
 	struct object_id oid;
 	struct ewah_bitmap *root;
+	/*
+	 * The bitmap as read from a roaring bitmap index, or NULL. When
+	 * set, "root" is only filled in once an EWAH copy is needed.
+	 */
+	struct roaring_bitmap *roaring;
 	struct stored_bitmap *xor;
 	size_t map_pos;
 	int flags;
@@ -155,6 +164,8 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 	struct ewah_bitmap *parent;
 	struct ewah_bitmap *composed;
 
+	if (!st->root)
+		st->root = roaring_to_ewah(st->roaring);
 	if (!st->xor)
 		return st->root;
 
@@ -166,6 +177,10 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 	st->root = composed;
 	st->xor = NULL;
 
+	/* the roaring copy does not have the XOR applied */
+	roaring_release(st->roaring);
+	FREE_AND_NULL(st->roaring);
+
 	return composed;
 }
 
@@ -197,6 +212,50 @@ static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 	return read_bitmap(index->map, index->map_size, &index->map_pos);
 }
 
+static int bitmap_is_roaring(struct bitmap_index *index)
+{
+	return index->version == 2;
+}
+
+static struct roaring_bitmap *read_roaring_bitmap_1(struct bitmap_index *index)
+{
+	struct roaring_bitmap *b = xcalloc(1, sizeof(*b));
+	ssize_t bitmap_size = roaring_read_mmap(b, index->map + index->map_pos,
+						index->map_size - index->map_pos);
+
+	if (bitmap_size < 0) {
+		error(_("failed to load bitmap index (corrupted?)"));
+		roaring_release(b);
+		free(b);
+		return NULL;
+	}
+
+	index->map_pos += bitmap_size;
+
+	return b;
+}
+
+/*
+ * Read one of the type bitmaps, which are always handed out as EWAH
+ * bitmaps, whatever their on-disk format.
+ */
+static struct ewah_bitmap *read_type_bitmap_1(struct bitmap_index *index)
+{
+	struct roaring_bitmap *roaring;
+	struct ewah_bitmap *ewah;
+
+	if (!bitmap_is_roaring(index))
+		return read_bitmap_1(index);
+
+	roaring = read_roaring_bitmap_1(index);
+	if (!roaring)
+		return NULL;
+	ewah = roaring_to_ewah(roaring);
+	roaring_release(roaring);
+	free(roaring);
+	return ewah;
+}
+
 static uint32_t bitmap_num_objects_total(struct bitmap_index *index)
 {
 	if (index->midx) {
@@ -256,7 +315,7 @@ static int load_bitmap_header(struct bitmap_index *index)
 		return error(_("corrupted bitmap index file (wrong header)"));
 
 	index->version = ntohs(header->version);
-	if (index->version != 1)
+	if (index->version != 1 && index->version != 2)
 		return error(_("unsupported version '%d' for bitmap index file"), index->version);
 
 	/* Parse known bitmap format options */
@@ -269,6 +328,10 @@ static int load_bitmap_header(struct bitmap_index *index)
 			BUG("unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
+		if (!(flags & BITMAP_OPT_ROARING) != (index->version == 1))
+			return error(_("corrupted bitmap index file (roaring option does not match version %d)"),
+				     index->version);
+
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			if (cache_size > index_end - index->map - header_size)
 				return error(_("corrupted bitmap index file (too short to fit hash cache)"));
@@ -335,6 +398,7 @@ static int load_bitmap_header(struct bitmap_index *index)
 
 static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 					  struct ewah_bitmap *root,
+					  struct roaring_bitmap *roaring,
 					  const struct object_id *oid,
 					  struct stored_bitmap *xor_with,
 					  int flags, size_t map_pos)
@@ -346,6 +410,7 @@ static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 	stored = xmalloc(sizeof(struct stored_bitmap));
 	stored->map_pos = map_pos;
 	stored->root = root;
+	stored->roaring = roaring;
 	stored->xor = xor_with;
 	stored->flags = flags;
 	oidcpy(&stored->oid, oid);
@@ -397,6 +462,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	for (i = 0; i < index->entry_count; ++i) {
 		int xor_offset, flags;
 		struct ewah_bitmap *bitmap = NULL;
+		struct roaring_bitmap *roaring = NULL;
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
 		struct object_id oid;
@@ -424,13 +490,16 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 				return error(_("invalid XOR offset in bitmap pack index"));
 		}
 
-		bitmap = read_bitmap_1(index);
-		if (!bitmap)
+		if (bitmap_is_roaring(index))
+			roaring = read_roaring_bitmap_1(index);
+		else
+			bitmap = read_bitmap_1(index);
+		if (!bitmap && !roaring)
 			return -1;
 
 		recent_bitmaps[i % MAX_XOR_OFFSET] =
-			store_bitmap(index, bitmap, &oid, xor_bitmap, flags,
-				     entry_map_pos);
+			store_bitmap(index, bitmap, roaring, &oid, xor_bitmap,
+				     flags, entry_map_pos);
 	}
 
 	return 0;
@@ -658,10 +727,10 @@ static int load_bitmap(struct repository *r, struct bitmap_index *bitmap_git,
 	if (load_reverse_index(r, bitmap_git))
 		return -1;
 
-	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
-		!(bitmap_git->trees = read_bitmap_1(bitmap_git)) ||
-		!(bitmap_git->blobs = read_bitmap_1(bitmap_git)) ||
-		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
+	if (!(bitmap_git->commits = read_type_bitmap_1(bitmap_git)) ||
+		!(bitmap_git->trees = read_type_bitmap_1(bitmap_git)) ||
+		!(bitmap_git->blobs = read_type_bitmap_1(bitmap_git)) ||
+		!(bitmap_git->tags = read_type_bitmap_1(bitmap_git)))
 		return -1;
 
 	if (!bitmap_git->table_lookup && load_bitmap_entries_v1(bitmap_git) < 0)
@@ -888,7 +957,8 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	int flags;
 	struct bitmap_lookup_table_triplet triplet;
 	struct object_id *oid = &commit->object.oid;
-	struct ewah_bitmap *bitmap;
+	struct ewah_bitmap *bitmap = NULL;
+	struct roaring_bitmap *roaring = NULL;
 	struct stored_bitmap *xor_bitmap = NULL;
 	const int bitmap_header_size = 6;
 	static struct bitmap_lookup_table_xor_item *xor_items = NULL;
@@ -960,13 +1030,19 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 		entry_map_pos = bitmap_git->map_pos;
 		bitmap_git->map_pos += sizeof(uint32_t) + sizeof(uint8_t);
 		xor_flags = read_u8(bitmap_git->map, &bitmap_git->map_pos);
-		bitmap = read_bitmap_1(bitmap_git);
+		if (bitmap_is_roaring(bitmap_git))
+			roaring = read_roaring_bitmap_1(bitmap_git);
+		else
+			bitmap = read_bitmap_1(bitmap_git);
 
-		if (!bitmap)
+		if (!bitmap && !roaring)
 			goto corrupt;
 
-		xor_bitmap = store_bitmap(bitmap_git, bitmap, &xor_item->oid,
-					  xor_bitmap, xor_flags, entry_map_pos);
+		xor_bitmap = store_bitmap(bitmap_git, bitmap, roaring,
+					  &xor_item->oid, xor_bitmap, xor_flags,
+					  entry_map_pos);
+		bitmap = NULL;
+		roaring = NULL;
 		xor_items_nr--;
 	}
 
@@ -1003,13 +1079,16 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	entry_map_pos = bitmap_git->map_pos;
 	bitmap_git->map_pos += sizeof(uint32_t) + sizeof(uint8_t);
 	flags = read_u8(bitmap_git->map, &bitmap_git->map_pos);
-	bitmap = read_bitmap_1(bitmap_git);
+	if (bitmap_is_roaring(bitmap_git))
+		roaring = read_roaring_bitmap_1(bitmap_git);
+	else
+		bitmap = read_bitmap_1(bitmap_git);
 
-	if (!bitmap)
+	if (!bitmap && !roaring)
 		goto corrupt;
 
-	return store_bitmap(bitmap_git, bitmap, oid, xor_bitmap, flags,
-			    entry_map_pos);
+	return store_bitmap(bitmap_git, bitmap, roaring, oid, xor_bitmap,
+			    flags, entry_map_pos);
 
 corrupt:
 	free(xor_items);
@@ -1017,9 +1096,9 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	return NULL;
 }
 
-static struct ewah_bitmap *find_bitmap_for_commit(struct bitmap_index *bitmap_git,
-						  struct commit *commit,
-						  struct bitmap_index **found)
+static struct stored_bitmap *find_stored_bitmap(struct bitmap_index *bitmap_git,
+						struct commit *commit,
+						struct bitmap_index **found)
 {
 	khiter_t hash_pos;
 	if (!bitmap_git)
@@ -1029,22 +1108,59 @@ static struct ewah_bitmap *find_bitmap_for_commit(struct bitmap_index *bitmap_gi
 	if (hash_pos >= kh_end(bitmap_git->bitmaps)) {
 		struct stored_bitmap *bitmap = NULL;
 		if (!bitmap_git->table_lookup)
-			return find_bitmap_for_commit(bitmap_git->base, commit,
-						      found);
+			return find_stored_bitmap(bitmap_git->base, commit,
+						  found);
 
 		/* this is a fairly hot codepath - no trace2_region please */
 		/* NEEDSWORK: cache misses aren't recorded */
 		bitmap = lazy_bitmap_for_commit(bitmap_git, commit);
 		if (!bitmap)
-			return find_bitmap_for_commit(bitmap_git->base, commit,
-						      found);
+			return find_stored_bitmap(bitmap_git->base, commit,
+						  found);
 		if (found)
 			*found = bitmap_git;
-		return lookup_stored_bitmap(bitmap);
+		return bitmap;
 	}
 	if (found)
 		*found = bitmap_git;
-	return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+	return kh_value(bitmap_git->bitmaps, hash_pos);
+}
+
+static struct ewah_bitmap *find_bitmap_for_commit(struct bitmap_index *bitmap_git,
+						  struct commit *commit,
+						  struct bitmap_index **found)
+{
+	struct stored_bitmap *st = find_stored_bitmap(bitmap_git, commit, found);
+	if (!st)
+		return NULL;
+	return lookup_stored_bitmap(st);
+}
+
+/*
+ * OR the stored bitmap "st" into "*base", allocating "*base" if it is
+ * NULL.
+ */
+static void bitmap_or_stored(struct bitmap **base, struct stored_bitmap *st)
+{
+	struct ewah_bitmap *or_with;
+
+	/*
+	 * Roaring bitmaps can be OR'd in directly, without going through
+	 * an EWAH copy.
+	 */
+	if (st->roaring && !st->xor) {
+		if (!*base)
+			*base = roaring_to_bitmap(st->roaring);
+		else
+			bitmap_or_roaring(*base, st->roaring);
+		return;
+	}
+
+	or_with = lookup_stored_bitmap(st);
+	if (!*base)
+		*base = ewah_to_bitmap(or_with);
+	else
+		bitmap_or_ewah(*base, or_with);
 }
 
 struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
@@ -1182,7 +1298,7 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 			      struct commit *commit,
 			      int bitmap_pos)
 {
-	struct ewah_bitmap *partial;
+	struct stored_bitmap *partial;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -1190,11 +1306,11 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	partial = bitmap_for_commit(bitmap_git, commit);
+	partial = find_stored_bitmap(bitmap_git, commit, NULL);
 	if (partial) {
 		existing_bitmaps_hits_nr++;
 
-		bitmap_or_ewah(data->base, partial);
+		bitmap_or_stored(&data->base, partial);
 		return 0;
 	}
 
@@ -1253,19 +1369,16 @@ static int add_commit_to_bitmap(struct bitmap_index *bitmap_git,
 				struct bitmap **base,
 				struct commit *commit)
 {
-	struct ewah_bitmap *or_with = bitmap_for_commit(bitmap_git, commit);
+	struct stored_bitmap *st = find_stored_bitmap(bitmap_git, commit, NULL);
 
-	if (!or_with) {
+	if (!st) {
 		existing_bitmaps_misses_nr++;
 		return 0;
 	}
 
 	existing_bitmaps_hits_nr++;
 
-	if (!*base)
-		*base = ewah_to_bitmap(or_with);
-	else
-		bitmap_or_ewah(*base, or_with);
+	bitmap_or_stored(base, st);
 
 	return 1;
 }
@@ -2256,6 +2369,29 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	return NULL;
 }
 
+/*
+ * A delta whose base the MIDX selected from a different pack can be
+ * reused verbatim as long as that copy of the base is sent before it,
+ * in which case pack-objects rewrites the delta as a REF_DELTA (see
+ * write_reused_pack_one()). Reuse is decided in pseudo-pack order, so
+ * the base has already been looked at if it is to be sent earlier.
+ */
+static int try_cross_pack_reuse(struct bitmap_index *bitmap_git,
+				const struct object_id *base_oid,
+				size_t bitmap_pos,
+				struct bitmap *reuse)
+{
+	int base_bitmap_pos = bitmap_position_midx(bitmap_git, base_oid);
+
+	if (base_bitmap_pos < 0 || (size_t)base_bitmap_pos >= bitmap_pos)
+		return 0;
+	if (!bitmap_get(reuse, base_bitmap_pos))
+		return 0;
+
+	bitmap_set(reuse, bitmap_pos);
+	return 0;
+}
+
 /*
  * -1 means "stop trying further objects"; 0 means we may or may not have
  * reused, but you can keep feeding bits.
@@ -2293,29 +2429,43 @@ static int try_partial_reuse(struct bitmap_index *bitmap_git,
 		 * and the normal slow path will complain about it in
 		 * more detail.
 		 */
-		base_offset = get_delta_base(pack->p, w_curs, &offset, type,
-					     delta_obj_offset);
+		if (type == OBJ_REF_DELTA && bitmap_is_midx(bitmap_git)) {
+			struct object_id base_oid;
+
+			oidread(&base_oid, use_pack(pack->p, w_curs, offset, NULL),
+				bitmap_repo(bitmap_git)->hash_algo);
+			base_offset = find_pack_entry_one(&base_oid, pack->p);
+			if (!base_offset)
+				return try_cross_pack_reuse(bitmap_git, &base_oid,
+							    bitmap_pos, reuse);
+		} else {
+			base_offset = get_delta_base(pack->p, w_curs, &offset,
+						     type, delta_obj_offset);
+		}
 		if (!base_offset)
 			return 0;
 
-		offset_to_pack_pos(pack->p, base_offset, &base_pos);
+		if (offset_to_pack_pos(pack->p, base_offset, &base_pos) < 0)
+			return 0;
 
 		if (bitmap_is_midx(bitmap_git)) {
 			/*
-			 * Cross-pack deltas are rejected for now, but could
-			 * theoretically be supported in the future.
-			 *
-			 * We would need to ensure that we're sending both
-			 * halves of the delta/base pair, regardless of whether
-			 * or not the two cross a pack boundary. If they do,
-			 * then we must convert the delta to an REF_DELTA to
-			 * refer back to the base in the other pack.
-			 * */
+			 * If the MIDX picked the base from a different pack,
+			 * we can still send this delta as long as we send
+			 * that copy of the base ahead of it, see
+			 * try_cross_pack_reuse().
+			 */
 			if (midx_pair_to_pack_pos(bitmap_git->midx,
 						  pack->pack_int_id,
 						  base_offset,
 						  &base_bitmap_pos) < 0) {
-				return 0;
+				struct object_id base_oid;
+
+				if (nth_packed_object_id(&base_oid, pack->p,
+							 pack_pos_to_index(pack->p, base_pos)) < 0)
+					return 0;
+				return try_cross_pack_reuse(bitmap_git, &base_oid,
+							    bitmap_pos, reuse);
 			}
 		} else {
 			if (offset_to_pack_pos(pack->p, base_offset,
@@ -2657,6 +2807,159 @@ void count_bitmap_commit_list(struct bitmap_index *bitmap_git,
 		*tags = count_object_type(bitmap_git, OBJ_TAG);
 }
 
+/*
+ * Return a bitmap of the commits reachable from "tip" (along with
+ * other objects, when stored bitmaps are used). Walk the commit graph
+ * from "tip" down to the commits that have a stored bitmap, and OR in
+ * those bitmaps. Commits that are not in the bitmapped pack are added
+ * to the extended index, and marked in "commits" along with the
+ * commits of the pack. Returns NULL if a commit cannot be parsed.
+ */
+static struct bitmap *find_commit_reach(struct bitmap_index *bitmap_git,
+					struct commit *tip,
+					struct bitmap *commits)
+{
+	struct repository *repo = bitmap_repo(bitmap_git);
+	struct prio_queue queue = { .compare = compare_commits_by_gen_then_commit_date };
+	struct bitmap *result = bitmap_new();
+
+	if (repo_parse_commit(repo, tip))
+		goto fail;
+	prio_queue_put(&queue, tip);
+
+	while (queue.nr) {
+		struct commit *c = prio_queue_get(&queue);
+		struct stored_bitmap *st;
+		struct commit_list *p;
+		int pos = bitmap_position(bitmap_git, &c->object.oid);
+
+		if (pos >= 0 && bitmap_get(result, pos))
+			continue;
+
+		st = find_stored_bitmap(bitmap_git, c, NULL);
+		if (st) {
+			bitmap_or_stored(&result, st);
+			continue;
+		}
+
+		if (pos < 0) {
+			pos = ext_index_add_object(bitmap_git, &c->object, NULL);
+			bitmap_set(commits, pos);
+		}
+		bitmap_set(result, pos);
+
+		for (p = c->parents; p; p = p->next) {
+			if (repo_parse_commit(repo, p->item))
+				goto fail;
+			prio_queue_put(&queue, p->item);
+		}
+	}
+
+	clear_prio_queue(&queue);
+	return result;
+
+fail:
+	clear_prio_queue(&queue);
+	bitmap_free(result);
+	return NULL;
+}
+
+static void count_ahead_behind(struct bitmap *tip, struct bitmap *base,
+			       struct bitmap *commits,
+			       struct ahead_behind_count *count)
+{
+	count->ahead = 0;
+	count->behind = 0;
+
+	for (size_t i = 0; i < commits->word_alloc; i++) {
+		eword_t t = i < tip->word_alloc ? tip->words[i] : 0;
+		eword_t b = i < base->word_alloc ? base->words[i] : 0;
+
+		count->ahead += ewah_bit_popcount64(t & ~b & commits->words[i]);
+		count->behind += ewah_bit_popcount64(b & ~t & commits->words[i]);
+	}
+}
+
+int bitmap_ahead_behind(struct repository *r,
+			struct commit **commits, size_t commits_nr,
+			struct ahead_behind_count *counts, size_t counts_nr)
+{
+	struct bitmap_index *bitmap_git;
+	struct bitmap *commit_type = bitmap_new();
+	struct bitmap **reach;
+	size_t *last_use;
+	struct ewah_or_iterator it;
+	eword_t word;
+	size_t i;
+	int ret = -1;
+
+	if (is_repository_shallow(r))
+		return -1;
+	bitmap_git = prepare_bitmap_git(r);
+	if (!bitmap_git)
+		return -1;
+
+	trace2_region_enter("pack-bitmap", "ahead-behind", r);
+
+	init_type_iterator(&it, bitmap_git, OBJ_COMMIT);
+	for (i = 0; ewah_or_iterator_next(&word, &it); i++) {
+		bitmap_grow(commit_type, i + 1);
+		commit_type->words[i] = word;
+	}
+	ewah_or_iterator_release(&it);
+
+	/*
+	 * Keep the bitmap of each commit around only until its last use,
+	 * so that only the bases (which are usually shared by all of the
+	 * comparisons) and a single tip are held in memory at a time.
+	 */
+	CALLOC_ARRAY(reach, commits_nr);
+	CALLOC_ARRAY(last_use, commits_nr);
+	for (i = 0; i < counts_nr; i++) {
+		last_use[counts[i].tip_index] = i;
+		last_use[counts[i].base_index] = i;
+	}
+
+	for (i = 0; i < counts_nr; i++) {
+		size_t tip = counts[i].tip_index;
+		size_t base = counts[i].base_index;
+
+		if (!reach[tip] &&
+		    !(reach[tip] = find_commit_reach(bitmap_git, commits[tip],
+						     commit_type)))
+			goto cleanup;
+		if (!reach[base] &&
+		    !(reach[base] = find_commit_reach(bitmap_git, commits[base],
+						      commit_type)))
+			goto cleanup;
+
+		count_ahead_behind(reach[tip], reach[base], commit_type,
+				   &counts[i]);
+
+		if (last_use[tip] == i) {
+			bitmap_free(reach[tip]);
+			reach[tip] = NULL;
+		}
+		if (last_use[base] == i) {
+			bitmap_free(reach[base]);
+			reach[base] = NULL;
+		}
+	}
+
+	ret = 0;
+
+cleanup:
+	trace2_region_leave("pack-bitmap", "ahead-behind", r);
+
+	for (i = 0; i < commits_nr; i++)
+		bitmap_free(reach[i]);
+	free(reach);
+	free(last_use);
+	bitmap_free(commit_type);
+	free_bitmap_index(bitmap_git);
+	return ret;
+}
+
 struct bitmap_test_data {
 	struct bitmap_index *bitmap_git;
 	struct bitmap *base;
@@ -3170,6 +3473,8 @@ void free_bitmap_index(struct bitmap_index *b)
 		struct stored_bitmap *sb;
 		kh_foreach_value(b->bitmaps, sb, {
 			ewah_pool_free(sb->root);
+			roaring_release(sb->roaring);
+			free(sb->roaring);
 			free(sb);
 		});
 	}
@@ -39,6 +39,7 @@ enum pack_bitmap_opts {
 	BITMAP_OPT_HASH_CACHE = 0x4,
 	BITMAP_OPT_LOOKUP_TABLE = 0x10,
 	BITMAP_OPT_PSEUDO_MERGES = 0x20,
+	BITMAP_OPT_ROARING = 0x40,
 };
 
 enum pack_bitmap_flags {
@@ -80,6 +81,20 @@ void count_bitmap_commit_list(struct bitmap_index *, uint32_t *commits,
 void traverse_bitmap_commit_list(struct bitmap_index *,
 				 struct rev_info *revs,
 				 show_reachable_fn show_reachable);
+
+struct ahead_behind_count;
+
+/*
+ * Compute the ahead/behind counts of ahead_behind() from the reachability
+ * bitmaps of "r", walking the commit graph only from commits that are
+ * not bitmapped themselves down to those that are. Returns 0 on success,
+ * or -1 if there is no bitmap to use, in which case "counts" should be
+ * computed by other means.
+ */
+int bitmap_ahead_behind(struct repository *r,
+			struct commit **commits, size_t commits_nr,
+			struct ahead_behind_count *counts, size_t counts_nr);
+
 void test_bitmap_walk(struct rev_info *revs);
 int test_bitmap_commits(struct repository *r);
 int test_bitmap_commits_with_offset(struct repository *r);
@@ -0,0 +1,257 @@
+#include "git-compat-util.h"
+#include "gettext.h"
+#include "pack-dhints.h"
+#include "csum-file.h"
+#include "hash.h"
+#include "hex.h"
+#include "odb.h"
+#include "packfile.h"
+#include "path.h"
+#include "repository.h"
+#include "strbuf.h"
+
+#define DHINTS_HEADER_SIZE (20)
+#define DHINTS_WINDOW_OFFSET (12)
+#define DHINTS_DEPTH_OFFSET (16)
+
+static char *pack_dhints_filename(struct packed_git *p)
+{
+	size_t len;
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.dhints", (int)len, p->pack_name);
+}
+
+/* The checksum of a pack is stored in the trailer of its index. */
+static const unsigned char *pack_checksum(struct packed_git *p)
+{
+	return (const unsigned char *)p->index_data + p->index_size -
+	       st_mult(2, p->repo->hash_algo->rawsz);
+}
+
+static size_t dhints_words(uint32_t num_objects)
+{
+	return DIV_ROUND_UP((size_t)num_objects, 32);
+}
+
+static int load_pack_dhints_file(char *dhints_file,
+				 const struct git_hash_algo *algop,
+				 uint32_t num_objects,
+				 const unsigned char *pack_hash,
+				 const unsigned char **data_p, size_t *len_p)
+{
+	int fd, ret = 0;
+	struct stat st;
+	unsigned char *data = NULL;
+	size_t dhints_size, expected_size;
+	uint32_t signature, version, hash_id;
+
+	fd = git_open(dhints_file);
+
+	if (fd < 0) {
+		ret = -1;
+		goto cleanup;
+	}
+	if (fstat(fd, &st)) {
+		ret = error_errno(_("failed to read %s"), dhints_file);
+		goto cleanup;
+	}
+
+	dhints_size = xsize_t(st.st_size);
+
+	if (dhints_size < DHINTS_HEADER_SIZE) {
+		ret = error(_("delta hints file %s is too small"), dhints_file);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, dhints_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	signature = get_be32(data);
+	version = get_be32(data + 4);
+	hash_id = get_be32(data + 8);
+
+	if (signature != DHINTS_SIGNATURE) {
+		ret = error(_("delta hints file %s has unknown signature"),
+			    dhints_file);
+		goto cleanup;
+	}
+
+	if (version != DHINTS_VERSION) {
+		ret = error(_("delta hints file %s has unsupported version %"PRIu32),
+			    dhints_file, version);
+		goto cleanup;
+	}
+
+	if (hash_id != hash_algo_by_ptr(algop)) {
+		ret = error(_("delta hints file %s has unsupported hash id %"PRIu32),
+			    dhints_file, hash_id);
+		goto cleanup;
+	}
+
+	expected_size = DHINTS_HEADER_SIZE;
+	expected_size = st_add(expected_size, st_mult(4, dhints_words(num_objects)));
+	expected_size = st_add(expected_size, st_mult(2, algop->rawsz));
+
+	if (dhints_size != expected_size) {
+		ret = error(_("delta hints file %s is corrupt"), dhints_file);
+		goto cleanup;
+	}
+
+	/*
+	 * Hints left behind by an older pack with the same name do not
+	 * describe this one. That is not an error, but we must ignore them.
+	 */
+	if (!hasheq(data + dhints_size - st_mult(2, algop->rawsz), pack_hash,
+		    algop)) {
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret) {
+		if (data)
+			munmap(data, dhints_size);
+	} else {
+		*len_p = dhints_size;
+		*data_p = data;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+int load_pack_dhints(struct packed_git *p)
+{
+	char *dhints_name = NULL;
+	int ret = 0;
+
+	if (p->dhints_map)
+		return ret; /* already loaded */
+	if (p->dhints_tried)
+		return -1; /* missing or unusable */
+	p->dhints_tried = 1;
+
+	ret = open_pack_index(p);
+	if (ret < 0)
+		goto cleanup;
+
+	dhints_name = pack_dhints_filename(p);
+	ret = load_pack_dhints_file(dhints_name, p->repo->hash_algo,
+				    p->num_objects, pack_checksum(p),
+				    &p->dhints_map,
+				    &p->dhints_size);
+cleanup:
+	free(dhints_name);
+	return ret;
+}
+
+int pack_dhints_usable(struct packed_git *p, unsigned window, unsigned depth)
+{
+	if (load_pack_dhints(p) < 0)
+		return 0;
+	return get_be32(p->dhints_map + DHINTS_WINDOW_OFFSET) >= window &&
+	       get_be32(p->dhints_map + DHINTS_DEPTH_OFFSET) >= depth;
+}
+
+int nth_packed_dhint(struct packed_git *p, uint32_t pos)
+{
+	uint32_t word;
+
+	if (!p->dhints_map)
+		BUG("pack .dhints file not loaded for %s", p->pack_name);
+	if (p->num_objects <= pos)
+		BUG("pack .dhints out-of-bounds (%"PRIu32" vs %"PRIu32")",
+		    pos, p->num_objects);
+
+	word = get_be32(p->dhints_map + DHINTS_HEADER_SIZE +
+			st_mult(4, pos / 32));
+	return !!(word & (1U << (pos % 32)));
+}
+
+int write_pack_dhints_file(struct packed_git *p,
+			   unsigned window, unsigned depth,
+			   pack_dhint_fn fn, void *data)
+{
+	struct repository *r = p->repo;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct pack_window *w_curs = NULL;
+	char *dhints_name = NULL;
+	const unsigned char *pack_hash;
+	struct hashfile *f;
+	uint32_t i, word = 0;
+	int fd, ret = 0;
+
+	if (open_pack_index(p)) {
+		ret = error(_("unable to load index for %s"), p->pack_name);
+		goto cleanup;
+	}
+
+	dhints_name = pack_dhints_filename(p);
+
+	pack_hash = pack_checksum(p);
+
+	fd = odb_mkstemp(r->objects, &tmp_file, "pack/tmp_dhints_XXXXXX");
+	f = hashfd(r->hash_algo, fd, tmp_file.buf);
+
+	hashwrite_be32(f, DHINTS_SIGNATURE);
+	hashwrite_be32(f, DHINTS_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(r->hash_algo));
+	hashwrite_be32(f, window);
+	hashwrite_be32(f, depth);
+	for (i = 0; i < p->num_objects; i++) {
+		struct object_id oid;
+		off_t offset = nth_packed_object_offset(p, i);
+		enum object_type type;
+		unsigned long size;
+
+		if (nth_packed_object_id(&oid, p, i) < 0) {
+			ret = error(_("unable to read object %"PRIu32" of %s"),
+				    i, p->pack_name);
+			break;
+		}
+		type = unpack_object_header(p, &w_curs, &offset, &size);
+		if (type <= OBJ_NONE) {
+			ret = error(_("unable to read object %s in %s"),
+				    oid_to_hex(&oid), p->pack_name);
+			break;
+		}
+
+		if (fn(&oid, type, data))
+			word |= 1U << (i % 32);
+		if (i % 32 == 31) {
+			hashwrite_be32(f, word);
+			word = 0;
+		}
+	}
+	if (ret < 0) {
+		discard_hashfile(f);
+		unlink(tmp_file.buf);
+		goto cleanup;
+	}
+	if (i % 32)
+		hashwrite_be32(f, word);
+	hashwrite(f, pack_hash, r->hash_algo->rawsz);
+
+	if (adjust_shared_perm(r, tmp_file.buf) < 0)
+		die(_("failed to make %s readable"), tmp_file.buf);
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_PACK_METADATA,
+			  CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+
+	/*
+	 * Unlike the pack itself, the hints of an existing pack may have
+	 * changed since they were written, so replace them.
+	 */
+	if (rename(tmp_file.buf, dhints_name)) {
+		ret = error_errno(_("unable to rename temporary file to '%s'"),
+				  dhints_name);
+		unlink_or_warn(tmp_file.buf);
+	}
+
+cleanup:
+	unuse_pack(&w_curs);
+	free(dhints_name);
+	strbuf_release(&tmp_file);
+	return ret;
+}
@@ -0,0 +1,56 @@
+#ifndef PACK_DHINTS_H
+#define PACK_DHINTS_H
+
+#include "object.h"
+
+#define DHINTS_SIGNATURE 0x44484e54 /* "DHNT" */
+#define DHINTS_VERSION 1
+
+struct packed_git;
+
+/*
+ * Loads the .dhints file corresponding to "p", if any, returning zero
+ * on success. A missing (or invalid) file is only looked for once per
+ * pack, subsequent calls return -1 cheaply.
+ */
+int load_pack_dhints(struct packed_git *p);
+
+/*
+ * Returns 1 if "p" has a .dhints file that was written by a delta
+ * search at least as thorough as one using the given "window" and
+ * "depth", and 0 otherwise. Loads the file if necessary.
+ */
+int pack_dhints_usable(struct packed_git *p, unsigned window, unsigned depth);
+
+/*
+ * Returns the delta hint of the object at position "pos" (in
+ * lexicographic/index order) in pack "p". For an object that is stored
+ * as a delta, a set hint means that the delta was chosen by a full
+ * search. For any other object, it means that a full search did not
+ * find a delta for it among the other objects in the pack.
+ *
+ * Note that it is a BUG() to call this function if the .dhints file of
+ * "p" has not been loaded successfully.
+ */
+int nth_packed_dhint(struct packed_git *p, uint32_t pos);
+
+/*
+ * Called by write_pack_dhints_file() for every object in the pack,
+ * with "in_pack_type" being the type it is stored as (which is either
+ * OBJ_OFS_DELTA, OBJ_REF_DELTA or a non-delta type). Returns the hint
+ * to record for the object.
+ */
+typedef int (*pack_dhint_fn)(const struct object_id *oid,
+			     enum object_type in_pack_type,
+			     void *data);
+
+/*
+ * Writes the .dhints file next to "p", recording the hints returned by
+ * "fn" for a search using "window" and "depth". Returns zero on
+ * success.
+ */
+int write_pack_dhints_file(struct packed_git *p,
+			   unsigned window, unsigned depth,
+			   pack_dhint_fn fn, void *data);
+
+#endif
@@ -74,8 +74,10 @@ enum dfs_state {
  * during delta searching phase when we find better deltas.
  *
  * delta_child and delta_sibling are last needed in
- * compute_write_order(). "delta" and "delta_size" must remain valid
- * at object writing phase in case the delta is not cached.
+ * compute_write_order(), so they live in packing_data instead of here
+ * and are freed before objects are written. "delta" and "delta_size"
+ * must remain valid at object writing phase in case the delta is not
+ * cached.
  *
  * If a delta is cached in memory and is compressed, delta_data points
  * to the data and z_delta_size contains the compressed size. If it's
@@ -85,6 +87,10 @@ enum dfs_state {
  *
  * [1] during try_delta phase we don't bother with compressing because
  * the delta could be quickly replaced with a better one.
+ *
+ * delta_good and delta_rejected carry the results of earlier delta
+ * searches, as read from the .dhints file of the source pack, and are
+ * updated by find_deltas() so they can be written out again.
  */
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -94,10 +100,6 @@ struct object_entry {
 	unsigned size_:OE_SIZE_BITS;
 	unsigned size_valid:1;
 	uint32_t delta_idx;	/* delta base object */
-	uint32_t delta_child_idx; /* deltified objects who bases me */
-	uint32_t delta_sibling_idx; /* other deltified objects who
-				     * uses the same base as me
-				     */
 	unsigned delta_size_:OE_DELTA_SIZE_BITS; /* delta data size (uncompressed) */
 	unsigned delta_size_valid:1;
 	unsigned char in_pack_header_size;
@@ -118,6 +120,11 @@ struct object_entry {
 	unsigned dfs_state:OE_DFS_STATE_BITS;
 	unsigned depth:OE_DEPTH_BITS;
 	unsigned ext_base:1; /* delta_idx points outside packlist */
+	unsigned delta_good:1; /* delta was chosen by a full search */
+	unsigned delta_rejected:1; /*
+				    * a full search found no delta against
+				    * the other objects of its pack
+				    */
 };
 
 /**
@@ -143,6 +150,15 @@ struct packing_data {
 	unsigned int *in_pack_pos;
 	unsigned long *delta_size;
 
+	/*
+	 * The delta tree, as 1-based indices into objects[]: the first
+	 * object that uses an object as its delta base, and the next
+	 * object that uses the same base. Allocated on first use, see
+	 * oe_set_delta_child() and oe_set_delta_sibling().
+	 */
+	uint32_t *delta_child;
+	uint32_t *delta_sibling;
+
 	/*
 	 * Only one of these can be non-NULL and they have different
 	 * sizes. if in_pack_by_idx is allocated, oe_in_pack() returns
@@ -0,0 +1,313 @@
+#include "git-compat-util.h"
+#include "gettext.h"
+#include "pack-objinfo.h"
+#include "csum-file.h"
+#include "hash.h"
+#include "object-file.h"
+#include "odb.h"
+#include "pack-revindex.h"
+#include "packfile.h"
+#include "path.h"
+#include "repository.h"
+#include "strbuf.h"
+
+/*
+ * Each entry stores the object type in its topmost bits and the size of
+ * the object in the remaining ones.
+ */
+#define OBJINFO_TYPE_SHIFT 60
+#define OBJINFO_SIZE_MASK ((UINT64_C(1) << OBJINFO_TYPE_SHIFT) - 1)
+
+#define OBJINFO_HEADER_SIZE (12)
+#define OBJINFO_ENTRY_SIZE (8)
+
+static char *pack_objinfo_filename(struct packed_git *p)
+{
+	size_t len;
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.objinfo", (int)len, p->pack_name);
+}
+
+/* The checksum of a pack is stored in the trailer of its index. */
+static const unsigned char *pack_checksum(struct packed_git *p)
+{
+	return (const unsigned char *)p->index_data + p->index_size -
+	       st_mult(2, p->repo->hash_algo->rawsz);
+}
+
+struct objinfo_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t hash_id;
+};
+
+static int load_pack_objinfo_file(char *objinfo_file,
+				  const struct git_hash_algo *algop,
+				  uint32_t num_objects,
+				  const unsigned char *pack_hash,
+				  const unsigned char **data_p, size_t *len_p)
+{
+	int fd, ret = 0;
+	struct stat st;
+	unsigned char *data = NULL;
+	size_t objinfo_size, expected_size;
+	struct objinfo_header header;
+
+	fd = git_open(objinfo_file);
+
+	if (fd < 0) {
+		ret = -1;
+		goto cleanup;
+	}
+	if (fstat(fd, &st)) {
+		ret = error_errno(_("failed to read %s"), objinfo_file);
+		goto cleanup;
+	}
+
+	objinfo_size = xsize_t(st.st_size);
+
+	if (objinfo_size < OBJINFO_HEADER_SIZE) {
+		ret = error(_("object info file %s is too small"), objinfo_file);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, objinfo_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	header.signature = get_be32(data);
+	header.version = get_be32(data + 4);
+	header.hash_id = get_be32(data + 8);
+
+	if (header.signature != OBJINFO_SIGNATURE) {
+		ret = error(_("object info file %s has unknown signature"),
+			    objinfo_file);
+		goto cleanup;
+	}
+
+	if (header.version != OBJINFO_VERSION) {
+		ret = error(_("object info file %s has unsupported version %"PRIu32),
+			    objinfo_file, header.version);
+		goto cleanup;
+	}
+
+	if (header.hash_id != hash_algo_by_ptr(algop)) {
+		ret = error(_("object info file %s has unsupported hash id %"PRIu32),
+			    objinfo_file, header.hash_id);
+		goto cleanup;
+	}
+
+	expected_size = OBJINFO_HEADER_SIZE;
+	expected_size = st_add(expected_size, st_mult(OBJINFO_ENTRY_SIZE, num_objects));
+	expected_size = st_add(expected_size, st_mult(2, algop->rawsz));
+
+	if (objinfo_size != expected_size) {
+		ret = error(_("object info file %s is corrupt"), objinfo_file);
+		goto cleanup;
+	}
+
+	/*
+	 * A pack may have been replaced by one with the same name but
+	 * different contents (older versions of Git named packs after the
+	 * objects they contain), leaving the info of the old one behind.
+	 * That is not an error, but we must not trust it either.
+	 */
+	if (!hasheq(data + objinfo_size - st_mult(2, algop->rawsz), pack_hash,
+		    algop)) {
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret) {
+		if (data)
+			munmap(data, objinfo_size);
+	} else {
+		*len_p = objinfo_size;
+		*data_p = data;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+int load_pack_objinfo(struct packed_git *p)
+{
+	char *objinfo_name = NULL;
+	int ret = 0;
+
+	if (p->objinfo_map)
+		return ret; /* already loaded */
+	if (p->objinfo_tried)
+		return -1; /* missing or unusable */
+	p->objinfo_tried = 1;
+
+	ret = open_pack_index(p);
+	if (ret < 0)
+		goto cleanup;
+
+	objinfo_name = pack_objinfo_filename(p);
+	ret = load_pack_objinfo_file(objinfo_name, p->repo->hash_algo,
+				     p->num_objects, pack_checksum(p),
+				     &p->objinfo_map,
+				     &p->objinfo_size);
+cleanup:
+	free(objinfo_name);
+	return ret;
+}
+
+enum object_type nth_packed_objinfo(struct packed_git *p, uint32_t pos,
+				    unsigned long *sizep)
+{
+	uint64_t entry;
+
+	if (!p->objinfo_map)
+		BUG("pack .objinfo file not loaded for %s", p->pack_name);
+	if (p->num_objects <= pos)
+		BUG("pack .objinfo out-of-bounds (%"PRIu32" vs %"PRIu32")",
+		    pos, p->num_objects);
+
+	entry = get_be64(p->objinfo_map + OBJINFO_HEADER_SIZE +
+			 st_mult(OBJINFO_ENTRY_SIZE, pos));
+	if (sizep)
+		*sizep = (unsigned long)(entry & OBJINFO_SIZE_MASK);
+	return entry >> OBJINFO_TYPE_SHIFT;
+}
+
+/*
+ * Fills "types" and "sizes" (both in index order) with the final type
+ * and size of every object in "p".
+ */
+static int compute_pack_objinfo(struct packed_git *p,
+				enum object_type *types,
+				unsigned long *sizes)
+{
+	struct pack_window *w_curs = NULL;
+	uint32_t i;
+	int ret = 0;
+
+	/*
+	 * Walk the pack in offset order, so that the base of an OFS_DELTA
+	 * has always been resolved by the time we get to the delta itself.
+	 * Only REF_DELTAs against later objects (as appended by "index-pack
+	 * --fix-thin") need to walk their delta chain.
+	 */
+	for (i = 0; i < p->num_objects; i++) {
+		off_t obj_offset = pack_pos_to_offset(p, i);
+		off_t curpos = obj_offset;
+		uint32_t index_pos = pack_pos_to_index(p, i);
+		enum object_type type;
+		unsigned long size;
+
+		type = unpack_object_header(p, &w_curs, &curpos, &size);
+		if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) {
+			off_t base_offset;
+			uint32_t base_pos;
+
+			base_offset = get_delta_base(p, &w_curs, &curpos, type,
+						     obj_offset);
+			if (!base_offset ||
+			    offset_to_pack_pos(p, base_offset, &base_pos) < 0) {
+				ret = error(_("bad delta base for object at offset %"PRIuMAX" in %s"),
+					    (uintmax_t)obj_offset, p->pack_name);
+				break;
+			}
+
+			size = get_size_from_delta(p, &w_curs, curpos);
+			if (!size) {
+				ret = error(_("unable to read delta size for object at offset %"PRIuMAX" in %s"),
+					    (uintmax_t)obj_offset, p->pack_name);
+				break;
+			}
+
+			type = types[pack_pos_to_index(p, base_pos)];
+			if (type == OBJ_NONE) {
+				struct object_info oi = OBJECT_INFO_INIT;
+
+				oi.typep = &type;
+				if (packed_object_info(p, base_offset, &oi) < 0)
+					type = OBJ_BAD;
+			}
+		}
+
+		if (type < OBJ_COMMIT || type > OBJ_TAG) {
+			ret = error(_("unable to determine type of object at offset %"PRIuMAX" in %s"),
+				    (uintmax_t)obj_offset, p->pack_name);
+			break;
+		}
+
+		types[index_pos] = type;
+		sizes[index_pos] = size;
+	}
+
+	unuse_pack(&w_curs);
+	return ret;
+}
+
+int write_pack_objinfo_file(struct packed_git *p)
+{
+	struct repository *r = p->repo;
+	struct strbuf tmp_file = STRBUF_INIT;
+	char *objinfo_name = NULL;
+	enum object_type *types = NULL;
+	unsigned long *sizes = NULL;
+	const unsigned char *pack_hash, *old_map;
+	size_t old_size;
+	struct hashfile *f;
+	uint32_t i;
+	int fd, ret = 0;
+
+	if (open_pack_index(p) || load_pack_revindex(r, p)) {
+		ret = error(_("unable to load index for %s"), p->pack_name);
+		goto cleanup;
+	}
+
+	pack_hash = pack_checksum(p);
+	objinfo_name = pack_objinfo_filename(p);
+	if (!access(objinfo_name, F_OK)) {
+		if (!load_pack_objinfo_file(objinfo_name, r->hash_algo,
+					    p->num_objects, pack_hash,
+					    &old_map, &old_size)) {
+			/* the pack has not changed, neither has its info */
+			munmap((void *)old_map, old_size);
+			goto cleanup;
+		}
+		/* replace the info of a pack that used to have our name */
+		unlink_or_warn(objinfo_name);
+	}
+
+	CALLOC_ARRAY(types, p->num_objects);
+	ALLOC_ARRAY(sizes, p->num_objects);
+
+	ret = compute_pack_objinfo(p, types, sizes);
+	if (ret < 0)
+		goto cleanup;
+
+	fd = odb_mkstemp(r->objects, &tmp_file, "pack/tmp_objinfo_XXXXXX");
+	f = hashfd(r->hash_algo, fd, tmp_file.buf);
+
+	hashwrite_be32(f, OBJINFO_SIGNATURE);
+	hashwrite_be32(f, OBJINFO_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(r->hash_algo));
+	for (i = 0; i < p->num_objects; i++)
+		hashwrite_be64(f, ((uint64_t)types[i] << OBJINFO_TYPE_SHIFT) |
+				  sizes[i]);
+	hashwrite(f, pack_hash, r->hash_algo->rawsz);
+
+	if (adjust_shared_perm(r, tmp_file.buf) < 0)
+		die(_("failed to make %s readable"), tmp_file.buf);
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_PACK_METADATA,
+			  CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+
+	if (finalize_object_file(r, tmp_file.buf, objinfo_name))
+		ret = error(_("unable to rename temporary file to '%s'"),
+			    objinfo_name);
+
+cleanup:
+	free(types);
+	free(sizes);
+	free(objinfo_name);
+	strbuf_release(&tmp_file);
+	return ret;
+}
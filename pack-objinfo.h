@@ -0,0 +1,35 @@
+#ifndef PACK_OBJINFO_H
+#define PACK_OBJINFO_H
+
+#include "object.h"
+
+#define OBJINFO_SIGNATURE 0x4f494e46 /* "OINF" */
+#define OBJINFO_VERSION 1
+
+struct packed_git;
+
+/*
+ * Loads the .objinfo file corresponding to "p", if any, returning zero
+ * on success. A missing (or invalid) file is only looked for once per
+ * pack, subsequent calls return -1 cheaply.
+ */
+int load_pack_objinfo(struct packed_git *p);
+
+/*
+ * Returns the final (i.e., non-delta) type of the object at position
+ * "pos" (in lexicographic/index order) in pack "p" and stores its
+ * inflated size in "sizep".
+ *
+ * Note that it is a BUG() to call this function if the .objinfo file
+ * of "p" has not been loaded successfully.
+ */
+enum object_type nth_packed_objinfo(struct packed_git *p, uint32_t pos,
+				    unsigned long *sizep);
+
+/*
+ * Computes the final type and size of every object in "p" and writes
+ * them to the .objinfo file next to it. Returns zero on success.
+ */
+int write_pack_objinfo_file(struct packed_git *p);
+
+#endif
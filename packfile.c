@@ -16,6 +16,7 @@
 #include "object.h"
 #include "tag.h"
 #include "trace.h"
+#include "trace2.h"
 #include "tree-walk.h"
 #include "tree.h"
 #include "object-file.h"
@@ -26,6 +27,7 @@
 #include "pack-revindex.h"
 #include "promisor-remote.h"
 #include "pack-mtimes.h"
+#include "pack-objinfo.h"
 
 char *odb_pack_name(struct repository *r, struct strbuf *buf,
 		    const unsigned char *hash, const char *ext)
@@ -437,6 +439,26 @@ static void close_pack_mtimes(struct packed_git *p)
 	p->mtimes_map = NULL;
 }
 
+static void close_pack_objinfo(struct packed_git *p)
+{
+	p->objinfo_tried = 0;
+	if (!p->objinfo_map)
+		return;
+
+	munmap((void *)p->objinfo_map, p->objinfo_size);
+	p->objinfo_map = NULL;
+}
+
+static void close_pack_dhints(struct packed_git *p)
+{
+	p->dhints_tried = 0;
+	if (!p->dhints_map)
+		return;
+
+	munmap((void *)p->dhints_map, p->dhints_size);
+	p->dhints_map = NULL;
+}
+
 void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
@@ -444,12 +466,15 @@ void close_pack(struct packed_git *p)
 	close_pack_index(p);
 	close_pack_revindex(p);
 	close_pack_mtimes(p);
+	close_pack_objinfo(p);
+	close_pack_dhints(p);
 	oidset_clear(&p->bad_objects);
 }
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".idx", ".pack", ".rev", ".keep", ".bitmap", ".promisor", ".mtimes"};
+	static const char *exts[] = {".idx", ".pack", ".rev", ".keep", ".bitmap", ".promisor", ".mtimes",
+				     ".objinfo", ".dhints"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -1017,7 +1042,9 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	    ends_with(file_name, ".bitmap") ||
 	    ends_with(file_name, ".keep") ||
 	    ends_with(file_name, ".promisor") ||
-	    ends_with(file_name, ".mtimes"))
+	    ends_with(file_name, ".mtimes") ||
+	    ends_with(file_name, ".objinfo") ||
+	    ends_with(file_name, ".dhints"))
 		string_list_append(data->garbage, full_name);
 	else
 		report_garbage(PACKDIR_FILE_GARBAGE, full_name);
@@ -1439,8 +1466,23 @@ struct delta_base_cache_entry {
 	void *data;
 	unsigned long size;
 	enum object_type type;
+
+	/* number of deltas that were applied to reconstruct "data" */
+	unsigned int depth;
+
+	/*
+	 * How many more times the entry may be skipped when it is the
+	 * least recently used one; see add_delta_base_cache().
+	 */
+	unsigned int credits;
 };
 
+/*
+ * Upper bound for the credits of an entry, so that a few very deep entries
+ * cannot pin the cache and make eviction expensive.
+ */
+#define DELTA_BASE_CACHE_MAX_CREDITS 16
+
 static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
 	unsigned int hash;
@@ -1517,6 +1559,8 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 	if (!ent)
 		return unpack_entry(r, p, base_offset, type, base_size);
 
+	trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HITS, 1);
+
 	if (type)
 		*type = ent->type;
 	if (base_size)
@@ -1540,13 +1584,27 @@ void clear_delta_base_cache(void)
 	}
 }
 
+/*
+ * Add "base", which took "depth" deltas to reconstruct, to the cache and
+ * evict other entries until the cache fits in its limit again.
+ *
+ * Rebuilding an entry means inflating its innermost base and applying one
+ * delta per level of its chain, each of which costs time proportional to
+ * the size of the entry. Relative to the space it takes up, an entry is
+ * thus worth more the deeper it is, and a plain LRU would too eagerly
+ * throw away the deep bases that long chains need most, only to keep
+ * full objects that are cheap to inflate again. Instead, every entry
+ * gets one credit per level of depth. When the least recently used entry
+ * still has credits, it spends one and is moved to the end of the queue
+ * instead of being evicted.
+ */
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 				 void *base, unsigned long base_size,
+				 unsigned int depth,
 				 unsigned long delta_base_cache_limit,
 				 enum object_type type)
 {
 	struct delta_base_cache_entry *ent;
-	struct list_head *lru, *tmp;
 
 	/*
 	 * Check required to avoid redundant entries when more than one thread
@@ -1558,13 +1616,31 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 		return;
 	}
 
+	/*
+	 * A base that is larger than the whole cache would evict every
+	 * other entry, only to be evicted itself by the next insertion.
+	 * Keep the existing (and cheaper to hold) entries instead.
+	 */
+	if (base_size > delta_base_cache_limit) {
+		free(base);
+		return;
+	}
+
 	delta_base_cached += base_size;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
+	while (delta_base_cached > delta_base_cache_limit &&
+	       !list_empty(&delta_base_cache_lru)) {
 		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
+			list_first_entry(&delta_base_cache_lru,
+					 struct delta_base_cache_entry, lru);
+		if (f->credits) {
+			f->credits--;
+			list_del(&f->lru);
+			list_add_tail(&f->lru, &delta_base_cache_lru);
+			continue;
+		}
+		trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_EVICTED_BYTES,
+				   f->size);
 		release_delta_base_cache(f);
 	}
 
@@ -1574,6 +1650,9 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
+	ent->depth = depth;
+	ent->credits = depth < DELTA_BASE_CACHE_MAX_CREDITS ?
+		depth : DELTA_BASE_CACHE_MAX_CREDITS;
 	list_add_tail(&ent->lru, &delta_base_cache_lru);
 
 	if (!delta_base_cache.cmpfn)
@@ -1586,9 +1665,9 @@ static int packed_object_info_with_index_pos(struct packed_git *p, off_t obj_off
 					     uint32_t *maybe_index_pos, struct object_info *oi)
 {
 	struct pack_window *w_curs = NULL;
-	unsigned long size;
+	unsigned long size, final_size = 0;
 	off_t curpos = obj_offset;
-	enum object_type type = OBJ_NONE;
+	enum object_type type = OBJ_NONE, final_type = OBJ_NONE;
 	uint32_t pack_pos;
 	int ret;
 
@@ -1605,8 +1684,33 @@ static int packed_object_info_with_index_pos(struct packed_git *p, off_t obj_off
 		type = unpack_object_header(p, &w_curs, &curpos, &size);
 	}
 
+	/*
+	 * Finding out the final size and type of a delta requires inflating
+	 * its header and walking down its delta chain. If the pack comes
+	 * with an .objinfo file, look both up there instead.
+	 */
+	if (!oi->contentp && (oi->sizep || oi->typep) &&
+	    (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) &&
+	    !load_pack_objinfo(p)) {
+		uint32_t index_pos;
+
+		if (maybe_index_pos)
+			index_pos = *maybe_index_pos;
+		else if (offset_to_pack_pos(p, obj_offset, &pack_pos) < 0)
+			index_pos = p->num_objects;
+		else
+			index_pos = pack_pos_to_index(p, pack_pos);
+
+		if (index_pos < p->num_objects)
+			final_type = nth_packed_objinfo(p, index_pos, &final_size);
+		if (final_type < OBJ_COMMIT || final_type > OBJ_TAG)
+			final_type = OBJ_NONE;
+	}
+
 	if (!oi->contentp && oi->sizep) {
-		if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) {
+		if (final_type > OBJ_NONE) {
+			*oi->sizep = final_size;
+		} else if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) {
 			off_t tmp_pos = curpos;
 			off_t base_offset = get_delta_base(p, &w_curs, &tmp_pos,
 							   type, obj_offset);
@@ -1657,8 +1761,11 @@ static int packed_object_info_with_index_pos(struct packed_git *p, off_t obj_off
 
 	if (oi->typep) {
 		enum object_type ptot;
-		ptot = packed_to_object_type(p->repo, p, obj_offset,
-					     type, &w_curs, curpos);
+		if (final_type > OBJ_NONE)
+			ptot = final_type;
+		else
+			ptot = packed_to_object_type(p->repo, p, obj_offset,
+						     type, &w_curs, curpos);
 		if (oi->typep)
 			*oi->typep = ptot;
 		if (ptot < 0) {
@@ -1711,6 +1818,12 @@ int packed_object_info(struct packed_git *p, off_t obj_offset,
 	return packed_object_info_with_index_pos(p, obj_offset, NULL, oi);
 }
 
+/*
+ * Objects up to this size are first attempted to be inflated in one go by
+ * unpack_compressed_entry().
+ */
+#define INFLATE_ONESHOT_MAX (64 * 1024)
+
 static void *unpack_compressed_entry(struct packed_git *p,
 				    struct pack_window **w_curs,
 				    off_t curpos,
@@ -1723,6 +1836,25 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+	/*
+	 * Small objects are usually found within a single window, in which
+	 * case we can inflate them in one go. Otherwise, or when the data is
+	 * corrupt, we fall back to streaming them below.
+	 */
+	if (size <= INFLATE_ONESHOT_MAX) {
+		unsigned long in_len, out_len = size + 1;
+
+		in = use_pack(p, w_curs, curpos, &in_len);
+		obj_read_unlock();
+		st = git_inflate_oneshot(buffer, &out_len, in, &in_len);
+		obj_read_lock();
+		if (st == Z_STREAM_END && out_len == size) {
+			buffer[size] = '\0';
+			return buffer;
+		}
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -1784,6 +1916,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	struct unpack_entry_stack_ent *delta_stack = small_delta_stack;
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
 	int base_from_cache = 0;
+	unsigned int depth = 0;
 
 	prepare_repo_settings(p->repo);
 
@@ -1797,13 +1930,17 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		ent = get_delta_base_cache_entry(p, curpos);
 		if (ent) {
+			trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HITS, 1);
 			type = ent->type;
 			data = ent->data;
 			size = ent->size;
+			depth = ent->depth;
 			detach_delta_base_cache_entry(ent);
 			base_from_cache = 1;
 			break;
 		}
+		if (delta_stack_nr)
+			trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISSES, 1);
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
 			uint32_t pack_pos, index_pos;
@@ -1943,8 +2080,18 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
 		} else {
+			/*
+			 * Both `base` and `delta_data` are private to us at
+			 * this point: the former was either detached from the
+			 * delta base cache or freshly inflated, and is only
+			 * added back to the cache below. Applying the delta
+			 * is pure CPU work, so let other threads use the
+			 * object store in the meantime.
+			 */
+			obj_read_unlock();
 			data = patch_delta(base, base_size, delta_data,
 					   delta_size, &size);
+			obj_read_lock();
 
 			/*
 			 * We could not apply the delta; warn the user, but
@@ -1969,8 +2116,10 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		 */
 		if (!external_base)
 			add_delta_base_cache(p, base_obj_offset, base, base_size,
+					     depth,
 					     p->repo->settings.delta_base_cache_limit,
 					     type);
+		depth++;
 
 		free(delta_data);
 		free(external_base);
@@ -2109,6 +2258,13 @@ int is_pack_valid(struct packed_git *p)
 	return !open_packed_git(p);
 }
 
+int packfile_fd(struct packed_git *p)
+{
+	if (p->pack_fd == -1 && open_packed_git(p))
+		return -1;
+	return p->pack_fd;
+}
+
 static int fill_pack_entry(const struct object_id *oid,
 			   struct pack_entry *e,
 			   struct packed_git *p)
@@ -2182,7 +2338,6 @@ int packfile_store_read_object_info(struct packfile_store *store,
 				    enum object_info_flags flags)
 {
 	struct pack_entry e;
-	int ret;
 
 	/*
 	 * In case the first read didn't surface the object, we have to reload
@@ -2195,6 +2350,13 @@ int packfile_store_read_object_info(struct packfile_store *store,
 	if (!find_pack_entry(store, oid, &e))
 		return 1;
 
+	return pack_entry_read_object_info(oid, &e, oi);
+}
+
+int pack_entry_read_object_info(const struct object_id *oid,
+				const struct pack_entry *e,
+				struct object_info *oi)
+{
 	/*
 	 * We know that the caller doesn't actually need the
 	 * information below, so return early.
@@ -2202,15 +2364,34 @@ int packfile_store_read_object_info(struct packfile_store *store,
 	if (!oi)
 		return 0;
 
-	ret = packed_object_info(e.p, e.offset, oi);
-	if (ret < 0) {
-		mark_bad_packed_object(e.p, oid);
+	if (packed_object_info(e->p, e->offset, oi) < 0) {
+		mark_bad_packed_object(e->p, oid);
 		return -1;
 	}
 
 	return 0;
 }
 
+int packfile_store_find_entry(struct packfile_store *store,
+			      const struct object_id *oid,
+			      struct pack_entry *e)
+{
+	return find_pack_entry(store, oid, e);
+}
+
+int pack_entry_is_delta(const struct pack_entry *e)
+{
+	struct pack_window *w_curs = NULL;
+	off_t offset = e->offset;
+	enum object_type type;
+	unsigned long size;
+
+	type = unpack_object_header(e->p, &w_curs, &offset, &size);
+	unuse_pack(&w_curs);
+
+	return type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA;
+}
+
 static void maybe_invalidate_kept_pack_cache(struct packfile_store *store,
 					     unsigned flags)
 {
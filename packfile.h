@@ -13,6 +13,8 @@
 struct object_info;
 struct odb_read_stream;
 
+struct pack_entry;
+
 struct packed_git {
 	struct pack_window *windows;
 	off_t pack_size;
@@ -46,6 +48,21 @@ struct packed_git {
 	 */
 	const uint32_t *mtimes_map;
 	size_t mtimes_size;
+	/*
+	 * objinfo_map points at the memory mapped .objinfo file of this
+	 * pack, if any. objinfo_tried is set once we looked for it, so that
+	 * we do not keep trying to open a non-existent file.
+	 */
+	const unsigned char *objinfo_map;
+	size_t objinfo_size;
+	unsigned objinfo_tried:1;
+	/*
+	 * dhints_map points at the memory mapped .dhints file of this
+	 * pack, if any, and dhints_tried works like objinfo_tried.
+	 */
+	const unsigned char *dhints_map;
+	size_t dhints_size;
+	unsigned dhints_tried:1;
 
 	/* repo denotes the repository this packfile belongs to */
 	struct repository *repo;
@@ -242,6 +259,31 @@ int packfile_store_read_object_stream(struct odb_read_stream **out,
 				      struct packfile_store *store,
 				      const struct object_id *oid);
 
+/*
+ * Look up the object identified by its ID in the packfiles of the store and
+ * store its location in "e". Returns 1 if the object has been found, 0
+ * otherwise.
+ */
+int packfile_store_find_entry(struct packfile_store *store,
+			      const struct object_id *oid,
+			      struct pack_entry *e);
+
+/*
+ * Return whether the packed object at the given location is stored as a
+ * delta. This only reads the header of the packed object and is thus much
+ * cheaper than reading its object info.
+ */
+int pack_entry_is_delta(const struct pack_entry *e);
+
+/*
+ * Like packfile_store_read_object_info(), but read the object from a
+ * location found via packfile_store_find_entry() before. This saves
+ * callers that need to look at the entry first from looking it up twice.
+ */
+int pack_entry_read_object_info(const struct object_id *oid,
+				const struct pack_entry *e,
+				struct object_info *oi);
+
 /*
  * Try to read the object identified by its ID from the object store and
  * populate the object info with its data. Returns 1 in case the object was
@@ -455,6 +497,14 @@ off_t nth_packed_object_offset(const struct packed_git *, uint32_t n);
 off_t find_pack_entry_one(const struct object_id *oid, struct packed_git *);
 
 int is_pack_valid(struct packed_git *);
+
+/*
+ * Return a descriptor to read from the packfile, reopening it in case it has
+ * been closed after it got mapped completely. Returns -1 if the pack cannot
+ * be opened. The descriptor is owned by the packfile and must not be closed.
+ */
+int packfile_fd(struct packed_git *p);
+
 void *unpack_entry(struct repository *r, struct packed_git *, off_t, enum object_type *, unsigned long *);
 unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
@@ -0,0 +1,474 @@
+#include "git-compat-util.h"
+#include "path-index.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "ewah/ewok.h"
+#include "gettext.h"
+#include "pathspec.h"
+#include "progress.h"
+#include "repository.h"
+#include "string-list.h"
+#include "strbuf.h"
+#include "strvec.h"
+#include "trace2.h"
+
+/*
+ * Return 1 if "path" is "dir" itself, or a path below it.
+ */
+static int path_is_within(const char *path, const char *dir)
+{
+	const char *rest;
+
+	if (!skip_prefix(path, dir, &rest))
+		return 0;
+	return !*rest || *rest == '/';
+}
+
+static void add_be32(struct strbuf *sb, uint32_t value)
+{
+	unsigned char buf[4];
+
+	put_be32(buf, value);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void add_offset(struct strbuf *sb, size_t offset)
+{
+	if (offset > UINT32_MAX)
+		die(_("path index is too large"));
+	add_be32(sb, offset);
+}
+
+/*
+ * Read the bitmap of the most specific path in the PIDX chunk of "g"
+ * that contains "path" into "ewah", and store the length of that path
+ * in "matched_len". Returns 0 on success, 1 if no path contains it, or
+ * -1 if the chunk is corrupt.
+ */
+static int read_path_bitmap(const struct commit_graph *g, const char *path,
+			    struct ewah_bitmap **ewah, size_t *matched_len)
+{
+	const unsigned char *chunk = g->chunk_path_index;
+	size_t size = g->chunk_path_index_size;
+	const unsigned char *names, *bitmaps;
+	size_t names_size, bitmaps_size, start, end;
+	uint32_t nr, i, best = 0, best_len = 0;
+	ssize_t ret;
+
+	if (size < 4)
+		return -1;
+	nr = get_be32(chunk);
+	if (!nr)
+		return 1;
+	if ((size - 4) / 8 < nr)
+		return -1;
+
+	names = chunk + 4 + st_mult(8, nr);
+	names_size = get_be32(chunk + 4 + st_mult(4, nr - 1));
+	if (names_size > size - (names - chunk))
+		return -1;
+	bitmaps = names + names_size;
+	bitmaps_size = size - (bitmaps - chunk);
+
+	for (i = 0, start = 0; i < nr; i++, start = end) {
+		end = get_be32(chunk + 4 + st_mult(4, i));
+		if (end <= start || end > names_size || names[end - 1])
+			return -1;
+		if (end - start - 1 > best_len &&
+		    path_is_within(path, (const char *)names + start)) {
+			best = i + 1;
+			best_len = end - start - 1;
+		}
+	}
+	if (!best)
+		return 1;
+
+	start = best > 1 ? get_be32(chunk + 4 + st_mult(4, nr + best - 2)) : 0;
+	end = get_be32(chunk + 4 + st_mult(4, nr + best - 1));
+	if (start > end || end > bitmaps_size)
+		return -1;
+
+	*ewah = ewah_new();
+	ret = ewah_read_mmap(*ewah, bitmaps + start, end - start);
+	if (ret < 0 || (size_t)ret != end - start) {
+		ewah_free(*ewah);
+		return -1;
+	}
+	*matched_len = best_len;
+
+	return 0;
+}
+
+/*
+ * The bitmaps of an existing commit-graph layer for the paths we are
+ * indexing, or NULL if the layer does not index all of them.
+ */
+struct reused_layer {
+	const struct commit_graph *g;
+	struct bitmap **touched;
+};
+
+static struct bitmap **load_reused_layer(const struct commit_graph *g,
+					 const struct string_list *paths)
+{
+	struct bitmap **touched;
+	size_t i;
+
+	if (!g->chunk_path_index)
+		return NULL;
+
+	CALLOC_ARRAY(touched, paths->nr);
+	for (i = 0; i < paths->nr; i++) {
+		const char *path = paths->items[i].string;
+		struct ewah_bitmap *ewah;
+		size_t matched_len;
+
+		if (read_path_bitmap(g, path, &ewah, &matched_len))
+			goto unusable;
+		if (matched_len != strlen(path)) {
+			ewah_free(ewah);
+			goto unusable;
+		}
+		touched[i] = ewah_to_bitmap(ewah);
+		ewah_free(ewah);
+	}
+	return touched;
+
+unusable:
+	while (i--)
+		bitmap_free(touched[i]);
+	free(touched);
+	return NULL;
+}
+
+/*
+ * If "c" is part of an existing commit-graph layer that indexes all of
+ * "paths", copy its bits from there into position "n" of "touched" and
+ * return 1. Otherwise return 0.
+ */
+static int reuse_path_index(struct repository *r, struct commit *c,
+			    const struct string_list *paths,
+			    struct reused_layer **layers, size_t *layers_nr,
+			    size_t *layers_alloc,
+			    struct bitmap **touched, size_t n)
+{
+	struct commit_graph *g;
+	struct reused_layer *layer = NULL;
+	uint32_t pos;
+	size_t i;
+
+	g = repo_find_commit_pos_in_graph(r, c, &pos);
+	if (!g)
+		return 0;
+	while (pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	for (i = 0; i < *layers_nr; i++) {
+		if ((*layers)[i].g == g) {
+			layer = &(*layers)[i];
+			break;
+		}
+	}
+	if (!layer) {
+		ALLOC_GROW(*layers, *layers_nr + 1, *layers_alloc);
+		layer = &(*layers)[(*layers_nr)++];
+		layer->g = g;
+		layer->touched = load_reused_layer(g, paths);
+	}
+	if (!layer->touched)
+		return 0;
+
+	pos -= g->num_commits_in_base;
+	for (i = 0; i < paths->nr; i++)
+		if (bitmap_get(layer->touched[i], pos))
+			bitmap_set(touched[i], n);
+	return 1;
+}
+
+void compute_path_index(struct repository *r,
+			struct commit **commits, size_t nr,
+			const struct string_list *paths,
+			struct strbuf *out, int report_progress)
+{
+	struct reused_layer *layers = NULL;
+	size_t layers_nr = 0, layers_alloc = 0, reused = 0;
+	struct bitmap **touched;
+	struct diff_options diffopt;
+	struct strvec args = STRVEC_INIT;
+	struct strbuf name_ends = STRBUF_INIT, bitmap_ends = STRBUF_INIT;
+	struct strbuf names = STRBUF_INIT, bitmaps = STRBUF_INIT;
+	struct progress *progress = NULL;
+	size_t i;
+	int j;
+
+	if (report_progress)
+		progress = start_delayed_progress(r,
+						  _("Computing commit path index"),
+						  nr);
+
+	CALLOC_ARRAY(touched, paths->nr);
+	for (i = 0; i < paths->nr; i++) {
+		touched[i] = bitmap_new();
+		strvec_push(&args, paths->items[i].string);
+	}
+
+	/*
+	 * Limit the diff to the indexed paths, so that it does not need
+	 * to descend into any other tree.
+	 */
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.detect_rename = 0;
+	parse_pathspec(&diffopt.pathspec, 0, PATHSPEC_LITERAL_PATH, NULL,
+		       args.v);
+	diff_setup_done(&diffopt);
+
+	for (i = 0; i < nr; i++) {
+		struct commit *c = commits[i];
+
+		/*
+		 * Commits that are already part of a layer that indexes
+		 * the same paths need not be diffed again.
+		 */
+		if (reuse_path_index(r, c, paths, &layers, &layers_nr,
+				     &layers_alloc, touched, i)) {
+			reused++;
+			display_progress(progress, i + 1);
+			continue;
+		}
+
+		repo_parse_commit(r, c);
+		if (c->parents)
+			diff_tree_oid(&c->parents->item->object.oid,
+				      &c->object.oid, "", &diffopt);
+		else
+			diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
+
+		for (j = 0; j < diff_queued_diff.nr; j++) {
+			const char *path = diff_queued_diff.queue[j]->two->path;
+			size_t k;
+
+			for (k = 0; k < paths->nr; k++)
+				if (path_is_within(path, paths->items[k].string))
+					bitmap_set(touched[k], i);
+		}
+		diff_queue_clear(&diff_queued_diff);
+
+		display_progress(progress, i + 1);
+	}
+
+	for (i = 0; i < paths->nr; i++) {
+		struct ewah_bitmap *ewah = bitmap_to_ewah(touched[i]);
+		const char *path = paths->items[i].string;
+
+		strbuf_add(&names, path, strlen(path) + 1);
+		add_offset(&name_ends, names.len);
+
+		ewah_serialize_strbuf(ewah, &bitmaps);
+		add_offset(&bitmap_ends, bitmaps.len);
+
+		ewah_free(ewah);
+		bitmap_free(touched[i]);
+	}
+
+	add_be32(out, paths->nr);
+	strbuf_addbuf(out, &name_ends);
+	strbuf_addbuf(out, &bitmap_ends);
+	strbuf_addbuf(out, &names);
+	strbuf_addbuf(out, &bitmaps);
+
+	stop_progress(&progress);
+	trace2_data_intmax("commit-graph", r, "path-index/reused", reused);
+	trace2_data_intmax("commit-graph", r, "path-index/computed",
+			   nr - reused);
+
+	for (i = 0; i < layers_nr; i++) {
+		size_t k;
+
+		if (!layers[i].touched)
+			continue;
+		for (k = 0; k < paths->nr; k++)
+			bitmap_free(layers[i].touched[k]);
+		free(layers[i].touched);
+	}
+	free(layers);
+	clear_pathspec(&diffopt.pathspec);
+	strvec_clear(&args);
+	strbuf_release(&name_ends);
+	strbuf_release(&bitmap_ends);
+	strbuf_release(&names);
+	strbuf_release(&bitmaps);
+	free(touched);
+}
+
+int normalize_path_index_path(struct strbuf *path)
+{
+	const char *p;
+
+	while (path->len && path->buf[path->len - 1] == '/')
+		strbuf_setlen(path, path->len - 1);
+	if (!path->len || path->buf[0] == '/')
+		return -1;
+
+	for (p = path->buf; p; p = strchr(p, '/')) {
+		size_t len;
+
+		if (*p == '/')
+			p++;
+		len = strchrnul(p, '/') - p;
+		if (!len ||
+		    (len == 1 && p[0] == '.') ||
+		    (len == 2 && p[0] == '.' && p[1] == '.'))
+			return -1;
+	}
+
+	return 0;
+}
+
+struct path_index_layer {
+	const struct commit_graph *g;
+	/*
+	 * The commits of the layer which change any of the paths, or
+	 * NULL if the layer cannot tell.
+	 */
+	struct bitmap *touched;
+	/*
+	 * Whether all paths are indexed themselves, rather than through
+	 * a directory containing them.
+	 */
+	unsigned exact : 1;
+};
+
+struct path_index_filter {
+	struct repository *repo;
+	char **paths;
+	size_t nr;
+
+	struct path_index_layer *layers;
+	size_t layers_nr, layers_alloc;
+};
+
+struct path_index_filter *path_index_filter_new(struct repository *r,
+						const char **paths, size_t nr)
+{
+	struct path_index_filter *filter;
+	struct commit_graph *g;
+	size_t i;
+
+	for (g = prepare_commit_graph(r); g; g = g->base_graph)
+		if (g->chunk_path_index)
+			break;
+	if (!g)
+		return NULL;
+
+	CALLOC_ARRAY(filter, 1);
+	filter->repo = r;
+	filter->nr = nr;
+	ALLOC_ARRAY(filter->paths, nr);
+	for (i = 0; i < nr; i++)
+		filter->paths[i] = xstrdup(paths[i]);
+
+	return filter;
+}
+
+/*
+ * OR the bitmap of the most specific path in the PIDX chunk of "g"
+ * that contains "path" into "touched", and clear "exact" if that is
+ * not "path" itself. Returns like read_path_bitmap().
+ */
+static int or_path_bitmap(const struct commit_graph *g, const char *path,
+			  struct bitmap *touched, unsigned *exact)
+{
+	struct ewah_bitmap *ewah;
+	size_t matched_len;
+	int ret = read_path_bitmap(g, path, &ewah, &matched_len);
+
+	if (ret)
+		return ret;
+	if (matched_len != strlen(path))
+		*exact = 0;
+	bitmap_or_ewah(touched, ewah);
+	ewah_free(ewah);
+
+	return 0;
+}
+
+static void load_layer(struct path_index_filter *filter,
+		       struct path_index_layer *layer)
+{
+	const struct commit_graph *g = layer->g;
+	unsigned exact = 1;
+	size_t i;
+
+	if (!g->chunk_path_index)
+		return;
+
+	layer->touched = bitmap_new();
+	for (i = 0; i < filter->nr; i++) {
+		int ret = or_path_bitmap(g, filter->paths[i], layer->touched,
+					 &exact);
+
+		if (ret < 0)
+			warning(_("ignoring corrupt path index in commit-graph file '%s'"),
+				g->filename);
+		if (ret) {
+			FREE_AND_NULL(layer->touched);
+			return;
+		}
+	}
+	layer->exact = exact;
+}
+
+int path_index_filter_check(struct path_index_filter *filter,
+			    struct commit *c)
+{
+	struct commit_graph *g;
+	struct path_index_layer *layer = NULL;
+	uint32_t pos;
+	size_t i;
+
+	g = repo_find_commit_pos_in_graph(filter->repo, c, &pos);
+	if (!g)
+		return -1;
+	while (pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	for (i = 0; i < filter->layers_nr; i++) {
+		if (filter->layers[i].g == g) {
+			layer = &filter->layers[i];
+			break;
+		}
+	}
+	if (!layer) {
+		ALLOC_GROW(filter->layers, filter->layers_nr + 1,
+			   filter->layers_alloc);
+		layer = &filter->layers[filter->layers_nr++];
+		memset(layer, 0, sizeof(*layer));
+		layer->g = g;
+		load_layer(filter, layer);
+	}
+
+	if (!layer->touched)
+		return -1;
+	if (!bitmap_get(layer->touched, pos - g->num_commits_in_base))
+		return 0;
+	return layer->exact ? 1 : -1;
+}
+
+void path_index_filter_free(struct path_index_filter *filter)
+{
+	size_t i;
+
+	if (!filter)
+		return;
+
+	for (i = 0; i < filter->nr; i++)
+		free(filter->paths[i]);
+	free(filter->paths);
+	for (i = 0; i < filter->layers_nr; i++)
+		bitmap_free(filter->layers[i].touched);
+	free(filter->layers);
+	free(filter);
+}
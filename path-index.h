@@ -0,0 +1,65 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+struct commit;
+struct repository;
+struct strbuf;
+struct string_list;
+
+/*
+ * A path index records, for each of a configured set of paths, which
+ * commits of a commit-graph layer change that path (or anything below
+ * it, if it is a directory) compared to their first parent, or to the
+ * empty tree for root commits. It is stored as one EWAH bitmap per
+ * path with a bit for each commit, in the order of the layer's OID
+ * Lookup chunk.
+ *
+ * Unlike changed-path Bloom filters, a path index has no false
+ * positives, and it costs a single bit test per commit to query.
+ *
+ * See Documentation/gitformat-commit-graph.adoc for the format of the
+ * PIDX chunk holding it.
+ */
+
+/*
+ * Compute the path index for "paths" over the "nr" commits in
+ * "commits", and append it to "out" in the format of the PIDX chunk.
+ * "paths" must be sorted, without duplicates or trailing slashes.
+ */
+void compute_path_index(struct repository *r,
+			struct commit **commits, size_t nr,
+			const struct string_list *paths,
+			struct strbuf *out, int report_progress);
+
+/*
+ * Strip trailing slashes from "path", the form in which paths are
+ * stored in a path index. Returns 0 on success, or -1 if "path" cannot
+ * be indexed (because it is empty, absolute, or has empty, "." or ".."
+ * components).
+ */
+int normalize_path_index_path(struct strbuf *path);
+
+struct path_index_filter;
+
+/*
+ * Prepare to answer whether commits change any of the "nr" "paths"
+ * using the path indexes in the commit-graph of "r". The paths follow
+ * the same rules as for compute_path_index(), but do not need to be
+ * sorted. Returns NULL if no commit-graph layer has a path index.
+ */
+struct path_index_filter *path_index_filter_new(struct repository *r,
+						const char **paths, size_t nr);
+
+/*
+ * Return 0 if "c" does not change any of the paths of "filter"
+ * compared to its first parent, 1 if it does, or -1 if the path index
+ * cannot tell. It cannot tell when "c" is not in the commit-graph, when
+ * its layer does not index the paths, or when "c" changes a directory
+ * which is indexed in place of one of the paths.
+ */
+int path_index_filter_check(struct path_index_filter *filter,
+			    struct commit *c);
+
+void path_index_filter_free(struct path_index_filter *filter);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "git-compat-util.h"
 #include "gettext.h"
+#include "loose-cache.h"
 #include "object-file.h"
 #include "packfile.h"
 #include "progress.h"
@@ -43,6 +44,9 @@ void prune_packed_objects(int opts)
 	for_each_loose_file_in_source(the_repository->objects->sources,
 				      prune_object, NULL, prune_subdir, &opts);
 
+	if (!(opts & PRUNE_PACKED_DRY_RUN))
+		update_loose_cache(the_repository->objects->sources);
+
 	/* Ensure we show 100% before finishing progress */
 	display_progress(progress, 256);
 	stop_progress(&progress);
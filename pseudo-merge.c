@@ -14,6 +14,9 @@
 #include "alloc.h"
 #include "progress.h"
 #include "hex.h"
+#include "path.h"
+#include "trace2.h"
+#include "upload-pack.h"
 
 #define DEFAULT_PSEUDO_MERGE_DECAY 1.0
 #define DEFAULT_PSEUDO_MERGE_MAX_MERGES 64
@@ -37,7 +40,7 @@ static double gitexp(double base, int exp)
 }
 
 static uint32_t pseudo_merge_group_size(const struct pseudo_merge_group *group,
-					const struct pseudo_merge_matches *matches,
+					uint32_t nr, uint32_t max_merges,
 					uint32_t i)
 {
 	double C = 0.0f;
@@ -77,9 +80,9 @@ static uint32_t pseudo_merge_group_size(const struct pseudo_merge_group *group,
 	 *
 	 *   { 5012, 1772, 964, 626, 448, 341, 271, 221, 186, 158 }
 	 */
-	for (n = 0; n < group->max_merges; n++)
+	for (n = 0; n < max_merges; n++)
 		C += 1.0 / gitexp(n + 1, group->decay);
-	C = matches->unstable_nr / C;
+	C = nr / C;
 
 	return (uint32_t)((C / gitexp(i + 1, group->decay)) + 0.5);
 }
@@ -195,6 +198,8 @@ static int pseudo_merge_config(const char *var, const char *value,
 			warning(_("%s must be positive, using default"), var);
 			group->stable_size = DEFAULT_PSEUDO_MERGE_STABLE_SIZE;
 		}
+	} else if (!strcmp(key, "usenegotiationlog")) {
+		group->use_negotiation_log = git_config_bool(var, value);
 	}
 
 done:
@@ -327,11 +332,306 @@ static struct pseudo_merge_commit_idx *pseudo_merge_idx(kh_oid_map_t *pseudo_mer
 	return pmc;
 }
 
+/*
+ * Append "c" to the parents of the pseudo-merge being built, keeping
+ * our mapping of commits -> pseudo-merge(s) which include them
+ * up-to-date.
+ */
+static struct commit_list **add_pseudo_merge_parent(struct bitmap_writer *writer,
+						    struct commit *c,
+						    struct commit_list **p)
+{
+	struct pseudo_merge_commit_idx *pmc;
+
+	pmc = pseudo_merge_idx(writer->pseudo_merge_commits, &c->object.oid);
+
+	ALLOC_GROW(pmc->pseudo_merge, pmc->nr + 1, pmc->alloc);
+
+	pmc->pseudo_merge[pmc->nr++] = writer->pseudo_merges_nr;
+	return commit_list_append(c, p);
+}
+
 #define MIN_PSEUDO_MERGE_SIZE 8
 
+/*
+ * Partition the "nr" unstable commits in "commits" (ordered by date)
+ * into up to "max_merges" pseudo-merges, whose sizes decay according
+ * to the group's parameters.
+ */
+static void select_unstable_pseudo_merges(struct bitmap_writer *writer,
+					  struct pseudo_merge_group *group,
+					  struct commit **commits, uint32_t nr,
+					  uint32_t max_merges)
+{
+	uint32_t i, j;
+
+	/* make up to max_merges pseudo merges for unstable commits */
+	for (i = 0, j = 0; i < max_merges; i++) {
+		struct commit *merge;
+		struct commit_list **p;
+		uint32_t size, end;
+
+		merge = push_pseudo_merge(group);
+		p = &merge->parents;
+
+		size = pseudo_merge_group_size(group, nr, max_merges, i);
+		end = size < MIN_PSEUDO_MERGE_SIZE ? nr : j + size;
+
+		/*
+		 * For each pseudo-merge commit created above, add parents to
+		 * the allocated commit node from the unstable set of commits
+		 * (newer than the stable threshold).
+		 *
+		 * Account for the sample rate, since not every candidate from
+		 * the set of stable commits will be included as a pseudo-merge
+		 * parent.
+		 */
+		for (; j < end && j < nr; j++) {
+			if (j % (uint32_t)(1.0 / group->sample_rate))
+				continue;
+
+			p = add_pseudo_merge_parent(writer, commits[j], p);
+		}
+
+		if (merge->parents) {
+			bitmap_writer_push_commit(writer, merge, 1);
+			writer->pseudo_merges_nr++; }
+		if (end >= nr)
+			break;
+	}
+}
+
+/*
+ * The sets of commits that were wanted or had together in the requests
+ * recorded by upload-pack (see UPLOAD_PACK_NEGOTIATION_LOG).
+ */
+struct negotiation_log {
+	struct oid_array *sets;
+	size_t nr, alloc;
+};
+
+static void read_negotiation_log_1(struct negotiation_log *log,
+				   const char *name)
+{
+	struct strbuf line = STRBUF_INIT;
+	char *path = repo_git_path(the_repository, "%s", name);
+	FILE *fp = fopen(path, "r");
+
+	if (!fp) {
+		if (errno != ENOENT)
+			warning_errno(_("unable to open '%s'"), path);
+		free(path);
+		return;
+	}
+
+	while (strbuf_getline(&line, fp) != EOF) {
+		struct oid_array set = OID_ARRAY_INIT;
+		const char *p;
+
+		if (!skip_prefix(line.buf, "want", &p) &&
+		    !skip_prefix(line.buf, "have", &p))
+			continue;
+
+		while (*p == ' ') {
+			struct object_id oid;
+
+			if (parse_oid_hex(p + 1, &oid, &p))
+				break;
+			oid_array_append(&set, &oid);
+		}
+		if (*p) {
+			/* ignore entries cut short, or otherwise garbled */
+			oid_array_clear(&set);
+			continue;
+		}
+
+		ALLOC_GROW(log->sets, log->nr + 1, log->alloc);
+		log->sets[log->nr++] = set;
+	}
+
+	fclose(fp);
+	free(path);
+	strbuf_release(&line);
+}
+
+static void read_negotiation_log(struct negotiation_log *log)
+{
+	/* the log that upload-pack rotated out last is still recent */
+	read_negotiation_log_1(log, UPLOAD_PACK_NEGOTIATION_LOG_OLD);
+	read_negotiation_log_1(log, UPLOAD_PACK_NEGOTIATION_LOG);
+}
+
+static void clear_negotiation_log(struct negotiation_log *log)
+{
+	for (size_t i = 0; i < log->nr; i++)
+		oid_array_clear(&log->sets[i]);
+	free(log->sets);
+}
+
+/*
+ * A set of unstable commits (as indexes into the sorted array of
+ * unstable matches) that appeared together "count" times in the
+ * negotiation log.
+ */
+struct negotiated_set {
+	uint32_t *commits;
+	uint32_t nr;
+	uint32_t count;
+};
+
+static int uint32_cmp(const void *va, const void *vb)
+{
+	uint32_t a = *(const uint32_t *)va;
+	uint32_t b = *(const uint32_t *)vb;
+
+	if (a < b)
+		return -1;
+	else if (a > b)
+		return 1;
+	return 0;
+}
+
+/*
+ * Order sets by the number of bitmaps that a pseudo-merge made out of
+ * them saves over all of the logged requests, most first.
+ */
+static int negotiated_set_cmp(const void *va, const void *vb)
+{
+	const struct negotiated_set *a = *(const struct negotiated_set **)va;
+	const struct negotiated_set *b = *(const struct negotiated_set **)vb;
+	uint64_t saved_a = (uint64_t)a->count * (a->nr - 1);
+	uint64_t saved_b = (uint64_t)b->count * (b->nr - 1);
+
+	if (saved_a != saved_b)
+		return saved_a < saved_b ? 1 : -1;
+	for (uint32_t i = 0; i < a->nr && i < b->nr; i++)
+		if (a->commits[i] != b->commits[i])
+			return a->commits[i] < b->commits[i] ? -1 : 1;
+	return a->nr < b->nr ? -1 : a->nr > b->nr;
+}
+
+/*
+ * Make pseudo-merges out of the sets of unstable commits that clients
+ * most often want or have together according to "log", so that their
+ * requests can use a single pseudo-merge bitmap in place of those of
+ * each commit. Only sets seen at least twice are considered. Commits
+ * which are not covered by any of them are partitioned as usual, into
+ * the rest of the group's pseudo-merges.
+ */
+static void select_negotiated_pseudo_merges(struct bitmap_writer *writer,
+					    struct pseudo_merge_group *group,
+					    struct pseudo_merge_matches *matches,
+					    const struct negotiation_log *log)
+{
+	kh_oid_pos_t *positions = kh_init_oid_pos();
+	struct strmap sets = STRMAP_INIT;
+	struct negotiated_set **sorted = NULL;
+	size_t sorted_nr = 0, sorted_alloc = 0;
+	struct strbuf key = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct commit **rest;
+	uint32_t *commits = NULL;
+	size_t commits_alloc = 0;
+	uint32_t rest_nr = 0, merges_nr = 0;
+	unsigned char *covered;
+	size_t i;
+
+	for (i = 0; i < matches->unstable_nr; i++) {
+		int hash_ret;
+		khiter_t pos = kh_put_oid_pos(positions,
+					      matches->unstable[i]->object.oid,
+					      &hash_ret);
+		if (hash_ret)
+			kh_value(positions, pos) = i;
+	}
+
+	for (i = 0; i < log->nr; i++) {
+		struct negotiated_set *set;
+		uint32_t nr = 0;
+
+		for (size_t j = 0; j < log->sets[i].nr; j++) {
+			khiter_t pos = kh_get_oid_pos(positions,
+						      log->sets[i].oid[j]);
+			if (pos == kh_end(positions))
+				continue;
+			ALLOC_GROW(commits, nr + 1, commits_alloc);
+			commits[nr++] = kh_value(positions, pos);
+		}
+		if (nr < 2)
+			continue;
+
+		QSORT(commits, nr, uint32_cmp);
+		strbuf_reset(&key);
+		for (uint32_t j = 0; j < nr; j++)
+			strbuf_addf(&key, "%"PRIu32" ", commits[j]);
+
+		set = strmap_get(&sets, key.buf);
+		if (!set) {
+			CALLOC_ARRAY(set, 1);
+			DUP_ARRAY(set->commits, commits, nr);
+			set->nr = nr;
+			strmap_put(&sets, key.buf, set);
+		}
+		set->count++;
+	}
+
+	strmap_for_each_entry(&sets, &iter, e) {
+		struct negotiated_set *set = e->value;
+
+		if (set->count < 2)
+			continue;
+		ALLOC_GROW(sorted, sorted_nr + 1, sorted_alloc);
+		sorted[sorted_nr++] = set;
+	}
+	QSORT(sorted, sorted_nr, negotiated_set_cmp);
+
+	CALLOC_ARRAY(covered, matches->unstable_nr);
+	for (i = 0; i < sorted_nr && merges_nr < group->max_merges; i++) {
+		struct commit *merge = push_pseudo_merge(group);
+		struct commit_list **p = &merge->parents;
+
+		for (uint32_t j = 0; j < sorted[i]->nr; j++) {
+			uint32_t c = sorted[i]->commits[j];
+
+			p = add_pseudo_merge_parent(writer,
+						    matches->unstable[c], p);
+			covered[c] = 1;
+		}
+
+		bitmap_writer_push_commit(writer, merge, 1);
+		writer->pseudo_merges_nr++;
+		merges_nr++;
+	}
+
+	ALLOC_ARRAY(rest, matches->unstable_nr);
+	for (i = 0; i < matches->unstable_nr; i++)
+		if (!covered[i])
+			rest[rest_nr++] = matches->unstable[i];
+	if (rest_nr && merges_nr < group->max_merges)
+		select_unstable_pseudo_merges(writer, group, rest, rest_nr,
+					      group->max_merges - merges_nr);
+
+	trace2_data_intmax("pseudo-merge", the_repository,
+			   "negotiated-pseudo-merges", merges_nr);
+
+	strmap_for_each_entry(&sets, &iter, e) {
+		struct negotiated_set *set = e->value;
+		free(set->commits);
+	}
+	strmap_clear(&sets, 1);
+	kh_destroy_oid_pos(positions);
+	strbuf_release(&key);
+	free(sorted);
+	free(commits);
+	free(covered);
+	free(rest);
+}
+
 static void select_pseudo_merges_1(struct bitmap_writer *writer,
 				   struct pseudo_merge_group *group,
-				   struct pseudo_merge_matches *matches)
+				   struct pseudo_merge_matches *matches,
+				   const struct negotiation_log *log)
 {
 	uint32_t i, j;
 	uint32_t stable_merges_nr;
@@ -357,25 +657,11 @@ static void select_pseudo_merges_1(struct bitmap_writer *writer,
 		 * (un-bitmapped, newer than the stable threshold).
 		 */
 		do {
-			struct commit *c;
-			struct pseudo_merge_commit_idx *pmc;
-
 			if (j >= matches->stable_nr)
 				break;
 
-			c = matches->stable[j++];
-			/*
-			 * Here and below, make sure that we keep our mapping of
-			 * commits -> pseudo-merge(s) which include the key'd
-			 * commit up-to-date.
-			 */
-			pmc = pseudo_merge_idx(writer->pseudo_merge_commits,
-					       &c->object.oid);
-
-			ALLOC_GROW(pmc->pseudo_merge, pmc->nr + 1, pmc->alloc);
-
-			pmc->pseudo_merge[pmc->nr++] = writer->pseudo_merges_nr;
-			p = commit_list_append(c, p);
+			p = add_pseudo_merge_parent(writer, matches->stable[j++],
+						    p);
 		} while (j % group->stable_size);
 
 		if (merge->parents) {
@@ -384,49 +670,13 @@ static void select_pseudo_merges_1(struct bitmap_writer *writer,
 		}
 	}
 
-	/* make up to group->max_merges pseudo merges for unstable commits */
-	for (i = 0, j = 0; i < group->max_merges; i++) {
-		struct commit *merge;
-		struct commit_list **p;
-		uint32_t size, end;
-
-		merge = push_pseudo_merge(group);
-		p = &merge->parents;
-
-		size = pseudo_merge_group_size(group, matches, i);
-		end = size < MIN_PSEUDO_MERGE_SIZE ? matches->unstable_nr : j + size;
-
-		/*
-		 * For each pseudo-merge commit created above, add parents to
-		 * the allocated commit node from the unstable set of commits
-		 * (newer than the stable threshold).
-		 *
-		 * Account for the sample rate, since not every candidate from
-		 * the set of stable commits will be included as a pseudo-merge
-		 * parent.
-		 */
-		for (; j < end && j < matches->unstable_nr; j++) {
-			struct commit *c = matches->unstable[j];
-			struct pseudo_merge_commit_idx *pmc;
-
-			if (j % (uint32_t)(1.0 / group->sample_rate))
-				continue;
-
-			pmc = pseudo_merge_idx(writer->pseudo_merge_commits,
-					       &c->object.oid);
-
-			ALLOC_GROW(pmc->pseudo_merge, pmc->nr + 1, pmc->alloc);
-
-			pmc->pseudo_merge[pmc->nr++] = writer->pseudo_merges_nr;
-			p = commit_list_append(c, p);
-		}
-
-		if (merge->parents) {
-			bitmap_writer_push_commit(writer, merge, 1);
-			writer->pseudo_merges_nr++; }
-		if (end >= matches->unstable_nr)
-			break;
+	if (log && log->nr) {
+		select_negotiated_pseudo_merges(writer, group, matches, log);
+		return;
 	}
+
+	select_unstable_pseudo_merges(writer, group, matches->unstable,
+				      matches->unstable_nr, group->max_merges);
 }
 
 static int commit_date_cmp(const void *va, const void *vb)
@@ -450,11 +700,22 @@ static void sort_pseudo_merge_matches(struct pseudo_merge_matches *matches)
 void select_pseudo_merges(struct bitmap_writer *writer)
 {
 	struct progress *progress = NULL;
+	struct negotiation_log log = { 0 };
 	uint32_t i;
 
 	if (!writer->pseudo_merge_groups.nr)
 		return;
 
+	for (i = 0; i < writer->pseudo_merge_groups.nr; i++) {
+		struct pseudo_merge_group *group;
+
+		group = writer->pseudo_merge_groups.items[i].util;
+		if (group->use_negotiation_log) {
+			read_negotiation_log(&log);
+			break;
+		}
+	}
+
 	if (writer->show_progress)
 		progress = start_progress(the_repository,
 					  "Selecting pseudo-merge commits",
@@ -474,13 +735,15 @@ void select_pseudo_merges(struct bitmap_writer *writer)
 
 			sort_pseudo_merge_matches(matches);
 
-			select_pseudo_merges_1(writer, group, matches);
+			select_pseudo_merges_1(writer, group, matches,
+					       group->use_negotiation_log ? &log : NULL);
 		}
 
 		display_progress(progress, i + 1);
 	}
 
 	stop_progress(&progress);
+	clear_negotiation_log(&log);
 }
 
 void free_pseudo_merge_map(struct pseudo_merge_map *pm)
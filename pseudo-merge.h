@@ -49,6 +49,7 @@ struct pseudo_merge_group {
 	int stable_size;
 	timestamp_t threshold;
 	timestamp_t stable_threshold;
+	int use_negotiation_log;
 };
 
 void pseudo_merge_group_release(struct pseudo_merge_group *group);
@@ -70,6 +71,7 @@ struct pseudo_merge_matches {
  *   - bitmapPseudoMerge.<name>.maxMerges
  *   - bitmapPseudoMerge.<name>.stableThreshold
  *   - bitmapPseudoMerge.<name>.stableSize
+ *   - bitmapPseudoMerge.<name>.useNegotiationLog
  *
  * and populates the given `list` with pseudo-merge groups. String
  * entry keys are the pseudo-merge group names, and the values are
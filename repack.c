@@ -284,6 +284,8 @@ static struct {
 	{".pack"},
 	{".rev", 1},
 	{".mtimes", 1},
+	{".objinfo", 1},
+	{".dhints", 1},
 	{".bitmap", 1},
 	{".promisor", 1},
 	{".idx"},
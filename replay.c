@@ -5,6 +5,7 @@
 #include "hex.h"
 #include "merge-ort.h"
 #include "object-name.h"
+#include "odb.h"
 #include "refs.h"
 #include "replay.h"
 #include "revision.h"
@@ -359,6 +360,7 @@ int replay_revisions(struct rev_info *revs,
 	struct commit *commit;
 	struct commit *onto = NULL;
 	struct merge_options merge_opt = { 0 };
+	struct odb_transaction *transaction = NULL;
 	struct merge_result result = {
 		.clean = 1,
 	};
@@ -407,6 +409,12 @@ int replay_revisions(struct rev_info *revs,
 	merge_opt.show_rename_progress = 0;
 	last_commit = onto;
 	replayed_commits = kh_init_oid_map();
+
+	/*
+	 * None of the new objects are referenced before our caller updates
+	 * refs, so we can write all of them in a single transaction.
+	 */
+	transaction = odb_transaction_begin_pack(revs->repo->objects);
 	while ((commit = get_revision(revs))) {
 		const struct name_decoration *decoration;
 		khint_t pos;
@@ -470,6 +478,7 @@ int replay_revisions(struct rev_info *revs,
 	ret = 0;
 
 out:
+	odb_transaction_commit(transaction);
 	if (update_refs) {
 		strset_clear(update_refs);
 		free(update_refs);
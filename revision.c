@@ -44,6 +44,7 @@
 #include "hashmap.h"
 #include "utf8.h"
 #include "bloom.h"
+#include "path-index.h"
 #include "json-writer.h"
 #include "list-objects-filter-options.h"
 #include "resolve-undo.h"
@@ -666,16 +667,15 @@ static int forbid_bloom_filters(struct pathspec *spec)
 
 static void release_revisions_bloom_keyvecs(struct rev_info *revs);
 
-static int convert_pathspec_to_bloom_keyvec(struct bloom_keyvec **out,
-					    const struct pathspec_item *pi,
-					    const struct bloom_filter_settings *settings)
+/*
+ * Return the length of the leading directory or path of "pi" which
+ * can be looked up in a Bloom filter or path index, or 0 if there is
+ * none.
+ */
+static size_t pathspec_item_filter_len(const struct pathspec_item *pi)
 {
-	char *path_alloc = NULL;
-	const char *path;
-	size_t len;
-	int res = -1;
+	size_t len = pi->nowildcard_len;
 
-	len = pi->nowildcard_len;
 	if (len != pi->len) {
 		/*
 		 * for path like "dir/file*", nowildcard part would be
@@ -689,6 +689,19 @@ static int convert_pathspec_to_bloom_keyvec(struct bloom_keyvec **out,
 	if (len > 0 && pi->match[len - 1] == '/')
 		len--;
 
+	return len;
+}
+
+static int convert_pathspec_to_bloom_keyvec(struct bloom_keyvec **out,
+					    const struct pathspec_item *pi,
+					    const struct bloom_filter_settings *settings)
+{
+	char *path_alloc = NULL;
+	const char *path;
+	size_t len;
+	int res = -1;
+
+	len = pathspec_item_filter_len(pi);
 	if (!len)
 		goto cleanup;
 
@@ -745,6 +758,87 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	release_revisions_bloom_keyvecs(revs);
 }
 
+static int path_index_atexit_registered;
+static unsigned int count_path_index_unknown;
+static unsigned int count_path_index_changed;
+static unsigned int count_path_index_unchanged;
+
+static void trace2_path_index_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "unknown", count_path_index_unknown);
+	jw_object_intmax(&jw, "changed", count_path_index_changed);
+	jw_object_intmax(&jw, "unchanged", count_path_index_unchanged);
+	jw_end(&jw);
+
+	trace2_data_json("path-index", the_repository, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
+static void prepare_to_use_path_index(struct rev_info *revs)
+{
+	const char **paths;
+	int i;
+
+	if (!revs->commits || !revs->pruning.pathspec.nr)
+		return;
+
+	if (forbid_bloom_filters(&revs->prune_data))
+		return;
+
+	CALLOC_ARRAY(paths, revs->pruning.pathspec.nr);
+	for (i = 0; i < revs->pruning.pathspec.nr; i++) {
+		const struct pathspec_item *pi = &revs->pruning.pathspec.items[i];
+		size_t len = pathspec_item_filter_len(pi);
+
+		if (!len)
+			goto cleanup;
+		paths[i] = xmemdupz(pi->match, len);
+	}
+
+	revs->path_index = path_index_filter_new(revs->repo, paths,
+						 revs->pruning.pathspec.nr);
+
+	if (revs->path_index && trace2_is_enabled() &&
+	    !path_index_atexit_registered) {
+		atexit(trace2_path_index_statistics_atexit);
+		path_index_atexit_registered = 1;
+	}
+
+cleanup:
+	for (i = 0; i < revs->pruning.pathspec.nr; i++)
+		free((char *)paths[i]);
+	free(paths);
+}
+
+/*
+ * Return 0 if "commit" does not change the pathspec compared to its
+ * first parent according to the path index, 1 if it does, or -1 if
+ * the path index cannot tell.
+ */
+static int check_changed_in_path_index(struct rev_info *revs,
+				       struct commit *commit)
+{
+	int result;
+
+	if (commit_graph_generation(commit) == GENERATION_NUMBER_INFINITY)
+		return -1;
+
+	result = path_index_filter_check(revs->path_index, commit);
+
+	if (result < 0)
+		count_path_index_unknown++;
+	else if (result)
+		count_path_index_changed++;
+	else
+		count_path_index_unchanged++;
+
+	return result;
+}
+
 static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 						 struct commit *commit)
 {
@@ -780,6 +874,7 @@ static int rev_compare_tree(struct rev_info *revs,
 {
 	struct tree *t1 = repo_get_commit_tree(the_repository, parent);
 	struct tree *t2 = repo_get_commit_tree(the_repository, commit);
+	int index_ret = -1;
 	int bloom_ret = 1;
 
 	if (!t1)
@@ -805,7 +900,14 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	if (revs->bloom_keyvecs_nr && !nth_parent) {
+	if (revs->path_index && !nth_parent) {
+		index_ret = check_changed_in_path_index(revs, commit);
+
+		if (index_ret == 0)
+			return REV_TREE_SAME;
+	}
+
+	if (revs->bloom_keyvecs_nr && !nth_parent && index_ret < 0) {
 		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
 
 		if (bloom_ret == 0)
@@ -816,7 +918,7 @@ static int rev_compare_tree(struct rev_info *revs,
 	revs->pruning.flags.has_changes = 0;
 	diff_tree_oid(&t1->object.oid, &t2->object.oid, "", &revs->pruning);
 
-	if (!nth_parent)
+	if (!nth_parent && index_ret < 0)
 		if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
 			count_bloom_filter_false_positive++;
 
@@ -827,12 +929,19 @@ static int rev_same_tree_as_empty(struct rev_info *revs, struct commit *commit,
 				  int nth_parent)
 {
 	struct tree *t1 = repo_get_commit_tree(the_repository, commit);
+	int index_ret = -1;
 	int bloom_ret = -1;
 
 	if (!t1)
 		return 0;
 
-	if (!nth_parent && revs->bloom_keyvecs_nr) {
+	if (!nth_parent && revs->path_index) {
+		index_ret = check_changed_in_path_index(revs, commit);
+		if (!index_ret)
+			return 1;
+	}
+
+	if (!nth_parent && revs->bloom_keyvecs_nr && index_ret < 0) {
 		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
 		if (!bloom_ret)
 			return 1;
@@ -3274,6 +3383,7 @@ void release_revisions(struct rev_info *revs)
 	line_log_free(revs);
 	oidset_clear(&revs->missing_commits);
 	release_revisions_bloom_keyvecs(revs);
+	path_index_filter_free(revs->path_index);
 }
 
 static void add_child(struct rev_info *revs, struct commit *parent, struct commit *child)
@@ -3965,8 +4075,10 @@ int prepare_revision_walk(struct rev_info *revs)
 		odb_for_each_object(revs->repo->objects, NULL, mark_uninteresting,
 				    revs, ODB_FOR_EACH_OBJECT_PROMISOR_ONLY);
 
-	if (!revs->reflog_info)
+	if (!revs->reflog_info) {
+		prepare_to_use_path_index(revs);
 		prepare_to_use_bloom_filter(revs);
+	}
 	if (!revs->unsorted_input)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
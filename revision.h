@@ -67,6 +67,7 @@ struct string_list;
 struct saved_parents;
 struct bloom_keyvec;
 struct bloom_filter_settings;
+struct path_index_filter;
 struct option;
 struct parse_opt_ctx_t;
 define_shared_commit_slab(revision_sources, char *);
@@ -372,6 +373,9 @@ struct rev_info {
 	 */
 	struct bloom_filter_settings *bloom_filter_settings;
 
+	/* The commit-graph path index for the pathspec, if any */
+	struct path_index_filter *path_index;
+
 	/* misc. flags related to '--no-kept-objects' */
 	unsigned keep_pack_cache_flags;
 
@@ -211,6 +211,28 @@ static GIT_PATH_FUNC(rebase_path_drop_redundant_commits, "rebase-merge/drop_redu
 static GIT_PATH_FUNC(rebase_path_keep_redundant_commits, "rebase-merge/keep_redundant_commits")
 static GIT_PATH_FUNC(rebase_path_trailer, "rebase-merge/trailer")
 
+/*
+ * An update of HEAD or of the sequencer state that is held back until
+ * the objects it refers to have been committed to the object database.
+ */
+struct deferred_update {
+	enum {
+		DEFERRED_SAVE_TODO,
+		DEFERRED_UPDATE_HEAD,
+		DEFERRED_REWRITTEN,
+	} type;
+	/* The todo item that has been started (DEFERRED_SAVE_TODO). */
+	int item;
+	/* The new commit (DEFERRED_UPDATE_HEAD, DEFERRED_REWRITTEN). */
+	struct object_id oid;
+	/* The arguments of update_head_with_reflog(). */
+	struct commit *old_head;
+	char *action;
+	struct strbuf msg;
+	/* The command following the rewritten one (DEFERRED_REWRITTEN). */
+	enum todo_command next_command;
+};
+
 /*
  * A 'struct replay_ctx' represents the private state of the sequencer.
  */
@@ -234,6 +256,23 @@ struct replay_ctx {
 	 * Whether message contains a commit message.
 	 */
 	unsigned have_message :1;
+	/*
+	 * Whether head holds the commit HEAD will point at once the
+	 * deferred updates have been done.
+	 */
+	unsigned have_head :1;
+	/*
+	 * With "core.packTransactions", a series of consecutive picks and
+	 * reverts writes all of its objects into this transaction. As
+	 * nothing may refer to them before it is committed, updating HEAD,
+	 * the todo list and the list of rewritten commits is deferred
+	 * until then; see commit_pick_series().
+	 */
+	struct odb_transaction *transaction;
+	struct todo_list *todo_list;
+	struct deferred_update *deferred;
+	size_t deferred_nr, deferred_alloc;
+	struct object_id head;
 };
 
 struct replay_ctx* replay_ctx_new(void)
@@ -407,6 +446,7 @@ static void replay_ctx_release(struct replay_ctx *ctx)
 {
 	strbuf_release(&ctx->current_fixups);
 	strbuf_release(&ctx->message);
+	free(ctx->deferred);
 }
 
 void replay_opts_release(struct replay_opts *opts)
@@ -629,6 +669,36 @@ static int error_dirty_index(struct repository *repo, struct replay_opts *opts)
 	return -1;
 }
 
+static int commit_pick_series(struct replay_opts *opts);
+
+static struct deferred_update *defer_update(struct replay_ctx *ctx, int type)
+{
+	struct deferred_update *update;
+
+	ALLOC_GROW(ctx->deferred, ctx->deferred_nr + 1, ctx->deferred_alloc);
+	update = &ctx->deferred[ctx->deferred_nr++];
+	memset(update, 0, sizeof(*update));
+	update->type = type;
+	strbuf_init(&update->msg, 0);
+
+	return update;
+}
+
+/*
+ * While a series of picks is pending, HEAD has not been updated yet. Returns
+ * 1 and stores the commit it is going to point at in "oid" in that case,
+ * and 0 if HEAD itself should be read.
+ */
+static int read_pending_head(struct replay_opts *opts, struct object_id *oid)
+{
+	struct replay_ctx *ctx = opts->ctx;
+
+	if (!ctx->transaction || !ctx->have_head)
+		return 0;
+	oidcpy(oid, &ctx->head);
+	return 1;
+}
+
 static void update_abort_safety_file(void)
 {
 	struct object_id head;
@@ -653,6 +723,9 @@ static int fast_forward_to(struct repository *r,
 	struct strbuf sb = STRBUF_INIT;
 	struct strbuf err = STRBUF_INIT;
 
+	if (commit_pick_series(opts))
+		return -1;
+
 	repo_read_index(r);
 	if (checkout_fast_forward(r, from, to, 1))
 		return -1; /* the callee should have complained already */
@@ -780,6 +853,15 @@ static int do_recursive_merge(struct repository *r,
 
 	memset(&result, 0, sizeof(result));
 	merge_incore_nonrecursive(&o, base_tree, head_tree, next_tree, &result);
+	/*
+	 * We are going to stop. Conflicts refer to the objects of the merge
+	 * via AUTO_MERGE, and the user needs to see the picks made so far.
+	 */
+	if (!result.clean && commit_pick_series(opts)) {
+		merge_finalize(&o, &result);
+		rollback_lock_file(&index_lock);
+		return -1;
+	}
 	show_output = !is_rebase_i(opts) || !result.clean;
 	/*
 	 * TODO: merge_switch_to_result will update index/working tree;
@@ -823,7 +905,7 @@ static struct object_id *get_cache_tree_oid(struct index_state *istate)
 	return &istate->cache_tree->oid;
 }
 
-static int is_index_unchanged(struct repository *r)
+static int is_index_unchanged(struct repository *r, struct replay_opts *opts)
 {
 	struct object_id head_oid, *cache_tree_oid;
 	const struct object_id *head_tree_oid;
@@ -831,7 +913,8 @@ static int is_index_unchanged(struct repository *r)
 	struct index_state *istate = r->index;
 	const char *head_name;
 
-	if (!refs_resolve_ref_unsafe(get_main_ref_store(the_repository), "HEAD", RESOLVE_REF_READING, &head_oid, NULL)) {
+	if (!read_pending_head(opts, &head_oid) &&
+	    !refs_resolve_ref_unsafe(get_main_ref_store(the_repository), "HEAD", RESOLVE_REF_READING, &head_oid, NULL)) {
 		/* Check to see if this is an unborn branch */
 		head_name = refs_resolve_ref_unsafe(get_main_ref_store(the_repository),
 						    "HEAD",
@@ -1494,12 +1577,13 @@ void print_commit_summary(struct repository *r,
 	strbuf_release(&format);
 }
 
-static int parse_head(struct repository *r, struct commit **head)
+static int parse_head(struct repository *r, struct replay_opts *opts,
+		      struct commit **head)
 {
 	struct commit *current_head;
 	struct object_id oid;
 
-	if (repo_get_oid(r, "HEAD", &oid)) {
+	if (!read_pending_head(opts, &oid) && repo_get_oid(r, "HEAD", &oid)) {
 		current_head = NULL;
 	} else {
 		current_head = lookup_commit_reference(r, &oid);
@@ -1532,6 +1616,7 @@ static int try_to_commit(struct repository *r,
 			 struct replay_opts *opts, unsigned int flags,
 			 struct object_id *oid)
 {
+	struct replay_ctx *ctx = opts->ctx;
 	struct object_id tree;
 	struct commit *current_head = NULL;
 	struct commit_list *parents = NULL;
@@ -1544,7 +1629,7 @@ static int try_to_commit(struct repository *r,
 	enum commit_msg_cleanup_mode cleanup;
 	int res = 0;
 
-	if (parse_head(r, &current_head))
+	if (parse_head(r, opts, &current_head))
 		return -1;
 
 	if (flags & AMEND_MSG) {
@@ -1604,6 +1689,10 @@ static int try_to_commit(struct repository *r,
 	}
 
 	if (hook_exists(r, "prepare-commit-msg")) {
+		if (commit_pick_series(opts)) {
+			res = -1;
+			goto out;
+		}
 		res = run_prepare_commit_msg_hook(r, msg, hook_commit);
 		if (res)
 			goto out;
@@ -1688,12 +1777,26 @@ static int try_to_commit(struct repository *r,
 		goto out;
 	}
 
-	if (update_head_with_reflog(current_head, oid, reflog_action,
-				    msg, &err)) {
+	if (ctx->transaction) {
+		struct deferred_update *update =
+			defer_update(ctx, DEFERRED_UPDATE_HEAD);
+
+		update->old_head = current_head;
+		oidcpy(&update->oid, oid);
+		update->action = xstrdup_or_null(reflog_action);
+		strbuf_addbuf(&update->msg, msg);
+		oidcpy(&ctx->head, oid);
+		ctx->have_head = 1;
+	} else if (update_head_with_reflog(current_head, oid, reflog_action,
+					   msg, &err)) {
 		res = error("%s", err.buf);
 		goto out;
 	}
 
+	if (hook_exists(r, "post-commit") && commit_pick_series(opts)) {
+		res = -1;
+		goto out;
+	}
 	run_commit_hook(0, r->index_file, NULL, "post-commit", NULL);
 	if (flags & AMEND_MSG)
 		commit_post_rewrite(r, current_head, oid);
@@ -1748,6 +1851,8 @@ static int do_commit(struct repository *r,
 		}
 	}
 	if (res == 1) {
+		if (commit_pick_series(opts))
+			return -1;
 		if (is_rebase_i(opts) && oid)
 			if (write_rebase_head(oid))
 			    return -1;
@@ -1798,7 +1903,7 @@ static int allow_empty(struct repository *r,
 	 * drop_redundant_commits determine whether the commit should be kept or
 	 * dropped. If neither is specified, halt.
 	 */
-	index_unchanged = is_index_unchanged(r);
+	index_unchanged = is_index_unchanged(r, opts);
 	if (index_unchanged < 0)
 		return index_unchanged;
 	if (!index_unchanged)
@@ -2293,7 +2398,8 @@ static int do_pick_commit(struct repository *r,
 		if (write_index_as_tree(&head, r->index, r->index_file, 0, NULL))
 			return error(_("your index file is unmerged."));
 	} else {
-		unborn = repo_get_oid(r, "HEAD", &head);
+		unborn = !read_pending_head(opts, &head) &&
+			 repo_get_oid(r, "HEAD", &head);
 		/* Do we want to generate a root commit? */
 		if (is_pick_or_similar(command) && opts->have_squash_onto &&
 		    oideq(&head, &opts->squash_onto)) {
@@ -2303,7 +2409,7 @@ static int do_pick_commit(struct repository *r,
 			unborn = 1;
 		} else if (unborn)
 			oidcpy(&head, the_hash_algo->empty_tree);
-		if (index_differs_from(r, unborn ? empty_tree_oid_hex(the_repository->hash_algo) : "HEAD",
+		if (index_differs_from(r, unborn ? empty_tree_oid_hex(the_repository->hash_algo) : oid_to_hex(&head),
 				       NULL, 0))
 			return error_dirty_index(r, opts);
 	}
@@ -2458,9 +2564,13 @@ static int do_pick_commit(struct repository *r,
 
 		commit_list_insert(base, &common);
 		commit_list_insert(next, &remotes);
-		res |= try_merge_command(r, opts->strategy,
-					 opts->xopts.nr, opts->xopts.v,
-					common, oid_to_hex(&head), remotes);
+		if (commit_pick_series(opts))
+			res = -1;
+		else
+			res |= try_merge_command(r, opts->strategy,
+						 opts->xopts.nr, opts->xopts.v,
+						 common, oid_to_hex(&head),
+						 remotes);
 		commit_list_free(common);
 		commit_list_free(remotes);
 	}
@@ -2545,7 +2655,8 @@ static int do_pick_commit(struct repository *r,
 leave:
 	free_message(commit, &msg);
 	free(author);
-	update_abort_safety_file();
+	if (!ctx->transaction)
+		update_abort_safety_file();
 
 	return res;
 }
@@ -3666,6 +3777,98 @@ static int save_todo(struct todo_list *todo_list, struct replay_opts *opts,
 	return 0;
 }
 
+static int run_deferred_update(struct replay_opts *opts,
+			       struct deferred_update *update)
+{
+	struct replay_ctx *ctx = opts->ctx;
+	struct strbuf err = STRBUF_INIT;
+	int res = 0;
+
+	switch (update->type) {
+	case DEFERRED_SAVE_TODO:
+		ctx->todo_list->current = update->item;
+		res = save_todo(ctx->todo_list, opts, 0);
+		break;
+	case DEFERRED_UPDATE_HEAD:
+		if (update_head_with_reflog(update->old_head, &update->oid,
+					    update->action, &update->msg, &err))
+			res = error("%s", err.buf);
+		break;
+	case DEFERRED_REWRITTEN:
+		record_in_rewritten(&update->oid, update->next_command);
+		break;
+	}
+
+	strbuf_release(&err);
+	return res;
+}
+
+/*
+ * Commits the objects written by a series of picks to the object database
+ * and then performs the updates that have been deferred until then.
+ */
+static int commit_pick_series(struct replay_opts *opts)
+{
+	struct replay_ctx *ctx = opts->ctx;
+	int current, res = 0;
+
+	if (!ctx->transaction)
+		return 0;
+
+	odb_transaction_commit(ctx->transaction);
+	ctx->transaction = NULL;
+	ctx->have_head = 0;
+
+	current = ctx->todo_list->current;
+	for (size_t i = 0; i < ctx->deferred_nr; i++) {
+		struct deferred_update *update = &ctx->deferred[i];
+
+		if (!res)
+			res = run_deferred_update(opts, update);
+		free(update->action);
+		strbuf_release(&update->msg);
+	}
+	ctx->todo_list->current = current;
+	ctx->deferred_nr = 0;
+
+	update_abort_safety_file();
+	return res;
+}
+
+/*
+ * Adds the current todo item to the pending series of picks, starting one
+ * if needed. Returns 0 if the item cannot be part of a series, in which
+ * case the caller has to commit the pending one before running it.
+ */
+static int continue_pick_series(struct repository *r,
+				struct todo_list *todo_list,
+				struct replay_opts *opts)
+{
+	struct replay_ctx *ctx = opts->ctx;
+	struct todo_item *item = todo_list->items + todo_list->current;
+	struct deferred_update *update;
+
+	/*
+	 * Editing the message runs "git commit", and every ref update runs
+	 * the reference-transaction hook, which would require committing
+	 * the series after each pick anyway.
+	 */
+	if ((item->command != TODO_PICK && item->command != TODO_REVERT) ||
+	    should_edit(opts) || hook_exists(r, "reference-transaction"))
+		return 0;
+
+	if (!ctx->transaction) {
+		ctx->transaction = odb_transaction_begin_pack(r->objects);
+		if (!ctx->transaction)
+			return 0;
+		ctx->todo_list = todo_list;
+	}
+
+	update = defer_update(ctx, DEFERRED_SAVE_TODO);
+	update->item = todo_list->current;
+	return 1;
+}
+
 static int save_opts(struct replay_opts *opts)
 {
 	const char *opts_file = git_path_opts_file();
@@ -4914,12 +5117,15 @@ static int pick_one_commit(struct repository *r,
 			   struct replay_opts *opts,
 			   int *check_todo, int* reschedule)
 {
+	struct replay_ctx *ctx = opts->ctx;
 	int res;
 	struct todo_item *item = todo_list->items + todo_list->current;
 	const char *arg = todo_item_get_arg(todo_list, item);
 
 	res = do_pick_commit(r, item, opts, is_final_fixup(todo_list),
 			     check_todo);
+	if (res && commit_pick_series(opts))
+		res = -1;
 	if (is_rebase_i(opts) && res < 0) {
 		/* Reschedule */
 		*reschedule = 1;
@@ -4936,9 +5142,16 @@ static int pick_one_commit(struct repository *r,
 		return error_with_patch(r, commit,
 					arg, item->arg_len, opts, res, !res);
 	}
-	if (is_rebase_i(opts) && !res)
+	if (is_rebase_i(opts) && !res && ctx->transaction) {
+		struct deferred_update *update =
+			defer_update(ctx, DEFERRED_REWRITTEN);
+
+		oidcpy(&update->oid, &item->commit->object.oid);
+		update->next_command = peek_command(todo_list, 1);
+	} else if (is_rebase_i(opts) && !res) {
 		record_in_rewritten(&item->commit->object.oid,
 				    peek_command(todo_list, 1));
+	}
 	if (res && is_fixup(item->command)) {
 		if (res == 1)
 			intend_to_amend();
@@ -4993,7 +5206,9 @@ static int pick_commits(struct repository *r,
 		const char *arg = todo_item_get_arg(todo_list, item);
 		int check_todo = 0;
 
-		if (save_todo(todo_list, opts, reschedule))
+		if (!continue_pick_series(r, todo_list, opts) &&
+		    (commit_pick_series(opts) ||
+		     save_todo(todo_list, opts, reschedule)))
 			return -1;
 		if (is_rebase_i(opts)) {
 			if (item->command != TODO_COMMENT) {
@@ -5093,6 +5308,9 @@ static int pick_commits(struct repository *r,
 		todo_list->current++;
 	}
 
+	if (commit_pick_series(opts))
+		return -1;
+
 	if (is_rebase_i(opts)) {
 		struct strbuf head_ref = STRBUF_INIT, buf = STRBUF_INIT;
 		struct stat st;
@@ -5346,7 +5564,7 @@ static int commit_staged_changes(struct repository *r,
 				const char *path = rebase_path_squash_msg();
 				const char *encoding = get_commit_output_encoding();
 
-				if (parse_head(r, &commit)) {
+				if (parse_head(r, opts, &commit)) {
 					ret = error(_("could not parse HEAD"));
 					goto out;
 				}
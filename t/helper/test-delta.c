@@ -12,9 +12,75 @@
 #include "git-compat-util.h"
 #include "delta.h"
 #include "strbuf.h"
+#include "trace.h"
 
 static const char usage_str[] =
-	"test-tool delta (-d|-p) <from_file> <data_file> <out_file>";
+	"test-tool delta (-d|-p) <from_file> <data_file> <out_file>\n"
+	"   or: test-tool delta --bench <from_file> <data_file> [<count>]";
+
+static double mb_per_sec(unsigned long bytes, uint64_t ns)
+{
+	return ns ? bytes * 1e3 / ns : 0;
+}
+
+/*
+ * Index <from_file> and compute its delta against <data_file> "count"
+ * times, and report how fast both steps went.
+ */
+static int bench_delta(int argc, const char **argv)
+{
+	struct strbuf from = STRBUF_INIT, data = STRBUF_INIT;
+	uint64_t index_ns = 0, delta_ns = 0;
+	unsigned long delta_size = 0;
+	int i, count = 10;
+
+	if (argc != 4 && argc != 5)
+		usage(usage_str);
+	if (argc == 5 && (count = atoi(argv[4])) <= 0)
+		die("invalid count '%s'", argv[4]);
+
+	if (strbuf_read_file(&from, argv[2], 0) < 0)
+		die_errno("unable to read '%s'", argv[2]);
+	if (strbuf_read_file(&data, argv[3], 0) < 0)
+		die_errno("unable to read '%s'", argv[3]);
+
+	for (i = 0; i < count; i++) {
+		struct delta_index *index;
+		void *delta, *check;
+		unsigned long check_size;
+		uint64_t t0, t1, t2;
+
+		t0 = getnanotime();
+		index = create_delta_index(from.buf, from.len);
+		t1 = getnanotime();
+		delta = create_delta(index, data.buf, data.len, &delta_size, 0);
+		t2 = getnanotime();
+		if (!index || !delta)
+			die("delta operation failed (returned NULL)");
+
+		check = patch_delta(from.buf, from.len, delta, delta_size,
+				    &check_size);
+		if (!check || check_size != data.len ||
+		    memcmp(check, data.buf, data.len))
+			die("delta does not reproduce '%s'", argv[3]);
+
+		index_ns += t1 - t0;
+		delta_ns += t2 - t1;
+		free(check);
+		free(delta);
+		free_delta_index(index);
+	}
+
+	printf("delta size: %lu\n", delta_size);
+	printf("index: %.1f MB/s\n",
+	       mb_per_sec(from.len * (unsigned long)count, index_ns));
+	printf("delta: %.1f MB/s\n",
+	       mb_per_sec(data.len * (unsigned long)count, delta_ns));
+
+	strbuf_release(&from);
+	strbuf_release(&data);
+	return 0;
+}
 
 int cmd__delta(int argc, const char **argv)
 {
@@ -23,6 +89,8 @@ int cmd__delta(int argc, const char **argv)
 	char *out_buf;
 	unsigned long out_size;
 
+	if (argc > 1 && !strcmp(argv[1], "--bench"))
+		return bench_delta(argc, argv);
 	if (argc != 5 || (strcmp(argv[1], "-d") && strcmp(argv[1], "-p")))
 		usage(usage_str);
 
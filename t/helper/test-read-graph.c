@@ -34,6 +34,8 @@ static void dump_graph_info(struct commit_graph *graph)
 		printf(" bloom_indexes");
 	if (graph->chunk_bloom_data)
 		printf(" bloom_data");
+	if (graph->chunk_path_index)
+		printf(" path_index");
 	printf("\n");
 
 	printf("options:");
@@ -0,0 +1,28 @@
+#!/bin/sh
+
+test_description='Tests inflating many small objects'
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'setup' '
+	git cat-file --batch-all-objects --batch-check="%(objectname) %(objecttype)" |
+	sed -n "s/ tree$//p" >trees &&
+
+	# Write the trees of HEAD as loose objects into a separate repository.
+	git ls-tree -r -d --format="%(objectname)" HEAD >loose-trees &&
+	git rev-parse HEAD^{tree} >>loose-trees &&
+	git init --bare loose.git &&
+	git pack-objects --stdout <loose-trees |
+	git -C loose.git unpack-objects -q
+'
+
+test_perf 'inflate all packed trees' '
+	git cat-file --batch <trees >/dev/null
+'
+
+test_perf 'inflate loose trees' '
+	git -C loose.git cat-file --batch <loose-trees >/dev/null
+'
+
+test_done
@@ -0,0 +1,37 @@
+#!/bin/sh
+
+test_description='Tests computing deltas between blobs'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'setup' '
+	# The largest blob at HEAD, and its version from before the
+	# last commit that touched it.
+	git ls-tree -r -l HEAD |
+	sort -n -k 4 |
+	tail -n 1 |
+	cut -f 2 >path &&
+	path=$(cat path) &&
+	git cat-file blob "HEAD:$path" >new &&
+	commit=$(git rev-list -1 HEAD -- "$path") &&
+	if git cat-file -e "$commit^:$path" 2>/dev/null
+	then
+		git cat-file blob "$commit^:$path" >old
+	else
+		cp new old
+	fi &&
+
+	test-tool genrandom a 1048576 >random-a &&
+	test-tool genrandom b 1048576 >random-b
+'
+
+test_perf 'delta against previous version' '
+	test-tool delta --bench old new 20
+'
+
+test_perf 'delta between unrelated random data' '
+	test-tool delta --bench random-a random-b 5
+'
+
+test_done
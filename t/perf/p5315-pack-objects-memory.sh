@@ -0,0 +1,43 @@
+#!/bin/sh
+
+test_description='Tests memory usage of pack-objects'
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+# Print the largest peak RSS (in bytes) reported by any process in
+# "trace.event".
+peak_rss () {
+	sed -n 's/.*"linux\/memory","value":{[^}]*"VmHWM":\([0-9]*\)}.*/\1/p' \
+		trace.event | sort -n | tail -n 1
+}
+
+test_expect_success 'setup' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git version &&
+	if test -n "$(peak_rss)"
+	then
+		test_set_prereq PEAK_RSS
+	fi
+'
+
+test_size 'peak RSS of pack-objects --all' --prereq PEAK_RSS '
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git pack-objects --stdout --revs --all --delta-base-offset \
+		</dev/null >/dev/null &&
+	peak_rss
+'
+
+test_size 'peak RSS of repack -adf' --prereq PEAK_RSS '
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git repack -adf &&
+	peak_rss
+'
+
+test_size 'peak RSS of repack -adf --path-walk' --prereq PEAK_RSS '
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git repack -adf --path-walk &&
+	peak_rss
+'
+
+test_done
@@ -84,4 +84,31 @@ test_expect_success 'pack refs' '
 '
 run_tests "packed"
 
+test_expect_success 'setup ahead-behind' '
+	git commit-graph write --reachable &&
+
+	# Topic branches which each add a commit on top of HEAD~N.
+	head=$(git rev-parse HEAD) &&
+	for i in $(test_seq $ref_count_per_type)
+	do
+		echo "commit refs/topics/topic_$i" &&
+		printf "committer %s <%s> %s\n" \
+			"$GIT_COMMITTER_NAME" \
+			"$GIT_COMMITTER_EMAIL" \
+			"$GIT_COMMITTER_DATE" &&
+		echo "data <<EOF" &&
+		echo "topic $i" &&
+		echo "EOF" &&
+		echo "from $head~$i" || return 1
+	done | git fast-import
+'
+
+test_for_each_ref "ahead-behind" '--format="%(ahead-behind:HEAD)"' refs/topics/
+
+test_expect_success 'write bitmaps' '
+	git repack -adb
+'
+
+test_for_each_ref "ahead-behind, bitmaps" '--format="%(ahead-behind:HEAD)"' refs/topics/
+
 test_done
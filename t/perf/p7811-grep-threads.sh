@@ -0,0 +1,37 @@
+#!/bin/sh
+
+test_description="git-grep scaling with the number of threads
+
+Grepping a revision (rather than the worktree) makes every worker thread
+read blobs out of the object database, so this mostly measures how well
+concurrent object reads scale. Inflating objects and applying deltas happen
+outside of the object read lock, but looking up objects and managing pack
+windows does not.
+
+The blobs at HEAD are mostly delta bases, so grepping it hardly applies any
+deltas. An older revision is grepped as well, whose blobs are mostly stored
+as deltas against newer ones.
+"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'set up old revision' '
+	old=$(git rev-list --first-parent -1000 HEAD | tail -n 1) &&
+	git tag -f grep-old $old
+'
+
+for t in 1 2 4 8 16 32
+do
+	THREADS=$t
+	export THREADS
+	test_perf "grep -e x HEAD, $t threads" '
+		git grep --threads=$THREADS -e x HEAD >/dev/null || :
+	'
+	test_perf "grep -e x old revision, $t threads" '
+		git grep --threads=$THREADS -e x grep-old >/dev/null || :
+	'
+done
+
+test_done
@@ -611,6 +611,16 @@ flush"
 	test_cmp expect_nul actual
     '
 
+    test_expect_success '--batch-command --threads gives correct format' '
+	echo "$batch_command_multiple_contents" >in &&
+	git cat-file --batch-command --buffer --threads=4 <in >actual &&
+	test_cmp expect actual &&
+
+	echo "$batch_command_multiple_contents" | tr "\n" "\0" >in &&
+	git cat-file --batch-command --buffer --threads=4 -Z <in >actual &&
+	test_cmp expect_nul actual
+    '
+
 }
 
 batch_tests $hello_oid $tree_oid $tree_size $commit_oid $commit_size "$commit_content" $tag_oid $tag_size "$tag_content"
@@ -1351,6 +1361,60 @@ test_expect_success 'batch-command flush without --buffer' '
 	grep "^fatal:.*flush is only for --buffer mode.*" err
 '
 
+test_expect_success '--threads requires --batch-command' '
+	test_expect_code 129 git cat-file --batch --threads=2 </dev/null 2>err &&
+	test_grep "the option .--threads. requires .--batch-command." err
+'
+
+test_expect_success 'batch-command --threads reads ahead in request order' '
+	test_when_finished "rm -rf threads" &&
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 20)
+		do
+			test_seq $i 100 >file &&
+			git add file &&
+			git commit -q -m "$i" || return 1
+		done &&
+		git repack -ad &&
+
+		git rev-list --objects --all >objs &&
+		cut -d" " -f1 objs | sort -r >oids &&
+		{
+			sed -e "s/^/contents /" -e "5s/^contents/info/" oids &&
+			echo "contents HEAD:file" &&
+			echo "contents HEAD:missing" &&
+			echo flush &&
+			sed -e "s/^/contents /" oids
+		} >cmd &&
+
+		git cat-file --batch-command --buffer <cmd >expect &&
+		git cat-file --batch-command --buffer --threads=4 <cmd >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'batch-command --threads does not repeat ambiguity errors' '
+	test_when_finished "rm -rf ambiguous" &&
+	git init ambiguous &&
+	(
+		cd ambiguous &&
+		# Both start with "beef..", under both SHA-1 and SHA-256
+		echo 1agllotbh | git hash-object -w --stdin &&
+		echo 1bbfctrkc | git hash-object -w --stdin &&
+
+		echo "contents beef" >cmd &&
+		git cat-file --batch-command --buffer <cmd >expect 2>expect.err &&
+		git cat-file --batch-command --buffer --threads=2 \
+			<cmd >actual 2>actual.err &&
+		test_cmp expect actual &&
+		test_cmp expect.err actual.err &&
+		grep "is ambiguous" actual.err >errors &&
+		test_line_count = 1 errors
+	)
+'
+
 perl_script='
 use warnings;
 use strict;
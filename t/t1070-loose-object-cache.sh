@@ -0,0 +1,136 @@
+#!/bin/sh
+
+test_description='persistent loose object cache'
+
+. ./test-lib.sh
+
+objdir=.git/objects
+
+# Move the mtime of all loose object directories into the past, so that
+# the cache written afterwards does not consider them racy.
+age_loose_dirs () {
+	test-tool chmtime =-60 $objdir/?? &&
+	git prune-packed
+}
+
+test_expect_success 'setup' '
+	git config core.looseObjectCache true &&
+	for i in $(test_seq 1 20)
+	do
+		echo $i >file.$i || return 1
+	done &&
+	git add file.* &&
+	test_path_is_file $objdir/info/loose-cache
+'
+
+test_expect_success 'cache is not written when disabled' '
+	test_when_finished "rm -rf disabled" &&
+	git init disabled &&
+	echo content >disabled/file &&
+	git -C disabled add file &&
+	test_path_is_missing disabled/.git/objects/info/loose-cache
+'
+
+test_expect_success 'lookups are unaffected by the cache' '
+	git ls-files -s >files &&
+	oid=$(git rev-parse :file.1) &&
+	short=$(git rev-parse --short=4 $oid) &&
+	git -c core.looseObjectCache=false \
+		rev-parse --disambiguate=$short >expect &&
+	git rev-parse --disambiguate=$short >actual &&
+	test_cmp expect actual &&
+	git rev-parse --short $oid >actual &&
+	git -c core.looseObjectCache=false rev-parse --short $oid >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unmodified directories are not read' '
+	age_loose_dirs &&
+	oid=$(git rev-parse :file.1) &&
+	short=$(git rev-parse --short=4 $oid) &&
+	file=$objdir/$(echo $oid | sed "s,..,&/,") &&
+	dir=${file%/*} &&
+
+	# Remove the object behind the back of the cache.
+	mtime=$(test-tool chmtime --get $dir) &&
+	mv $file hidden &&
+	test-tool chmtime =$mtime $dir &&
+
+	git rev-parse --disambiguate=$short >actual &&
+	test_grep $oid actual &&
+	git -c core.looseObjectCache=false \
+		rev-parse --disambiguate=$short >actual &&
+	test_grep ! $oid actual
+'
+
+test_expect_success 'modified directories are read again' '
+	test-tool chmtime =-30 $dir &&
+	git rev-parse --disambiguate=$short >actual &&
+	test_grep ! $oid actual &&
+	mv hidden $file
+'
+
+test_expect_success 'writing objects updates the cache' '
+	age_loose_dirs &&
+	cp $objdir/info/loose-cache old-cache &&
+	echo new >file.new &&
+	git add file.new &&
+	! test_cmp_bin old-cache $objdir/info/loose-cache &&
+	oid=$(git rev-parse :file.new) &&
+	git rev-parse --disambiguate=$(git rev-parse --short=4 $oid) >actual &&
+	test_grep $oid actual
+'
+
+test_expect_success 'reading a stale directory leaves the cache alone' '
+	age_loose_dirs &&
+	oid=$(git rev-parse :file.3) &&
+	short=$(git rev-parse --short=4 $oid) &&
+	test-tool chmtime =-30 $objdir/$(echo $oid | cut -c1-2) &&
+	cp $objdir/info/loose-cache old-cache &&
+	git rev-parse --disambiguate=$short >actual &&
+	test_grep $oid actual &&
+	test_cmp_bin old-cache $objdir/info/loose-cache &&
+	test_path_is_missing $objdir/info/loose-cache.lock &&
+
+	# prune-packed brings the stale directory up-to-date.
+	git prune-packed &&
+	! test_cmp_bin old-cache $objdir/info/loose-cache &&
+	git rev-parse --disambiguate=$short >actual &&
+	test_grep $oid actual
+'
+
+test_expect_success 'pushing objects updates the cache' '
+	test_when_finished "rm -rf remote.git" &&
+	git init --bare remote.git &&
+	git -C remote.git config core.looseObjectCache true &&
+	git -C remote.git config receive.unpackLimit 1000 &&
+	git commit -q -m base &&
+	git push -q remote.git HEAD:refs/heads/main &&
+	test_path_is_file remote.git/objects/info/loose-cache &&
+	test-tool chmtime =-60 remote.git/objects/?? &&
+	git -C remote.git prune-packed &&
+
+	cp remote.git/objects/info/loose-cache old-cache &&
+	echo pushed >file.pushed &&
+	git add file.pushed &&
+	git commit -q -m pushed &&
+	git push -q remote.git HEAD:refs/heads/main &&
+	! test_cmp_bin old-cache remote.git/objects/info/loose-cache &&
+	test_path_is_missing remote.git/objects/tmp_objdir-* &&
+	oid=$(git rev-parse HEAD:file.pushed) &&
+	git -C remote.git rev-parse --disambiguate=$(git rev-parse --short=4 $oid) >actual &&
+	test_grep $oid actual
+'
+
+test_expect_success 'corrupt caches are ignored' '
+	test_when_finished "rm -f $objdir/info/loose-cache" &&
+	chmod +w $objdir/info/loose-cache &&
+	printf "xxxx" | dd of=$objdir/info/loose-cache bs=1 conv=notrunc &&
+	oid=$(git rev-parse :file.2) &&
+	git rev-parse --disambiguate=$(git rev-parse --short=4 $oid) \
+		>actual 2>err &&
+	test_grep $oid actual &&
+	test_grep "has unknown signature" err
+'
+
+test_done
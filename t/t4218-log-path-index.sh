@@ -0,0 +1,167 @@
+#!/bin/sh
+
+test_description='git log for a path with a commit-graph path index'
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-chunk.sh
+
+GIT_TEST_COMMIT_GRAPH=0
+GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS=0
+
+# Turn off any inherited trace2 settings for this test.
+sane_unset GIT_TRACE2 GIT_TRACE2_PERF GIT_TRACE2_EVENT
+sane_unset GIT_TRACE2_PERF_BRIEF
+sane_unset GIT_TRACE2_CONFIG_PARAMS
+
+test_expect_success 'setup' '
+	mkdir -p A/B/C D &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 D/file4 &&
+	test_commit c5 A/file1 &&
+	test_commit c6 A/B/file2 &&
+	git checkout -b side HEAD~2 &&
+	test_commit side-1 A/B/file5 &&
+	test_commit side-2 D/file4 &&
+	git checkout main &&
+	git merge side &&
+	test_commit c7 A/B/C/file3 &&
+	git rm -r D &&
+	git commit -m "remove D" &&
+	git commit --allow-empty -m "empty" &&
+
+	git config commitGraph.pathIndex A/B/ &&
+	git config --add commitGraph.pathIndex D &&
+	git config --add commitGraph.pathIndex A/file1 &&
+	git commit-graph write --reachable
+'
+
+test_expect_success 'commit-graph write wrote out the path index chunk' '
+	test-tool read-graph >actual &&
+	grep "^chunks: .* path_index$" actual
+'
+
+test_expect_success 'rewriting the commit-graph reuses the path index' '
+	cp .git/objects/info/commit-graph old-graph &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git commit-graph write --reachable &&
+	test_trace2_data commit-graph path-index/reused 12 <trace.event &&
+	test_trace2_data commit-graph path-index/computed 0 <trace.event &&
+	test_cmp_bin old-graph .git/objects/info/commit-graph
+'
+
+test_expect_success 'the path index is not reused for different paths' '
+	test_when_finished "git commit-graph write --reachable" &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c commitGraph.pathIndex=A commit-graph write --reachable &&
+	test_trace2_data commit-graph path-index/reused 0 <trace.event &&
+	test_trace2_data commit-graph path-index/computed 12 <trace.event
+'
+
+setup () {
+	rm -f "$TRASH_DIRECTORY/trace.perf" &&
+	git -c core.commitGraph=false log --pretty="format:%s" "$@" >expect &&
+	GIT_TRACE2_PERF="$TRASH_DIRECTORY/trace.perf" \
+		git log --pretty="format:%s" "$@" >actual &&
+	test_cmp expect actual
+}
+
+# test_path_index_used <unknown> <log args>...
+test_path_index_used () {
+	unknown=$1 &&
+	shift &&
+	setup "$@" &&
+	grep "path-index.*statistics:{\"unknown\":$unknown," \
+		"$TRASH_DIRECTORY/trace.perf"
+}
+
+test_path_index_not_used () {
+	setup "$@" &&
+	if grep "path-index.*statistics" "$TRASH_DIRECTORY/trace.perf"
+	then
+		# if a path index was loaded, ensure that it did not
+		# answer for any commit
+		grep "path-index.*statistics:{\"unknown\":[0-9]*,\"changed\":0,\"unchanged\":0}" \
+			"$TRASH_DIRECTORY/trace.perf"
+	fi
+}
+
+for path in A/B D A/file1 A/B/file2 A/B/C A/B/C/file3 "A/B/*"
+do
+	for option in "" \
+		      "--full-history" \
+		      "--simplify-merges" \
+		      "--first-parent" \
+		      "--topo-order"
+	do
+		test_expect_success "path index used for $path with '$option'" '
+			test_path_index_used "[0-9]*" $option -- "$path"
+		'
+	done
+done
+
+test_expect_success 'path index answers for indexed paths' '
+	test_path_index_used 0 -- A/B &&
+	test_path_index_used 0 -- D A/file1
+'
+
+test_expect_success 'paths below an indexed directory fall back when changed' '
+	# c3 and c7 change A/B/C/file3, and c2, c6 and the merge change
+	# other paths in A/B, so the path index cannot tell for those
+	# commits. side-1 is not visited, as the merge is TREESAME to its
+	# first parent.
+	test_path_index_used 5 -- A/B/C
+'
+
+test_expect_success 'path index not used for paths it does not cover' '
+	test_path_index_not_used -- A &&
+	test_path_index_not_used -- A/B D/file4 E
+'
+
+test_expect_success 'path index not used with pathspec magic' '
+	test_path_index_not_used -- ":(icase)d"
+'
+
+test_expect_success 'layers without a path index are not used' '
+	test_when_finished "rm -rf .git/objects/info/commit-graph*" &&
+	rm -f .git/objects/info/commit-graph &&
+	git -c commitGraph.pathIndex= commit-graph write --reachable \
+		--split=no-merge 2>err &&
+	mkdir D &&
+	test_commit c8 D/file4 &&
+	git commit-graph write --reachable --split=no-merge &&
+	test_line_count = 2 .git/objects/info/commit-graphs/commit-graph-chain &&
+	test_path_index_used "[1-9][0-9]*" -- D
+'
+
+test_expect_success 'invalid paths are ignored' '
+	test_when_finished "git commit-graph write --reachable" &&
+	git -c commitGraph.pathIndex=./A -c commitGraph.pathIndex=/D \
+		commit-graph write --reachable 2>err &&
+	test_grep "ignoring invalid commitGraph.pathIndex path ${SQ}./A${SQ}" err &&
+	test_grep "ignoring invalid commitGraph.pathIndex path ${SQ}/D${SQ}" err &&
+	test-tool read-graph >actual &&
+	grep "^chunks: .* path_index$" actual
+'
+
+test_expect_success 'no path index is written without paths' '
+	test_when_finished "git commit-graph write --reachable" &&
+	git -c commitGraph.pathIndex= commit-graph write --reachable 2>err &&
+	test-tool read-graph >actual &&
+	! grep path_index actual
+'
+
+test_expect_success 'corrupt path index is ignored' '
+	test_when_finished "git commit-graph write --reachable" &&
+	corrupt_chunk_file .git/objects/info/commit-graph PIDX 4 00000001 &&
+	git log --pretty="format:%s" -- D >actual 2>err &&
+	git -c core.commitGraph=false log --pretty="format:%s" -- D >expect &&
+	test_cmp expect actual &&
+	test_grep "ignoring corrupt path index" err
+'
+
+test_done
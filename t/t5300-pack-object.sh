@@ -742,4 +742,81 @@ test_expect_success '--path-walk thin pack' '
 	git -C server index-pack --fix-thin --stdin <out.pack
 '
 
+test_expect_success 'reusing large packs verbatim to pipes and files' '
+	git init large &&
+	(
+		cd large &&
+		test-tool genrandom a 300000 >a &&
+		test-tool genrandom b 300000 >b &&
+		git add a b &&
+		git commit -m large &&
+		git repack -adb &&
+		git rev-parse HEAD >in &&
+
+		git pack-objects --stdout --revs <in >file.pack &&
+		git pack-objects --stdout --revs <in | cat >pipe.pack &&
+		test_cmp_bin file.pack pipe.pack &&
+		git index-pack file.pack &&
+		git verify-pack file.idx
+	)
+'
+
+test_expect_success 'writing objects with threads' '
+	git init threaded &&
+	(
+		cd threaded &&
+		test_seq 1000 >file &&
+		for i in $(test_seq 20)
+		do
+			echo $i >>file &&
+			git add file &&
+			git commit -q -m $i || return 1
+		done &&
+		test-tool genrandom big 100000 >big &&
+		git add big &&
+		git commit -m big &&
+		git rev-list --objects --all >in &&
+
+		git -c core.bigFileThreshold=50k pack-objects --stdout \
+			--threads=1 --window=0 --no-reuse-object <in >one.pack &&
+		GIT_TEST_PACK_WRITE_PIPELINE=1 \
+		git -c core.bigFileThreshold=50k pack-objects --stdout \
+			--threads=4 --window=0 --no-reuse-object <in >four.pack &&
+		test_cmp_bin one.pack four.pack &&
+
+		GIT_TEST_PACK_WRITE_PIPELINE=1 \
+		git pack-objects --stdout --threads=4 --no-reuse-delta \
+			<in >delta.pack &&
+		git index-pack delta.pack &&
+		git verify-pack -v delta.idx >out &&
+		grep chain out
+	)
+'
+
+test_expect_success 'delta search reports per-thread statistics' '
+	(
+		cd threaded &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git pack-objects --stdout --threads=2 --no-reuse-delta \
+			<in >/dev/null &&
+		grep "\"key\":\"delta-search\"" trace.event >stats &&
+		grep "\"threads\":\[{\"busy_us\":[0-9]*,\"idle_us\":" stats
+	)
+'
+
+test_expect_success 'index-pack hashes objects with threads' '
+	(
+		cd threaded &&
+		git -c core.bigFileThreshold=50k index-pack --threads=1 \
+			-o one-serial.idx one.pack &&
+		git -c core.bigFileThreshold=50k index-pack --threads=4 \
+			--strict -o one-threaded.idx one.pack &&
+		test_cmp_bin one-serial.idx one-threaded.idx &&
+		git index-pack --threads=1 -o delta-serial.idx delta.pack &&
+		GIT_FORCE_THREADS=1 git index-pack --threads=1 --strict \
+			-o delta-threaded.idx delta.pack &&
+		test_cmp_bin delta-serial.idx delta-threaded.idx
+	)
+'
+
 test_done
@@ -293,6 +293,58 @@ test_expect_success 'too-large packs report the breach' '
 	grep "maximum allowed size (20 bytes)" err
 '
 
+test_expect_success 'index-pack --low-memory writes identical indexes' '
+	pack=$(git pack-objects --all --delta-base-offset pack </dev/null) &&
+	git index-pack --rev-index -o normal.idx pack-$pack.pack &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+	GIT_TEST_INDEX_PACK_SPILL_RECORDS=10 \
+		git index-pack --low-memory --rev-index -o low.idx \
+		pack-$pack.pack &&
+	test_cmp_bin normal.idx low.idx &&
+	test_cmp_bin normal.rev low.rev &&
+	grep "\"key\":\"low-memory/spill-runs\",\"value\":\"[1-9]" trace.event
+'
+
+test_expect_success 'index-pack --low-memory completes thin packs' '
+	test_when_finished "rm -rf thin" &&
+	git init thin &&
+	(
+		cd thin &&
+		test-tool genrandom old 4096 >old &&
+		test-tool genrandom new 4096 >new &&
+		for i in $(test_seq 1 9)
+		do
+			test-tool genrandom $i 200 >file_$i &&
+			cat old >>file_$i || return 1
+		done &&
+		git add . &&
+		git commit -m old &&
+
+		# The new blobs are closer to each other than to their old
+		# versions: OFS_DELTA objects end up based on a REF_DELTA one.
+		for i in $(test_seq 1 9)
+		do
+			cat new >>file_$i || return 1
+		done &&
+		git commit -a -m new &&
+		printf "HEAD\n^HEAD^\n" >revs &&
+		git pack-objects --revs --thin --delta-base-offset --stdout \
+			<revs >thin.pack &&
+
+		git index-pack --fix-thin --rev-index --stdin normal.pack \
+			<thin.pack &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		GIT_TEST_INDEX_PACK_SPILL_RECORDS=3 \
+			git index-pack --low-memory --fix-thin --rev-index \
+			--stdin low.pack <thin.pack &&
+		grep "\"key\":\"low-memory/deferred-deltas\",\"value\":\"[1-9]" \
+			trace.event &&
+		test_cmp_bin normal.pack low.pack &&
+		test_cmp_bin normal.idx low.idx &&
+		test_cmp_bin normal.rev low.rev
+	)
+'
+
 # git-index-pack(1) uses the default hash algorithm outside of the repository,
 # and it has no way to tell it otherwise. So we can only run this test with the
 # default hash algorithm, as it would otherwise fail to parse the tree.
@@ -290,6 +290,7 @@ test_bitmap_cases () {
 	test_expect_success 'truncated bitmap fails gracefully (ewah)' '
 		test_config pack.writebitmaphashcache false &&
 		test_config pack.writebitmaplookuptable false &&
+		test_config pack.writebitmaproaring false &&
 		git repack -ad &&
 		git rev-list --use-bitmap-index --count --all >expect &&
 		bitmap=$(ls .git/objects/pack/*.bitmap) &&
@@ -648,4 +649,30 @@ test_expect_success 'truncated bitmap fails gracefully (lookup table)' '
 	test_grep corrupted.bitmap.index stderr
 '
 
+test_expect_success 'enable roaring bitmaps' '
+	git config --global pack.writeBitmapRoaring true
+'
+
+test_bitmap_cases
+
+test_bitmap_cases "pack.writeBitmapLookupTable"
+
+test_expect_success 'roaring bitmaps are written when enabled' '
+	git repack -adb &&
+	git rev-list --test-bitmap HEAD 2>stderr &&
+	test_grep "Bitmap v2 test" stderr
+'
+
+test_expect_success 'roaring bitmap index must set the roaring option' '
+	git rev-list --use-bitmap-index --count --all >expect &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_when_finished "rm -f $bitmap" &&
+	chmod +w $bitmap &&
+	# clear the option bits, leaving only BITMAP_OPT_FULL_DAG
+	printf "\000\001" | dd of=$bitmap bs=1 seek=6 conv=notrunc &&
+	git rev-list --use-bitmap-index --count --all >actual 2>stderr &&
+	test_cmp expect actual &&
+	test_grep "roaring option does not match" stderr
+'
+
 test_done
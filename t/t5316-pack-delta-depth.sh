@@ -121,4 +121,90 @@ test_expect_success 'negative depth disables deltas' '
 	test_cmp expect actual
 '
 
+test_expect_success 'delta base cache reports hits and misses' '
+	# Avoid --path-walk to keep all versions of "file" in one chain.
+	git repack -adf --depth=50 --no-path-walk &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git log -p >/dev/null &&
+	grep "\"category\":\"delta-base-cache\",\"name\":\"hits\"" trace &&
+	grep "\"category\":\"delta-base-cache\",\"name\":\"misses\"" trace
+'
+
+test_expect_success 'bases larger than the delta base cache are not cached' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c core.deltaBaseCacheLimit=1 log -p >/dev/null &&
+	grep "\"category\":\"delta-base-cache\",\"name\":\"misses\"" trace &&
+	! grep "\"category\":\"delta-base-cache\",\"name\":\"hits\"" trace &&
+	! grep "\"category\":\"delta-base-cache\",\"name\":\"evicted-bytes\"" trace
+'
+
+test_expect_success 'evicting deep bases from a small cache' '
+	git init chains &&
+	(
+		cd chains &&
+		for f in a b c
+		do
+			test-tool genrandom $f 4096 >$f.base || return 1
+		done &&
+		for i in $(test_seq 1 20)
+		do
+			for f in a b c
+			do
+				cat $f.base >$f &&
+				echo $i >>$f || return 1
+			done &&
+			git add a b c &&
+			git commit -q -m $i || return 1
+		done &&
+		git repack -adf --depth=50 --no-path-walk &&
+
+		git log -p >expect &&
+		rm -f trace &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c core.deltaBaseCacheLimit=10k log -p >actual &&
+		grep "\"category\":\"delta-base-cache\",\"name\":\"evicted-bytes\"" trace &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'delta base cache keeps deep bases over shallow ones' '
+	git init cache-depth &&
+	(
+		cd cache-depth &&
+		for f in deep flat1 flat2
+		do
+			test-tool genrandom $f 16384 >$f || return 1
+		done &&
+		# fast-import deltifies each blob against the one written
+		# before it: deep.4 is at the end of a chain of depth 3,
+		# while flat1.2 and flat2.2 are deltas against full objects.
+		for b in deep.1 deep.2 deep.3 deep.4 flat1.1 flat1.2 flat2.1 flat2.2
+		do
+			{ cat ${b%.*} && echo ${b#*.}; } >$b &&
+			printf "blob\ndata %d\n" $(wc -c <$b) &&
+			cat $b &&
+			echo || return 1
+		done >stream &&
+		git -c fastimport.unpackLimit=0 fast-import --quiet <stream &&
+		deep=$(git hash-object deep.4) &&
+		flat1=$(git hash-object flat1.2) &&
+		flat2=$(git hash-object flat2.2) &&
+
+		# The cache holds two bases. Reading the flat objects evicts
+		# their own shallow bases rather than the deep ones.
+		printf "%s\n" $deep $flat1 $flat2 $deep >in &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git -c core.deltaBaseCacheLimit=40k \
+			cat-file --batch <in >/dev/null &&
+		grep "\"category\":\"delta-base-cache\",\"name\":\"hits\",\"count\":1}" trace &&
+
+		printf "%s\n" $deep $flat1 $flat2 $flat1 >in &&
+		rm -f trace &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git -c core.deltaBaseCacheLimit=40k \
+			cat-file --batch <in >/dev/null &&
+		grep "\"category\":\"delta-base-cache\",\"name\":\"evicted-bytes\"" trace &&
+		! grep "\"category\":\"delta-base-cache\",\"name\":\"hits\"" trace
+	)
+'
+
 test_done
@@ -353,6 +353,16 @@ test_midx_bitmap_cases
 
 test_midx_bitmap_cases "pack.writeBitmapLookupTable"
 
+test_expect_success 'enable roaring bitmaps' '
+	git config --global pack.writeBitmapRoaring true
+'
+
+test_midx_bitmap_cases "pack.writeBitmapLookupTable"
+
+test_expect_success 'disable roaring bitmaps' '
+	git config --global --unset pack.writeBitmapRoaring
+'
+
 test_expect_success 'multi-pack-index write writes lookup table if enabled' '
 	rm -fr repo &&
 	git init repo &&
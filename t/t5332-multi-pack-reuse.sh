@@ -201,7 +201,7 @@ test_expect_success 'omit delta with uninteresting base (same pack)' '
 	test_pack_objects_reused 3 1 <in
 '
 
-test_expect_success 'omit delta from uninteresting base (cross pack)' '
+test_expect_success 'reuse delta with base from another pack' '
 	cat >in <<-EOF &&
 	$(git rev-parse $base)
 	^$(git rev-parse $delta)
@@ -214,7 +214,10 @@ test_expect_success 'omit delta from uninteresting base (cross pack)' '
 	packs_nr="$(find $packdir -type f -name "pack-*.pack" | wc -l)" &&
 	objects_nr="$(git rev-list --count --all --objects)" &&
 
-	test_pack_objects_reused_all $(($objects_nr - 1)) $packs_nr
+	# The MIDX picks the base of "$delta:f" from the preferred
+	# pack, which is sent first, so the delta can be reused as a
+	# REF_DELTA against it.
+	test_pack_objects_reused_all $objects_nr $packs_nr
 '
 
 test_expect_success 'non-omitted delta in MIDX preferred pack' '
@@ -288,4 +291,35 @@ test_expect_success 'duplicate objects with verbatim reuse' '
 	)
 '
 
+test_expect_success 'reused objects are written before searching for deltas' '
+	git init stream-reused &&
+	(
+		cd stream-reused &&
+
+		test_commit_bulk 64 &&
+		git repack -adb &&
+
+		# loose objects that are not covered by the bitmap
+		test_commit_bulk --start=65 16 &&
+
+		: >trace2.txt &&
+		GIT_TRACE2_EVENT="$PWD/trace2.txt" \
+			git pack-objects --stdout --revs --all \
+			--delta-base-offset >got.pack &&
+		test_pack_reused 192 <trace2.txt &&
+
+		grep -n "\"region_enter\".*\"label\":\"stream-reused\"" \
+			trace2.txt >stream &&
+		grep -n "\"region_enter\".*\"label\":\"prepare-pack\"" \
+			trace2.txt >prepare &&
+		test $(cut -d: -f1 stream) -lt $(cut -d: -f1 prepare) &&
+
+		git index-pack --strict -o got.idx got.pack &&
+		git rev-list --objects --all >expect.raw &&
+		cut -d" " -f1 expect.raw | sort >expect &&
+		git show-index <got.idx | cut -d" " -f2 | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
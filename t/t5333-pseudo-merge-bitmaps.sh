@@ -462,4 +462,142 @@ test_expect_success 'use pseudo-merge in boundary traversal' '
 	)
 '
 
+test_expect_success 'upload-pack records negotiations' '
+	git init negotiation-log &&
+	(
+		cd negotiation-log &&
+
+		for b in one two three
+		do
+			git checkout -b $b main 2>/dev/null ||
+			git checkout --orphan $b &&
+			test_commit $b-1 || return 1
+		done &&
+
+		git config uploadpack.negotiationLog true &&
+		git config uploadpack.negotiationLogSampleRate 1
+	) &&
+
+	git clone --no-local negotiation-log negotiation-log-client &&
+	git -C negotiation-log rev-parse one two three >expect &&
+	sed -n "s/^want //p" negotiation-log/.git/upload-pack-negotiations |
+	tr " " "\n" >actual &&
+	test_cmp_sorted expect actual &&
+	! grep ^have negotiation-log/.git/upload-pack-negotiations &&
+
+	for b in one two
+	do
+		git -C negotiation-log checkout $b &&
+		test_commit -C negotiation-log $b-2 || return 1
+	done &&
+	rm negotiation-log/.git/upload-pack-negotiations &&
+	git -C negotiation-log-client fetch &&
+
+	git -C negotiation-log rev-parse one two >expect &&
+	sed -n "s/^want //p" negotiation-log/.git/upload-pack-negotiations |
+	tr " " "\n" >actual &&
+	test_cmp_sorted expect actual &&
+	git -C negotiation-log rev-parse one~1 two~1 three >expect &&
+	sed -n "s/^have //p" negotiation-log/.git/upload-pack-negotiations |
+	tr " " "\n" >actual &&
+	test_cmp_sorted expect actual &&
+
+	rm negotiation-log/.git/upload-pack-negotiations &&
+	git -c protocol.version=0 clone --no-local negotiation-log \
+		negotiation-log-v0 &&
+	git -C negotiation-log for-each-ref --format="%(objectname)" |
+	sort -u >expect &&
+	sed -n "s/^want //p" negotiation-log/.git/upload-pack-negotiations |
+	tr " " "\n" | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'upload-pack negotiation log sampling and limit' '
+	test_when_finished "git -C negotiation-log config unset uploadpack.negotiationLogLimit" &&
+	rm negotiation-log/.git/upload-pack-negotiations &&
+
+	git -C negotiation-log config uploadpack.negotiationLogSampleRate 0 &&
+	git clone --no-local negotiation-log negotiation-log-sampled &&
+	test_path_is_missing negotiation-log/.git/upload-pack-negotiations &&
+
+	git -C negotiation-log config uploadpack.negotiationLogSampleRate 1 &&
+	git -C negotiation-log config uploadpack.negotiationLogLimit 1 &&
+	echo garbage >negotiation-log/.git/upload-pack-negotiations &&
+	git clone --no-local negotiation-log negotiation-log-limited &&
+	echo garbage >expect &&
+	test_cmp expect negotiation-log/.git/upload-pack-negotiations.old &&
+	grep ^want negotiation-log/.git/upload-pack-negotiations >expect &&
+	test_line_count = 1 expect &&
+
+	# the log keeps being rotated
+	git clone --no-local negotiation-log negotiation-log-rotated &&
+	test_cmp expect negotiation-log/.git/upload-pack-negotiations.old &&
+	test_cmp expect negotiation-log/.git/upload-pack-negotiations
+'
+
+test_expect_success 'pseudo-merges from the negotiation log' '
+	git init pseudo-merge-negotiations &&
+	(
+		cd pseudo-merge-negotiations &&
+
+		test_commit_bulk 256 &&
+		tag_everything &&
+
+		git repack -adb &&
+		test-tool bitmap list-commits | sort >bitmapped &&
+		git rev-list HEAD | sort | comm -23 - bitmapped >unbitmapped &&
+
+		sed -n 1,3p unbitmapped >x &&
+		sed -n 4,5p unbitmapped >y &&
+		sed -n 6,9p unbitmapped >z &&
+
+		# the rotated log is read, too
+		for set in x x y
+		do
+			echo "have $(cat $set)" | tr "\n" " " &&
+			echo || return 1
+		done | sed "s/ $//" >.git/upload-pack-negotiations.old &&
+		log=.git/upload-pack-negotiations &&
+		for set in z x y
+		do
+			echo "have $(cat $set)" | tr "\n" " " &&
+			echo || return 1
+		done | sed "s/ $//" >$log &&
+		# entries which are not of use, or which are cut short
+		git rev-parse HEAD >>$log &&
+		echo "have $(cat z | tr "\n" " ")" >>$log &&
+		echo "want $(head -c 10 x)" >>$log &&
+
+		: >trace2.txt &&
+		GIT_TRACE2_EVENT=$PWD/trace2.txt git \
+			-c bitmapPseudoMerge.test.pattern="refs/tags/" \
+			-c bitmapPseudoMerge.test.maxMerges=3 \
+			-c bitmapPseudoMerge.test.stableThreshold=never \
+			-c bitmapPseudoMerge.test.useNegotiationLog=true \
+			repack -adb &&
+		test_trace2_data pseudo-merge negotiated-pseudo-merges 2 <trace2.txt &&
+
+		test_pseudo_merges >merges &&
+		test_line_count = 3 merges &&
+
+		test_pseudo_merge_commits 0 >actual &&
+		test_cmp_sorted x actual &&
+		test_pseudo_merge_commits 1 >actual &&
+		test_cmp_sorted y actual &&
+
+		# all other unbitmapped tags go into the remaining pseudo-merge
+		test_pseudo_merge_commits 2 | sort >actual &&
+		cat x y | sort | comm -23 unbitmapped - >expect &&
+		test_cmp expect actual &&
+
+		: >trace2.txt &&
+		GIT_TRACE2_EVENT=$PWD/trace2.txt \
+			git rev-list --count --objects --use-bitmap-index \
+			$(cat x) >actual &&
+		git rev-list --count --objects $(cat x) >expect &&
+		test_cmp expect actual &&
+		! test_pseudo_merges_satisfied 0 <trace2.txt
+	)
+'
+
 test_done
@@ -0,0 +1,128 @@
+#!/bin/sh
+
+test_description='pack .objinfo files'
+
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	test-tool genrandom base 4096 >base &&
+	for i in $(test_seq 1 10)
+	do
+		cat base >file &&
+		echo $i >>file &&
+		git add file &&
+		test_tick &&
+		git commit -q -m $i || return 1
+	done
+'
+
+test_expect_success 'pack-objects does not write .objinfo by default' '
+	git repack -adf &&
+	find $packdir -name "*.objinfo" >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'pack-objects writes .objinfo with pack.writeObjectInfo' '
+	git -c pack.writeObjectInfo=true repack -adf &&
+	ls $packdir/*.pack >packs &&
+	test_line_count = 1 packs &&
+	pack=$(cat packs) &&
+	test_path_is_file ${pack%.pack}.objinfo
+'
+
+test_expect_success 'type and size lookups are unaffected' '
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objecttype) %(objectsize)" >actual &&
+	mv ${pack%.pack}.objinfo objinfo.bak &&
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objecttype) %(objectsize)" >expect.all &&
+	mv objinfo.bak ${pack%.pack}.objinfo &&
+	test_cmp expect.all actual
+'
+
+test_expect_success 'deltified objects are looked up in .objinfo' '
+	objinfo=${pack%.pack}.objinfo &&
+	test_when_finished "mv objinfo.bak $objinfo" &&
+	cp $objinfo objinfo.bak &&
+
+	git verify-pack -v ${pack%.pack}.idx >verify &&
+	delta=$(awk "NF == 7 && \$2 == \"blob\" { print \$1; exit }" verify) &&
+	test -n "$delta" &&
+	git show-index <${pack%.pack}.idx >index &&
+	pos=$(awk "\$2 == \"$delta\" { print NR - 1 }" index) &&
+
+	# Claim that the object is a 42-byte blob.
+	printf "\060\000\000\000\000\000\000\052" |
+	dd of=$objinfo bs=1 seek=$((12 + 8 * $pos)) conv=notrunc &&
+
+	echo 42 >expect &&
+	git cat-file -s $delta >actual &&
+	test_cmp expect actual &&
+
+	# Reading the full object does not use .objinfo.
+	git cat-file blob $delta >content &&
+	test_file_size content >actual &&
+	! test_cmp expect actual
+'
+
+test_expect_success 'corrupt .objinfo files are ignored' '
+	objinfo=${pack%.pack}.objinfo &&
+	test_when_finished "mv objinfo.bak $objinfo" &&
+	cp $objinfo objinfo.bak &&
+
+	printf "xxxx" | dd of=$objinfo bs=1 count=4 conv=notrunc &&
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objecttype) %(objectsize)" \
+		>actual 2>err &&
+	test_grep "has unknown signature" err &&
+	test_cmp expect.all actual
+'
+
+test_expect_success '.objinfo of a different pack is ignored' '
+	objinfo=${pack%.pack}.objinfo &&
+	test_when_finished "mv objinfo.bak $objinfo" &&
+	cp $objinfo objinfo.bak &&
+
+	git show-index <${pack%.pack}.idx >index &&
+	pos=$(awk "\$2 == \"$delta\" { print NR - 1 }" index) &&
+	printf "\060\000\000\000\000\000\000\052" |
+	dd of=$objinfo bs=1 seek=$((12 + 8 * $pos)) conv=notrunc &&
+
+	# Pretend that the file was written for another pack.
+	size=$(test_file_size $objinfo) &&
+	printf "xxxx" |
+	dd of=$objinfo bs=1 seek=$(($size - 2 * $(test_oid rawsz))) conv=notrunc &&
+
+	git cat-file -s $delta >actual &&
+	! test_cmp expect actual &&
+
+	# Writing the pack info again replaces the stale file.
+	git -c pack.writeObjectInfo=true index-pack $pack &&
+	test_cmp_bin objinfo.bak $objinfo
+'
+
+test_expect_success 'index-pack writes .objinfo with pack.writeObjectInfo' '
+	git -c pack.writeObjectInfo=true clone -q --no-local . clone &&
+	ls clone/$packdir/*.pack >packs &&
+	test_line_count = 1 packs &&
+	clone_pack=$(cat packs) &&
+	test_path_is_file ${clone_pack%.pack}.objinfo &&
+	git -C clone cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objecttype) %(objectsize)" >actual &&
+	rm ${clone_pack%.pack}.objinfo &&
+	git -C clone cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objecttype) %(objectsize)" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success '.objinfo is removed along with its pack' '
+	test_commit another &&
+	git repack -adf &&
+	test_path_is_missing ${pack%.pack}.objinfo &&
+	find $packdir -name "*.objinfo" >actual &&
+	test_must_be_empty actual
+'
+
+test_done
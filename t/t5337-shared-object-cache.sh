@@ -0,0 +1,118 @@
+#!/bin/sh
+
+test_description='shared cache of reconstructed objects'
+
+. ./test-lib.sh
+
+entry_path () {
+	echo "$cache/$(echo $1 | sed "s,..,&/,")"
+}
+
+test_expect_success 'setup' '
+	test-tool genrandom base 4096 >base &&
+	for i in $(test_seq 1 10)
+	do
+		cat base >file &&
+		echo $i >>file &&
+		git add file &&
+		test_tick &&
+		git commit -q -m $i || return 1
+	done &&
+	git repack -adf &&
+	git verify-pack -v .git/objects/pack/pack-*.idx >verify &&
+	delta=$(awk "NF == 7 && \$2 == \"blob\" { print \$1; exit }" verify) &&
+	full=$(awk "NF == 5 && \$2 == \"blob\" { print \$1; exit }" verify) &&
+	test -n "$delta" &&
+	test -n "$full" &&
+	cache="$(pwd)/cache"
+'
+
+test_expect_success 'no cache is used by default' '
+	git cat-file blob $delta >/dev/null &&
+	test_path_is_missing "$cache"
+'
+
+test_expect_success 'reading deltified objects populates the cache' '
+	git config core.sharedObjectCache "$cache" &&
+	git cat-file blob $delta >expect &&
+	test_path_is_file "$(entry_path $delta)" &&
+	git cat-file blob $delta >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'non-deltified objects are not cached' '
+	git cat-file blob $full >/dev/null &&
+	test_path_is_missing "$(entry_path $full)"
+'
+
+test_expect_success 'cache is shared with other repositories' '
+	git clone -q --no-local . other &&
+	>reference &&
+	test-tool chmtime =-300 reference "$(entry_path $delta)" &&
+	git -C other -c core.sharedObjectCache="$cache" \
+		cat-file blob $delta >actual &&
+	test_cmp expect actual &&
+
+	# The clone has found the entry and thus refreshed it.
+	test $(test-tool chmtime --get "$(entry_path $delta)") -gt \
+		$(test-tool chmtime --get reference)
+'
+
+test_expect_success 'entries that do not match their object ID are dropped' '
+	test_when_finished "git cat-file blob $delta >/dev/null" &&
+	chmod +w "$(entry_path $delta)" &&
+	printf "blob 6\0hello\n" >"$(entry_path $delta)" &&
+	git -C other -c core.sharedObjectCache="$cache" \
+		cat-file blob $delta >actual &&
+	git -c core.sharedObjectCache= cat-file blob $delta >expect &&
+	test_cmp expect actual &&
+	! grep hello "$(entry_path $delta)"
+'
+
+test_expect_success 'reading entries keeps them from being evicted' '
+	>reference &&
+	test-tool chmtime =-300 reference "$(entry_path $delta)" &&
+	git cat-file blob $delta >/dev/null &&
+	test $(test-tool chmtime --get "$(entry_path $delta)") -gt \
+		$(test-tool chmtime --get reference) &&
+
+	# Recently refreshed entries are not refreshed again.
+	test-tool chmtime =-10 "$(entry_path $delta)" &&
+	test-tool chmtime --get "$(entry_path $delta)" >before &&
+	git cat-file blob $delta >/dev/null &&
+	test-tool chmtime --get "$(entry_path $delta)" >after &&
+	test_cmp before after
+'
+
+test_expect_success 'least recently used entries are evicted' '
+	rm -rf "$cache" &&
+	dir=$(dirname "$(entry_path $delta)") &&
+	mkdir -p "$dir" &&
+	test-tool genrandom old 5000 >"$dir/old" &&
+	test-tool genrandom recent 5000 >"$dir/recent" &&
+	test-tool chmtime =-120 "$dir/old" &&
+	test-tool chmtime =-60 "$dir/recent" &&
+
+	# Each fan-out directory gets 1/256th of the limit, i.e. 12000 bytes.
+	git -c core.sharedObjectCacheLimit=3072000 cat-file blob $delta >/dev/null &&
+	test_path_is_file "$(entry_path $delta)" &&
+	test_path_is_file "$dir/recent" &&
+	test_path_is_missing "$dir/old"
+'
+
+test_expect_success 'objects too large for the limit are not cached' '
+	rm -rf "$cache" &&
+	git -c core.sharedObjectCacheLimit=256k cat-file blob $delta >/dev/null &&
+	test_path_is_missing "$(entry_path $delta)"
+'
+
+test_expect_success 'unusable caches are ignored' '
+	>not-a-directory &&
+	git -c core.sharedObjectCache="$(pwd)/not-a-directory" \
+		cat-file blob $delta >actual 2>err &&
+	git -c core.sharedObjectCache= cat-file blob $delta >expect &&
+	test_cmp expect actual &&
+	test_grep "is not a directory" err
+'
+
+test_done
@@ -0,0 +1,155 @@
+#!/bin/sh
+
+test_description='writing objects of transactions into packfiles'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test-tool genrandom base 4096 >base &&
+	for i in $(test_seq 1 10)
+	do
+		cat base >file.$i &&
+		echo $i >>file.$i || return 1
+	done
+'
+
+test_expect_success 'transactions write loose objects by default' '
+	git init loose &&
+	cp file.* loose/ &&
+	git -C loose add file.* &&
+	git -C loose count-objects -v >counts &&
+	test_grep "^count: 10" counts &&
+	test_grep "^packs: 0" counts
+'
+
+test_expect_success 'core.packTransactions writes a single packfile' '
+	git init packed &&
+	cp file.* packed/ &&
+	git -C packed -c core.packTransactions=true add file.* &&
+	git -C packed count-objects -v >counts &&
+	test_grep "^count: 0" counts &&
+	test_grep "^packs: 1" counts &&
+	git -C packed cat-file blob :file.3 >actual &&
+	test_cmp file.3 actual &&
+	git -C packed commit -m packed &&
+	git -C packed fsck --strict
+'
+
+test_expect_success 'objects can be read before the transaction is committed' '
+	git -C loose commit -m loose &&
+	pack=$(git -C loose pack-objects --all ../pack </dev/null) &&
+	git verify-pack -v pack-$pack.idx >verify &&
+	test_grep " 1 [0-9a-f]*$" verify &&
+
+	# Resolving deltas requires reading back their bases.
+	git init unpacked &&
+	git -C unpacked -c core.packTransactions=true \
+		unpack-objects <pack-$pack.pack &&
+	git -C unpacked count-objects -v >counts &&
+	test_grep "^count: 0" counts &&
+	test_grep "^packs: 1" counts &&
+	git -C unpacked fsck --strict $(git -C loose rev-parse HEAD)
+'
+
+test_expect_success 'existing objects are not written again' '
+	git -C packed -c core.packTransactions=true add file.* &&
+	git -C packed count-objects -v >counts &&
+	test_grep "^packs: 1" counts
+'
+
+test_expect_success 'merges write their trees into a packfile' '
+	git init merges &&
+	(
+		cd merges &&
+		test_commit base &&
+		git branch -M main &&
+		git checkout -b side &&
+		test_commit side-1 &&
+		test_commit side-2 &&
+		git checkout main &&
+		test_commit main &&
+		git repack -ad &&
+
+		tree=$(git -c core.packTransactions=true \
+			merge-tree --write-tree main side) &&
+		git count-objects -v >counts &&
+		test_grep "^count: 0" counts &&
+		test_grep "^packs: 2" counts &&
+		git ls-tree -r --name-only $tree >actual &&
+		test_write_lines base.t main.t side-1.t side-2.t >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'rebase writes all picks into one packfile' '
+	(
+		cd merges &&
+		git checkout -b topic base &&
+		test_commit topic-1 &&
+		test_commit topic-2 &&
+		test_commit topic-3 &&
+		git repack -ad &&
+		git -c core.packTransactions=true rebase main &&
+		git count-objects -v >counts &&
+		test_grep "^count: 0" counts &&
+		test_grep "^packs: 2" counts &&
+		git log --format=%s main.. >actual &&
+		test_write_lines topic-3 topic-2 topic-1 >expect &&
+		test_cmp expect actual &&
+		git reflog -3 --format=%gs >actual &&
+		test_write_lines "rebase (finish): returning to refs/heads/topic" \
+			"rebase (pick): topic-3" "rebase (pick): topic-2" >expect &&
+		test_cmp expect actual &&
+		git fsck --strict
+	)
+'
+
+test_expect_success 'hooks see the objects of previous picks' '
+	test_when_finished "rm -f merges/.git/hooks/post-commit" &&
+	(
+		cd merges &&
+		write_script .git/hooks/post-commit <<-\EOF &&
+		git rev-parse HEAD >>hook.log &&
+		git ls-tree -r HEAD >/dev/null || echo broken >>hook.log
+		EOF
+		git reset --hard topic-3 &&
+		git -c core.packTransactions=true rebase main &&
+		test_line_count = 3 hook.log &&
+		test_grep ! broken hook.log &&
+		git checkout main
+	)
+'
+
+test_expect_success 'replay writes all of its objects into one packfile' '
+	(
+		cd merges &&
+		git repack -ad &&
+		git -c core.packTransactions=true \
+			replay --ref-action=print --onto main base..side >updates &&
+		git count-objects -v >counts &&
+		test_grep "^count: 0" counts &&
+		test_grep "^packs: 2" counts &&
+		git update-ref --stdin <updates &&
+		git log --format=%s main..side >actual &&
+		test_write_lines side-2 side-1 >expect &&
+		test_cmp expect actual &&
+		git fsck --strict
+	)
+'
+
+test_expect_success 'notes write their trees and commits into a packfile' '
+	(
+		cd merges &&
+		git repack -ad &&
+		blob=$(echo note | git hash-object -w --stdin) &&
+		git -c core.packTransactions=true notes add -C $blob &&
+		git count-objects -v >counts &&
+		test_grep "^count: 1" counts &&
+		test_grep "^packs: 2" counts &&
+		echo note >expect &&
+		git notes show >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_done
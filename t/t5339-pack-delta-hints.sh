@@ -0,0 +1,118 @@
+#!/bin/sh
+
+test_description='pack .dhints files'
+
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+# Print the value of the given "delta-hints" trace2 key from "trace.event".
+delta_hints_value () {
+	sed -n "s/.*\"key\":\"delta-hints\/$1\",\"value\":\"\([0-9]*\)\".*/\1/p" \
+		trace.event
+}
+
+# List the deltified objects of the only pack along with their bases.
+list_deltas () {
+	git verify-pack -v $packdir/*.idx >verify &&
+	awk "NF == 7 { print \$1, \$7 }" verify | sort
+}
+
+test_expect_success 'setup' '
+	test_seq 1 1000 >file &&
+	test-tool genrandom unrelated 4096 >unrelated &&
+	git add file unrelated &&
+	test_tick &&
+	git commit -q -m base &&
+	for i in $(test_seq 1 10)
+	do
+		echo $i >>file &&
+		test-tool genrandom unrelated-$i 4096 >unrelated &&
+		git add file unrelated &&
+		test_tick &&
+		git commit -q -m $i || return 1
+	done
+'
+
+test_expect_success 'pack-objects does not write .dhints by default' '
+	git repack -adf &&
+	find $packdir -name "*.dhints" >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'pack-objects writes .dhints with pack.deltaHints' '
+	git -c pack.deltaHints=true repack -adf &&
+	ls $packdir/*.pack >packs &&
+	test_line_count = 1 packs &&
+	pack=$(cat packs) &&
+	test_path_is_file ${pack%.pack}.dhints &&
+	list_deltas >expect.deltas &&
+	test_file_not_empty expect.deltas
+'
+
+test_expect_success 'repacking with hints reuses earlier search results' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c pack.deltaHints=true repack -adf &&
+	test $(delta_hints_value reused) = $(wc -l <expect.deltas) &&
+	test $(delta_hints_value rejected) -gt 0 &&
+	list_deltas >actual.deltas &&
+	test_cmp expect.deltas actual.deltas &&
+	git fsck
+'
+
+test_expect_success 'hints from a smaller window are not used' '
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c pack.deltaHints=true repack -adf --window=20 &&
+	test $(delta_hints_value reused) = 0 &&
+	test $(delta_hints_value rejected) = 0
+'
+
+test_expect_success 'new objects are still searched' '
+	git -c pack.deltaHints=true repack -adf &&
+	echo new >>file &&
+	git add file &&
+	test_tick &&
+	git commit -q -m new &&
+	new=$(git rev-parse HEAD:file) &&
+	git -c pack.deltaHints=true repack -adf &&
+	list_deltas >actual.deltas &&
+	grep -e "^$new " -e " $new\$" actual.deltas
+'
+
+test_expect_success 'corrupt .dhints files are ignored' '
+	pack=$(ls $packdir/*.pack) &&
+	dhints=${pack%.pack}.dhints &&
+	printf "xxxx" | dd of=$dhints bs=1 count=4 conv=notrunc &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c pack.deltaHints=true repack -adf 2>err &&
+	test_grep "has unknown signature" err &&
+	test $(delta_hints_value reused) = 0 &&
+	git fsck
+'
+
+test_expect_success '.dhints of a different pack are ignored' '
+	pack=$(ls $packdir/*.pack) &&
+	dhints=${pack%.pack}.dhints &&
+	size=$(test_file_size $dhints) &&
+	printf "xxxx" |
+	dd of=$dhints bs=1 seek=$(($size - 2 * $(test_oid rawsz))) conv=notrunc &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c pack.deltaHints=true repack -adf 2>err &&
+	test_must_be_empty err &&
+	test $(delta_hints_value reused) = 0 &&
+	git fsck
+'
+
+test_expect_success '.dhints is removed along with its pack' '
+	pack=$(ls $packdir/*.pack) &&
+	test_commit another &&
+	git repack -adf &&
+	test_path_is_missing ${pack%.pack}.dhints &&
+	find $packdir -name "*.dhints" >actual &&
+	test_must_be_empty actual
+'
+
+test_done
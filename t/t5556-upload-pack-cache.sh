@@ -0,0 +1,127 @@
+#!/bin/sh
+
+test_description='upload-pack generated-pack cache'
+
+. ./test-lib.sh
+
+cachedir=.git/upload-pack-cache
+
+# clone_traced <dst> [<clone-options>...]
+clone_traced () {
+	dst=$1 &&
+	shift &&
+	rm -rf "$dst" trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git clone --no-local "$@" . "$dst"
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated v2 two
+'
+
+test_expect_success 'no packs are cached by default' '
+	clone_traced dst.git &&
+	test_path_is_missing $cachedir &&
+	! grep "\"key\":\"pack-cache" trace.event
+'
+
+test_expect_success 'first clone fills the cache' '
+	test_config uploadpack.packCache true &&
+	clone_traced dst.git &&
+	test_trace2_data upload-pack pack-cache miss <trace.event &&
+	ls $cachedir/*.pack >entries &&
+	test_line_count = 1 entries
+'
+
+test_expect_success 'identical clone is served from the cache' '
+	test_config uploadpack.packCache true &&
+	clone_traced dst2.git --quiet &&
+	test_trace2_data upload-pack pack-cache hit <trace.event &&
+	git -C dst2.git fsck &&
+	git -C dst.git for-each-ref >expect &&
+	git -C dst2.git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cache works with protocol v0' '
+	test_config uploadpack.packCache true &&
+	clone_traced dst.git -c protocol.version=0 &&
+	clone_traced dst2.git -c protocol.version=0 &&
+	test_trace2_data upload-pack pack-cache hit <trace.event &&
+	git -C dst2.git fsck
+'
+
+test_expect_success 'updated refs are not served from the cache' '
+	test_config uploadpack.packCache true &&
+	test_commit three &&
+	clone_traced dst.git &&
+	test_trace2_data upload-pack pack-cache miss <trace.event &&
+	git -C dst.git rev-parse --verify three
+'
+
+test_expect_success 'new packs are not served from the cache' '
+	test_config uploadpack.packCache true &&
+	git repack -ad &&
+	clone_traced dst.git &&
+	test_trace2_data upload-pack pack-cache miss <trace.event
+'
+
+test_expect_success 'packs larger than the limit are not cached' '
+	rm -rf $cachedir &&
+	test_config uploadpack.packCache true &&
+	test_config uploadpack.packCacheLimit 100 &&
+	clone_traced dst.git &&
+	test_trace2_data upload-pack pack-cache miss <trace.event &&
+	! grep "\"key\":\"pack-cache/stored" trace.event &&
+	find $cachedir -type f >entries &&
+	test_must_be_empty entries
+'
+
+test_expect_success 'least recently used packs are evicted' '
+	rm -rf $cachedir &&
+	test_config uploadpack.packCache true &&
+	clone_traced dst.git &&
+	size=$(test_file_size $cachedir/*.pack) &&
+	test-tool chmtime =-60 $cachedir/*.pack &&
+	test_config uploadpack.packCacheLimit $((size + 10)) &&
+	test_config uploadpack.allowFilter true &&
+	clone_traced dst.git --bare --filter=blob:none &&
+	test_trace2_data upload-pack pack-cache miss <trace.event &&
+	ls $cachedir/*.pack >entries &&
+	test_line_count = 1 entries &&
+	clone_traced dst2.git --bare --filter=blob:none &&
+	test_trace2_data upload-pack pack-cache hit <trace.event
+'
+
+test_expect_success 'abandoned partial entries are removed' '
+	rm -rf $cachedir &&
+	mkdir $cachedir &&
+	>$cachedir/tmp_pack_stale &&
+	>$cachedir/tmp_pack_fresh &&
+	test-tool chmtime =-90000 $cachedir/tmp_pack_stale &&
+	test_config uploadpack.packCache true &&
+	clone_traced dst.git &&
+	test_trace2_data upload-pack pack-cache miss <trace.event &&
+	test_path_is_missing $cachedir/tmp_pack_stale &&
+	test_path_is_file $cachedir/tmp_pack_fresh &&
+	ls $cachedir/tmp_pack_* >entries &&
+	test_line_count = 1 entries
+'
+
+test_expect_success 'packs are not cached with a pack-objects hook' '
+	rm -rf $cachedir &&
+	write_script .git/hook <<-\EOF &&
+	echo >&2 "hook running" &&
+	"$@"
+	EOF
+	test_config uploadpack.packCache true &&
+	test_config_global uploadpack.packObjectsHook ./hook &&
+	clone_traced dst.git 2>stderr &&
+	test_grep "hook running" stderr &&
+	test_path_is_missing $cachedir &&
+	! grep "\"key\":\"pack-cache" trace.event
+'
+
+test_done
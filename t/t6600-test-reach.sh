@@ -882,4 +882,66 @@ test_expect_success 'rev-list --maximal-only matches merge-base --independent' '
 	test_cmp expect.sorted actual.sorted
 '
 
+test_expect_success 'setup ahead-behind with bitmaps' '
+	git clone --bare --no-local . bitmaps.git &&
+	# Enough history that not every commit gets a bitmap.
+	git -C bitmaps.git branch long commit-5-5 &&
+	test_commit_bulk -C bitmaps.git --ref=refs/heads/long 250 &&
+	git -C bitmaps.git repack -adb &&
+	git -C bitmaps.git branch long-old long~220 &&
+	git -C bitmaps.git for-each-ref --format="%(refname)" refs/heads >refs &&
+
+	# Commits that are not in the bitmapped pack.
+	git -C bitmaps.git branch new-1 commit-4-8 &&
+	git -C bitmaps.git branch new-2 commit-9-6 &&
+	for i in $(test_seq 1 3)
+	do
+		commit=$(git -C bitmaps.git commit-tree -m "new-1-$i" \
+			 -p new-1 new-1^{tree}) &&
+		git -C bitmaps.git branch -f new-1 $commit &&
+		commit=$(git -C bitmaps.git commit-tree -m "new-2-$i" \
+			 -p new-2 -p commit-2-10 new-2^{tree}) &&
+		git -C bitmaps.git branch -f new-2 $commit || return 1
+	done &&
+	echo refs/heads/new-1 >>refs &&
+	echo refs/heads/new-2 >>refs &&
+
+	mv bitmaps.git/objects/pack/*.bitmap . &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git -C bitmaps.git for-each-ref \
+		--format="%(refname) %(ahead-behind:commit-9-6) %(ahead-behind:new-1)" \
+		--stdin <refs >expect &&
+	test_region ! pack-bitmap ahead-behind trace.txt &&
+	mv *.bitmap bitmaps.git/objects/pack/
+'
+
+test_ahead_behind_bitmap () {
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git -C bitmaps.git for-each-ref \
+		--format="%(refname) %(ahead-behind:commit-9-6) %(ahead-behind:new-1)" \
+		--stdin <refs >actual &&
+	test_cmp expect actual &&
+	test_region pack-bitmap ahead-behind trace.txt
+}
+
+test_expect_success 'for-each-ref ahead-behind:pack bitmap' '
+	test_ahead_behind_bitmap
+'
+
+test_expect_success 'for-each-ref ahead-behind:MIDX bitmap' '
+	git -C bitmaps.git multi-pack-index write --bitmap &&
+	rm bitmaps.git/objects/pack/pack-*.bitmap &&
+	test_ahead_behind_bitmap
+'
+
+test_expect_success 'for-each-ref ahead-behind:shallow repository' '
+	test_when_finished "rm -f bitmaps.git/shallow" &&
+	git -C bitmaps.git rev-parse commit-1-1 >bitmaps.git/shallow &&
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git -C bitmaps.git for-each-ref \
+		--format="%(refname) %(ahead-behind:commit-9-6) %(ahead-behind:new-1)" \
+		--stdin <refs >actual &&
+	test_cmp expect actual &&
+	test_region ! pack-bitmap ahead-behind trace.txt
+'
+
 test_done
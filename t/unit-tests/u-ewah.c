@@ -0,0 +1,167 @@
+#include "unit-test.h"
+#include "ewah/ewok.h"
+
+static uint32_t next_random(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+/*
+ * Build a bitmap of "nr_bits" bits out of alternating stretches of
+ * zeroes, ones and random bits, so that its EWAH form has clean runs of
+ * both kinds as well as literal words.
+ */
+static struct bitmap *random_bitmap(size_t nr_bits, uint32_t seed)
+{
+	struct bitmap *bitmap = bitmap_new();
+	uint32_t state = seed;
+	size_t i = 0;
+
+	while (i < nr_bits) {
+		size_t len = next_random(&state) % 1000;
+		uint32_t kind = next_random(&state) % 3;
+
+		for (; len && i < nr_bits; len--, i++) {
+			if (kind == 1 ||
+			    (kind == 2 && next_random(&state) & 1))
+				bitmap_set(bitmap, i);
+		}
+	}
+	return bitmap;
+}
+
+static size_t expand(struct ewah_bitmap *ewah, eword_t **out)
+{
+	struct ewah_iterator it;
+	size_t nr = 0, alloc = 0;
+	eword_t word;
+
+	*out = NULL;
+	ewah_iterator_init(&it, ewah);
+	while (ewah_iterator_next(&word, &it)) {
+		ALLOC_GROW(*out, nr + 1, alloc);
+		(*out)[nr++] = word;
+	}
+	return nr;
+}
+
+void test_ewah__iterator_next_words(void)
+{
+	size_t sizes[] = { 1, 3, 64, 100000 };
+
+	for (uint32_t seed = 1; seed <= 4; seed++) {
+		struct bitmap *bitmap = random_bitmap(50000 + seed * 77, seed);
+		struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+		eword_t *expect, *got;
+		size_t expect_nr = expand(ewah, &expect);
+
+		ALLOC_ARRAY(got, expect_nr + 100000);
+		for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+			struct ewah_iterator it;
+			size_t nr = 0, n;
+
+			ewah_iterator_init(&it, ewah);
+			while ((n = ewah_iterator_next_words(got + nr, sizes[i],
+							     &it)))
+				nr += n;
+
+			cl_assert_equal_i(nr, expect_nr);
+			cl_assert(!memcmp(got, expect, nr * sizeof(eword_t)));
+		}
+
+		free(got);
+		free(expect);
+		ewah_free(ewah);
+		bitmap_free(bitmap);
+	}
+}
+
+void test_ewah__or_iterator(void)
+{
+	struct ewah_bitmap *ewah[3];
+	eword_t *words[3];
+	size_t nr[3], max = 0;
+	struct ewah_or_iterator it;
+	eword_t word;
+	size_t i = 0;
+
+	for (size_t j = 0; j < ARRAY_SIZE(ewah); j++) {
+		struct bitmap *bitmap = random_bitmap(10000 + j * 6000, j + 7);
+		ewah[j] = bitmap_to_ewah(bitmap);
+		nr[j] = expand(ewah[j], &words[j]);
+		if (nr[j] > max)
+			max = nr[j];
+		bitmap_free(bitmap);
+	}
+
+	ewah_or_iterator_init(&it, ewah, ARRAY_SIZE(ewah));
+	while (ewah_or_iterator_next(&word, &it)) {
+		eword_t expect = 0;
+
+		for (size_t j = 0; j < ARRAY_SIZE(ewah); j++)
+			if (i < nr[j])
+				expect |= words[j][i];
+		cl_assert(word == expect);
+		i++;
+	}
+	cl_assert_equal_i(i, max);
+	ewah_or_iterator_release(&it);
+
+	for (size_t j = 0; j < ARRAY_SIZE(ewah); j++) {
+		free(words[j]);
+		ewah_free(ewah[j]);
+	}
+}
+
+void test_ewah__bitmap_ops(void)
+{
+	size_t nr_bits = 40000 + 13;
+	struct bitmap *a = random_bitmap(nr_bits, 11);
+	struct bitmap *b = random_bitmap(nr_bits - 3000, 12);
+	struct ewah_bitmap *b_ewah = bitmap_to_ewah(b);
+	struct bitmap *or = bitmap_dup(a), *or_ewah = bitmap_dup(a);
+	struct bitmap *and_not = bitmap_dup(a);
+	size_t count = 0;
+
+	bitmap_or(or, b);
+	bitmap_or_ewah(or_ewah, b_ewah);
+	bitmap_and_not(and_not, b);
+
+	for (size_t i = 0; i < nr_bits; i++) {
+		int in_a = !!bitmap_get(a, i), in_b = !!bitmap_get(b, i);
+
+		cl_assert_equal_i(!!bitmap_get(or, i), in_a || in_b);
+		cl_assert_equal_i(!!bitmap_get(or_ewah, i), in_a || in_b);
+		cl_assert_equal_i(!!bitmap_get(and_not, i), in_a && !in_b);
+		count += in_b;
+	}
+
+	cl_assert_equal_i(bitmap_popcount(b), count);
+	cl_assert_equal_i(ewah_bitmap_popcount(b_ewah), count);
+
+	ewah_free(b_ewah);
+	bitmap_free(a);
+	bitmap_free(b);
+	bitmap_free(or);
+	bitmap_free(or_ewah);
+	bitmap_free(and_not);
+}
+
+void test_ewah__words_popcount(void)
+{
+	eword_t words[37];
+	uint32_t state = 5;
+
+	for (size_t i = 0; i < ARRAY_SIZE(words); i++)
+		words[i] = ((eword_t)next_random(&state) << 40) ^
+			   next_random(&state);
+
+	for (size_t nr = 0; nr <= ARRAY_SIZE(words); nr++) {
+		size_t expect = 0;
+
+		for (size_t i = 0; i < nr; i++)
+			expect += ewah_bit_popcount64(words[i]);
+		cl_assert_equal_i(ewah_words_popcount(words, nr), expect);
+	}
+}
@@ -0,0 +1,184 @@
+#include "unit-test.h"
+#include "ewah/ewok.h"
+#include "ewah/roaring.h"
+#include "strbuf.h"
+
+static int write_strbuf(void *out, const void *buf, size_t len)
+{
+	strbuf_add(out, buf, len);
+	return len;
+}
+
+static void roundtrip(struct bitmap *bitmap, size_t nr_bits,
+		      struct strbuf *buf, struct roaring_bitmap *roaring)
+{
+	struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+	int len = roaring_serialize_ewah(ewah, write_strbuf, buf);
+
+	cl_assert_equal_i(len, buf->len);
+	cl_assert_equal_i(roaring_read_mmap(roaring, buf->buf, buf->len),
+			  buf->len);
+	cl_assert_equal_i(roaring->bit_size, ewah->bit_size);
+	ewah_free(ewah);
+
+	for (size_t i = 0; i < nr_bits; i++)
+		cl_assert_equal_i(roaring_contains(roaring, i),
+				  bitmap_get(bitmap, i));
+	cl_assert_equal_i(roaring_popcount(roaring), bitmap_popcount(bitmap));
+}
+
+static void check_roundtrip(struct bitmap *bitmap, size_t nr_bits,
+			    uint16_t expect_type)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct roaring_bitmap roaring = { 0 };
+	struct bitmap *out;
+	struct ewah_bitmap *ewah;
+
+	roundtrip(bitmap, nr_bits, &buf, &roaring);
+
+	if (expect_type) {
+		cl_assert(roaring.nr > 0);
+		for (size_t i = 0; i < roaring.nr; i++)
+			cl_assert_equal_i(roaring.containers[i].type,
+					  expect_type);
+	}
+
+	out = roaring_to_bitmap(&roaring);
+	cl_assert(bitmap_equals(out, bitmap));
+	bitmap_free(out);
+
+	ewah = roaring_to_ewah(&roaring);
+	cl_assert(bitmap_equals_ewah(bitmap, ewah));
+	ewah_free(ewah);
+
+	roaring_release(&roaring);
+	strbuf_release(&buf);
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+void test_roaring__empty(void)
+{
+	struct bitmap *bitmap = bitmap_new();
+
+	check_roundtrip(bitmap, 1024, 0);
+	bitmap_free(bitmap);
+}
+
+void test_roaring__sparse_uses_arrays(void)
+{
+	struct bitmap *bitmap = bitmap_new();
+
+	for (size_t i = 3; i < 300000; i += 997)
+		bitmap_set(bitmap, i);
+	check_roundtrip(bitmap, 300000, ROARING_ARRAY);
+	bitmap_free(bitmap);
+}
+
+void test_roaring__dense_uses_bitsets(void)
+{
+	struct bitmap *bitmap = bitmap_new();
+	uint32_t state = 1;
+
+	for (size_t i = 0; i < 4 * 65536; i++)
+		if (next_random(&state) & 1)
+			bitmap_set(bitmap, i);
+	check_roundtrip(bitmap, 4 * 65536, ROARING_BITSET);
+	bitmap_free(bitmap);
+}
+
+void test_roaring__runs_use_run_containers(void)
+{
+	struct bitmap *bitmap = bitmap_new();
+
+	for (size_t i = 100; i < 70000; i++)
+		bitmap_set(bitmap, i);
+	for (size_t i = 131072; i < 131072 + 65536; i++)
+		bitmap_set(bitmap, i);
+	for (size_t i = 200000; i < 250000; i++)
+		if ((i / 1000) % 2)
+			bitmap_set(bitmap, i);
+	check_roundtrip(bitmap, 260000, ROARING_RUN);
+	bitmap_free(bitmap);
+}
+
+void test_roaring__mixed(void)
+{
+	struct bitmap *bitmap = bitmap_new();
+	uint32_t state = 42;
+
+	/* a sparse chunk, a dense chunk and a chunk of runs */
+	for (size_t i = 0; i < 65536; i += 4099)
+		bitmap_set(bitmap, i);
+	for (size_t i = 65536; i < 2 * 65536; i++)
+		if (next_random(&state) % 3)
+			bitmap_set(bitmap, i);
+	for (size_t i = 3 * 65536 + 17; i < 3 * 65536 + 60000; i++)
+		bitmap_set(bitmap, i);
+	bitmap_set(bitmap, 4 * 65536 + 63);
+
+	check_roundtrip(bitmap, 5 * 65536, 0);
+	bitmap_free(bitmap);
+}
+
+void test_roaring__or_into_bitmap(void)
+{
+	struct bitmap *a = bitmap_new(), *b = bitmap_new();
+	struct bitmap *expect;
+	struct strbuf buf = STRBUF_INIT;
+	struct roaring_bitmap roaring = { 0 };
+
+	for (size_t i = 0; i < 1000; i += 3)
+		bitmap_set(a, i);
+	for (size_t i = 500; i < 140000; i += 2)
+		bitmap_set(b, i);
+	for (size_t i = 150000; i < 160000; i++)
+		bitmap_set(b, i);
+
+	expect = bitmap_dup(a);
+	bitmap_or(expect, b);
+
+	roundtrip(b, 160000, &buf, &roaring);
+	bitmap_or_roaring(a, &roaring);
+	cl_assert(bitmap_equals(a, expect));
+
+	roaring_release(&roaring);
+	strbuf_release(&buf);
+	bitmap_free(a);
+	bitmap_free(b);
+	bitmap_free(expect);
+}
+
+void test_roaring__corrupt(void)
+{
+	struct bitmap *bitmap = bitmap_new();
+	struct strbuf buf = STRBUF_INIT;
+	struct roaring_bitmap roaring = { 0 };
+
+	for (size_t i = 0; i < 200000; i += 7)
+		bitmap_set(bitmap, i);
+	roundtrip(bitmap, 200000, &buf, &roaring);
+
+	/* truncated payload */
+	cl_assert(roaring_read_mmap(&roaring, buf.buf, buf.len - 1) < 0);
+	/* truncated descriptors */
+	cl_assert(roaring_read_mmap(&roaring, buf.buf, 12) < 0);
+
+	/* keys out of order */
+	buf.buf[8 + 8 + 1] = 0;
+	cl_assert(roaring_read_mmap(&roaring, buf.buf, buf.len) < 0);
+	buf.buf[8 + 8 + 1] = 1;
+
+	/* unknown container type */
+	buf.buf[8 + 3] = 9;
+	cl_assert(roaring_read_mmap(&roaring, buf.buf, buf.len) < 0);
+
+	roaring_release(&roaring);
+	strbuf_release(&buf);
+	bitmap_free(bitmap);
+}
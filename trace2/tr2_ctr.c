@@ -46,6 +46,21 @@ static struct tr2_counter_metadata tr2_counter_metadata[TRACE2_NUMBER_OF_COUNTER
 		.name = "hardware-flush",
 		.want_per_thread_events = 0,
 	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HITS] = {
+		.category = "delta-base-cache",
+		.name = "hits",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISSES] = {
+		.category = "delta-base-cache",
+		.name = "misses",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_EVICTED_BYTES] = {
+		.category = "delta-base-cache",
+		.name = "evicted-bytes",
+		.want_per_thread_events = 0,
+	},
 
 	/* Add additional metadata before here. */
 };
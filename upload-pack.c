@@ -11,6 +11,8 @@
 #include "sideband.h"
 #include "repository.h"
 #include "odb.h"
+#include "packfile.h"
+#include "path.h"
 #include "oid-array.h"
 #include "object.h"
 #include "commit.h"
@@ -33,6 +35,7 @@
 #include "write-or-die.h"
 #include "json-writer.h"
 #include "strmap.h"
+#include "tempfile.h"
 #include "promisor-remote.h"
 
 /* Remember to update object flag allocation in object.h */
@@ -100,6 +103,9 @@ struct upload_pack_data {
 	struct packet_writer writer;
 
 	char *pack_objects_hook;
+	unsigned long pack_cache_limit;
+	double negotiation_log_rate;
+	unsigned long negotiation_log_limit;
 
 	unsigned stateless_rpc : 1;				/* v0 only */
 	unsigned no_done : 1;					/* v0 only */
@@ -122,6 +128,8 @@ struct upload_pack_data {
 	unsigned allow_packfile_uris : 1;			/* v2 only */
 	unsigned advertise_sid : 1;
 	unsigned sent_capabilities : 1;
+	unsigned use_pack_cache : 1;
+	unsigned use_negotiation_log : 1;
 };
 
 static void upload_pack_data_init(struct upload_pack_data *data)
@@ -155,6 +163,9 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 
 	data->keepalive = 5;
 	data->advertise_sid = 0;
+	data->pack_cache_limit = 1024 * 1024 * 1024;
+	data->negotiation_log_rate = 0.1;
+	data->negotiation_log_limit = 16 * 1024 * 1024;
 }
 
 static void upload_pack_data_clear(struct upload_pack_data *data)
@@ -199,12 +210,235 @@ static void send_client_data(int fd, const char *data, ssize_t sz,
 
 static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 {
-	FILE *fp = cb_data;
+	struct strbuf *buf = cb_data;
 	if (graft->nr_parent == -1)
-		fprintf(fp, "--shallow %s\n", oid_to_hex(&graft->oid));
+		strbuf_addf(buf, "--shallow %s\n", oid_to_hex(&graft->oid));
 	return 0;
 }
 
+/*
+ * An entry of the generated-pack cache, see uploadpack.packCache. Each
+ * entry holds the exact output of pack-objects for one request, and is
+ * named after a hash of everything that output depends on.
+ */
+struct pack_cache {
+	struct strbuf path;
+	struct tempfile *tmp;
+	unsigned long limit;
+	size_t size;
+};
+
+#define PACK_CACHE_INIT { \
+	.path = STRBUF_INIT, \
+}
+
+static int hash_one_ref(const struct reference *ref, void *cb_data)
+{
+	struct git_hash_ctx *ctx = cb_data;
+
+	git_hash_update(ctx, ref->name, strlen(ref->name) + 1);
+	git_hash_update(ctx, ref->oid->hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+/*
+ * Compute the name of the cache entry for running pack-objects with
+ * "args" and feeding it "input". Since the output also depends on the
+ * state of the repository (e.g., through --include-tag, or the deltas
+ * available for reuse), the names of all refs and packs go into the
+ * key, too. Any change to either makes all existing entries stale;
+ * they are not used again and eventually get evicted.
+ */
+static void pack_cache_init(struct pack_cache *cache,
+			    const struct strvec *args,
+			    const struct strbuf *input,
+			    unsigned long limit)
+{
+	struct string_list packs = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item;
+	struct git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct packed_git *p;
+	size_t i;
+
+	git_hash_init(&ctx, the_hash_algo);
+	for (i = 0; i < args->nr; i++) {
+		/* progress goes to stderr and is not cached */
+		if (!strcmp(args->v[i], "--progress"))
+			continue;
+		git_hash_update(&ctx, args->v[i], strlen(args->v[i]) + 1);
+	}
+	git_hash_update(&ctx, "", 1);
+	git_hash_update(&ctx, input->buf, input->len);
+
+	refs_for_each_ref(get_main_ref_store(the_repository),
+			  hash_one_ref, &ctx);
+	git_hash_update(&ctx, "", 1);
+
+	repo_for_each_pack(the_repository, p)
+		string_list_append(&packs, pack_basename(p));
+	string_list_sort(&packs);
+	for_each_string_list_item(item, &packs)
+		git_hash_update(&ctx, item->string, strlen(item->string) + 1);
+	string_list_clear(&packs, 0);
+
+	git_hash_final(hash, &ctx);
+
+	repo_git_path_replace(the_repository, &cache->path, "upload-pack-cache/%s.pack",
+			      hash_to_hex(hash));
+	cache->limit = limit;
+}
+
+/*
+ * Start writing a new entry for "cache", if possible. The entry is
+ * written to a tempfile, so that it is removed if we die or are killed
+ * before it is complete (e.g., because the client hung up on us).
+ */
+static void pack_cache_start(struct pack_cache *cache)
+{
+	const char *slash = find_last_dir_sep(cache->path.buf);
+	struct strbuf tmp = STRBUF_INIT;
+
+	strbuf_add(&tmp, cache->path.buf, slash - cache->path.buf);
+	if (mkdir(tmp.buf, 0777) < 0 && errno != EEXIST)
+		goto out;
+	if (adjust_shared_perm(the_repository, tmp.buf) < 0)
+		goto out;
+	strbuf_addstr(&tmp, "/tmp_pack_XXXXXX");
+	cache->tmp = mks_tempfile_m(tmp.buf, 0444);
+	cache->size = 0;
+out:
+	strbuf_release(&tmp);
+}
+
+static void pack_cache_abort(struct pack_cache *cache)
+{
+	delete_tempfile(&cache->tmp);
+}
+
+static void pack_cache_write(struct pack_cache *cache,
+			     const char *buf, size_t len)
+{
+	if (!cache->tmp)
+		return;
+	if (cache->limit && cache->size + len > cache->limit) {
+		/* too big to ever be kept */
+		pack_cache_abort(cache);
+		return;
+	}
+	if (write_in_full(get_tempfile_fd(cache->tmp), buf, len) < 0) {
+		pack_cache_abort(cache);
+		return;
+	}
+	cache->size += len;
+}
+
+struct pack_cache_entry {
+	char *path;
+	off_t size;
+	timestamp_t mtime;
+};
+
+static int pack_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct pack_cache_entry *a = va, *b = vb;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/* Seconds after which a partially written entry is considered abandoned. */
+#define PACK_CACHE_STALE_TMP (24 * 60 * 60)
+
+/*
+ * Remove the least recently used entries from the directory of "cache"
+ * until all of them fit in its size limit.
+ */
+static void pack_cache_evict(struct pack_cache *cache)
+{
+	struct pack_cache_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i;
+	struct strbuf dir = STRBUF_INIT;
+	const char *slash = find_last_dir_sep(cache->path.buf);
+	uintmax_t total = 0;
+	struct dirent *de;
+	size_t dirlen;
+	DIR *d;
+
+	if (!cache->limit)
+		return;
+
+	strbuf_add(&dir, cache->path.buf, slash - cache->path.buf);
+	d = opendir(dir.buf);
+	if (!d)
+		goto out;
+	strbuf_addch(&dir, '/');
+	dirlen = dir.len;
+
+	while ((de = readdir(d))) {
+		struct stat st;
+
+		if (starts_with(de->d_name, "tmp_pack_")) {
+			/*
+			 * Entries still being written are removed when their
+			 * writer dies, unless it got killed hard. Clean up
+			 * after those once nobody can be writing them anymore.
+			 */
+			strbuf_setlen(&dir, dirlen);
+			strbuf_addstr(&dir, de->d_name);
+			if (!stat(dir.buf, &st) &&
+			    st.st_mtime + PACK_CACHE_STALE_TMP < time(NULL))
+				unlink(dir.buf);
+			continue;
+		}
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		strbuf_setlen(&dir, dirlen);
+		strbuf_addstr(&dir, de->d_name);
+		if (stat(dir.buf, &st) < 0)
+			continue;
+
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = xstrdup(dir.buf);
+		entries[nr].size = st.st_size;
+		entries[nr].mtime = st.st_mtime;
+		nr++;
+		total += st.st_size;
+	}
+	closedir(d);
+
+	QSORT(entries, nr, pack_cache_entry_cmp);
+	for (i = 0; i < nr && total > cache->limit; i++) {
+		if (!unlink(entries[i].path))
+			total -= entries[i].size;
+	}
+
+out:
+	for (i = 0; i < nr; i++)
+		free(entries[i].path);
+	free(entries);
+	strbuf_release(&dir);
+}
+
+/* Make the entry being written available to later requests. */
+static void pack_cache_commit(struct pack_cache *cache)
+{
+	if (!cache->tmp)
+		return;
+	if (rename_tempfile(&cache->tmp, cache->path.buf) < 0)
+		return;
+	trace2_data_intmax("upload-pack", the_repository,
+			   "pack-cache/stored", cache->size);
+	pack_cache_evict(cache);
+}
+
+static void pack_cache_release(struct pack_cache *cache)
+{
+	pack_cache_abort(cache);
+	strbuf_release(&cache->path);
+}
+
 struct output_state {
 	/*
 	 * We do writes no bigger than LARGE_PACKET_DATA_MAX - 1, because with
@@ -216,6 +450,8 @@ struct output_state {
 	int used;
 	unsigned packfile_uris_started : 1;
 	unsigned packfile_started : 1;
+	/* the cache entry to copy all data into, if any */
+	struct pack_cache *cache;
 };
 
 static int relay_pack_data(int pack_objects_out, struct output_state *os,
@@ -241,6 +477,8 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	if (readsz < 0) {
 		return readsz;
 	}
+	if (os->cache)
+		pack_cache_write(os->cache, os->buffer + os->used, readsz);
 	os->used += readsz;
 
 	while (!os->packfile_started) {
@@ -296,6 +534,118 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	return readsz;
 }
 
+/*
+ * Stream the cached pack for "cache" to the client. Returns 0 if there
+ * is no such pack, in which case nothing has been sent.
+ */
+static int pack_cache_send(struct pack_cache *cache,
+			   struct output_state *os,
+			   int use_sideband, int write_packfile_line)
+{
+	int fd = open(cache->path.buf, O_RDONLY);
+	int ret;
+
+	if (fd < 0)
+		return 0;
+	trace2_data_string("upload-pack", the_repository, "pack-cache", "hit");
+
+	/* keep recently used entries from being evicted */
+	utime(cache->path.buf, NULL);
+
+	do {
+		bool did_send_data;
+		ret = relay_pack_data(fd, os, use_sideband,
+				      write_packfile_line, &did_send_data);
+	} while (ret > 0);
+	close(fd);
+
+	if (ret < 0)
+		return -1;
+	return 1;
+}
+
+static void add_negotiation_log_line(struct strbuf *buf, const char *side,
+				     const struct object_array *objects)
+{
+	size_t start = buf->len;
+	int nr = 0;
+
+	strbuf_addstr(buf, side);
+	for (size_t i = 0; i < objects->nr; i++) {
+		const struct object *o = objects->objects[i].item;
+
+		if (o->type != OBJ_COMMIT)
+			continue;
+		strbuf_addf(buf, " %s", oid_to_hex(&o->oid));
+		nr++;
+	}
+	strbuf_addch(buf, '\n');
+
+	/* a pseudo-merge needs at least two commits to be of any use */
+	if (nr < 2)
+		strbuf_setlen(buf, start);
+}
+
+/*
+ * Record the commits of this request in the negotiation log, if it is
+ * enabled and the request is sampled. A log that has reached its limit
+ * is rotated, so that it keeps following recent requests while taking
+ * up at most about twice the limit.
+ */
+static void log_negotiation(struct upload_pack_data *data)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct stat st;
+	char *path;
+	int fd;
+
+	if (!data->use_negotiation_log)
+		return;
+	if (data->negotiation_log_rate < 1 &&
+	    git_rand(CSPRNG_BYTES_INSECURE) >=
+	    data->negotiation_log_rate * UINT32_MAX)
+		return;
+
+	path = repo_git_path(the_repository, UPLOAD_PACK_NEGOTIATION_LOG);
+	if (data->negotiation_log_limit && !stat(path, &st) &&
+	    (uintmax_t)st.st_size >= data->negotiation_log_limit) {
+		char *old = repo_git_path(the_repository,
+					  UPLOAD_PACK_NEGOTIATION_LOG_OLD);
+
+		/*
+		 * Concurrent requests may both rotate the log, dropping
+		 * the entries in between, which is fine for a sample.
+		 */
+		if (rename(path, old) && errno != ENOENT)
+			warning_errno(_("unable to rename '%s' to '%s'"),
+				      path, old);
+		free(old);
+	}
+
+	add_negotiation_log_line(&buf, "want", &data->want_obj);
+	add_negotiation_log_line(&buf, "have", &data->have_obj);
+	if (!buf.len)
+		goto done;
+
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd < 0)
+		goto done;
+	adjust_shared_perm(the_repository, path);
+	/*
+	 * Write the whole entry at once, so that it does not interleave
+	 * with those of concurrent requests.
+	 */
+	if (write_in_full(fd, buf.buf, buf.len) < 0)
+		warning_errno(_("unable to write to '%s'"), path);
+	close(fd);
+	trace2_data_intmax("upload-pack", the_repository,
+			   "negotiation-log/bytes", buf.len);
+
+done:
+	free(path);
+	strbuf_release(&buf);
+}
+
 static void create_pack_file(struct upload_pack_data *pack_data,
 			     const struct string_list *uri_protocols)
 {
@@ -305,9 +655,12 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
 	uint64_t last_sent_ms = 0;
+	struct pack_cache cache = PACK_CACHE_INIT;
+	struct strbuf input = STRBUF_INIT;
 	ssize_t sz;
 	int i;
-	FILE *pipe_fd;
+
+	log_negotiation(pack_data);
 
 	if (!pack_data->pack_objects_hook)
 		pack_objects.git_cmd = 1;
@@ -353,27 +706,53 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	pack_objects.err = -1;
 	pack_objects.clean_on_exit = 1;
 
-	if (start_command(&pack_objects))
-		die("git upload-pack: unable to fork git-pack-objects");
-
-	pipe_fd = xfdopen(pack_objects.in, "w");
-
 	if (pack_data->shallow_nr)
-		for_each_commit_graft(write_one_shallow, pipe_fd);
+		for_each_commit_graft(write_one_shallow, &input);
 
 	for (i = 0; i < pack_data->want_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->want_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "--not\n");
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->want_obj.objects[i].item->oid));
+	strbuf_addstr(&input, "--not\n");
 	for (i = 0; i < pack_data->have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
 	for (i = 0; i < pack_data->extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "\n");
-	fflush(pipe_fd);
-	fclose(pipe_fd);
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
+	strbuf_addch(&input, '\n');
+
+	/*
+	 * A pack-objects hook may produce different output for the same
+	 * request (or may want to see every request), so do not cache
+	 * its packs.
+	 */
+	if (pack_data->use_pack_cache && !pack_data->pack_objects_hook) {
+		pack_cache_init(&cache, &pack_objects.args, &input,
+				pack_data->pack_cache_limit);
+		switch (pack_cache_send(&cache, output_state,
+					pack_data->use_sideband,
+					!!uri_protocols)) {
+		case 1:
+			child_process_clear(&pack_objects);
+			goto done;
+		case -1:
+			goto fail;
+		}
+		trace2_data_string("upload-pack", the_repository,
+				   "pack-cache", "miss");
+		pack_cache_start(&cache);
+		output_state->cache = &cache;
+	}
+
+	if (start_command(&pack_objects))
+		die("git upload-pack: unable to fork git-pack-objects");
+
+	if (write_in_full(pack_objects.in, input.buf, input.len) < 0) {
+		error_errno("git upload-pack: unable to feed git-pack-objects");
+		close(pack_objects.in);
+		goto fail;
+	}
+	close(pack_objects.in);
 
 	/* We read from pack_objects.err to capture stderr output for
 	 * progress bar, and pack_objects.out to capture the pack data.
@@ -502,18 +881,24 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		error("git upload-pack: git-pack-objects died with error.");
 		goto fail;
 	}
+	pack_cache_commit(&cache);
 
+ done:
 	/* flush the data */
 	if (output_state->used > 0)
 		send_client_data(1, output_state->buffer, output_state->used,
 				 pack_data->use_sideband);
 	free(output_state);
+	pack_cache_release(&cache);
+	strbuf_release(&input);
 	if (pack_data->use_sideband)
 		packet_flush(1);
 	return;
 
  fail:
 	free(output_state);
+	pack_cache_release(&cache);
+	strbuf_release(&input);
 	send_client_data(3, abort_msg, strlen(abort_msg),
 			 pack_data->use_sideband);
 	die("git upload-pack: %s", abort_msg);
@@ -1369,6 +1754,21 @@ static int upload_pack_config(const char *var, const char *value,
 		precomposed_unicode = git_config_bool(var, value);
 	} else if (!strcmp("transfer.advertisesid", var)) {
 		data->advertise_sid = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		data->use_pack_cache = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcachelimit", var)) {
+		data->pack_cache_limit = git_config_ulong(var, value, ctx->kvi);
+	} else if (!strcmp("uploadpack.negotiationlog", var)) {
+		data->use_negotiation_log = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.negotiationlogsamplerate", var)) {
+		data->negotiation_log_rate = git_config_double(var, value, ctx->kvi);
+		if (!(0 <= data->negotiation_log_rate &&
+		      data->negotiation_log_rate <= 1)) {
+			warning(_("%s must be between 0 and 1, using default"), var);
+			data->negotiation_log_rate = 0.1;
+		}
+	} else if (!strcmp("uploadpack.negotiationloglimit", var)) {
+		data->negotiation_log_limit = git_config_ulong(var, value, ctx->kvi);
 	}
 
 	if (parse_object_filter_config(var, value, ctx->kvi, data) < 0)
@@ -1,6 +1,20 @@
 #ifndef UPLOAD_PACK_H
 #define UPLOAD_PACK_H
 
+/*
+ * The file, relative to $GIT_DIR, in which upload-pack records the
+ * commits that are wanted and had in a sample of requests (see
+ * uploadpack.negotiationLog). Each line lists the commits on one side
+ * of a request, as "want" or "have" followed by their object IDs.
+ */
+#define UPLOAD_PACK_NEGOTIATION_LOG "upload-pack-negotiations"
+
+/*
+ * Where the negotiation log is moved once it reaches
+ * uploadpack.negotiationLogLimit, replacing the previous one.
+ */
+#define UPLOAD_PACK_NEGOTIATION_LOG_OLD "upload-pack-negotiations.old"
+
 void upload_pack(const int advertise_refs, const int stateless_rpc,
 		 const int timeout);
 
@@ -0,0 +1,8 @@
+#ifndef VERSION_DEF_H
+#define VERSION_DEF_H
+
+#define GIT_VERSION "2.54.0"
+#define GIT_BUILT_FROM_COMMIT "24a2f8d295bc896210a29e384765ee3ec9d1012b"
+#define GIT_USER_AGENT "git/2.54.0"
+
+#endif /* VERSION_DEF_H */
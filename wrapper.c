@@ -283,6 +283,35 @@ ssize_t xpread(int fd, void *buf, size_t len, off_t offset)
 	}
 }
 
+/*
+ * xsendfile() copies up to "len" bytes starting at "offset" of "in_fd" to
+ * "out_fd" without passing them through user space. It automatically
+ * restarts on recoverable errors and fails with ENOSYS on platforms that
+ * do not support it. Like xwrite(), it DOES NOT GUARANTEE that all "len"
+ * bytes are copied.
+ */
+ssize_t xsendfile(int out_fd, int in_fd, off_t offset, size_t len)
+{
+#ifdef HAVE_SENDFILE
+	ssize_t nr;
+	if (len > MAX_IO_SIZE)
+		len = MAX_IO_SIZE;
+	while (1) {
+		nr = sendfile(out_fd, in_fd, &offset, len);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			if (handle_nonblock(out_fd, POLLOUT, errno))
+				continue;
+		}
+		return nr;
+	}
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 ssize_t read_in_full(int fd, void *buf, size_t count)
 {
 	char *p = buf;